@@ -0,0 +1,109 @@
+import { createHash } from "node:crypto";
+import {
+  CREDIT_CARD_DATA_LEN,
+  DigitalIntercomPlatformConfig,
+  IntercomEventType,
+} from "./constants.js";
+
+// The credentials the intercom opens the door for without asking the
+// bridge. This should be kept in sync with allowlist.h in the C++ code.
+export const ALLOWLIST_DIGEST_SIZE = 16;
+export const ALLOWLIST_HEADER_SIZE = 8;
+// Fits the intercom's allowlist partition
+export const ALLOWLIST_MAX_COUNT = 4095;
+
+// Only ASCII letters, which is all the intercom upper-cases
+function asciiUpperCase(text: string): string {
+  return text.replace(/[a-z]/g, (c) => c.toUpperCase());
+}
+
+// Truncated SHA-256 of the radio message the credential arrives in
+function digest(message: Buffer): Buffer {
+  return createHash("sha256")
+    .update(message)
+    .digest()
+    .subarray(0, ALLOWLIST_DIGEST_SIZE);
+}
+
+const CARD_HASH = new RegExp(`^[0-9a-f]{${CREDIT_CARD_DATA_LEN * 2}}$`);
+
+// A configured card hash as the bridge compares it with the lower-case hex
+// of a card message, or undefined if no card message could ever match it
+export function normalizeCardHash(hash: string): string | undefined {
+  const lower = hash.toLowerCase();
+  return CARD_HASH.test(lower) ? lower : undefined;
+}
+
+export function cardDigest(hash: string): Buffer | undefined {
+  const normalized = normalizeCardHash(hash);
+  if (normalized === undefined) {
+    return undefined;
+  }
+  return digest(
+    Buffer.concat([
+      Buffer.from(IntercomEventType.CREDIT_CARD),
+      Buffer.from(normalized, "hex"),
+    ]),
+  );
+}
+
+// Only the fields are upper-cased, like the intercom does. An ID with a ';'
+// in a field can't be matched by the bridge, so it isn't listed.
+export function digitalIdDigest(
+  givenName: string,
+  familyName: string,
+  birthDate: string,
+): Buffer | undefined {
+  const fields = [givenName, familyName, birthDate];
+  if (fields.some((field) => field.includes(";"))) {
+    return undefined;
+  }
+  return digest(
+    Buffer.from(
+      IntercomEventType.DIGITAL_ID + asciiUpperCase(fields.join(";")),
+      "utf8",
+    ),
+  );
+}
+
+// What an NFC reader that only asks for age_over_NN sends
+export function ageOverMessage(age: number): string {
+  return `age_over_${String(age).padStart(2, "0")}=true`;
+}
+
+// Matched exactly, so not upper-cased
+export function ageOverDigest(age: number): Buffer {
+  return digest(
+    Buffer.from(IntercomEventType.DIGITAL_ID + ageOverMessage(age), "utf8"),
+  );
+}
+
+// Sent after ALLOWLIST: the header, then the digests in ascending order.
+// The version is taken from the digests, so an unchanged list isn't
+// rewritten to the intercom's flash.
+export function encodeAllowlist(config: DigitalIntercomPlatformConfig): {
+  payload: Buffer;
+  count: number;
+} {
+  const digests = [
+    ...config.allowedCards.map((card) => cardDigest(card.hash)),
+    ...config.allowedDigitalIds.map((id) =>
+      digitalIdDigest(id.givenName, id.familyName, id.birthDate),
+    ),
+    ...(config.allowedAgeOver ? [ageOverDigest(config.allowedAgeOver)] : []),
+  ]
+    .filter((d): d is Buffer => d !== undefined)
+    .sort(Buffer.compare);
+  const unique = digests
+    .filter((d, i) => i === 0 || !d.equals(digests[i - 1]))
+    .slice(0, ALLOWLIST_MAX_COUNT);
+  const body = Buffer.concat(unique);
+
+  const header = Buffer.alloc(ALLOWLIST_HEADER_SIZE);
+  header.writeUInt32LE(
+    createHash("sha256").update(body).digest().readUInt32LE(0),
+    0,
+  );
+  header.writeUInt16LE(unique.length, 4);
+  return { payload: Buffer.concat([header, body]), count: unique.length };
+}
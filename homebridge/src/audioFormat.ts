@@ -0,0 +1,145 @@
+import { UplinkCodec } from "./uplinkReceiver.js";
+
+export enum SampleFormat {
+  S16LE = 0,
+}
+
+// Sent after LISTEN_ON and TALK_ON. This should be kept in sync with
+// audioFormat.h in the C++ code.
+export type AudioDescriptor = {
+  sampleRate: number;
+  sampleFormat: SampleFormat;
+  codec: UplinkCodec;
+  // Audio per packet
+  frameMs: number;
+  // Listen: where the bridge receives the uplink. Talk: where the intercom
+  // receives audio from the bridge.
+  port: number;
+};
+
+export const AUDIO_DESCRIPTOR_SIZE = 8;
+
+export function encodeAudioDescriptor(format: AudioDescriptor): Buffer {
+  const buffer = Buffer.alloc(AUDIO_DESCRIPTOR_SIZE);
+  buffer.writeUInt16LE(format.sampleRate, 0);
+  buffer.writeUInt8(format.sampleFormat, 2);
+  buffer.writeUInt8(format.codec, 3);
+  buffer.writeUInt16LE(format.frameMs, 4);
+  buffer.writeUInt16LE(format.port, 6);
+  return buffer;
+}
+
+export const UPLINK_SUBSCRIPTION_SIZE = 4 + AUDIO_DESCRIPTOR_SIZE;
+
+// Sent after SUBSCRIBE and UNSUBSCRIBE. The descriptor's port is where the
+// subscriber receives the uplink, and its frameMs is ignored.
+export function encodeSubscription(
+  address: string,
+  format: AudioDescriptor,
+): Buffer {
+  const buffer = Buffer.alloc(UPLINK_SUBSCRIPTION_SIZE);
+  // Network byte order
+  address.split(".").forEach((octet, i) => {
+    buffer.writeUInt8(Number(octet), i);
+  });
+  encodeAudioDescriptor(format).copy(buffer, 4);
+  return buffer;
+}
+
+export const TALK_GAIN_SIZE = 8;
+// Talk gains are Q12 on the intercom, up to 4
+const TALK_UNITY_GAIN = 1 << 12;
+const TALK_MAX_GAIN = 4;
+
+// Sent after TALK_GAIN. Port 0 means every port on the address.
+export function encodeTalkGain(
+  address: string,
+  port: number,
+  gain: number,
+): Buffer {
+  const buffer = Buffer.alloc(TALK_GAIN_SIZE);
+  // Network byte order
+  address.split(".").forEach((octet, i) => {
+    buffer.writeUInt8(Number(octet), i);
+  });
+  buffer.writeUInt16LE(port, 4);
+  const clamped = Math.min(Math.max(gain, 0), TALK_MAX_GAIN);
+  buffer.writeUInt16LE(Math.round(clamped * TALK_UNITY_GAIN), 6);
+  return buffer;
+}
+
+// Bytes of encoded audio in one frame
+export function frameBytes(format: AudioDescriptor): number {
+  const bytesPerSample = format.codec === UplinkCodec.PCM_S16 ? 2 : 1;
+  return (
+    Math.floor((format.sampleRate * format.frameMs) / 1000) * bytesPerSample
+  );
+}
+
+// ffmpeg's name for the raw format
+export function ffmpegFormat(format: AudioDescriptor): string {
+  return format.codec === UplinkCodec.MULAW ? "mulaw" : "s16le";
+}
+
+const LISTEN_PORT = 9999;
+const TALK_PORT = 9997;
+
+export type AudioProfileName = "default" | "lowLatency" | "lowBandwidth";
+
+export type AudioProfile = {
+  listen: AudioDescriptor;
+  talk: AudioDescriptor;
+};
+
+export const AUDIO_PROFILES: Record<AudioProfileName, AudioProfile> = {
+  default: {
+    listen: {
+      sampleRate: 32000,
+      sampleFormat: SampleFormat.S16LE,
+      codec: UplinkCodec.PCM_S16,
+      frameMs: 16,
+      port: LISTEN_PORT,
+    },
+    talk: {
+      sampleRate: 16000,
+      sampleFormat: SampleFormat.S16LE,
+      codec: UplinkCodec.PCM_S16,
+      frameMs: 32,
+      port: TALK_PORT,
+    },
+  },
+  // Smaller packets, so less audio is buffered before anything is sent
+  lowLatency: {
+    listen: {
+      sampleRate: 32000,
+      sampleFormat: SampleFormat.S16LE,
+      codec: UplinkCodec.PCM_S16,
+      frameMs: 8,
+      port: LISTEN_PORT,
+    },
+    talk: {
+      sampleRate: 16000,
+      sampleFormat: SampleFormat.S16LE,
+      codec: UplinkCodec.PCM_S16,
+      frameMs: 10,
+      port: TALK_PORT,
+    },
+  },
+  // Narrowband mu-law, for a weak Wi-Fi link
+  lowBandwidth: {
+    listen: {
+      sampleRate: 16000,
+      sampleFormat: SampleFormat.S16LE,
+      codec: UplinkCodec.MULAW,
+      frameMs: 32,
+      port: LISTEN_PORT,
+    },
+    talk: {
+      sampleRate: 8000,
+      sampleFormat: SampleFormat.S16LE,
+      codec: UplinkCodec.MULAW,
+      frameMs: 40,
+      port: TALK_PORT,
+    },
+  },
+};
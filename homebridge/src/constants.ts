@@ -1,21 +1,63 @@
 import type { PlatformConfig } from "homebridge";
+import type { AudioProfileName } from "./audioFormat.js";
 
 // These should be kept in sync with the C++ code
 export enum Command {
   OPEN_DOOR = "D",
+  // Both followed by an audio descriptor, see audioFormat.ts
   LISTEN_ON = "L",
   TALK_ON = "T",
   LISTEN_STOP = "S",
   HEARTBEAT = "H",
+  // Followed by a receiver report, see uplinkReceiver.ts
+  RECEIVER_REPORT = "Q",
+  // Answered with a latency report, see parseLatencyReport()
+  LATENCY_PROBE = "P",
+  // Both followed by an uplink subscription, see audioFormat.ts
+  SUBSCRIBE = "U",
+  UNSUBSCRIBE = "X",
+  // Followed by the allowlist, see allowlist.ts
+  ALLOWLIST = "A",
+  // Followed by a talk gain, see audioFormat.ts
+  TALK_GAIN = "G",
 }
 
 export enum IntercomEventType {
   BUZZER = "B",
   CREDIT_CARD = "C",
   DIGITAL_ID = "D",
+  // Followed by the CREDIT_CARD or DIGITAL_ID event the intercom opened the
+  // door for from its allowlist
+  DOOR_OPENED = "O",
+  LATENCY_REPORT = "P",
 }
 
 export const CREDIT_CARD_DATA_LEN = 34;
+export const LATENCY_REPORT_LEN = 20;
+
+// Mirrors LatencyReport in intercom/main/latencyProbe.h
+export interface LatencyReport {
+  // -1 if the probe's chirp wasn't found
+  delayUs: number;
+  meanUs: number;
+  stdDevUs: number;
+  runs: number;
+  // 0 to 1
+  correlation: number;
+  // Time the intercom spent on the probe
+  elapsedUs: number;
+}
+
+export function parseLatencyReport(data: Buffer): LatencyReport {
+  return {
+    delayUs: data.readInt32LE(0),
+    meanUs: data.readUInt32LE(4),
+    stdDevUs: data.readUInt32LE(8),
+    runs: data.readUInt16LE(12),
+    correlation: data.readUInt16LE(14) / 32767,
+    elapsedUs: data.readUInt32LE(16),
+  };
+}
 export const HEARTBEAT_INTERVAL = 1000;
 
 export interface DigitalIntercomPlatformConfig extends PlatformConfig {
@@ -28,4 +70,24 @@ export interface DigitalIntercomPlatformConfig extends PlatformConfig {
     givenName: string;
     birthDate: string;
   }[];
+  // Opens the door for anyone with a digital ID showing they're over this
+  // age, for NFC readers built to only ask for age_over_NN
+  allowedAgeOver?: number;
+  audioProfile?: AudioProfileName;
+  // Extra receivers for the listen uplink, e.g. a recorder
+  uplinkSubscribers?: {
+    address: string;
+    port: number;
+    // Must divide the listen profile's rate by 1, 2 or 4. Defaults to 8000.
+    sampleRate?: number;
+    codec?: "pcm" | "mulaw";
+  }[];
+  // Gains for talk audio from other senders, e.g. a second bridge
+  talkGains?: {
+    address: string;
+    // Every port on the address if left out
+    port?: number;
+    // Up to 4
+    gain: number;
+  }[];
 }
@@ -5,7 +5,20 @@ import {
   DigitalIntercomPlatformConfig,
   HEARTBEAT_INTERVAL,
   IntercomEventType,
+  LATENCY_REPORT_LEN,
+  parseLatencyReport,
 } from "./constants.js";
+import {
+  encodeSubscription,
+  encodeTalkGain,
+  SampleFormat,
+} from "./audioFormat.js";
+import {
+  ageOverMessage,
+  encodeAllowlist,
+  normalizeCardHash,
+} from "./allowlist.js";
+import { UplinkCodec } from "./uplinkReceiver.js";
 import { Logging } from "homebridge";
 import { DigitalIntercomPlatform } from "./platform.js";
 
@@ -14,6 +27,7 @@ export class Server {
   private log: Logging;
   private config: DigitalIntercomPlatformConfig;
   private platform: DigitalIntercomPlatform;
+  private latencyProbeSentAt: number | null = null;
 
   constructor(platform: DigitalIntercomPlatform) {
     this.platform = platform;
@@ -37,6 +51,10 @@ export class Server {
         socket.remotePort,
       );
 
+      this.subscribeUplinkReceivers();
+      this.sendTalkGains();
+      this.sendAllowlist();
+
       socket.on("data", (data) => {
         this.onIntercomData(data);
       });
@@ -68,12 +86,85 @@ export class Server {
     return this.socket.remoteAddress ?? null;
   }
 
-  sendCommand(cmd: Command) {
+  sendCommand(cmd: Command, payload?: Buffer) {
     if (this.socket === null) {
       this.log.error("Cannot send command because no TCP client connected");
       return;
     }
-    this.socket.write(cmd);
+    if (payload === undefined) {
+      this.socket.write(cmd);
+      return;
+    }
+    // Written in one go so the intercom gets the payload with the command
+    this.socket.write(Buffer.concat([Buffer.from(cmd), payload]));
+  }
+
+  // The intercom forgets its extra uplink receivers when it disconnects
+  subscribeUplinkReceivers() {
+    for (const subscriber of this.config.uplinkSubscribers ?? []) {
+      const subscription = encodeSubscription(subscriber.address, {
+        sampleRate: subscriber.sampleRate ?? 8000,
+        sampleFormat: SampleFormat.S16LE,
+        codec:
+          subscriber.codec === "mulaw"
+            ? UplinkCodec.MULAW
+            : UplinkCodec.PCM_S16,
+        frameMs: 0,
+        port: subscriber.port,
+      });
+      this.sendCommand(Command.SUBSCRIBE, subscription);
+    }
+  }
+
+  // The intercom forgets these too when it disconnects
+  sendTalkGains() {
+    for (const talkGain of this.config.talkGains ?? []) {
+      this.sendCommand(
+        Command.TALK_GAIN,
+        encodeTalkGain(talkGain.address, talkGain.port ?? 0, talkGain.gain),
+      );
+    }
+  }
+
+  // Lets the intercom open the door for allowed credentials by itself, even
+  // while the bridge is down
+  sendAllowlist() {
+    const { payload, count } = encodeAllowlist(this.config);
+    this.log.info(`Sending allowlist of ${count} credentials`);
+    this.sendCommand(Command.ALLOWLIST, payload);
+  }
+
+  // Has the intercom measure its own audio latency. Only works while it's
+  // idle, and is audible on the intercom line.
+  probeLatency() {
+    this.latencyProbeSentAt = performance.now();
+    this.sendCommand(Command.LATENCY_PROBE);
+  }
+
+  onLatencyReport(data: Buffer) {
+    if (data.length !== LATENCY_REPORT_LEN + 1) {
+      this.log.warn("Invalid latency report length", data.length);
+      return;
+    }
+    const report = parseLatencyReport(data.subarray(1));
+    // What the round trip took beyond the probe itself is the network
+    let networkRoundTripMs = "unknown";
+    if (this.latencyProbeSentAt !== null) {
+      const roundTripMs = performance.now() - this.latencyProbeSentAt;
+      networkRoundTripMs = (roundTripMs - report.elapsedUs / 1000).toFixed(1);
+      this.latencyProbeSentAt = null;
+    }
+    if (report.delayUs < 0) {
+      this.log.warn(
+        `Latency probe: chirp not found (correlation ${report.correlation.toFixed(2)})`,
+      );
+      return;
+    }
+    this.log.info(
+      `Latency probe: intercom ${report.delayUs / 1000} ms ` +
+        `(mean ${report.meanUs / 1000} ms, std dev ${report.stdDevUs / 1000} ms ` +
+        `over ${report.runs} runs), control round trip ${networkRoundTripMs} ms`,
+    );
   }
 
   onIntercomData(data: Buffer<ArrayBuffer>): void {
@@ -96,7 +187,7 @@ export class Server {
       const hash = creditCardData.toString("hex");
       console.log("Got credit card data", hash);
       const allowedCard = this.config.allowedCards.find(
-        (card) => card.hash === hash,
+        (card) => normalizeCardHash(card.hash) === hash,
       );
       if (!allowedCard) {
         console.log("Card not allowed", hash);
@@ -106,10 +197,41 @@ export class Server {
         this.socket?.write(Command.OPEN_DOOR);
       }
       return;
+    } else if (eventType === IntercomEventType.DOOR_OPENED) {
+      // Already opened, so only for the record
+      const event = data.subarray(1);
+      if (String.fromCharCode(event[0]) === IntercomEventType.DIGITAL_ID) {
+        this.log.info(
+          "Intercom opened door for digital ID",
+          event.subarray(1).toString("utf8"),
+        );
+      } else {
+        this.log.info(
+          "Intercom opened door for card",
+          event.subarray(1).toString("hex"),
+        );
+      }
+      return;
+    } else if (eventType === IntercomEventType.LATENCY_REPORT) {
+      this.onLatencyReport(data);
+      return;
     } else if (eventType === IntercomEventType.DIGITAL_ID) {
       console.log("Got digital ID event", data);
       const digitalIdData = data.subarray(1, data.length).toString("utf8");
       console.log("Got digital ID data", digitalIdData);
+      if (digitalIdData.startsWith("age_over_")) {
+        const allowedAgeOver = this.config.allowedAgeOver;
+        if (
+          allowedAgeOver &&
+          digitalIdData === ageOverMessage(allowedAgeOver)
+        ) {
+          console.log("Digital ID allowed", digitalIdData);
+          this.socket?.write(Command.OPEN_DOOR);
+        } else {
+          console.log("Digital ID not allowed", digitalIdData);
+        }
+        return;
+      }
       const splitData = digitalIdData.split(";");
       if (splitData.length !== 3) {
         console.log("Invalid digital ID data length", splitData.length);
@@ -31,6 +31,14 @@ import sharp from "sharp";
 import pathToFfmpeg from "ffmpeg-for-homebridge";
 import path from "node:path";
 import { DigitalIntercomPlatform } from "./platform.js";
+import { UplinkReceiver } from "./uplinkReceiver.js";
+import {
+  AUDIO_PROFILES,
+  AudioProfile,
+  encodeAudioDescriptor,
+  ffmpegFormat,
+  frameBytes,
+} from "./audioFormat.js";
 
 const videomtu = 188 * 5;
 const audiomtu = 188 * 1;
@@ -68,6 +76,8 @@ interface ActiveSession {
   startTime: number;
   ffmpegProcess: ChildProcess;
   returnFfmpegProcess: ChildProcess;
+  uplinkReceiver: UplinkReceiver;
+  audioProfile: AudioProfile;
   microphoneMuted: boolean | null;
   rtpDemuxer: RtpDemuxer;
 }
@@ -157,16 +167,28 @@ export class IntercomStreamingDelegate implements CameraStreamingDelegate {
       }
 
       console.log("Microphone muted", this.activeSession?.microphoneMuted);
+      const audioProfile =
+        this.activeSession?.audioProfile ?? this.audioProfile();
       if (this.activeSession?.microphoneMuted) {
-        this.platform.server.sendCommand(Command.LISTEN_ON);
+        this.platform.server.sendCommand(
+          Command.LISTEN_ON,
+          encodeAudioDescriptor(audioProfile.listen),
+        );
       } else {
-        this.platform.server.sendCommand(Command.TALK_ON);
+        this.platform.server.sendCommand(
+          Command.TALK_ON,
+          encodeAudioDescriptor(audioProfile.talk),
+        );
       }
 
       this.controller.setMicrophoneMuted(true);
     });
   }
 
+  private audioProfile(): AudioProfile {
+    return AUDIO_PROFILES[this.platform.config.audioProfile ?? "default"];
+  }
+
   handleSnapshotRequest(
     request: SnapshotRequest,
     callback: SnapshotRequestCallback,
@@ -350,7 +372,11 @@ export class IntercomStreamingDelegate implements CameraStreamingDelegate {
     }
 
     console.log("Starting stream", request);
-    this.platform.server.sendCommand(Command.LISTEN_ON);
+    const audioProfile = this.audioProfile();
+    this.platform.server.sendCommand(
+      Command.LISTEN_ON,
+      encodeAudioDescriptor(audioProfile.listen),
+    );
     // 1. INPUT GENERATORS
     // const videoInput = `-f lavfi -i color=c=red:s=${request.video.width}x${request.video.height}:r=${request.video.fps}`;
     const videoInput = `-f lavfi -i "movie=${snapPath}:loop=0,setpts=N/(${request.video.fps}*TB)"`;
@@ -360,7 +386,8 @@ export class IntercomStreamingDelegate implements CameraStreamingDelegate {
     const audioInput =
       `-fflags nobuffer -flags low_delay -analyzeduration 0 -probesize 32 ` +
       // `-f lavfi -i "sine=frequency=1000:sample_rate=16000"`;
-      `-ac 1 -f u16le -ar 32000 -i "udp://0.0.0.0:9999?pkt_size=1024&fifo_size=1000000&overrun_nonfatal=0"`;
+      // The intercom's uplink is decoded by UplinkReceiver and piped in
+      `-ac 1 -f s16le -ar ${audioProfile.listen.sampleRate} -i pipe:0`;
 
     // 2. VIDEO ARGUMENTS
     const ffmpegVideoArgs = ` -map 0:0 -vcodec libx264 -pix_fmt yuvj420p -r ${request.video.fps} -f rawvideo -probesize 32 -analyzeduration 0 -fflags nobuffer -preset veryfast -refs 1 -x264-params intra-refresh=1:bframes=0 -b:v ${request.video.max_bit_rate}k -bufsize ${2 * request.video.max_bit_rate}k -maxrate ${request.video.max_bit_rate}k -payload_type ${request.video.pt}`;
@@ -382,6 +409,18 @@ export class IntercomStreamingDelegate implements CameraStreamingDelegate {
     const fcmd = `${videoInput} ${audioInput}${ffmpegVideoArgs}${ffmpegVideoStream}${ffmpegAudioFull}`;
     // TODO: refactor so the binary spawned is pathToFfmpeg and the args are an array
     const ffmpegProcess = spawn("/bin/bash", ["-c", `${pathToFfmpeg} ${fcmd}`]);
+    // ffmpeg exiting closes the pipe, which shouldn't take the plugin down
+    ffmpegProcess.stdin?.on("error", () => {});
+    const uplinkReceiver = new UplinkReceiver(
+      audioProfile.listen.port,
+      audioProfile.listen.sampleRate,
+      (pcm) => {
+        ffmpegProcess.stdin?.write(pcm);
+      },
+      (report) => {
+        this.platform.server.sendCommand(Command.RECEIVER_REPORT, report);
+      },
+    );
 
     const sdpIpVersion = sessionInfo.addressVersion === "ipv6" ? "IP6" : "IP4";
 
@@ -428,14 +467,14 @@ export class IntercomStreamingDelegate implements CameraStreamingDelegate {
       "-flags",
       "+global_header",
       "-ar",
-      "16000", //this.protectCamera.ufp.talkbackSettings.samplingRate.toString(),
+      audioProfile.talk.sampleRate.toString(),
       // "-b:a",
       // request.audio.max_bit_rate.toString() + "k",
       "-ac",
       "1", //this.protectCamera.ufp.talkbackSettings.channels.toString(),
       "-f",
-      "s16le",
-      `udp://${this.platform.server.getSocketAddress()}:9997?pkt_size=1024`,
+      ffmpegFormat(audioProfile.talk),
+      `udp://${this.platform.server.getSocketAddress()}:${audioProfile.talk.port}?pkt_size=${frameBytes(audioProfile.talk)}`,
     ];
 
     // TODO: handle no socket address
@@ -448,6 +487,8 @@ export class IntercomStreamingDelegate implements CameraStreamingDelegate {
       startTime: Date.now(),
       ffmpegProcess,
       returnFfmpegProcess,
+      uplinkReceiver,
+      audioProfile,
       microphoneMuted: null,
       rtpDemuxer: sessionInfo.rtpDemuxer,
     };
@@ -478,6 +519,7 @@ export class IntercomStreamingDelegate implements CameraStreamingDelegate {
 
     this.activeSession.ffmpegProcess.kill("SIGKILL");
     this.activeSession.returnFfmpegProcess.kill("SIGKILL");
+    this.activeSession.uplinkReceiver.close();
     this.activeSession.rtpDemuxer.close();
     this.activeSession = null;
 
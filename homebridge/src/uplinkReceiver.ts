@@ -0,0 +1,366 @@
+import dgram from "node:dgram";
+
+// Wire format of the intercom's listen uplink. These should be kept in sync
+// with uplinkPacket.h in the C++ code.
+export enum UplinkPacketType {
+  AUDIO = 0x41, // 'A'
+  COMFORT_NOISE = 0x4e, // 'N'
+  PARITY = 0x50, // 'P'
+}
+
+export enum UplinkCodec {
+  PCM_S16 = 0,
+  MULAW = 1,
+}
+
+export const UPLINK_HEADER_SIZE = 12;
+const PARITY_OVERHEAD = UPLINK_HEADER_SIZE + 2;
+export const RECEIVER_REPORT_SIZE = 8;
+
+export type UplinkHeader = {
+  type: UplinkPacketType;
+  codec: UplinkCodec;
+  seq: number;
+  timestamp: number;
+  sampleRate: number;
+  sampleCount: number;
+};
+
+export function parseUplinkHeader(packet: Buffer): UplinkHeader | null {
+  if (packet.length < UPLINK_HEADER_SIZE) {
+    return null;
+  }
+  return {
+    type: packet.readUInt8(0),
+    codec: packet.readUInt8(1),
+    seq: packet.readUInt16LE(2),
+    timestamp: packet.readUInt32LE(4),
+    sampleRate: packet.readUInt16LE(8),
+    sampleCount: packet.readUInt16LE(10),
+  };
+}
+
+function muLawDecode(encoded: number): number {
+  encoded = ~encoded & 0xff;
+  const exponent = (encoded >> 4) & 0x07;
+  const mantissa = encoded & 0x0f;
+  const value = (((mantissa << 3) + 0x84) << exponent) - 0x84;
+  return encoded & 0x80 ? -value : value;
+}
+const MULAW_DECODE_TABLE = Int16Array.from({ length: 256 }, (_, i) =>
+  muLawDecode(i),
+);
+
+// Gaps longer than this are the intercom pausing the uplink (e.g. while
+// talking) rather than silence, so playback restarts instead of filling them
+const MAX_GAP_SECONDS = 0.5;
+// Packets kept around for FEC recovery
+const HISTORY = 256;
+const REPORT_INTERVAL = 1000;
+// Arrival delay is measured against the quickest packet in this window
+const DELAY_WINDOW_REPORTS = 10;
+
+function seqDiff(a: number, b: number): number {
+  return ((a - b + 0x18000) % 0x10000) - 0x8000;
+}
+
+// Receives the listen uplink and turns it back into a continuous s16le
+// stream for ffmpeg, generating comfort noise for the stretches the
+// intercom didn't send because nobody was talking.
+//
+// Packets are played in sequence order. When the intercom sends FEC parity,
+// a missing packet is waited for until its group's parity could have
+// arrived, and rebuilt from it if it was the only one lost.
+//
+// Audio is handed to ffmpeg at the negotiated listen rate (clockRate),
+// whatever rate the intercom is currently sending at.
+//
+// Once a second, a receiver report with the loss, jitter and arrival delay
+// seen is passed to onReport for sending back to the intercom, which adapts
+// the uplink format to it.
+export class UplinkReceiver {
+  private socket = dgram.createSocket("udp4");
+  private packets = new Map<number, Buffer>();
+  private nextSeq: number | null = null;
+  private newestSeq = 0;
+  private groupSize = 0;
+  // Stream position up to which audio has been written, in clock ticks
+  private expected: number | null = null;
+  private noiseLevel = 0;
+  private lastSample = 0;
+
+  // Receiver report state
+  private reportTimer: NodeJS.Timeout;
+  private reportBaseSeq: number | null = null;
+  private receivedSinceReport = 0;
+  private lastTransit: number | null = null;
+  private jitter = 0;
+  private transitSum = 0;
+  private minTransits: number[] = [];
+
+  constructor(
+    port: number,
+    private readonly clockRate: number,
+    private readonly onAudio: (pcm: Buffer) => void,
+    private readonly onReport: (report: Buffer) => void,
+  ) {
+    this.socket.on("message", (packet) => this.onPacket(packet));
+    this.socket.on("error", (err) => {
+      console.error("Uplink socket error:", err.message);
+    });
+    this.socket.bind(port, "0.0.0.0");
+    this.reportTimer = setInterval(() => this.sendReport(), REPORT_INTERVAL);
+  }
+
+  close() {
+    clearInterval(this.reportTimer);
+    this.socket.close();
+  }
+
+  private onPacket(packet: Buffer) {
+    const header = parseUplinkHeader(packet);
+    if (header === null) {
+      return;
+    }
+
+    if (header.type === UplinkPacketType.PARITY) {
+      this.groupSize = header.sampleCount;
+      this.recover(packet, header);
+    } else {
+      this.measureArrival(header);
+      if (
+        this.nextSeq === null ||
+        Math.abs(seqDiff(header.seq, this.nextSeq)) > HISTORY
+      ) {
+        // First packet, or the intercom restarted
+        this.packets.clear();
+        this.nextSeq = header.seq;
+        this.newestSeq = header.seq;
+      }
+      if (seqDiff(header.seq, this.nextSeq) < 0) {
+        return;
+      }
+      this.packets.set(header.seq, packet);
+      if (seqDiff(header.seq, this.newestSeq) > 0) {
+        this.newestSeq = header.seq;
+      }
+    }
+    this.release();
+  }
+
+  private measureArrival(header: UplinkHeader) {
+    if (
+      this.reportBaseSeq === null ||
+      Math.abs(seqDiff(header.seq, this.newestSeq)) > HISTORY
+    ) {
+      this.reportBaseSeq = header.seq;
+      this.receivedSinceReport = 0;
+      this.lastTransit = null;
+      this.minTransits = [];
+    }
+    this.receivedSinceReport++;
+
+    // Relative transit time: arrival time minus send time, both in ms, with
+    // an unknown offset between the clocks that cancels out below. Packets
+    // are sent when their span ends. Comfort noise is stamped at the start
+    // of the silence it covers.
+    const end = header.timestamp + this.ticks(header);
+    const transit = performance.now() - (end * 1000) / this.clockRate;
+    if (this.lastTransit !== null) {
+      // RFC 3550 interarrival jitter
+      this.jitter +=
+        (Math.abs(transit - this.lastTransit) - this.jitter) / 16;
+    }
+    this.lastTransit = transit;
+    this.transitSum += transit;
+    if (this.minTransits.length === 0) {
+      this.minTransits.push(transit);
+    } else {
+      this.minTransits[this.minTransits.length - 1] = Math.min(
+        this.minTransits[this.minTransits.length - 1],
+        transit,
+      );
+    }
+  }
+
+  private sendReport() {
+    if (this.reportBaseSeq === null || this.receivedSinceReport === 0) {
+      return;
+    }
+
+    const expected = seqDiff(this.newestSeq, this.reportBaseSeq) + 1;
+    const lost = Math.max(0, expected - this.receivedSinceReport);
+    const fractionLost =
+      expected > 0 ? Math.min(255, Math.floor((lost * 256) / expected)) : 0;
+    const meanTransit = this.transitSum / this.receivedSinceReport;
+    const delay = meanTransit - Math.min(...this.minTransits);
+
+    const report = Buffer.alloc(RECEIVER_REPORT_SIZE);
+    report.writeUInt16LE(this.newestSeq, 0);
+    report.writeUInt8(fractionLost, 2);
+    report.writeUInt16LE(Math.min(65535, Math.round(this.jitter)), 4);
+    report.writeUInt16LE(Math.min(65535, Math.round(delay)), 6);
+    this.onReport(report);
+
+    this.reportBaseSeq = (this.newestSeq + 1) % 0x10000;
+    this.receivedSinceReport = 0;
+    this.transitSum = 0;
+    this.minTransits.push(Infinity);
+    if (this.minTransits.length > DELAY_WINDOW_REPORTS) {
+      this.minTransits.shift();
+    }
+  }
+
+  private recover(parity: Buffer, header: UplinkHeader) {
+    if (this.nextSeq === null || parity.length < PARITY_OVERHEAD) {
+      return;
+    }
+    const group = Array.from(
+      { length: header.sampleCount },
+      (_, i) => (header.seq + i) % 0x10000,
+    );
+    const missing = group.filter((seq) => !this.packets.has(seq));
+    if (missing.length !== 1 || seqDiff(missing[0], this.nextSeq) < 0) {
+      return;
+    }
+
+    let length = parity.readUInt16LE(UPLINK_HEADER_SIZE);
+    const rebuilt = Buffer.from(parity.subarray(PARITY_OVERHEAD));
+    for (const seq of group) {
+      const packet = this.packets.get(seq);
+      if (packet === undefined) {
+        continue;
+      }
+      length ^= packet.length;
+      for (let i = 0; i < packet.length && i < rebuilt.length; i++) {
+        rebuilt[i] ^= packet[i];
+      }
+    }
+    this.packets.set(missing[0], rebuilt.subarray(0, length));
+    if (seqDiff(missing[0], this.newestSeq) > 0) {
+      this.newestSeq = missing[0];
+    }
+  }
+
+  private release() {
+    // With FEC, a gap can still be filled until the parity after the next
+    // packet has had a chance to arrive
+    const hold = this.groupSize > 0 ? this.groupSize + 1 : 0;
+    while (
+      this.nextSeq !== null &&
+      seqDiff(this.newestSeq, this.nextSeq) >= 0
+    ) {
+      const packet = this.packets.get(this.nextSeq);
+      if (packet === undefined) {
+        if (seqDiff(this.newestSeq, this.nextSeq) <= hold) {
+          return;
+        }
+      } else {
+        this.play(packet);
+      }
+      this.nextSeq = (this.nextSeq + 1) % 0x10000;
+      this.packets.delete((this.nextSeq - HISTORY + 0x10000) % 0x10000);
+    }
+  }
+
+  // How much of the stream a packet covers, in clock ticks
+  private ticks(header: UplinkHeader): number {
+    if (header.sampleRate === 0) {
+      return 0;
+    }
+    return Math.round((header.sampleCount * this.clockRate) / header.sampleRate);
+  }
+
+  private play(packet: Buffer) {
+    const header = parseUplinkHeader(packet);
+    if (header === null || header.sampleRate === 0) {
+      return;
+    }
+    const ticks = this.ticks(header);
+
+    if (this.expected !== null) {
+      // Timestamps wrap at 32 bits
+      const gap = (header.timestamp - this.expected) | 0;
+      if (gap < 0 && -gap < this.clockRate * MAX_GAP_SECONDS) {
+        // Late or duplicate
+        return;
+      }
+      if (gap > 0 && gap < this.clockRate * MAX_GAP_SECONDS) {
+        this.onAudio(this.comfortNoise(gap));
+      }
+    }
+    this.expected = (header.timestamp + ticks) >>> 0;
+
+    switch (header.type) {
+      case UplinkPacketType.AUDIO: {
+        const samples = this.decode(packet, header);
+        if (samples !== null) {
+          this.onAudio(this.resample(samples, ticks));
+        }
+        break;
+      }
+      case UplinkPacketType.COMFORT_NOISE:
+        if (packet.length >= UPLINK_HEADER_SIZE + 2) {
+          this.noiseLevel = packet.readUInt16LE(UPLINK_HEADER_SIZE);
+        }
+        this.onAudio(this.comfortNoise(ticks));
+        break;
+      default:
+        console.warn("Unknown uplink packet type", header.type);
+    }
+  }
+
+  private decode(packet: Buffer, header: UplinkHeader): Int16Array | null {
+    const payload = packet.subarray(UPLINK_HEADER_SIZE);
+    const samples = new Int16Array(header.sampleCount);
+    switch (header.codec) {
+      case UplinkCodec.PCM_S16:
+        for (let i = 0; i < samples.length && i * 2 + 1 < payload.length; i++) {
+          samples[i] = payload.readInt16LE(i * 2);
+        }
+        return samples;
+      case UplinkCodec.MULAW:
+        for (let i = 0; i < samples.length && i < payload.length; i++) {
+          samples[i] = MULAW_DECODE_TABLE[payload[i]];
+        }
+        return samples;
+      default:
+        console.warn("Unknown uplink codec", header.codec);
+        return null;
+    }
+  }
+
+  // Linear interpolation up to clockRate, continuing from the end of
+  // the previous packet
+  private resample(samples: Int16Array, ticks: number): Buffer {
+    const pcm = Buffer.alloc(ticks * 2);
+    if (samples.length === 0) {
+      return pcm;
+    }
+    const step = samples.length / ticks;
+    for (let i = 0; i < ticks; i++) {
+      const position = (i + 1) * step - 1;
+      const index = Math.floor(position);
+      const before = index < 0 ? this.lastSample : samples[index];
+      const after = samples[Math.min(index + 1, samples.length - 1)];
+      const value = before + (after - before) * (position - index);
+      pcm.writeInt16LE(Math.round(value), i * 2);
+    }
+    this.lastSample = samples[samples.length - 1];
+    return pcm;
+  }
+
+  // White noise with the same mean absolute value as the intercom's
+  // background noise
+  private comfortNoise(samples: number): Buffer {
+    const pcm = Buffer.alloc(samples * 2);
+    const range = Math.min(this.noiseLevel * 2, 32767);
+    if (range === 0) {
+      return pcm;
+    }
+    for (let i = 0; i < samples; i++) {
+      pcm.writeInt16LE(Math.round((Math.random() * 2 - 1) * range), i * 2);
+    }
+    return pcm;
+  }
+}
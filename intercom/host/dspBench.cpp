@@ -0,0 +1,129 @@
+// Compares the integer uplink DSP chain against the float gain stage it
+// replaced (VolumeStream with allow_boost and a volume of 20) on a synthetic
+// ADC capture, reporting CPU time per second of audio and output quality.
+// Also compares idle doorbell monitoring at the listen rate with monitoring at
+// the idle ADC rate decimated to narrowband.
+#include "dsp.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <random>
+#include <span>
+#include <vector>
+
+constexpr int SAMPLE_RATE = 32000;
+constexpr int IDLE_SAMPLE_RATE = 24000;
+constexpr int IDLE_DECIMATION = 3;
+constexpr int SECONDS = 10;
+constexpr size_t BLOCK_SAMPLES = 512; // Same as the listen buffer
+constexpr int ITERATIONS = 20;
+constexpr float AUDIO_SCALE = 20;
+
+// DC offset + hiss, with a quiet talker and a loud one
+std::vector<int16_t> makeCapture(int sampleRate) {
+  std::mt19937 rng(1234);
+  std::normal_distribution<float> hiss(0, 25);
+  std::vector<int16_t> samples(sampleRate * SECONDS);
+  for (size_t i = 0; i < samples.size(); ++i) {
+    float t = static_cast<float>(i) / sampleRate;
+    float voice = 0;
+    if (t > 2 && t < 4) {
+      voice = 300 * std::sin(2 * M_PI * 220 * t) *
+              (0.6f + 0.4f * std::sin(2 * M_PI * 3 * t));
+    } else if (t > 6 && t < 8) {
+      voice = 3000 * std::sin(2 * M_PI * 180 * t) *
+              (0.6f + 0.4f * std::sin(2 * M_PI * 4 * t));
+    }
+    samples[i] = static_cast<int16_t>(1800 + voice + hiss(rng));
+  }
+  return samples;
+}
+
+// Per-sample work VolumeStream does for 16-bit audio
+void volumeStreamProcess(std::span<int16_t> samples, float factor) {
+  for (int16_t &sample : samples) {
+    float result = factor * sample;
+    sample = static_cast<int16_t>(std::clamp(result, -32768.0f, 32767.0f));
+  }
+}
+
+// process(block) returns how many samples it left at the front of block, which
+// is fewer than it was given if it decimates. Only those are measured.
+template <typename F>
+double benchmark(const char *name, const std::vector<int16_t> &capture,
+                 F &&process) {
+  std::vector<int16_t> work;
+  std::vector<size_t> kept((capture.size() + BLOCK_SAMPLES - 1) /
+                           BLOCK_SAMPLES);
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < ITERATIONS; ++i) {
+    work = capture;
+    for (size_t offset = 0; offset < work.size(); offset += BLOCK_SAMPLES) {
+      size_t len = std::min(BLOCK_SAMPLES, work.size() - offset);
+      kept[offset / BLOCK_SAMPLES] =
+          process(std::span<int16_t>(work.data() + offset, len));
+    }
+  }
+  auto end = std::chrono::steady_clock::now();
+  double us = std::chrono::duration<double, std::micro>(end - start).count();
+  double usPerSecond = us / (ITERATIONS * SECONDS);
+
+  int64_t sum = 0;
+  size_t count = 0;
+  size_t clipped = 0;
+  int peak = 0;
+  for (size_t block = 0; block < kept.size(); ++block) {
+    for (int16_t sample :
+         std::span(work).subspan(block * BLOCK_SAMPLES, kept[block])) {
+      sum += sample;
+      clipped += sample >= 32767 || sample <= -32767;
+      peak = std::max(peak, std::abs(static_cast<int>(sample)));
+    }
+    count += kept[block];
+  }
+  printf("%-14s %8.1f us CPU per second of audio | DC %6lld | peak %5d | "
+         "clipped %zu\n",
+         name, usPerSecond,
+         static_cast<long long>(count > 0 ? sum / (int64_t)count : 0), peak,
+         clipped);
+  return usPerSecond;
+}
+
+int main() {
+  std::vector<int16_t> capture = makeCapture(SAMPLE_RATE);
+
+  double floatUs = benchmark("VolumeStream", capture, [](auto block) {
+    volumeStreamProcess(block, AUDIO_SCALE);
+    return block.size();
+  });
+
+  UplinkDsp dsp;
+  dsp.begin(DspConfig{}, SAMPLE_RATE);
+  double dspUs = benchmark("UplinkDsp", capture, [&](auto block) {
+    dsp.process(block);
+    return block.size();
+  });
+
+  printf("UplinkDsp / VolumeStream CPU ratio: %.2f\n", dspUs / floatUs);
+
+  // Idle monitoring feeds the DSP and pre-roll; the volume meter is a similar
+  // per-sample cost either way
+  dsp.begin(DspConfig{}, SAMPLE_RATE);
+  double fullRateUs = benchmark("Idle 32 kHz", capture, [&](auto block) {
+    dsp.process(block);
+    return block.size();
+  });
+  std::vector<int16_t> idleCapture = makeCapture(IDLE_SAMPLE_RATE);
+  dsp.begin(DspConfig{}, IDLE_SAMPLE_RATE / IDLE_DECIMATION);
+  double idleUs = benchmark("Idle 24/3 kHz", idleCapture, [&](auto block) {
+    size_t count = decimate(block, IDLE_DECIMATION);
+    dsp.process(block.first(count));
+    return count;
+  });
+  printf("Idle monitoring CPU ratio: %.2f, ADC samples per second: %d -> %d\n",
+         idleUs / fullRateUs, SAMPLE_RATE, IDLE_SAMPLE_RATE);
+  return 0;
+}
@@ -0,0 +1,893 @@
+// Runs the intercom's audio processing on Linux. WAV files stand in for the
+// ADC and the DAC, and audio goes over real UDP sockets on loopback, so the
+// bridge or tools/udp_server.py can be pointed at it.
+//   pipelineHost listen <in.wav> [port] [profile] [fecGroup]
+//     Plays in.wav into the listen path as the ADC at its own rate, sending
+//     the uplink to 127.0.0.1:port (9999) in real time
+//   pipelineHost idle <in.wav> [preroll.wav]
+//     Doorbell monitoring and pre-roll, with in.wav as the idle ADC at 24 kHz.
+//     Writes out what the pre-roll holds at the end.
+//   pipelineHost talk <out.wav> [port] [rate] [pcm|mulaw]
+//     Receives talk audio on port (9997) from any number of senders, mixes
+//     it like the TALK state and plays it into out.wav
+//   pipelineHost mix <out.wav> <jitterMs> <lossPercent> <in.wav>[@gain]...
+//     Mixes each in.wav as a talk source sending over a synthetic network
+//     with the given jitter and loss, and writes the mix to out.wav
+//   pipelineHost gains
+//     Checks that talk gains sent by the bridge reach the right senders
+//   pipelineHost states
+//     Tries every command in every state, printing the transition table the
+//     state machine actually follows, and times it
+//   pipelineHost resample
+//     Checks that live audio queued behind the pre-roll comes out at the
+//     monitor rate, with the right length and pitch, from every listen rate
+//   pipelineHost bench <in.wav>
+//     CPU time per second of audio for each stage
+#include "capturePipeline.h"
+#include "doorbell.h"
+#include "dsp.h"
+#include "g711.h"
+#include "preRoll.h"
+#include "stateMachine.h"
+#include "talkMixer.h"
+#include "uplinkAdaptation.h"
+#include "uplinkFec.h"
+#include "uplinkPacketizer.h"
+#include "vad.h"
+#include "wavFile.h"
+
+#include <arpa/inet.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <netinet/in.h>
+#include <span>
+#include <string>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+// Same as main.cpp's defaults
+constexpr size_t UPLINK_PACKET_SIZE = 1024;
+constexpr size_t UPLINK_PACKET_SAMPLES =
+    (UPLINK_PACKET_SIZE - UPLINK_HEADER_SIZE) / sizeof(int16_t);
+constexpr int IDLE_SAMPLE_RATE = 24000;
+constexpr int IDLE_DECIMATION = 3;
+constexpr int IDLE_MONITOR_RATE = IDLE_SAMPLE_RATE / IDLE_DECIMATION;
+constexpr size_t IDLE_CAPTURE_SAMPLES = IDLE_SAMPLE_RATE / 50;
+constexpr int PREROLL_SECONDS = 2;
+constexpr int PREROLL_DOORBELL_LEAD_MS = 500;
+constexpr uint16_t AUDIO_OUT_PORT = 9999;
+constexpr uint16_t AUDIO_IN_PORT = 9997;
+constexpr int DAC_SAMPLE_RATE = 16000;
+constexpr int TALK_BLOCK_MS = 10;
+
+constexpr int BENCH_ITERATIONS = 20;
+constexpr int TALK_TIMEOUT_MS = 2000;
+// Synthetic talk traces
+constexpr int MIX_FRAME_MS = 20;
+constexpr int MIX_STAGGER_MS = 300;
+// Where the mix's sources send from, one port each
+constexpr char MIX_ADDRESS[] = "127.0.0.1";
+constexpr uint16_t MIX_BASE_PORT = 50000;
+
+// Stands in for UplinkSender, sending each packet as soon as it's committed
+class LoopbackSender {
+public:
+  bool begin(uint16_t port) {
+    fd_ = socket(AF_INET, SOCK_DGRAM, 0);
+    address_.sin_family = AF_INET;
+    address_.sin_port = htons(port);
+    address_.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    return fd_ >= 0;
+  }
+  ~LoopbackSender() {
+    if (fd_ >= 0) {
+      close(fd_);
+    }
+  }
+
+  uint8_t *acquire() { return buffer_; }
+  void commit(size_t len) {
+    if (len == 0) {
+      return;
+    }
+    if (sendto(fd_, buffer_, len, 0, reinterpret_cast<sockaddr *>(&address_),
+               sizeof(address_)) == static_cast<ssize_t>(len)) {
+      ++sentPackets_;
+      sentBytes_ += len;
+    } else {
+      ++droppedPackets_;
+    }
+  }
+
+  uint32_t sentPackets() const { return sentPackets_; }
+  uint32_t droppedPackets() const { return droppedPackets_; }
+  uint64_t sentBytes() const { return sentBytes_; }
+
+private:
+  int fd_ = -1;
+  sockaddr_in address_ = {};
+  uint8_t buffer_[UPLINK_PACKET_SIZE + UPLINK_PARITY_OVERHEAD];
+  uint32_t sentPackets_ = 0;
+  uint32_t droppedPackets_ = 0;
+  uint64_t sentBytes_ = 0;
+};
+
+// The listen path from the DSP on, as main.cpp runs it
+struct ListenPath {
+  AudioDescriptor format;
+  UplinkFormat frame;
+  UplinkDsp dsp;
+  VoiceActivityDetector vad;
+  UplinkPacketizer packetizer;
+  uint8_t fecStorage[UPLINK_PACKET_SIZE];
+  UplinkFec fec{fecStorage};
+  LoopbackSender sender;
+  int16_t captureBuffer[UPLINK_MAX_FRAME_SAMPLES];
+
+  bool begin(int sampleRate, uint16_t port, size_t profile, int fecGroup) {
+    format = {static_cast<uint16_t>(sampleRate), SampleFormat::S16LE,
+              UplinkCodec::PCM_S16, 16, port};
+    if (!isSupported(format) || profile >= UPLINK_PROFILE_COUNT) {
+      return false;
+    }
+    dsp.begin(DspConfig{}, sampleRate);
+    vad.begin(VadConfig{});
+    packetizer.begin(PacketizerConfig{}, sampleRate);
+    frame = resolveProfile(UPLINK_PROFILES[profile], format,
+                           UPLINK_PACKET_SIZE - UPLINK_HEADER_SIZE);
+    packetizer.setFormat(frame);
+    fec.begin(fecGroup);
+    return sender.begin(port);
+  }
+
+  // Captures samples and sends them, like the LISTEN state with only the
+  // bridge subscribed
+  void capture(std::span<const int16_t> samples) {
+    uint8_t *packet;
+    int16_t *frameBuffer =
+        acquireFrameBuffer(sender, samples.size(), UPLINK_PACKET_SAMPLES,
+                           false, captureBuffer, packet);
+    std::copy(samples.begin(), samples.end(), frameBuffer);
+    std::span<int16_t> captured{frameBuffer, samples.size()};
+    dsp.process(captured);
+
+    bool speech = vad.process(captured);
+    packetizeFrame({captured, format.sampleRate, speech, vad.noiseLevel()},
+                   frame.frameSamples, packetizer, fec, sender, packet);
+  }
+};
+
+int runListen(int argc, char **argv) {
+  WavData wav;
+  if (argc < 3 || !readWav(argv[2], wav)) {
+    return 1;
+  }
+  uint16_t port = argc > 3 ? atoi(argv[3]) : AUDIO_OUT_PORT;
+  size_t profile = argc > 4 ? atoi(argv[4]) : 0;
+  int fecGroup = argc > 5 ? atoi(argv[5]) : 0;
+
+  ListenPath listen;
+  if (!listen.begin(wav.sampleRate, port, profile, fecGroup)) {
+    fprintf(stderr, "Unsupported listen setup: %d Hz, profile %zu\n",
+            wav.sampleRate, profile);
+    return 1;
+  }
+  printf("Sending %s (%d Hz) to 127.0.0.1:%d, profile %zu, %d Hz %s in "
+         "%zu sample frames\n",
+         argv[2], wav.sampleRate, port, profile,
+         wav.sampleRate / listen.frame.decimation,
+         listen.frame.codec == UplinkCodec::MULAW ? "mu-law" : "PCM",
+         listen.frame.frameSamples);
+
+  // Paced like the ADC, which hands over a frame once it's been captured
+  auto start = std::chrono::steady_clock::now();
+  size_t frameSamples = listen.frame.frameSamples;
+  for (size_t offset = 0; offset + frameSamples <= wav.samples.size();
+       offset += frameSamples) {
+    std::this_thread::sleep_until(
+        start + std::chrono::microseconds(
+                    (offset + frameSamples) * 1000000 / wav.sampleRate));
+    listen.capture({wav.samples.data() + offset, frameSamples});
+  }
+
+  printf("Sent %u packets (%u audio, %u silent), %u dropped\n",
+         listen.sender.sentPackets(), listen.packetizer.audioPackets(),
+         listen.packetizer.silentPackets(), listen.sender.droppedPackets());
+  return 0;
+}
+
+int runIdle(int argc, char **argv) {
+  WavData wav;
+  if (argc < 3 || !readWav(argv[2], wav)) {
+    return 1;
+  }
+  if (wav.sampleRate != IDLE_SAMPLE_RATE) {
+    fprintf(stderr, "Idle capture runs at %d Hz, %s is %d Hz\n",
+            IDLE_SAMPLE_RATE, argv[2], wav.sampleRate);
+    return 1;
+  }
+
+  DoorbellDetector doorbell;
+  doorbell.begin(DoorbellConfig{}, IDLE_MONITOR_RATE);
+  UplinkDsp dsp;
+  dsp.begin(DspConfig{}, IDLE_MONITOR_RATE);
+  std::vector<uint8_t> preRollStorage(PREROLL_SECONDS * IDLE_MONITOR_RATE);
+  PreRollBuffer preRoll(preRollStorage);
+
+  std::vector<int16_t> block(IDLE_CAPTURE_SAMPLES);
+  for (size_t offset = 0; offset + block.size() <= wav.samples.size();
+       offset += block.size()) {
+    std::copy_n(wav.samples.begin() + offset, block.size(), block.begin());
+    std::span<int16_t> samples{block};
+    if (monitorIdle(samples, IDLE_DECIMATION, doorbell, dsp, preRoll,
+                    PREROLL_DOORBELL_LEAD_MS * IDLE_MONITOR_RATE / 1000)) {
+      printf("Doorbell at %.2f s (level %d)\n",
+             static_cast<double>(offset) / IDLE_SAMPLE_RATE, doorbell.level());
+    }
+  }
+
+  printf("Pre-roll holds %.2f s%s\n",
+         static_cast<double>(preRoll.available()) / IDLE_MONITOR_RATE,
+         preRoll.held() ? " (held)" : "");
+  if (argc > 3) {
+    WavData out{IDLE_MONITOR_RATE, std::vector<int16_t>(preRoll.available())};
+    preRoll.read(out.samples);
+    return writeWav(argv[3], out) ? 0 : 1;
+  }
+  return 0;
+}
+
+void printMixerStats(const TalkMixer &mixer) {
+  printf("Underruns: %u, dropped samples: %u, rejected packets: %u\n",
+         mixer.underruns(), mixer.droppedSamples(), mixer.rejectedPackets());
+}
+
+int runTalk(int argc, char **argv) {
+  if (argc < 3) {
+    return 1;
+  }
+  uint16_t port = argc > 3 ? atoi(argv[3]) : AUDIO_IN_PORT;
+  int rate = argc > 4 ? atoi(argv[4]) : DAC_SAMPLE_RATE;
+  bool mulaw = argc > 5 && strcmp(argv[5], "mulaw") == 0;
+
+  int fd = socket(AF_INET, SOCK_DGRAM, 0);
+  sockaddr_in address = {};
+  address.sin_family = AF_INET;
+  address.sin_port = htons(port);
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if (fd < 0 || bind(fd, reinterpret_cast<sockaddr *>(&address),
+                     sizeof(address)) != 0) {
+    perror("bind");
+    return 1;
+  }
+  printf("Receiving %s talk audio on 127.0.0.1:%d into %s at %d Hz\n",
+         mulaw ? "mu-law" : "PCM", port, argv[2], rate);
+
+  TalkMixer mixer;
+  mixer.begin(TalkMixerConfig{}, rate);
+  size_t blockSamples = TALK_BLOCK_MS * rate / 1000;
+  std::vector<int16_t> block(blockSamples);
+  WavData out{rate, {}};
+  alignas(int16_t) uint8_t datagram[AUDIO_MAX_DATAGRAM];
+  int16_t decoded[AUDIO_MAX_DATAGRAM];
+  size_t packets = 0;
+  auto start = std::chrono::steady_clock::now();
+  auto lastPacket = start;
+  // The DAC's clock: a block is mixed every TALK_BLOCK_MS of wall time
+  uint64_t blocks = 0;
+  while (true) {
+    // Waits for the first packet indefinitely, then stops once every sender
+    // goes quiet
+    auto now = std::chrono::steady_clock::now();
+    if (packets > 0 && now - lastPacket >
+                           std::chrono::milliseconds(TALK_TIMEOUT_MS)) {
+      break;
+    }
+    timeval timeout = {0, TALK_BLOCK_MS * 1000};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    sockaddr_in from = {};
+    socklen_t fromLen = sizeof(from);
+    ssize_t len = recvfrom(fd, datagram, sizeof(datagram), 0,
+                           reinterpret_cast<sockaddr *>(&from), &fromLen);
+    now = std::chrono::steady_clock::now();
+    uint32_t nowMs = std::chrono::duration_cast<std::chrono::milliseconds>(
+                         now - start)
+                         .count();
+    if (len > 0) {
+      if (packets == 0) {
+        start = now;
+        nowMs = 0;
+      }
+      ++packets;
+      lastPacket = now;
+      std::span<const int16_t> samples;
+      if (mulaw) {
+        samples = {decoded, muLawDecode({datagram, static_cast<size_t>(len)},
+                                        decoded)};
+      } else {
+        samples = {reinterpret_cast<const int16_t *>(datagram),
+                   len / sizeof(int16_t)};
+      }
+      // Addresses stay in network byte order, like the intercom's
+      mixer.push(talkSourceId(from.sin_addr.s_addr, ntohs(from.sin_port)),
+                 samples, nowMs);
+    }
+    for (; packets > 0 && blocks * TALK_BLOCK_MS <= nowMs; ++blocks) {
+      // Nothing is written while nobody's playing, which the DAC hears as
+      // silence
+      mixer.mix(block, nowMs);
+      out.samples.insert(out.samples.end(), block.begin(), block.end());
+    }
+  }
+  close(fd);
+
+  printf("Received %zu packets, %.2f s of audio\n", packets,
+         static_cast<double>(out.samples.size()) / rate);
+  printMixerStats(mixer);
+  return writeWav(argv[2], out) ? 0 : 1;
+}
+
+// A TALK_GAIN payload, laid out the way the bridge sends it
+TalkGain talkGainPayload(const char *address, uint16_t port, double gain) {
+  uint8_t payload[sizeof(TalkGain)];
+  inet_pton(AF_INET, address, payload);
+  uint16_t q12 = static_cast<uint16_t>(gain * TALK_UNITY_GAIN);
+  payload[4] = port & 0xFF;
+  payload[5] = port >> 8;
+  payload[6] = q12 & 0xFF;
+  payload[7] = q12 >> 8;
+  TalkGain talkGain;
+  memcpy(&talkGain, payload, sizeof(talkGain));
+  return talkGain;
+}
+
+TalkSourceId talkSourceId(const char *address, uint16_t port) {
+  in_addr parsed = {};
+  inet_pton(AF_INET, address, &parsed);
+  return talkSourceId(parsed.s_addr, port);
+}
+
+// A talk packet in a synthetic trace
+struct TraceEvent {
+  uint32_t arrivalMs;
+  size_t source;
+  size_t offset;
+};
+
+int runMix(int argc, char **argv) {
+  if (argc < 6) {
+    return 1;
+  }
+  int jitterMs = atoi(argv[3]);
+  int lossPercent = atoi(argv[4]);
+
+  // Every input is a source, optionally with a gain as in.wav@0.5
+  std::vector<WavData> inputs;
+  std::vector<double> gains;
+  for (int i = 5; i < argc; ++i) {
+    std::string arg = argv[i];
+    size_t at = arg.find('@');
+    double gain = at == std::string::npos ? 1 : atof(arg.c_str() + at + 1);
+    WavData wav;
+    if (!readWav(arg.substr(0, at).c_str(), wav)) {
+      return 1;
+    }
+    if (!inputs.empty() && wav.sampleRate != inputs[0].sampleRate) {
+      fprintf(stderr, "%s isn't at %d Hz\n", argv[i], inputs[0].sampleRate);
+      return 1;
+    }
+    inputs.push_back(std::move(wav));
+    gains.push_back(gain);
+  }
+  int rate = inputs[0].sampleRate;
+
+  // Each source starts a little after the last and sends MIX_FRAME_MS
+  // packets, which arrive after a random delay of up to jitterMs, or not
+  // at all. Seeded, so every run sees the same trace.
+  std::vector<TraceEvent> trace;
+  size_t frameSamples = MIX_FRAME_MS * rate / 1000;
+  uint32_t endMs = 0;
+  for (size_t source = 0; source < inputs.size(); ++source) {
+    std::minstd_rand random(source + 1);
+    uint32_t startMs = source * MIX_STAGGER_MS;
+    const std::vector<int16_t> &samples = inputs[source].samples;
+    for (size_t offset = 0; offset + frameSamples <= samples.size();
+         offset += frameSamples) {
+      uint32_t sentMs = startMs + offset * 1000 / rate;
+      uint32_t delayMs = jitterMs > 0 ? random() % (jitterMs + 1) : 0;
+      if (static_cast<int>(random() % 100) < lossPercent) {
+        continue;
+      }
+      trace.push_back({sentMs + delayMs, source, offset});
+      endMs = std::max(endMs, sentMs + delayMs);
+    }
+  }
+  std::stable_sort(trace.begin(), trace.end(),
+                   [](const TraceEvent &a, const TraceEvent &b) {
+                     return a.arrivalMs < b.arrivalMs;
+                   });
+  printf("Mixing %zu sources at %d Hz: %zu packets, up to %d ms jitter, "
+         "%d%% loss\n",
+         inputs.size(), rate, trace.size(), jitterMs, lossPercent);
+
+  // Stand-in addresses, one port per source. The gains are set the way the
+  // bridge does, before the sources start sending.
+  TalkMixer mixer;
+  mixer.begin(TalkMixerConfig{}, rate);
+  for (size_t source = 0; source < inputs.size(); ++source) {
+    mixer.setGain(
+        talkGainPayload(MIX_ADDRESS, MIX_BASE_PORT + source, gains[source]));
+  }
+  WavData out{rate, {}};
+  std::vector<int16_t> block(TALK_BLOCK_MS * rate / 1000);
+  size_t next = 0;
+  size_t maxMixed = 0;
+  for (uint32_t nowMs = 0; nowMs <= endMs + TALK_BLOCK_MS;
+       nowMs += TALK_BLOCK_MS) {
+    for (; next < trace.size() && trace[next].arrivalMs <= nowMs; ++next) {
+      const TraceEvent &event = trace[next];
+      std::span<const int16_t> samples{
+          inputs[event.source].samples.data() + event.offset, frameSamples};
+      mixer.push(talkSourceId(MIX_ADDRESS, MIX_BASE_PORT + event.source),
+                 samples, nowMs);
+    }
+    maxMixed = std::max(maxMixed, mixer.mix(block, nowMs));
+    out.samples.insert(out.samples.end(), block.begin(), block.end());
+  }
+
+  printf("Mixed up to %zu sources at once into %.2f s of audio\n", maxMixed,
+         static_cast<double>(out.samples.size()) / rate);
+  printMixerStats(mixer);
+  return writeWav(argv[2], out) ? 0 : 1;
+}
+
+// Plays a constant level from source alone and returns the level the mix
+// comes out at
+int16_t mixedLevel(TalkMixer &mixer, TalkSourceId source) {
+  constexpr int16_t LEVEL = 1000;
+  std::vector<int16_t> samples(DAC_SAMPLE_RATE / 10, LEVEL);
+  std::vector<int16_t> block(TALK_BLOCK_MS * DAC_SAMPLE_RATE / 1000);
+  mixer.reset();
+  mixer.push(source, samples, 0);
+  mixer.mix(block, 0);
+  return block.back();
+}
+
+int runGains() {
+  TalkMixer mixer;
+  mixer.begin(TalkMixerConfig{}, DAC_SAMPLE_RATE);
+  bool ok = true;
+  auto check = [&](const char *what, double actual, double expected) {
+    bool match = std::abs(actual - expected) < 0.01;
+    printf("%-40s %5.2f%s\n", what, actual, match ? "" : " FAILED");
+    ok &= match;
+  };
+  auto gainOf = [&](const char *address, uint16_t port) {
+    return static_cast<double>(mixer.gain(talkSourceId(address, port))) /
+           TALK_UNITY_GAIN;
+  };
+
+  // Set before anyone sends, like the bridge does when it connects
+  mixer.setGain(talkGainPayload("10.0.0.2", 0, 0.5));
+  mixer.setGain(talkGainPayload("10.0.0.2", 40000, 2));
+  check("Port over address", gainOf("10.0.0.2", 40000), 2);
+  check("Any port on address", gainOf("10.0.0.2", 40001), 0.5);
+  check("Other address", gainOf("10.0.0.3", 40000), 1);
+  check("Mixed at port gain",
+        mixedLevel(mixer, talkSourceId("10.0.0.2", 40000)) / 1000.0, 2);
+
+  // Applies to a source that's already sending
+  std::vector<int16_t> samples(DAC_SAMPLE_RATE / 10);
+  mixer.reset();
+  mixer.push(talkSourceId("10.0.0.3", 40000), samples, 0);
+  mixer.setGain(talkGainPayload("10.0.0.3", 40000, 0.25));
+  check("While sending", gainOf("10.0.0.3", 40000), 0.25);
+  mixer.setGain(talkGainPayload("10.0.0.3", 40000, 8));
+  check("Clamped", gainOf("10.0.0.3", 40000), 4);
+
+  // Room for TALK_MAX_GAINS senders, which can still be changed when full
+  bool fits = true;
+  for (uint16_t port = 1; mixer.setGain(talkGainPayload("10.0.0.4", port, 3));
+       ++port) {
+    fits &= port <= TALK_MAX_GAINS;
+  }
+  check("Full table rejects new senders", fits, 1);
+  check("Full table still updates",
+        mixer.setGain(talkGainPayload("10.0.0.2", 40000, 1.5)), 1);
+  check("Updated", gainOf("10.0.0.2", 40000), 1.5);
+
+  // A reconnected bridge sends them all again
+  mixer.clearGains();
+  check("Cleared", gainOf("10.0.0.2", 40000), 1);
+  return ok ? 0 : 1;
+}
+
+// Every command, including the internal ones
+constexpr Command ALL_COMMANDS[] = {
+    Command::OPEN_DOOR,       Command::LISTEN_ON,     Command::TALK_ON,
+    Command::LISTEN_STOP,     Command::HEARTBEAT,     Command::RECEIVER_REPORT,
+    Command::LATENCY_PROBE,   Command::SUBSCRIBE,     Command::UNSUBSCRIBE,
+    Command::ALLOWLIST,       Command::TALK_GAIN,     Command::RESET,
+    Command::PROBE_DONE,
+};
+constexpr int STATE_BENCH_COMMANDS = 1000000;
+
+// Hook calls, by state
+int enterCalls[STATE_COUNT];
+int exitCalls[STATE_COUNT];
+template <State S> void countEnter(State) {
+  ++enterCalls[static_cast<size_t>(S)];
+}
+template <State S> void countExit(State) {
+  ++exitCalls[static_cast<size_t>(S)];
+}
+
+int64_t steadyClockUs() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+int runStates() {
+  StateMachineConfig config;
+  config.hooks[0] = {countEnter<State::IDLE>, countExit<State::IDLE>};
+  config.hooks[1] = {countEnter<State::LISTEN>, countExit<State::LISTEN>};
+  config.hooks[2] = {countEnter<State::TALK>, countExit<State::TALK>};
+  config.hooks[3] = {countEnter<State::PROBE>, countExit<State::PROBE>};
+  config.clock = steadyClockUs;
+
+  // A state change must run exactly the old state's exit hook and the new
+  // state's enter hook, staying put must run neither, and allows() must
+  // agree with handle()
+  printf("%-8s", "");
+  for (Command command : ALL_COMMANDS) {
+    printf(" %-7c", static_cast<char>(command));
+  }
+  printf("\n");
+  bool hooksOk = true;
+  StateMachine machine;
+  for (size_t from = 0; from < STATE_COUNT; ++from) {
+    printf("%-8s", stateName(static_cast<State>(from)));
+    for (Command command : ALL_COMMANDS) {
+      machine.begin(config, static_cast<State>(from));
+      std::fill_n(enterCalls, STATE_COUNT, 0);
+      std::fill_n(exitCalls, STATE_COUNT, 0);
+      // main.cpp only sets up for a command allows() says will go through
+      bool allowed = machine.allows(command);
+      hooksOk &= allowed == machine.handle(command);
+      if (!allowed) {
+        printf(" %-7s", "-");
+        hooksOk &= std::count(enterCalls, enterCalls + STATE_COUNT, 0) ==
+                       STATE_COUNT &&
+                   std::count(exitCalls, exitCalls + STATE_COUNT, 0) ==
+                       STATE_COUNT;
+        continue;
+      }
+      size_t to = static_cast<size_t>(machine.state());
+      printf(" %-7s", stateName(machine.state()));
+      for (size_t state = 0; state < STATE_COUNT; ++state) {
+        bool changed = from != to;
+        hooksOk &= enterCalls[state] == (changed && state == to);
+        hooksOk &= exitCalls[state] == (changed && state == from);
+      }
+    }
+    printf("\n");
+  }
+  printf("Hooks %s\n", hooksOk ? "ran only on state changes"
+                                : "MISMATCHED, see above");
+
+  // Random commands, most of them illegal
+  std::minstd_rand random(1);
+  machine.begin(config, State::IDLE);
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < STATE_BENCH_COMMANDS; ++i) {
+    machine.handle(ALL_COMMANDS[random() % std::size(ALL_COMMANDS)]);
+  }
+  auto end = std::chrono::steady_clock::now();
+  double ns = std::chrono::duration<double, std::nano>(end - start).count();
+  printf("%d commands: %.1f ns each, %u transitions, %u rejected\n",
+         STATE_BENCH_COMMANDS, ns / STATE_BENCH_COMMANDS,
+         machine.transitions(), machine.rejected());
+  TransitionRecord last[4];
+  size_t count = machine.history(last);
+  for (size_t i = 0; i < count; ++i) {
+    printf("  %lld us: %s -> %s on %c\n",
+           static_cast<long long>(last[i].timeUs - last[0].timeUs),
+           stateName(last[i].from), stateName(last[i].to),
+           static_cast<char>(last[i].command));
+  }
+  return hooksOk ? 0 : 1;
+}
+
+// Listen rates to try queueing behind the pre-roll, most of them not a
+// multiple of the monitor rate
+constexpr int RESAMPLE_RATES[] = {8000,  11025, 16000, 22050,
+                                  24000, 32000, 44100, 48000};
+constexpr double RESAMPLE_TONE_HZ = 1000;
+constexpr int RESAMPLE_SECONDS = 2;
+
+int runResample() {
+  bool ok = true;
+  for (int rate : RESAMPLE_RATES) {
+    std::vector<int16_t> tone(rate * RESAMPLE_SECONDS);
+    for (size_t i = 0; i < tone.size(); ++i) {
+      tone[i] = static_cast<int16_t>(
+          8000 * std::sin(2 * M_PI * RESAMPLE_TONE_HZ * i / rate));
+    }
+
+    // 20 ms frames, like the listen loop, with the remainder carried over
+    // between them
+    Downsampler downsampler;
+    downsampler.begin(rate, IDLE_MONITOR_RATE);
+    std::vector<int16_t> out;
+    size_t frame = rate / 50;
+    for (size_t offset = 0; offset < tone.size(); offset += frame) {
+      std::span<int16_t> samples{tone.data() + offset,
+                                 std::min(frame, tone.size() - offset)};
+      auto kept = samples.first(downsampler.process(samples));
+      out.insert(out.end(), kept.begin(), kept.end());
+    }
+
+    // A rising zero crossing per cycle of the tone
+    int crossings = 0;
+    for (size_t i = 1; i < out.size(); ++i) {
+      crossings += out[i - 1] < 0 && out[i] >= 0;
+    }
+    double expected = static_cast<double>(IDLE_MONITOR_RATE) * RESAMPLE_SECONDS;
+    double pitch = crossings / (out.size() / static_cast<double>(
+                                                 IDLE_MONITOR_RATE));
+    bool lengthOk = std::abs(out.size() - expected) <= 1;
+    bool pitchOk = std::abs(pitch - RESAMPLE_TONE_HZ) <= RESAMPLE_TONE_HZ / 50;
+    printf("%5d Hz: %zu samples (%.0f expected), %.0f Hz tone%s\n", rate,
+           out.size(), expected, pitch, lengthOk && pitchOk ? "" : " FAILED");
+    ok &= lengthOk && pitchOk;
+  }
+  return ok ? 0 : 1;
+}
+
+// Runs stage over the whole capture BENCH_ITERATIONS times and prints its CPU
+// time per second of audio
+template <typename F>
+void benchStage(const char *name, double seconds, F &&stage) {
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < BENCH_ITERATIONS; ++i) {
+    stage();
+  }
+  auto end = std::chrono::steady_clock::now();
+  double us = std::chrono::duration<double, std::micro>(end - start).count();
+  printf("%-28s %8.1f us CPU per second of audio\n", name,
+         us / (BENCH_ITERATIONS * seconds));
+}
+
+int runBench(int argc, char **argv) {
+  WavData wav;
+  if (argc < 3 || !readWav(argv[2], wav)) {
+    return 1;
+  }
+  const std::vector<int16_t> &capture = wav.samples;
+  double listenSeconds = static_cast<double>(capture.size()) / wav.sampleRate;
+  // The same samples stand in for the idle ADC too
+  double idleSeconds = static_cast<double>(capture.size()) / IDLE_SAMPLE_RATE;
+  printf("%s: %zu samples, %.1f s at %d Hz (%.1f s as idle capture)\n",
+         argv[2], capture.size(), listenSeconds, wav.sampleRate, idleSeconds);
+
+  // Idle
+  std::vector<int16_t> work;
+  std::vector<int16_t> monitor;
+  benchStage("Idle decimation", idleSeconds, [&] {
+    work = capture;
+    monitor.clear();
+    for (size_t offset = 0; offset + IDLE_CAPTURE_SAMPLES <= work.size();
+         offset += IDLE_CAPTURE_SAMPLES) {
+      std::span<int16_t> block{work.data() + offset, IDLE_CAPTURE_SAMPLES};
+      size_t count = decimate(block, IDLE_DECIMATION);
+      monitor.insert(monitor.end(), block.begin(), block.begin() + count);
+    }
+  });
+  size_t monitorBlock = IDLE_CAPTURE_SAMPLES / IDLE_DECIMATION;
+  DoorbellDetector doorbell;
+  benchStage("Idle doorbell", idleSeconds, [&] {
+    doorbell.begin(DoorbellConfig{}, IDLE_MONITOR_RATE);
+    for (size_t offset = 0; offset + monitorBlock <= monitor.size();
+         offset += monitorBlock) {
+      doorbell.process({monitor.data() + offset, monitorBlock});
+    }
+  });
+  UplinkDsp dsp;
+  std::vector<int16_t> processed;
+  benchStage("Idle DSP", idleSeconds, [&] {
+    dsp.begin(DspConfig{}, IDLE_MONITOR_RATE);
+    processed = monitor;
+    for (size_t offset = 0; offset + monitorBlock <= processed.size();
+         offset += monitorBlock) {
+      dsp.process({processed.data() + offset, monitorBlock});
+    }
+  });
+  std::vector<uint8_t> preRollStorage(PREROLL_SECONDS * IDLE_MONITOR_RATE);
+  PreRollBuffer preRoll(preRollStorage);
+  benchStage("Idle pre-roll write", idleSeconds, [&] {
+    for (size_t offset = 0; offset + monitorBlock <= processed.size();
+         offset += monitorBlock) {
+      preRoll.write({processed.data() + offset, monitorBlock});
+    }
+  });
+
+  // Listen
+  AudioDescriptor format = {static_cast<uint16_t>(wav.sampleRate),
+                            SampleFormat::S16LE, UplinkCodec::PCM_S16, 16,
+                            AUDIO_OUT_PORT};
+  if (!isSupported(format)) {
+    printf("Listen stages skipped, %d Hz isn't a supported listen rate\n",
+           wav.sampleRate);
+    return 0;
+  }
+  UplinkFormat base = resolveProfile(UPLINK_PROFILES[0], format,
+                                     UPLINK_PACKET_SIZE - UPLINK_HEADER_SIZE);
+  benchStage("Listen DSP", listenSeconds, [&] {
+    dsp.begin(DspConfig{}, wav.sampleRate);
+    processed = capture;
+    for (size_t offset = 0; offset + base.frameSamples <= processed.size();
+         offset += base.frameSamples) {
+      dsp.process({processed.data() + offset, base.frameSamples});
+    }
+  });
+
+  std::vector<std::vector<uint8_t>> packets;
+  uint8_t packet[UPLINK_PACKET_SIZE + UPLINK_PARITY_OVERHEAD];
+  int16_t captureBuffer[UPLINK_MAX_FRAME_SAMPLES];
+  for (size_t profile = 0; profile < UPLINK_PROFILE_COUNT; ++profile) {
+    UplinkFormat frame = resolveProfile(
+        UPLINK_PROFILES[profile], format,
+        UPLINK_PACKET_SIZE - UPLINK_HEADER_SIZE);
+    VoiceActivityDetector vad;
+    UplinkPacketizer packetizer;
+    uint64_t bytes = 0;
+    char name[64];
+    snprintf(name, sizeof(name), "Listen packetize, profile %zu", profile);
+    benchStage(name, listenSeconds, [&] {
+      vad.begin(VadConfig{});
+      packetizer.begin(PacketizerConfig{}, wav.sampleRate);
+      packetizer.setFormat(frame);
+      bytes = 0;
+      if (profile == 0) {
+        // Kept for the FEC and send stages
+        packets.clear();
+      }
+      for (size_t offset = 0; offset + frame.frameSamples <= processed.size();
+           offset += frame.frameSamples) {
+        int16_t *samples =
+            frame.frameSamples <= UPLINK_PACKET_SAMPLES
+                ? reinterpret_cast<int16_t *>(packet + UPLINK_HEADER_SIZE)
+                : captureBuffer;
+        std::copy_n(processed.begin() + offset, frame.frameSamples, samples);
+        std::span<const int16_t> captured{samples, frame.frameSamples};
+        bool speech = vad.process(captured);
+        size_t len = packetizer.finish(
+            packet, {captured, wav.sampleRate, speech, vad.noiseLevel()});
+        bytes += len;
+        if (len > 0 && profile == 0) {
+          packets.emplace_back(packet, packet + len);
+        }
+      }
+    });
+    printf("%-28s %8.1f kbit/s sent\n", "",
+           bytes * 8 / listenSeconds / 1000);
+  }
+
+  // The bridge plus extra subscribers asking for μ-law at the capture rate,
+  // sharing the DSP and VAD above
+  UplinkFormat bridgeFrame = resolveProfile(
+      UPLINK_PROFILES[0], format, UPLINK_PACKET_SIZE - UPLINK_HEADER_SIZE);
+  UplinkFormat extraFrame;
+  AudioDescriptor extra = format;
+  extra.codec = UplinkCodec::MULAW;
+  resolveSubscription(extra, wav.sampleRate,
+                      UPLINK_PACKET_SIZE - UPLINK_HEADER_SIZE, extraFrame);
+  for (size_t subscribers : {1, 2, 4}) {
+    VoiceActivityDetector vad;
+    std::vector<UplinkPacketizer> packetizers(subscribers);
+    char name[64];
+    snprintf(name, sizeof(name), "Listen fan-out to %zu",
+             subscribers);
+    benchStage(name, listenSeconds, [&] {
+      vad.begin(VadConfig{});
+      for (size_t i = 0; i < subscribers; ++i) {
+        packetizers[i].begin(PacketizerConfig{}, wav.sampleRate);
+        packetizers[i].setFormat(i == 0 ? bridgeFrame : extraFrame);
+      }
+      for (size_t offset = 0;
+           offset + bridgeFrame.frameSamples <= processed.size();
+           offset += bridgeFrame.frameSamples) {
+        std::span<const int16_t> samples{processed.data() + offset,
+                                         bridgeFrame.frameSamples};
+        bool speech = vad.process(samples);
+        for (size_t i = 0; i < subscribers; ++i) {
+          size_t perPacket = (i == 0 ? bridgeFrame : extraFrame).frameSamples;
+          for (size_t chunk = 0; chunk < samples.size(); chunk += perPacket) {
+            packetizers[i].finish(
+                packet, {samples.subspan(chunk, std::min(perPacket,
+                                                         samples.size() -
+                                                             chunk)),
+                         wav.sampleRate, speech, vad.noiseLevel()});
+          }
+        }
+      }
+    });
+  }
+
+  std::vector<uint8_t> fecStorage(UPLINK_PACKET_SIZE);
+  UplinkFec fec(fecStorage);
+  benchStage("Listen FEC, groups of 4", listenSeconds, [&] {
+    fec.begin(4);
+    for (const std::vector<uint8_t> &sent : packets) {
+      if (fec.add(sent.data(), sent.size())) {
+        fec.writeParity(packet);
+      }
+    }
+  });
+
+  LoopbackSender sender;
+  sender.begin(AUDIO_OUT_PORT);
+  benchStage("Listen UDP send (loopback)", listenSeconds, [&] {
+    for (const std::vector<uint8_t> &sent : packets) {
+      memcpy(sender.acquire(), sent.data(), sent.size());
+      sender.commit(sent.size());
+    }
+  });
+
+  // Talk, with the capture standing in for mu-law from the bridge
+  std::vector<uint8_t> encoded(capture.size());
+  for (size_t i = 0; i < capture.size(); ++i) {
+    encoded[i] = muLawEncode(capture[i]);
+  }
+  std::vector<int16_t> decoded(AUDIO_MAX_DATAGRAM);
+  benchStage("Talk mu-law decode", listenSeconds, [&] {
+    for (size_t offset = 0; offset < encoded.size();
+         offset += AUDIO_MAX_DATAGRAM) {
+      size_t len = std::min(AUDIO_MAX_DATAGRAM, encoded.size() - offset);
+      muLawDecode({encoded.data() + offset, len}, decoded);
+    }
+  });
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  std::string mode = argc > 1 ? argv[1] : "";
+  if (mode == "listen") {
+    return runListen(argc, argv);
+  }
+  if (mode == "idle") {
+    return runIdle(argc, argv);
+  }
+  if (mode == "talk") {
+    return runTalk(argc, argv);
+  }
+  if (mode == "mix") {
+    return runMix(argc, argv);
+  }
+  if (mode == "gains") {
+    return runGains();
+  }
+  if (mode == "states") {
+    return runStates();
+  }
+  if (mode == "resample") {
+    return runResample();
+  }
+  if (mode == "bench") {
+    return runBench(argc, argv);
+  }
+  fprintf(stderr,
+          "Usage: %s listen|idle|talk|mix|gains|states|resample|bench "
+          "[options]\n",
+          argv[0]);
+  return 1;
+}
@@ -0,0 +1,103 @@
+#include "wavFile.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+
+namespace {
+
+struct __attribute__((packed)) FormatChunk {
+  uint16_t format;
+  uint16_t channels;
+  uint32_t sampleRate;
+  uint32_t byteRate;
+  uint16_t blockAlign;
+  uint16_t bitsPerSample;
+};
+
+constexpr uint16_t WAV_FORMAT_PCM = 1;
+
+uint32_t readU32(std::ifstream &in) {
+  uint32_t value = 0;
+  in.read(reinterpret_cast<char *>(&value), sizeof(value));
+  return value;
+}
+
+} // namespace
+
+bool readWav(const std::string &path, WavData &wav) {
+  std::ifstream in(path, std::ios::binary);
+  char tag[4];
+  if (!in.read(tag, 4) || memcmp(tag, "RIFF", 4) != 0) {
+    fprintf(stderr, "%s: not a RIFF file\n", path.c_str());
+    return false;
+  }
+  readU32(in);
+  if (!in.read(tag, 4) || memcmp(tag, "WAVE", 4) != 0) {
+    fprintf(stderr, "%s: not a WAVE file\n", path.c_str());
+    return false;
+  }
+
+  bool haveFormat = false;
+  while (in.read(tag, 4)) {
+    uint32_t size = readU32(in);
+    if (memcmp(tag, "fmt ", 4) == 0) {
+      FormatChunk format = {};
+      in.read(reinterpret_cast<char *>(&format),
+              std::min<uint32_t>(size, sizeof(format)));
+      in.seekg(size - std::min<uint32_t>(size, sizeof(format)), std::ios::cur);
+      if (format.format != WAV_FORMAT_PCM || format.channels != 1 ||
+          format.bitsPerSample != 16) {
+        fprintf(stderr, "%s: only mono 16-bit PCM is supported\n",
+                path.c_str());
+        return false;
+      }
+      wav.sampleRate = static_cast<int>(format.sampleRate);
+      haveFormat = true;
+    } else if (memcmp(tag, "data", 4) == 0 && haveFormat) {
+      wav.samples.resize(size / sizeof(int16_t));
+      in.read(reinterpret_cast<char *>(wav.samples.data()),
+              wav.samples.size() * sizeof(int16_t));
+      wav.samples.resize(in.gcount() / sizeof(int16_t));
+      return true;
+    } else {
+      // Chunks are padded to an even size
+      in.seekg(size + (size & 1), std::ios::cur);
+    }
+  }
+  fprintf(stderr, "%s: no audio data\n", path.c_str());
+  return false;
+}
+
+bool writeWav(const std::string &path, const WavData &wav) {
+  std::ofstream out(path, std::ios::binary);
+  uint32_t dataSize = wav.samples.size() * sizeof(int16_t);
+  uint32_t riffSize = 4 + 8 + sizeof(FormatChunk) + 8 + dataSize;
+  FormatChunk format = {
+      .format = WAV_FORMAT_PCM,
+      .channels = 1,
+      .sampleRate = static_cast<uint32_t>(wav.sampleRate),
+      .byteRate = static_cast<uint32_t>(wav.sampleRate) * 2,
+      .blockAlign = 2,
+      .bitsPerSample = 16,
+  };
+  uint32_t formatSize = sizeof(format);
+
+  out.write("RIFF", 4);
+  out.write(reinterpret_cast<const char *>(&riffSize), 4);
+  out.write("WAVE", 4);
+  out.write("fmt ", 4);
+  out.write(reinterpret_cast<const char *>(&formatSize), 4);
+  out.write(reinterpret_cast<const char *>(&format), sizeof(format));
+  out.write("data", 4);
+  out.write(reinterpret_cast<const char *>(&dataSize), 4);
+  out.write(reinterpret_cast<const char *>(wav.samples.data()), dataSize);
+  if (!out) {
+    fprintf(stderr, "%s: write failed\n", path.c_str());
+    return false;
+  }
+  return true;
+}
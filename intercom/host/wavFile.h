@@ -0,0 +1,16 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Mono 16-bit PCM WAV files, standing in for the ADC and DAC on the host
+struct WavData {
+  int sampleRate = 0;
+  std::vector<int16_t> samples;
+};
+
+// Returns false (with a message on stderr) if the file can't be read or
+// isn't mono 16-bit PCM
+bool readWav(const std::string &path, WavData &wav);
+bool writeWav(const std::string &path, const WavData &wav);
@@ -0,0 +1,186 @@
+#include "allowlist.h"
+#include "tcpClient.h"
+#include "util.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cinttypes>
+#include <cstring>
+#include <esp_partition.h>
+#include <esp_rom_crc.h>
+#include <mbedtls/sha256.h>
+#include <span>
+#include <string_view>
+
+constexpr const char *ALLOWLIST_PARTITION = "allowlist";
+constexpr std::string_view AGE_OVER_PREFIX = "age_over_";
+constexpr uint32_t ALLOWLIST_MAGIC = 0x31574c41; // "ALW1"
+// Flash erases in sectors
+constexpr size_t FLASH_SECTOR_SIZE = 4096;
+
+// At the start of the partition, followed by the digests. Written last, so a
+// list that was only partly written has no valid header.
+struct StoredHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t count;
+  // Over the digests
+  uint32_t crc;
+};
+static_assert(sizeof(StoredHeader) == ALLOWLIST_DIGEST_SIZE);
+
+bool credentialDigest(std::span<const uint8_t> message, AllowlistDigest &out) {
+  if (message.empty()) {
+    return false;
+  }
+  bool upperCase;
+  switch (static_cast<OutputEvent>(message[0])) {
+  case OutputEvent::CREDIT_CARD:
+    upperCase = false;
+    break;
+  case OutputEvent::DIGITAL_ID: {
+    // Like the bridge, age_over_NN=true is matched exactly and anything else
+    // is a name and birth date, matched ignoring case
+    std::string_view data{reinterpret_cast<const char *>(message.data()) + 1,
+                          message.size() - 1};
+    upperCase = !data.starts_with(AGE_OVER_PREFIX);
+    break;
+  }
+  default:
+    return false;
+  }
+
+  mbedtls_sha256_context sha;
+  mbedtls_sha256_init(&sha);
+  mbedtls_sha256_starts(&sha, 0);
+  for (uint8_t byte : message) {
+    // ASCII only. The bridge upper-cases all of Unicode, so this never
+    // matches anything it wouldn't, but may leave a non-ASCII name to it.
+    uint8_t hashed = upperCase ? std::toupper(byte) : byte;
+    mbedtls_sha256_update(&sha, &hashed, 1);
+  }
+  uint8_t hash[32];
+  mbedtls_sha256_finish(&sha, hash);
+  mbedtls_sha256_free(&sha);
+  std::copy_n(hash, ALLOWLIST_DIGEST_SIZE, out.begin());
+  return true;
+}
+
+bool Allowlist::begin() {
+  partition_ = esp_partition_find_first(
+      ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, ALLOWLIST_PARTITION);
+  if (partition_ == nullptr) {
+    ESP_LOGE(TAG, "No %s partition", ALLOWLIST_PARTITION);
+    return false;
+  }
+  map();
+  ESP_LOGI(TAG, "Allowlist: %zu credentials, version %08" PRIx32, count_,
+           version_);
+  return true;
+}
+
+void Allowlist::map() {
+  if (mapping_ != 0) {
+    esp_partition_munmap(mapping_);
+    mapping_ = 0;
+  }
+  digests_ = nullptr;
+  count_ = 0;
+  version_ = 0;
+
+  const void *mapped = nullptr;
+  if (esp_partition_mmap(partition_, 0, partition_->size,
+                         ESP_PARTITION_MMAP_DATA, &mapped,
+                         &mapping_) != ESP_OK) {
+    ESP_LOGE(TAG, "Failed to map the allowlist");
+    mapping_ = 0;
+    return;
+  }
+
+  auto *header = static_cast<const StoredHeader *>(mapped);
+  size_t capacity = partition_->size / ALLOWLIST_DIGEST_SIZE - 1;
+  if (header->magic != ALLOWLIST_MAGIC || header->count > capacity) {
+    return;
+  }
+  auto *digests = reinterpret_cast<const AllowlistDigest *>(header + 1);
+  if (esp_rom_crc32_le(0, reinterpret_cast<const uint8_t *>(digests),
+                       header->count * ALLOWLIST_DIGEST_SIZE) != header->crc) {
+    ESP_LOGE(TAG, "Allowlist is damaged, ignoring it");
+    return;
+  }
+  digests_ = digests;
+  count_ = header->count;
+  version_ = header->version;
+}
+
+bool Allowlist::contains(const AllowlistDigest &digest) const {
+  return digests_ != nullptr &&
+         std::binary_search(digests_, digests_ + count_, digest);
+}
+
+size_t Allowlist::size() const { return count_; }
+uint32_t Allowlist::version() const { return version_; }
+
+bool Allowlist::beginWrite(const AllowlistHeader &header) {
+  if (partition_ == nullptr) {
+    return false;
+  }
+  size_t bytes = (header.count + 1) * ALLOWLIST_DIGEST_SIZE;
+  if (bytes > partition_->size) {
+    ESP_LOGE(TAG, "Allowlist of %d credentials doesn't fit", header.count);
+    return false;
+  }
+
+  // Nothing is allowed while the list is rewritten
+  if (mapping_ != 0) {
+    esp_partition_munmap(mapping_);
+    mapping_ = 0;
+  }
+  digests_ = nullptr;
+  count_ = 0;
+  size_t eraseSize =
+      (bytes + FLASH_SECTOR_SIZE - 1) / FLASH_SECTOR_SIZE * FLASH_SECTOR_SIZE;
+  if (esp_partition_erase_range(partition_, 0, eraseSize) != ESP_OK) {
+    ESP_LOGE(TAG, "Failed to erase the allowlist");
+    return false;
+  }
+  writing_ = header;
+  written_ = 0;
+  crc_ = 0;
+  return true;
+}
+
+bool Allowlist::writeChunk(std::span<const AllowlistDigest> digests) {
+  for (const AllowlistDigest &digest : digests) {
+    // Strictly ascending, which also rules out duplicates
+    if (written_ > 0 && !(last_ < digest)) {
+      ESP_LOGE(TAG, "Allowlist isn't sorted at entry %zu", written_);
+      return false;
+    }
+    last_ = digest;
+    ++written_;
+  }
+  size_t first = written_ - digests.size();
+  size_t offset = sizeof(StoredHeader) + first * ALLOWLIST_DIGEST_SIZE;
+  if (esp_partition_write(partition_, offset, digests.data(),
+                          digests.size_bytes()) != ESP_OK) {
+    ESP_LOGE(TAG, "Failed to write the allowlist");
+    return false;
+  }
+  auto *bytes = reinterpret_cast<const uint8_t *>(digests.data());
+  crc_ = esp_rom_crc32_le(crc_, bytes, digests.size_bytes());
+  return true;
+}
+
+bool Allowlist::finishWrite() {
+  StoredHeader header = {ALLOWLIST_MAGIC, writing_.version, writing_.count,
+                         crc_};
+  if (esp_partition_write(partition_, 0, &header, sizeof(header)) != ESP_OK) {
+    ESP_LOGE(TAG, "Failed to write the allowlist header");
+    return false;
+  }
+  map();
+  ESP_LOGI(TAG, "Stored allowlist: %zu credentials, version %08" PRIx32,
+           count_, version_);
+  return count_ == writing_.count;
+}
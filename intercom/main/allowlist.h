@@ -0,0 +1,95 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <esp_partition.h>
+#include <span>
+
+// Credentials the intercom opens the door for by itself, pushed by the bridge
+// with Command::ALLOWLIST. Each is a truncated SHA-256 digest of the radio
+// message it would arrive in (see credentialDigest()), so the list holds no
+// card numbers or names. The list lives in the "allowlist" flash partition,
+// sorted, and is looked up by binary search straight out of memory-mapped
+// flash.
+
+constexpr size_t ALLOWLIST_DIGEST_SIZE = 16;
+using AllowlistDigest = std::array<uint8_t, ALLOWLIST_DIGEST_SIZE>;
+
+// Sent after Command::ALLOWLIST (little endian), followed by count digests
+// in ascending byte order. Must be kept in sync with the bridge's
+// allowlist.ts.
+struct __attribute__((packed)) AllowlistHeader {
+  // Identifies the list's contents, so an unchanged list isn't rewritten
+  uint32_t version;
+  uint16_t count;
+  uint16_t reserved;
+};
+static_assert(sizeof(AllowlistHeader) == 8);
+
+// Works out the digest a credential message from the scanner (starting with
+// its OutputEvent type) is listed under. Card messages are hashed as they
+// are. Digital ID messages ("given;family;birth date") are upper-cased
+// first, since the bridge matches them case-insensitively, except for
+// "age_over_NN=true", which it matches exactly. Returns false if the message
+// isn't a credential.
+bool credentialDigest(std::span<const uint8_t> message, AllowlistDigest &out);
+
+class Allowlist {
+public:
+  // Maps whatever list is in flash. An empty or damaged one counts as empty.
+  bool begin();
+
+  bool contains(const AllowlistDigest &digest) const;
+  size_t size() const;
+  uint32_t version() const;
+
+  // Replaces the list with header.count digests, read in chunks from read
+  // (which returns false if the connection fails). The new list only takes
+  // effect once completely written; until then, or if it's rejected
+  // (unsorted or too big), the list is empty. A list with the version and
+  // size already stored is read but not rewritten. Returns false if the list
+  // was rejected, in which case the rest of it is still read.
+  template <typename Read>
+  bool store(const AllowlistHeader &header, Read &&read);
+
+private:
+  bool beginWrite(const AllowlistHeader &header);
+  bool writeChunk(std::span<const AllowlistDigest> digests);
+  bool finishWrite();
+  void map();
+
+  const esp_partition_t *partition_ = nullptr;
+  esp_partition_mmap_handle_t mapping_ = 0;
+  const AllowlistDigest *digests_ = nullptr;
+  size_t count_ = 0;
+  uint32_t version_ = 0;
+
+  // While storing
+  AllowlistHeader writing_ = {};
+  size_t written_ = 0;
+  uint32_t crc_ = 0;
+  AllowlistDigest last_ = {};
+};
+
+// Digests read from the connection at a time while storing
+constexpr size_t ALLOWLIST_CHUNK = 32;
+
+template <typename Read>
+bool Allowlist::store(const AllowlistHeader &header, Read &&read) {
+  bool unchanged = digests_ != nullptr && header.version == version_ &&
+                   header.count == count_;
+  bool ok = unchanged || beginWrite(header);
+  AllowlistDigest chunk[ALLOWLIST_CHUNK];
+  for (size_t done = 0; done < header.count;) {
+    size_t len = std::min<size_t>(ALLOWLIST_CHUNK, header.count - done);
+    if (!read(std::span<uint8_t>{reinterpret_cast<uint8_t *>(chunk),
+                                 len * ALLOWLIST_DIGEST_SIZE})) {
+      return false;
+    }
+    ok = ok && (unchanged || writeChunk({chunk, len}));
+    done += len;
+  }
+  return ok && (unchanged || finishWrite());
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include "uplinkPacket.h"
+
+#include <cstddef>
+#include <cstdint>
+
+enum class SampleFormat : uint8_t {
+  S16LE = 0,
+};
+
+// Audio format for a listen or talk session, sent by the bridge after
+// Command::LISTEN_ON and Command::TALK_ON (little endian). Must be kept in
+// sync with the bridge's audioFormat.ts.
+struct __attribute__((packed)) AudioDescriptor {
+  uint16_t sampleRate;
+  SampleFormat sampleFormat;
+  UplinkCodec codec;
+  // Audio per packet
+  uint16_t frameMs;
+  // Listen: where the bridge receives the uplink. Talk: where the intercom
+  // receives audio from the bridge.
+  uint16_t port;
+};
+static_assert(sizeof(AudioDescriptor) == 8);
+
+// An extra listener for the listen uplink (e.g. a second bridge or a
+// recorder), sent by the bridge after Command::SUBSCRIBE and
+// Command::UNSUBSCRIBE
+struct __attribute__((packed)) UplinkSubscription {
+  // IPv4, in network byte order
+  uint32_t address;
+  // port is where to send the uplink. frameMs is ignored, since every
+  // subscriber gets the bridge's frames.
+  AudioDescriptor format;
+};
+static_assert(sizeof(UplinkSubscription) == 12);
+
+constexpr int AUDIO_MIN_SAMPLE_RATE = 8000;
+constexpr int AUDIO_MAX_SAMPLE_RATE = 48000;
+// Largest UDP payload that doesn't fragment on Ethernet-sized links
+constexpr size_t AUDIO_MAX_DATAGRAM = 1472;
+
+// Bytes of encoded audio in one frame
+constexpr size_t frameBytes(const AudioDescriptor &format) {
+  size_t bytesPerSample = format.codec == UplinkCodec::PCM_S16 ? 2 : 1;
+  return static_cast<size_t>(format.sampleRate) * format.frameMs / 1000 *
+         bytesPerSample;
+}
+
+// Whether the intercom can handle the format. Frames have to fit in a
+// single datagram.
+constexpr bool isSupported(const AudioDescriptor &format) {
+  return format.sampleRate >= AUDIO_MIN_SAMPLE_RATE &&
+         format.sampleRate <= AUDIO_MAX_SAMPLE_RATE &&
+         format.sampleFormat == SampleFormat::S16LE &&
+         (format.codec == UplinkCodec::PCM_S16 ||
+          format.codec == UplinkCodec::MULAW) &&
+         format.frameMs > 0 && frameBytes(format) <= AUDIO_MAX_DATAGRAM &&
+         format.port != 0;
+}
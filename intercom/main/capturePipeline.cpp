@@ -0,0 +1,19 @@
+#include "capturePipeline.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+
+bool monitorIdle(std::span<int16_t> &samples, int decimation,
+                 DoorbellDetector &doorbell, UplinkDsp &dsp,
+                 PreRollBuffer &preRoll, size_t leadSamples) {
+  samples = samples.first(decimate(samples, decimation));
+  bool rang = doorbell.process(samples);
+  if (rang) {
+    // Keep the visitor's first words after the ring for when someone answers
+    preRoll.holdAfter(preRoll.capacity() - leadSamples);
+  }
+  dsp.process(samples);
+  preRoll.write(samples);
+  return rang;
+}
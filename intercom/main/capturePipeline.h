@@ -0,0 +1,82 @@
+#pragma once
+
+#include "doorbell.h"
+#include "dsp.h"
+#include "preRoll.h"
+#include "uplinkFec.h"
+#include "uplinkPacket.h"
+#include "uplinkPacketizer.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+
+// The steps between the ADC and the network that the idle and listen states
+// run, without Arduino so pipelineHost runs the same ones on the host.
+//
+// A Sender hands out packet buffers and sends them to one receiver:
+//   uint8_t *acquire();      // nullptr if every buffer is in use
+//   void commit(size_t len); // a len of 0 hands the buffer back unsent
+
+// Idle: decimates a block of capture in place down to the monitor rate,
+// watches it for the doorbell and records it into the pre-roll. When the
+// doorbell rings the pre-roll is held with leadSamples from before it.
+// Returns whether the doorbell rang, with the monitor-rate samples left in
+// samples.
+bool monitorIdle(std::span<int16_t> &samples, int decimation,
+                 DoorbellDetector &doorbell, UplinkDsp &dsp,
+                 PreRollBuffer &preRoll, size_t leadSamples);
+
+// Listen: where to capture a frame of frameSamples. If it's only going to
+// one receiver and fits in packetSamples, it's captured straight into a
+// packet from sender, returned in packet, and nullptr is returned if there's
+// no packet free. Otherwise it goes in fallback and is copied out per
+// receiver by packetizeFrame().
+template <typename Sender>
+int16_t *acquireFrameBuffer(Sender &sender, size_t frameSamples,
+                            size_t packetSamples, bool shared,
+                            std::span<int16_t> fallback, uint8_t *&packet) {
+  packet = nullptr;
+  if (shared || frameSamples > packetSamples) {
+    return fallback.data();
+  }
+  packet = sender.acquire();
+  if (packet == nullptr) {
+    return nullptr;
+  }
+  return reinterpret_cast<int16_t *>(packet + UPLINK_HEADER_SIZE);
+}
+
+// Listen: packetizes a processed frame for one receiver in packets of up to
+// perPacket samples, along with FEC parity when a group is complete.
+// captured is the packet from acquireFrameBuffer(), if the frame is in one,
+// and is used for the first packet and cleared.
+template <typename Sender>
+void packetizeFrame(const UplinkFrame &frame, size_t perPacket,
+                    UplinkPacketizer &packetizer, UplinkFec &fec,
+                    Sender &sender, uint8_t *&captured) {
+  UplinkFrame part = frame;
+  for (size_t offset = 0; offset < frame.samples.size(); offset += perPacket) {
+    uint8_t *packet = captured != nullptr ? captured : sender.acquire();
+    captured = nullptr;
+    if (packet == nullptr) {
+      return;
+    }
+    part.samples = frame.samples.subspan(
+        offset, std::min(perPacket, frame.samples.size() - offset));
+    size_t len = packetizer.finish(packet, part);
+    bool parityDue = len > 0 && fec.add(packet, len);
+    // Silence is mostly not sent, in which case the buffer is simply reused
+    sender.commit(len);
+    if (!parityDue) {
+      continue;
+    }
+    uint8_t *parity = sender.acquire();
+    if (parity == nullptr) {
+      fec.reset();
+      continue;
+    }
+    sender.commit(fec.writeParity(parity));
+  }
+}
@@ -0,0 +1,34 @@
+#include "doorbell.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <span>
+
+void DoorbellDetector::begin(const DoorbellConfig &config, int sampleRate) {
+  config_ = config;
+  repeatSamples_ =
+      static_cast<uint32_t>(static_cast<int64_t>(config.repeatMs) *
+                            sampleRate / 1000);
+  sinceTrigger_ = UINT32_MAX;
+  level_ = 0;
+}
+
+bool DoorbellDetector::process(std::span<const int16_t> samples) {
+  int32_t peak = 0;
+  for (int16_t sample : samples) {
+    int32_t magnitude = sample < 0 ? -sample : sample;
+    peak = std::max(peak, magnitude);
+  }
+  level_ = peak;
+
+  sinceTrigger_ = sinceTrigger_ > UINT32_MAX - samples.size()
+                      ? UINT32_MAX
+                      : sinceTrigger_ + samples.size();
+  if (peak <= config_.triggerLevel || sinceTrigger_ < repeatSamples_) {
+    return false;
+  }
+  sinceTrigger_ = 0;
+  return true;
+}
+
+int32_t DoorbellDetector::level() const { return level_; }
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstdint>
+#include <span>
+
+struct DoorbellConfig {
+  // Peak sample level that counts as the doorbell ringing
+  int32_t triggerLevel = 1500;
+  // Rings closer together than this are the same ring
+  int repeatMs = 5000;
+};
+
+// Watches idle capture for the doorbell: the block's peak level going over a
+// threshold. Same measure as arduino-audio-tools' VolumeMeter, but without
+// the Arduino dependency so it can run on the host.
+class DoorbellDetector {
+public:
+  void begin(const DoorbellConfig &config, int sampleRate);
+
+  // Returns true when a block rings the doorbell
+  bool process(std::span<const int16_t> samples);
+  // Peak level of the last block
+  int32_t level() const;
+
+private:
+  DoorbellConfig config_;
+  uint32_t repeatSamples_ = 0;
+  // Saturates so the first ring after a long quiet spell always counts
+  uint32_t sinceTrigger_ = UINT32_MAX;
+  int32_t level_ = 0;
+};
@@ -0,0 +1,193 @@
+#include "dsp.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <span>
+
+// 2 * pi * 2^15, used to turn a corner frequency into a Q15 pole
+constexpr int64_t TWO_PI_Q15 = 205887;
+// Gate gain change per sample (Q15) while opening and closing
+constexpr int32_t GATE_ATTACK_STEP = DSP_Q15_ONE / 64;
+constexpr int32_t GATE_RELEASE_STEP = DSP_Q15_ONE / 4096;
+constexpr int32_t INT16_LIMIT = 32767;
+
+size_t decimate(std::span<int16_t> samples, int factor) {
+  if (factor <= 1) {
+    return samples.size();
+  }
+  size_t count = samples.size() / factor;
+  for (size_t i = 0; i < count; ++i) {
+    int32_t sum = 0;
+    for (int j = 0; j < factor; ++j) {
+      sum += samples[i * factor + j];
+    }
+    samples[i] = static_cast<int16_t>(sum / factor);
+  }
+  return count;
+}
+
+void Downsampler::begin(int inputRate, int outputRate) {
+  inputRate_ = inputRate;
+  outputRate_ = std::min(outputRate, inputRate);
+  reset();
+}
+
+void Downsampler::reset() {
+  phase_ = 0;
+  sum_ = 0;
+  count_ = 0;
+}
+
+size_t Downsampler::process(std::span<int16_t> samples) {
+  size_t count = 0;
+  for (size_t i = 0; i < samples.size(); ++i) {
+    sum_ += samples[i];
+    ++count_;
+    phase_ += outputRate_;
+    if (phase_ >= inputRate_) {
+      phase_ -= inputRate_;
+      // Never ahead of i, so this only overwrites samples already summed
+      samples[count++] = static_cast<int16_t>(sum_ / count_);
+      sum_ = 0;
+      count_ = 0;
+    }
+  }
+  return count;
+}
+
+void UplinkDsp::begin(const DspConfig &config, int sampleRate) {
+  config_ = config;
+  setSampleRate(sampleRate);
+  reset();
+}
+
+void UplinkDsp::setSampleRate(int sampleRate) {
+  highPassPole_ = DSP_Q15_ONE - static_cast<int32_t>(
+                                    TWO_PI_Q15 * config_.highPassCornerHz /
+                                    sampleRate);
+  gateHoldSamples_ = config_.gateHoldMs * sampleRate / 1000;
+  gateHoldRemaining_ = std::min(gateHoldRemaining_, gateHoldSamples_);
+}
+
+void UplinkDsp::reset() {
+  hpPrevInput_ = 0;
+  hpPrevOutput_ = 0;
+  gateEnvelope_ = 0;
+  gateGain_ = config_.gateFloor;
+  gateHoldRemaining_ = 0;
+  gateOpen_ = false;
+  agcEnvelope_ = 0;
+  agcGain_ = config_.agcMinGain;
+  std::fill(std::begin(lookahead_), std::end(lookahead_), 0);
+  lookaheadPos_ = 0;
+  limiterPeak_ = 0;
+  limiterPending_ = 0;
+  limiterHold_ = 0;
+  limiterTarget_ = DSP_Q15_ONE;
+  limiterGain_ = DSP_Q15_ONE;
+}
+
+int32_t UplinkDsp::agcGain() const { return agcGain_; }
+bool UplinkDsp::gateOpen() const { return gateOpen_; }
+
+void UplinkDsp::process(std::span<int16_t> samples) {
+  for (int16_t &sample : samples) {
+    sample = static_cast<int16_t>(processSample(sample));
+  }
+
+  // The AGC only adapts while someone is talking, otherwise it would slowly
+  // turn the background hiss up to the target level
+  if (gateOpen_ && agcEnvelope_ > 0) {
+    int32_t desired = std::clamp(config_.agcTargetLevel * DSP_UNITY_GAIN /
+                                     agcEnvelope_,
+                                 config_.agcMinGain, config_.agcMaxGain);
+    agcGain_ += (desired - agcGain_) / 8;
+  }
+}
+
+int32_t UplinkDsp::processSample(int32_t x) {
+  // DC-blocking high-pass: y[n] = x[n] - x[n-1] + a * y[n-1]
+  int32_t hp = ((x - hpPrevInput_) << 8) +
+               static_cast<int32_t>(
+                   (static_cast<int64_t>(highPassPole_) * hpPrevOutput_) >> 15);
+  hpPrevInput_ = x;
+  hpPrevOutput_ = hp;
+  int32_t y = std::clamp(hp >> 8, -INT16_LIMIT, INT16_LIMIT);
+
+  // Noise gate, driven by a fast-attack/slow-release envelope
+  int32_t magnitude = y < 0 ? -y : y;
+  gateEnvelope_ +=
+      (magnitude - gateEnvelope_) >> (magnitude > gateEnvelope_ ? 4 : 10);
+  if (gateEnvelope_ >= config_.gateOpenLevel) {
+    gateOpen_ = true;
+    gateHoldRemaining_ = gateHoldSamples_;
+  } else if (gateOpen_) {
+    if (gateEnvelope_ >= config_.gateCloseLevel) {
+      gateHoldRemaining_ = gateHoldSamples_;
+    } else if (gateHoldRemaining_ > 0) {
+      --gateHoldRemaining_;
+    } else {
+      gateOpen_ = false;
+    }
+  }
+  if (gateOpen_) {
+    gateGain_ = std::min(gateGain_ + GATE_ATTACK_STEP, DSP_Q15_ONE);
+  } else {
+    gateGain_ = std::max(gateGain_ - GATE_RELEASE_STEP, config_.gateFloor);
+  }
+  int32_t gated = (y * gateGain_) >> 15;
+
+  // AGC. The envelope is taken before the gain so the gain can be computed
+  // directly from it once per block.
+  int32_t gatedMagnitude = gated < 0 ? -gated : gated;
+  if (gatedMagnitude > agcEnvelope_) {
+    agcEnvelope_ = gatedMagnitude;
+  } else {
+    agcEnvelope_ -= agcEnvelope_ >> 12;
+  }
+  int32_t amplified = (gated * agcGain_) >> 10;
+
+  // Look-ahead limiter. limiterPeak_ is never lower than any sample still in
+  // the delay line, so reducing the gain immediately when it rises means the
+  // peak is already attenuated by the time it leaves the delay line.
+  int32_t amplifiedMagnitude = amplified < 0 ? -amplified : amplified;
+  bool peakChanged = false;
+  if (amplifiedMagnitude >= limiterPeak_) {
+    limiterPeak_ = amplifiedMagnitude;
+    limiterPending_ = 0;
+    limiterHold_ = DSP_LOOKAHEAD_SAMPLES + 1;
+    peakChanged = true;
+  } else {
+    limiterPending_ = std::max(limiterPending_, amplifiedMagnitude);
+    if (--limiterHold_ <= 0) {
+      // The sample that set the peak has left the delay line, so everything
+      // still in it is covered by limiterPending_
+      limiterPeak_ =
+          std::max(limiterPending_, limiterPeak_ - (limiterPeak_ >> 3));
+      limiterPending_ = 0;
+      limiterHold_ = DSP_LOOKAHEAD_SAMPLES + 1;
+      peakChanged = true;
+    }
+  }
+  if (peakChanged) {
+    limiterTarget_ =
+        limiterPeak_ > config_.limiterCeiling
+            ? static_cast<int32_t>(
+                  (static_cast<int64_t>(config_.limiterCeiling) << 15) /
+                  limiterPeak_)
+            : DSP_Q15_ONE;
+  }
+  if (limiterTarget_ < limiterGain_) {
+    limiterGain_ = limiterTarget_;
+  } else {
+    limiterGain_ += (limiterTarget_ - limiterGain_) >> 6;
+  }
+
+  int32_t delayed = lookahead_[lookaheadPos_];
+  lookahead_[lookaheadPos_] = amplified;
+  lookaheadPos_ = (lookaheadPos_ + 1) % DSP_LOOKAHEAD_SAMPLES;
+
+  int32_t out = static_cast<int32_t>(
+      (static_cast<int64_t>(delayed) * limiterGain_) >> 15);
+  return std::clamp(out, -INT16_LIMIT, INT16_LIMIT);
+}
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+
+// Integer-only conditioning for the listen uplink. ADC samples go through a
+// DC-blocking high-pass, a noise gate, automatic gain control and a
+// look-ahead limiter, and come out as signed 16-bit PCM.
+// This file has no Arduino dependencies so it can be benchmarked on the host.
+
+constexpr int32_t DSP_UNITY_GAIN = 1 << 10; // AGC gains are Q10
+constexpr int32_t DSP_Q15_ONE = 1 << 15;
+constexpr size_t DSP_LOOKAHEAD_SAMPLES = 32;
+
+struct DspConfig {
+  // Corner frequency of the DC-blocking high-pass
+  int highPassCornerHz = 25;
+  // Envelope levels (after the high-pass) that open and close the noise gate
+  int32_t gateOpenLevel = 120;
+  int32_t gateCloseLevel = 80;
+  // How long the gate stays open once the envelope drops below close level
+  int gateHoldMs = 300;
+  // Gain applied while the gate is closed, in Q15 (~-30 dB)
+  int32_t gateFloor = 1024;
+  // Peak level the AGC aims for and the range its gain may move in
+  int32_t agcTargetLevel = 12000;
+  int32_t agcMinGain = DSP_UNITY_GAIN;
+  int32_t agcMaxGain = 20 * DSP_UNITY_GAIN;
+  // Output peaks are kept at or below this level by the limiter
+  int32_t limiterCeiling = 30000;
+};
+
+// Box filter and decimate samples in place by factor, returning how many
+// samples are left. Crude as anti-aliasing goes, but speech has little energy
+// up where it leaks through.
+size_t decimate(std::span<int16_t> samples, int factor);
+
+// Box filter and downsample between any two rates, for rates that aren't a
+// multiple of the one wanted. Each output sample is the average of the input
+// samples in its period, so with a whole ratio this matches decimate().
+class Downsampler {
+public:
+  // outputRate can't be above inputRate
+  void begin(int inputRate, int outputRate);
+  void reset();
+  // Downsamples samples in place, returning how many are left. Input left
+  // over for a partial output sample carries over to the next call.
+  size_t process(std::span<int16_t> samples);
+
+private:
+  int32_t inputRate_ = 1;
+  int32_t outputRate_ = 1;
+  int32_t phase_ = 0;
+  int32_t sum_ = 0;
+  int32_t count_ = 0;
+};
+
+class UplinkDsp {
+public:
+  void begin(const DspConfig &config, int sampleRate);
+  void reset();
+  // Follows a change of capture rate without resetting the gate and AGC, so
+  // the level carries over from idle monitoring into a listen session
+  void setSampleRate(int sampleRate);
+
+  // Processes samples in place
+  void process(std::span<int16_t> samples);
+
+  int32_t agcGain() const;
+  bool gateOpen() const;
+
+private:
+  int32_t processSample(int32_t x);
+
+  DspConfig config_;
+  int32_t highPassPole_ = 0; // Q15
+  int32_t gateHoldSamples_ = 0;
+
+  // High-pass state. The output is kept with 8 fractional bits so the filter
+  // does not limit-cycle on small inputs.
+  int32_t hpPrevInput_ = 0;
+  int32_t hpPrevOutput_ = 0;
+
+  int32_t gateEnvelope_ = 0;
+  int32_t gateGain_ = 0; // Q15
+  int32_t gateHoldRemaining_ = 0;
+  bool gateOpen_ = false;
+
+  int32_t agcEnvelope_ = 0;
+  int32_t agcGain_ = DSP_UNITY_GAIN;
+
+  int32_t lookahead_[DSP_LOOKAHEAD_SAMPLES] = {};
+  size_t lookaheadPos_ = 0;
+  int32_t limiterPeak_ = 0;
+  int32_t limiterPending_ = 0;
+  int32_t limiterHold_ = 0;
+  int32_t limiterTarget_ = DSP_Q15_ONE; // Q15
+  int32_t limiterGain_ = DSP_Q15_ONE;   // Q15
+};
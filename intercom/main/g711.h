@@ -0,0 +1,65 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+
+// G.711 mu-law companding: 16-bit PCM in 8 bits with ~14 bits of dynamic
+// range. Used wherever audio has to be stored or sent compactly.
+
+constexpr int32_t MULAW_BIAS = 0x84;
+constexpr int32_t MULAW_CLIP = 32635;
+
+constexpr uint8_t muLawEncode(int16_t sample) {
+  int32_t value = sample;
+  uint8_t sign = 0;
+  if (value < 0) {
+    value = -value;
+    sign = 0x80;
+  }
+  if (value > MULAW_CLIP) {
+    value = MULAW_CLIP;
+  }
+  value += MULAW_BIAS;
+
+  int exponent = 7;
+  for (int32_t mask = 0x4000; (value & mask) == 0 && exponent > 0;
+       mask >>= 1) {
+    --exponent;
+  }
+  int mantissa = (value >> (exponent + 3)) & 0x0F;
+  return ~(sign | (exponent << 4) | mantissa);
+}
+
+constexpr int16_t muLawDecodeSlow(uint8_t encoded) {
+  encoded = ~encoded;
+  int exponent = (encoded >> 4) & 0x07;
+  int mantissa = encoded & 0x0F;
+  int32_t value = ((mantissa << 3) + MULAW_BIAS) << exponent;
+  value -= MULAW_BIAS;
+  return (encoded & 0x80) ? -value : value;
+}
+
+constexpr std::array<int16_t, 256> MULAW_DECODE_TABLE = [] {
+  std::array<int16_t, 256> table{};
+  for (int i = 0; i < 256; ++i) {
+    table[i] = muLawDecodeSlow(static_cast<uint8_t>(i));
+  }
+  return table;
+}();
+
+constexpr int16_t muLawDecode(uint8_t encoded) {
+  return MULAW_DECODE_TABLE[encoded];
+}
+
+// Decodes as much of encoded as fits in out, returning the sample count
+inline size_t muLawDecode(std::span<const uint8_t> encoded,
+                          std::span<int16_t> out) {
+  size_t count = std::min(encoded.size(), out.size());
+  for (size_t i = 0; i < count; ++i) {
+    out[i] = MULAW_DECODE_TABLE[encoded[i]];
+  }
+  return count;
+}
@@ -0,0 +1,122 @@
+#include "latencyProbe.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <span>
+
+// Sample n of the chirp at sampleRate: a linear sweep with a Hann window,
+// which keeps the correlation's side lobes down and the relay line from
+// clicking
+static int16_t chirpSample(size_t n, int sampleRate) {
+  constexpr float DURATION = PROBE_CHIRP_MS / 1000.0f;
+  constexpr float SWEEP =
+      (PROBE_CHIRP_END_HZ - PROBE_CHIRP_START_HZ) / DURATION;
+  float t = static_cast<float>(n) / sampleRate;
+  float phase = 2 * static_cast<float>(M_PI) *
+                (PROBE_CHIRP_START_HZ * t + SWEEP * t * t / 2);
+  float window = 0.5f - 0.5f * std::cos(2 * static_cast<float>(M_PI) * t /
+                                        DURATION);
+  return static_cast<int16_t>(PROBE_AMPLITUDE * window * std::sin(phase));
+}
+
+bool LatencyProbe::begin(int playbackRate, int captureRate) {
+  if (captureRate > PROBE_MAX_CAPTURE_RATE) {
+    return false;
+  }
+  playbackRate_ = playbackRate;
+  captureRate_ = captureRate;
+
+  referenceLen_ = PROBE_CHIRP_MS * captureRate / 1000;
+  referenceEnergy_ = 0;
+  for (size_t i = 0; i < referenceLen_; ++i) {
+    reference_[i] = chirpSample(i, captureRate);
+    referenceEnergy_ += static_cast<int32_t>(reference_[i]) * reference_[i];
+  }
+  windowLen_ = PROBE_WINDOW_MS * captureRate / 1000;
+  start();
+  return true;
+}
+
+void LatencyProbe::start() {
+  playPos_ = 0;
+  captured_ = 0;
+}
+
+void LatencyProbe::play(std::span<int16_t> out) {
+  size_t lead = PROBE_LEAD_MS * playbackRate_ / 1000;
+  size_t chirpLen = PROBE_CHIRP_MS * playbackRate_ / 1000;
+  for (int16_t &sample : out) {
+    bool inChirp = playPos_ >= lead && playPos_ < lead + chirpLen;
+    sample = inChirp ? chirpSample(playPos_ - lead, playbackRate_) : 0;
+    ++playPos_;
+  }
+}
+
+bool LatencyProbe::capture(std::span<const int16_t> samples) {
+  size_t count = std::min(samples.size(), windowLen_ - captured_);
+  std::copy_n(samples.begin(), count, window_ + captured_);
+  captured_ += count;
+  return done();
+}
+
+bool LatencyProbe::done() const { return captured_ >= windowLen_; }
+
+LatencyReport LatencyProbe::measure() {
+  LatencyReport report = {};
+  report.delayUs = -1;
+
+  // The ADC's DC offset would otherwise swamp the normalization
+  int64_t sum = 0;
+  for (size_t i = 0; i < captured_; ++i) {
+    sum += window_[i];
+  }
+  int32_t mean = captured_ > 0 ? static_cast<int32_t>(sum / captured_) : 0;
+  for (size_t i = 0; i < captured_; ++i) {
+    window_[i] = static_cast<int16_t>(
+        std::clamp<int32_t>(window_[i] - mean, INT16_MIN, INT16_MAX));
+  }
+
+  // Brute force is fine at these sizes: ~2M multiply-adds at 8 kHz, once per
+  // probe
+  int64_t bestCorrelation = 0;
+  size_t bestLag = 0;
+  for (size_t lag = 0; lag + referenceLen_ <= captured_; ++lag) {
+    int64_t correlation = 0;
+    for (size_t i = 0; i < referenceLen_; ++i) {
+      correlation += static_cast<int32_t>(reference_[i]) * window_[lag + i];
+    }
+    if (correlation > bestCorrelation) {
+      bestCorrelation = correlation;
+      bestLag = lag;
+    }
+  }
+
+  int64_t energy = 0;
+  for (size_t i = 0; i < referenceLen_ && bestLag + i < captured_; ++i) {
+    energy += static_cast<int32_t>(window_[bestLag + i]) * window_[bestLag + i];
+  }
+  double normalized = 0;
+  if (energy > 0 && referenceEnergy_ > 0) {
+    normalized = bestCorrelation / std::sqrt(static_cast<double>(energy) *
+                                             referenceEnergy_);
+  }
+  report.correlation = static_cast<uint16_t>(
+      std::clamp(normalized, 0.0, 1.0) * (INT16_MAX));
+
+  if (report.correlation >= PROBE_MIN_CORRELATION) {
+    int64_t delayUs = static_cast<int64_t>(bestLag) * 1000000 / captureRate_ -
+                      PROBE_LEAD_MS * 1000;
+    report.delayUs = static_cast<int32_t>(std::max<int64_t>(delayUs, 0));
+    ++runs_;
+    double delta = report.delayUs - mean_;
+    mean_ += delta / runs_;
+    m2_ += delta * (report.delayUs - mean_);
+  }
+
+  report.meanUs = static_cast<uint32_t>(mean_);
+  report.stdDevUs =
+      runs_ > 1 ? static_cast<uint32_t>(std::sqrt(m2_ / (runs_ - 1))) : 0;
+  report.runs = static_cast<uint16_t>(runs_);
+  return report;
+}
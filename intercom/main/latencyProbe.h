@@ -0,0 +1,86 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+
+// Measures the intercom's own share of mouth-to-ear latency: a chirp is
+// played through the talk path's DAC, picked up again by the listen path's
+// ADC with both relays closed, and found in the capture by cross-correlation.
+// The delay runs from the DAC write to the ADC read that returns the chirp,
+// so it includes both paths' DMA buffering. The network and the bridge's
+// ffmpeg are measured from the other end, see tools/latency_probe.py.
+// This file has no Arduino dependencies so it can be tested on the host.
+
+// Silence played before the chirp, while the relays settle
+constexpr int PROBE_LEAD_MS = 100;
+constexpr int PROBE_CHIRP_MS = 64;
+// Telephone band, so it survives the intercom line
+constexpr int PROBE_CHIRP_START_HZ = 300;
+constexpr int PROBE_CHIRP_END_HZ = 3400;
+constexpr int PROBE_AMPLITUDE = 5000;
+// How much capture the chirp is looked for in. Delays longer than this
+// minus the lead and the chirp can't be measured.
+constexpr int PROBE_WINDOW_MS = 500;
+// Highest rate the capture may be correlated at
+constexpr int PROBE_MAX_CAPTURE_RATE = 8000;
+// Normalized correlation (Q15) below which the chirp counts as not found
+constexpr int32_t PROBE_MIN_CORRELATION = 10000;
+
+// Sent with OutputEvent::LATENCY_REPORT after every probe
+struct __attribute__((packed)) LatencyReport {
+  // This run, or -1 if the chirp wasn't found
+  int32_t delayUs;
+  // Over the runs the chirp was found in since boot
+  uint32_t meanUs;
+  uint32_t stdDevUs;
+  uint16_t runs;
+  // Normalized peak correlation of this run, Q15
+  uint16_t correlation;
+  // From receiving Command::LATENCY_PROBE to sending this, so the bridge
+  // can tell how much of its round trip was the network
+  uint32_t elapsedUs;
+};
+
+class LatencyProbe {
+public:
+  // The chirp is played at playbackRate and looked for in audio captured at
+  // captureRate, which must not exceed PROBE_MAX_CAPTURE_RATE
+  bool begin(int playbackRate, int captureRate);
+  // Starts a run. Statistics carry over between runs.
+  void start();
+
+  // Fills out with the next playback samples: silence, the chirp, then
+  // silence again
+  void play(std::span<int16_t> out);
+  // Records samples captured since start(). Returns true once the window is
+  // full.
+  bool capture(std::span<const int16_t> samples);
+  bool done() const;
+
+  // Looks for the chirp in the capture and updates the statistics. elapsedUs
+  // is left for the caller.
+  LatencyReport measure();
+
+private:
+  int playbackRate_ = 0;
+  int captureRate_ = 0;
+  size_t playPos_ = 0;
+
+  static constexpr size_t MAX_CHIRP_SAMPLES =
+      PROBE_CHIRP_MS * PROBE_MAX_CAPTURE_RATE / 1000;
+  static constexpr size_t MAX_WINDOW_SAMPLES =
+      PROBE_WINDOW_MS * PROBE_MAX_CAPTURE_RATE / 1000;
+  // The chirp as it should appear in the capture
+  int16_t reference_[MAX_CHIRP_SAMPLES] = {};
+  size_t referenceLen_ = 0;
+  int64_t referenceEnergy_ = 0;
+  int16_t window_[MAX_WINDOW_SAMPLES] = {};
+  size_t windowLen_ = 0;
+  size_t captured_ = 0;
+
+  // Welford's running mean and variance, in microseconds
+  uint32_t runs_ = 0;
+  double mean_ = 0;
+  double m2_ = 0;
+};
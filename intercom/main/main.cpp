@@ -1,84 +1,407 @@
 #include "../../../constants.h"
 #include "WiFiUdp.h"
+#include "allowlist.h"
+#include "audioFormat.h"
+#include "capturePipeline.h"
+#include "doorbell.h"
+#include "dsp.h"
+#include "latencyProbe.h"
+#include "preRoll.h"
+#include "radio.h"
+#include "stateMachine.h"
 #include "talk.h"
 #include "tcpClient.h"
+#include "uplinkAdaptation.h"
+#include "uplinkPacketizer.h"
+#include "uplinkSender.h"
+#include "uplinkSubscribers.h"
 #include "util.h"
+#include "vad.h"
 
 #include <Arduino.h>
 #include <AudioTools.h>
-#include <AudioTools/Communication/UDPStream.h>
 #include <AudioTools/CoreAudio/AudioOutput.h>
 #include <AudioTools/CoreAudio/AudioStreams.h>
 #include <AudioTools/CoreAudio/AudioTypes.h>
-#include <RHReliableDatagram.h>
-#include <RH_RF69.h>
+#include <WiFi.h>
+#include <algorithm>
+#include <cinttypes>
 #include <cstdint>
+#include <esp_timer.h>
 
-// Idle - Radio
-constexpr int RADIO_IRQ_PIN = 26;
-RH_RF69 driver(SS, 26);
-RHReliableDatagram manager(driver, RADIO_INTERCOM_ADDRESS);
-uint8_t msgBuf[RH_RF69_MAX_MESSAGE_LEN];
-constexpr int RADIO_RESET_PIN = 16;
+// Radio
+RadioMessage radioMessage;
+// A radio message with the OutputEvent::DOOR_OPENED event in front
+uint8_t doorOpenedEvent[1 + sizeof(RadioMessage::data)];
+
+// Allowlist
+Allowlist allowlist;
 
 // Idle - Doorbell
-constexpr float DOORBELL_TRIGGER_VOLUME = 1500;
-constexpr int DOORBELL_REPEAT_TIME = 5000;
+DoorbellDetector doorbell;
+
+// Idle - Capture
+// While idle the ADC only feeds doorbell detection and the pre-roll, so it
+// runs near the lowest rate the ESP32's continuous ADC mode supports (20 kHz)
+// and is decimated down to narrowband before anything else touches it
+constexpr int IDLE_SAMPLE_RATE = 24000;
+constexpr int IDLE_DECIMATION = 3;
+constexpr int IDLE_MONITOR_RATE = IDLE_SAMPLE_RATE / IDLE_DECIMATION;
+// 20 ms of capture per loop
+constexpr size_t IDLE_CAPTURE_SAMPLES = IDLE_SAMPLE_RATE / 50;
+// Switching the ADC to the listen rate should take well under this, and a
+// warning is logged if it doesn't. Nothing is captured while it happens, but
+// there's nothing better to do than wait for it.
+constexpr int64_t ADC_SWITCH_WARN_US = 20000;
+int64_t adcSwitchMaxUs = 0;
+
+// Idle - Pre-roll
+// Recorded at IDLE_MONITOR_RATE
+constexpr int PREROLL_SECONDS = 2;
+// How much audio from before the doorbell to keep when it rings
+constexpr int PREROLL_DOORBELL_LEAD_MS = 500;
+// How long audio around the doorbell is kept before recording resumes
+constexpr int PREROLL_HOLD_TIME = 60000;
+// Pre-roll packets sent per loop. Each loop captures one packet of live audio,
+// so this drains the backlog at (PREROLL_FLUSH_PACKETS - 1)x real time.
+constexpr int PREROLL_FLUSH_PACKETS = 4;
 
 // Open door
 constexpr int DOOR_RELAY_PIN = 25;
 constexpr int OPEN_DOOR_TIME = 1000;
+// When the relay was last closed, while it's held
+uint32_t doorOpenedAt = 0;
+bool doorOpen = false;
 
 // Listen
-constexpr float AUDIO_SCALE = 20;
-AudioInfo info(32000, 1, 16);
+// Packet size and pacing can be overridden from .env
+#ifndef UPLINK_PACKET_SIZE
+#define UPLINK_PACKET_SIZE 1024
+#endif
+#ifndef UPLINK_PACKETS_PER_FLUSH
+#define UPLINK_PACKETS_PER_FLUSH 1
+#endif
+// Packets per FEC parity packet, 0 for no FEC
+#ifndef UPLINK_FEC_GROUP
+#define UPLINK_FEC_GROUP 0
+#endif
+// Range of UPLINK_PROFILES the uplink adapts within
+#ifndef UPLINK_BEST_PROFILE
+#define UPLINK_BEST_PROFILE 0
+#endif
+#ifndef UPLINK_WORST_PROFILE
+#define UPLINK_WORST_PROFILE (UPLINK_PROFILE_COUNT - 1)
+#endif
+// Until the bridge negotiates something else
+constexpr int LISTEN_SAMPLE_RATE = 32000;
+AudioDescriptor listenFormat = {LISTEN_SAMPLE_RATE, SampleFormat::S16LE,
+                                UplinkCodec::PCM_S16, 16, AUDIO_OUT_PORT};
+AudioInfo info(IDLE_SAMPLE_RATE, 1, 16);
 AnalogAudioStream audioInAnalog;
-UDPStream audioOutUdp(STRING(WIFI_SSID), STRING(WIFI_PASSWORD));
-VolumeStream volume((AudioOutput &)audioOutUdp);
-StreamCopy audioOutCopier(volume, audioInAnalog);
-VolumeMeter volumeMeter;
-StreamCopy audioMonitorCopier(volumeMeter, audioInAnalog);
+constexpr size_t UPLINK_PACKET_SAMPLES =
+    (UPLINK_PACKET_SIZE - UPLINK_HEADER_SIZE) / sizeof(int16_t);
+UplinkSender uplinkSender;
+UplinkDsp uplinkDsp;
+VoiceActivityDetector uplinkVad;
+UplinkAdaptation uplinkAdaptation;
+UplinkSubscribers uplinkSubscribers;
+// For audio that isn't captured straight into an uplink pbuf
+int16_t captureBuffer[UPLINK_MAX_FRAME_SAMPLES];
+uint8_t preRollStorage[PREROLL_SECONDS * IDLE_MONITOR_RATE];
+PreRollBuffer preRoll(preRollStorage);
+// Brings live audio queued behind the pre-roll down to the monitor rate
+Downsampler preRollDownsampler;
 constexpr int LISTEN_RELAY_PIN = 33;
+// Receiver reports are ignored for this long after the pre-roll has been
+// sent, since sending it faster than real time looks like queueing delay
+constexpr int ADAPTATION_SETTLE_TIME = 2000;
+uint32_t preRollSentTime = 0;
 
 // Talk
 WiFiUDP talkUdp;
-uint8_t rawAudioBuffer[1024];
 // DAC variables are set up in talk.cpp
 
-enum class State { IDLE, LISTEN, TALK };
-State state = State::IDLE;
+// Latency probe
+LatencyProbe latencyProbe;
+// 20 ms of playback per loop, at any talk rate
+int16_t probePlayback[AUDIO_MAX_SAMPLE_RATE / 50];
+int64_t probeStartTime = 0;
 
-void setup() {
-  Serial.begin(115200);
-  ESP_LOGI(TAG, "Initializing digital intercom...");
+StateMachine intercomState;
+
+int last_trigger_time = 0;
+
+uint64_t numPackets = 0;
+bool talkPlaying = false;
 
-  // Idle - Radio
-  pinMode(RADIO_RESET_PIN, OUTPUT);
-  digitalWrite(RADIO_RESET_PIN, LOW);
-  delay(100);
-  digitalWrite(RADIO_RESET_PIN, HIGH);
-  delay(100);
-  digitalWrite(RADIO_RESET_PIN, LOW);
-  delay(100);
-  bool radioInitialized = manager.init();
-  if (!radioInitialized) {
-    ESP_LOGI(TAG, "Waiting for radio to initialize...");
-    delay(1000);
+// Capture-rate samples per frame, which is one of the bridge's packets in
+// the current profile
+size_t uplinkFrameSamples() {
+  return uplinkSubscribers.bridge().format.frameSamples;
+}
+
+// Applies the current adaptation profile to the negotiated listen format
+void updateUplinkFormat() {
+  UplinkSubscriber &bridge = uplinkSubscribers.bridge();
+  bridge.format = resolveProfile(uplinkAdaptation.profile(), listenFormat,
+                                 UPLINK_PACKET_SIZE - UPLINK_HEADER_SIZE);
+  bridge.packetizer.setFormat(bridge.format);
+}
+
+// Sets an extra subscriber up for the format it asked for at the current
+// capture rate. Returns false if it can't be served.
+bool configureSubscriber(UplinkSubscriber &subscriber,
+                         const AudioDescriptor &requested) {
+  UplinkFormat format;
+  if (requested.sampleFormat != SampleFormat::S16LE ||
+      (requested.codec != UplinkCodec::PCM_S16 &&
+       requested.codec != UplinkCodec::MULAW) ||
+      requested.port == 0 ||
+      !resolveSubscription(requested, listenFormat.sampleRate,
+                           UPLINK_PACKET_SIZE - UPLINK_HEADER_SIZE,
+                           format)) {
+    return false;
   }
-  ESP_LOGI(TAG, "Bridge IP: %s\n", STRING(BRIDGE_IP));
+  subscriber.requested = requested;
+  subscriber.format = format;
+  subscriber.packetizer.begin(PacketizerConfig{}, listenFormat.sampleRate);
+  subscriber.packetizer.setFormat(format);
+  subscriber.fec.begin(UPLINK_FEC_GROUP);
+  return true;
+}
 
-  driver.setTxPower(RADIO_POWER, true);
-  bool radioFrequencySet = driver.setFrequency(RADIO_FREQUENCY);
-  if (!radioFrequencySet) {
-    ESP_LOGE(TAG, "Failed to set radio frequency");
-    errorHang();
+// Restarts the ADC at sampleRate, if it isn't already running at it. The
+// switch is timed since the audio it interrupts is lost.
+bool setCaptureRate(int sampleRate) {
+  if (info.sample_rate == sampleRate) {
+    return true;
+  }
+  int previousRate = info.sample_rate;
+  int64_t start = esp_timer_get_time();
+  info.sample_rate = sampleRate;
+  auto analogInConfig = audioInAnalog.defaultConfig(RX_MODE);
+  analogInConfig.copyFrom(info);
+  analogInConfig.channels = 1;
+  audioInAnalog.end();
+  if (!audioInAnalog.begin(analogInConfig)) {
+    ESP_LOGE(TAG, "Failed to restart ADC at %d Hz", sampleRate);
+    info.sample_rate = previousRate;
+    analogInConfig.copyFrom(info);
+    audioInAnalog.begin(analogInConfig);
+    return false;
+  }
+  int64_t elapsed = esp_timer_get_time() - start;
+  adcSwitchMaxUs = std::max(adcSwitchMaxUs, elapsed);
+  if (elapsed > ADC_SWITCH_WARN_US) {
+    ESP_LOGW(TAG, "ADC switch to %d Hz took %lld us, more than %lld us",
+             sampleRate, elapsed, ADC_SWITCH_WARN_US);
+  } else {
+    ESP_LOGI(TAG, "ADC switched to %d Hz in %lld us (max %lld us)",
+             sampleRate, elapsed, adcSwitchMaxUs);
   }
+  return true;
+}
 
-  bool radioModemConfigSet = driver.setModemConfig(RH_RF69::FSK_Rb2Fd5);
-  if (!radioModemConfigSet) {
-    ESP_LOGE(TAG, "Failed to set radio modem config");
-    errorHang();
+// Back to doorbell monitoring. The DSP carries on at the monitor rate so the
+// pre-roll picks up where it left off.
+void startIdleCapture() {
+  setCaptureRate(IDLE_SAMPLE_RATE);
+  uplinkDsp.setSampleRate(IDLE_MONITOR_RATE);
+}
+
+// Switches the capture side to a negotiated listen format. Returns false if
+// the format isn't supported, leaving the current one in place.
+bool configureListen(const AudioDescriptor &format) {
+  if (!isSupported(format)) {
+    ESP_LOGE(TAG, "Unsupported listen format: %d Hz, codec %d, %d ms",
+             format.sampleRate, static_cast<int>(format.codec),
+             format.frameMs);
+    return false;
+  }
+
+  UplinkSubscriber &bridge = uplinkSubscribers.bridge();
+  bool rateChanged = format.sampleRate != listenFormat.sampleRate;
+  listenFormat = format;
+  bridge.destination.port = format.port;
+  bridge.requested = format;
+  // The ADC itself is switched over when listening starts
+  if (rateChanged) {
+    bridge.packetizer.begin(PacketizerConfig{}, format.sampleRate);
+    // In case the pre-roll is still being sent
+    preRollDownsampler.begin(format.sampleRate, IDLE_MONITOR_RATE);
+    for (UplinkSubscriber &subscriber : uplinkSubscribers.slots().subspan(1)) {
+      if (subscriber.active &&
+          !configureSubscriber(subscriber, subscriber.requested)) {
+        ESP_LOGW(TAG, "Dropping subscriber on port %d, %d Hz doesn't work "
+                 "at %d Hz", subscriber.destination.port,
+                 subscriber.requested.sampleRate, format.sampleRate);
+        subscriber.active = false;
+      }
+    }
+  }
+  updateUplinkFormat();
+  ESP_LOGI(TAG, "Listen format: %d Hz, codec %d, %d ms frames, port %d",
+           format.sampleRate, static_cast<int>(format.codec), format.frameMs,
+           format.port);
+  return true;
+}
+
+// Sends one subscriber's packets out of the shared pbuf pool
+struct SubscriberSender {
+  const UplinkDestination &destination;
+
+  uint8_t *acquire() { return uplinkSender.acquire(); }
+  void commit(size_t len) { uplinkSender.commit(len, destination); }
+};
+
+// Where to capture the next frame. With only the bridge subscribed, frames
+// that fit are captured straight into a pbuf's payload, which is returned in
+// packet, and nullptr is returned if there's no pbuf free. Otherwise frames
+// go in captureBuffer and are copied out per subscriber.
+int16_t *acquireFrameBuffer(uint8_t *&packet) {
+  return acquireFrameBuffer(uplinkSender, uplinkFrameSamples(),
+                            UPLINK_PACKET_SAMPLES,
+                            uplinkSubscribers.count() > 1, captureBuffer,
+                            packet);
+}
+
+// Packetizes a processed frame for every subscriber. Voice detection runs
+// once for all of them. captured is the pbuf from acquireFrameBuffer(), if
+// the frame is in one.
+void sendUplinkFrame(std::span<const int16_t> samples, int sampleRate,
+                     uint8_t *captured) {
+  bool speech = uplinkVad.process(samples);
+  UplinkFrame frame = {samples, sampleRate, speech, uplinkVad.noiseLevel()};
+
+  for (UplinkSubscriber &subscriber : uplinkSubscribers.slots()) {
+    if (!subscriber.active) {
+      continue;
+    }
+    // Frames longer than fit in one of the subscriber's packets are split
+    SubscriberSender sender{subscriber.destination};
+    packetizeFrame(frame, subscriber.format.frameSamples,
+                   subscriber.packetizer, subscriber.fec, sender, captured);
+  }
+}
+
+// State hooks, run by intercomState only when the state changes. These are
+// the only places the listen and talk relays are switched.
+
+void enterIdle(State from) { startIdleCapture(); }
+
+void enterListen(State from) {
+  digitalWrite(LISTEN_RELAY_PIN, HIGH);
+  if (from == State::IDLE) {
+    // The DSP has been running on the pre-roll, so keep its state
+    ESP_LOGI(TAG, "Flushing %zu samples of pre-roll", preRoll.available());
+    preRoll.release();
+    preRollDownsampler.begin(listenFormat.sampleRate, IDLE_MONITOR_RATE);
+  } else {
+    // Nothing was recorded while talking or probing
+    preRoll.clear();
+    uplinkDsp.reset();
+    uplinkVad.reset();
+  }
+  for (UplinkSubscriber &subscriber : uplinkSubscribers.slots()) {
+    subscriber.fec.reset();
+  }
+  uplinkAdaptation.reset();
+  updateUplinkFormat();
+}
+
+void exitListen(State to) {
+  digitalWrite(LISTEN_RELAY_PIN, LOW);
+  uplinkSender.flush();
+  ESP_LOGI(TAG, "Uplink packets sent: %" PRIu32 ", dropped: %" PRIu32,
+           uplinkSender.sentPackets(), uplinkSender.droppedPackets());
+  UplinkPacketizer &packetizer = uplinkSubscribers.bridge().packetizer;
+  ESP_LOGI(TAG, "Uplink audio packets: %" PRIu32 ", silent: %" PRIu32,
+           packetizer.audioPackets(), packetizer.silentPackets());
+}
+
+void enterTalk(State from) {
+  resetTalk();
+  startIdleCapture();
+  digitalWrite(TALK_RELAY_PIN, HIGH);
+}
+
+void exitTalk(State to) {
+  digitalWrite(TALK_RELAY_PIN, LOW);
+  talkPlaying = false;
+  const TalkMixer &mixer = talkMixer();
+  ESP_LOGI(TAG, "Talk underruns: %" PRIu32 ", dropped samples: %" PRIu32
+           ", rejected packets: %" PRIu32, mixer.underruns(),
+           mixer.droppedSamples(), mixer.rejectedPackets());
+}
+
+// Both relays closed, so the talk path plays into the listen path
+void enterProbe(State from) {
+  digitalWrite(LISTEN_RELAY_PIN, HIGH);
+  digitalWrite(TALK_RELAY_PIN, HIGH);
+}
+
+void exitProbe(State to) {
+  digitalWrite(LISTEN_RELAY_PIN, LOW);
+  digitalWrite(TALK_RELAY_PIN, LOW);
+  if (to != State::IDLE) {
+    ESP_LOGW(TAG, "Latency probe cut short");
+  }
+}
+
+// Moves intercomState on for command and logs the transition. Returns false
+// if command isn't legal in the current state.
+bool changeState(Command command) {
+  State from = intercomState.state();
+  if (!intercomState.handle(command)) {
+    ESP_LOGW(TAG, "Ignoring command %c in %s (%" PRIu32 " rejected)",
+             static_cast<char>(command), stateName(from),
+             intercomState.rejected());
+    return false;
+  }
+  TransitionRecord last;
+  intercomState.history({&last, 1});
+  if (last.from == last.to) {
+    ESP_LOGW(TAG, "Command %c leaves %s as it is", static_cast<char>(command),
+             stateName(from));
+  } else {
+    ESP_LOGI(TAG, "%s -> %s on %c, hooks took %" PRIu32 " us",
+             stateName(last.from), stateName(last.to),
+             static_cast<char>(command), last.hookUs);
+  }
+  return true;
+}
+
+// Holds the relay closed for OPEN_DOOR_TIME. loop() lets it go, so audio
+// keeps flowing in the meantime.
+void openDoor() {
+  digitalWrite(DOOR_RELAY_PIN, HIGH);
+  doorOpenedAt = millis();
+  doorOpen = true;
+}
+
+// Opens the door straight away for a credential on the allowlist, and lets
+// the bridge know afterwards. Returns false if the bridge has to decide.
+bool openDoorLocally(std::span<const uint8_t> message) {
+  AllowlistDigest digest;
+  if (!credentialDigest(message, digest) || !allowlist.contains(digest)) {
+    return false;
   }
+  openDoor();
+  ESP_LOGI(TAG, "Opened door from allowlist");
+  doorOpenedEvent[0] = (char)OutputEvent::DOOR_OPENED;
+  std::copy(message.begin(), message.end(), doorOpenedEvent + 1);
+  sendData({doorOpenedEvent, message.size() + 1});
+  return true;
+}
+
+void setup() {
+  Serial.begin(115200);
+  ESP_LOGI(TAG, "Initializing digital intercom...");
+
+  // Radio, which is checked against the allowlist
+  allowlist.begin();
+  setupRadio();
+  ESP_LOGI(TAG, "Bridge IP: %s\n", STRING(BRIDGE_IP));
 
   // Open door
   pinMode(DOOR_RELAY_PIN, OUTPUT);
@@ -89,13 +412,42 @@ void setup() {
   pinMode(LISTEN_RELAY_PIN, OUTPUT);
   digitalWrite(LISTEN_RELAY_PIN, LOW);
   AudioToolsLogger.begin(Serial, AudioToolsLogLevel::Warning);
-  audioOutUdp.begin(STRING(BRIDGE_IP), AUDIO_OUT_PORT);
+  WiFi.begin(STRING(WIFI_SSID), STRING(WIFI_PASSWORD));
+  while (WiFi.status() != WL_CONNECTED) {
+    ESP_LOGI(TAG, "Waiting for WiFi to connect...");
+    delay(500);
+  }
 
-  auto config_vol = volume.defaultConfig();
-  config_vol.copyFrom(info);
-  config_vol.allow_boost = true;
-  config_vol.volume = AUDIO_SCALE;
-  volume.begin(config_vol);
+  UplinkSenderConfig uplinkConfig;
+  // Parity packets are slightly larger than the packets they protect
+  uplinkConfig.packetSize = UPLINK_PACKET_SIZE + UPLINK_PARITY_OVERHEAD;
+  uplinkConfig.packetsPerFlush = UPLINK_PACKETS_PER_FLUSH;
+  // Room for a packet and a parity packet per subscriber on top
+  uplinkConfig.poolSize =
+      std::min(UPLINK_MAX_POOL_SIZE,
+               UPLINK_PACKETS_PER_FLUSH + 3 + 2 * UPLINK_MAX_SUBSCRIBERS);
+  if (!uplinkSender.begin(uplinkConfig)) {
+    ESP_LOGE(TAG, "Failed to set up uplink sender");
+    errorHang();
+  }
+
+  uplinkDsp.begin(DspConfig{}, IDLE_MONITOR_RATE);
+  uplinkVad.begin(VadConfig{});
+  UplinkSubscriber &bridge = uplinkSubscribers.bridge();
+  if (!ipaddr_aton(STRING(BRIDGE_IP), &bridge.destination.address)) {
+    ESP_LOGE(TAG, "Invalid bridge address: %s", STRING(BRIDGE_IP));
+    errorHang();
+  }
+  bridge.destination.port = listenFormat.port;
+  bridge.requested = listenFormat;
+  bridge.packetizer.begin(PacketizerConfig{}, listenFormat.sampleRate);
+  bridge.fec.begin(UPLINK_FEC_GROUP);
+  bridge.active = true;
+  AdaptationConfig adaptationConfig;
+  adaptationConfig.bestProfile = UPLINK_BEST_PROFILE;
+  adaptationConfig.worstProfile = UPLINK_WORST_PROFILE;
+  uplinkAdaptation.begin(adaptationConfig);
+  updateUplinkFormat();
 
   auto analogInConfig = audioInAnalog.defaultConfig(RX_MODE);
   analogInConfig.copyFrom(info);
@@ -103,26 +455,28 @@ void setup() {
   audioInAnalog.begin(analogInConfig);
 
   // Idle - doorbell
-  volumeMeter.begin(analogInConfig);
+  doorbell.begin(DoorbellConfig{}, IDLE_MONITOR_RATE);
 
   // Talk
   setupTalk(talkUdp);
 
+  // State machine
+  StateMachineConfig stateConfig;
+  stateConfig.hooks[static_cast<size_t>(State::IDLE)] = {enterIdle, nullptr};
+  stateConfig.hooks[static_cast<size_t>(State::LISTEN)] = {enterListen,
+                                                           exitListen};
+  stateConfig.hooks[static_cast<size_t>(State::TALK)] = {enterTalk, exitTalk};
+  stateConfig.hooks[static_cast<size_t>(State::PROBE)] = {enterProbe,
+                                                          exitProbe};
+  stateConfig.clock = esp_timer_get_time;
+  intercomState.begin(stateConfig, State::IDLE);
+
   ESP_LOGI(TAG, "Setting up TCP Server");
   connectToTCPServer();
 
   ESP_LOGI(TAG, "Digital intercom initialized.");
 }
 
-int last_trigger_time = 0;
-const int amplitude = 5000;
-const int frequency = 440;
-const int halfWavelength = (DAC_SAMPLE_RATE / frequency);
-int16_t sample = amplitude; // current sample value
-int count = 0;
-
-uint64_t numPackets = 0;
-
 void loop() {
   std::optional<Command> cmd = getCommand();
   if (cmd) {
@@ -130,112 +484,269 @@ void loop() {
     switch (*cmd) {
     case Command::HEARTBEAT:
       break;
+    case Command::RECEIVER_REPORT: {
+      const ReceiverReport &report = getReceiverReport();
+      if (intercomState.state() == State::LISTEN &&
+          preRoll.available() == 0 &&
+          millis() - preRollSentTime > ADAPTATION_SETTLE_TIME &&
+          uplinkAdaptation.onReport(report)) {
+        ESP_LOGI(TAG,
+                 "Uplink profile %zu (loss %d/256, jitter %d ms, delay %d ms)",
+                 uplinkAdaptation.profileIndex(), report.fractionLost,
+                 report.jitterMs, report.delayMs);
+        updateUplinkFormat();
+      }
+      break;
+    }
     case Command::OPEN_DOOR: {
       ESP_LOGI(TAG, "Opening door...");
-      digitalWrite(DOOR_RELAY_PIN, HIGH);
-      delay(OPEN_DOOR_TIME);
-      digitalWrite(DOOR_RELAY_PIN, LOW);
-      ESP_LOGI(TAG, "Door opened");
+      openDoor();
+      break;
+    }
+    case Command::ALLOWLIST: {
+      const AllowlistHeader &header = getAllowlistHeader();
+      bool connected = true;
+      bool stored =
+          allowlist.store(header, [&](std::span<uint8_t> digests) {
+            connected = recvPayload(digests.data(), digests.size());
+            return connected;
+          });
+      if (!connected) {
+        // recvPayload() already reconnected
+        uplinkSubscribers.clear();
+        changeState(Command::RESET);
+      } else if (!stored) {
+        ESP_LOGE(TAG, "Rejected allowlist of %d credentials", header.count);
+      }
       break;
     }
     case Command::LISTEN_ON: {
-      if (state == State::LISTEN) {
-        ESP_LOGW(TAG, "Setting state to LISTEN when already in LISTEN");
+      // Nothing is reconfigured for a command the state machine rejects
+      if (intercomState.allows(*cmd)) {
+        configureListen(getAudioDescriptor());
+        setCaptureRate(listenFormat.sampleRate);
+        uplinkDsp.setSampleRate(listenFormat.sampleRate);
       }
-      state = State::LISTEN;
+      changeState(*cmd);
       break;
     }
     case Command::TALK_ON: {
-      if (state == State::TALK) {
-        ESP_LOGW(TAG, "Setting state to TALK when already in TALK");
+      if (intercomState.allows(*cmd)) {
+        configureTalk(talkUdp, getAudioDescriptor());
+      }
+      // Someone else answering joins the mix instead of starting over, since
+      // staying in TALK doesn't reset it
+      changeState(*cmd);
+      break;
+    }
+    case Command::LATENCY_PROBE: {
+      // Only legal while idle, so it never plays into a call
+      if (!changeState(*cmd)) {
+        break;
+      }
+      if (!latencyProbe.begin(talkSampleRate(), IDLE_MONITOR_RATE)) {
+        ESP_LOGE(TAG, "Failed to set up latency probe");
+        changeState(Command::PROBE_DONE);
+        break;
+      }
+      probeStartTime = esp_timer_get_time();
+      break;
+    }
+    case Command::SUBSCRIBE: {
+      const UplinkSubscription &subscription = getSubscription();
+      UplinkDestination destination = {};
+      ip_addr_set_ip4_u32(&destination.address, subscription.address);
+      destination.port = subscription.format.port;
+      UplinkSubscriber *subscriber = uplinkSubscribers.add(destination);
+      if (subscriber == nullptr) {
+        ESP_LOGE(TAG, "No room for another uplink subscriber");
+      } else if (!configureSubscriber(*subscriber, subscription.format)) {
+        ESP_LOGE(TAG, "Unsupported subscriber format: %d Hz, codec %d",
+                 subscription.format.sampleRate,
+                 static_cast<int>(subscription.format.codec));
+        subscriber->active = false;
+      } else {
+        subscriber->active = true;
+        ESP_LOGI(TAG, "Uplink subscriber %s:%d at %d Hz, %zu subscribers",
+                 ipaddr_ntoa(&destination.address), destination.port,
+                 subscription.format.sampleRate, uplinkSubscribers.count());
+      }
+      break;
+    }
+    case Command::UNSUBSCRIBE: {
+      const UplinkSubscription &subscription = getSubscription();
+      UplinkDestination destination = {};
+      ip_addr_set_ip4_u32(&destination.address, subscription.address);
+      destination.port = subscription.format.port;
+      if (!uplinkSubscribers.remove(destination)) {
+        ESP_LOGW(TAG, "Not an uplink subscriber: %s:%d",
+                 ipaddr_ntoa(&destination.address), destination.port);
+      }
+      break;
+    }
+    case Command::TALK_GAIN: {
+      const TalkGain &gain = getTalkGain();
+      ip_addr_t address = {};
+      ip_addr_set_ip4_u32(&address, gain.address);
+      if (setTalkGain(gain)) {
+        ESP_LOGI(TAG, "Talk gain for %s:%d: %d/%" PRId32,
+                 ipaddr_ntoa(&address), gain.port, gain.gain,
+                 TALK_UNITY_GAIN);
+      } else {
+        ESP_LOGW(TAG, "No room for a talk gain for %s:%d",
+                 ipaddr_ntoa(&address), gain.port);
       }
-      state = State::TALK;
       break;
     }
     case Command::LISTEN_STOP:
     case Command::RESET: {
-      if (state == State::IDLE) {
-        ESP_LOGW(TAG, "Setting state to IDLE when already in IDLE");
+      // A reconnected bridge subscribes everyone again
+      if (*cmd == Command::RESET) {
+        uplinkSubscribers.clear();
+        clearTalkGains();
       }
-      state = State::IDLE;
+      changeState(*cmd);
       break;
     }
+    case Command::PROBE_DONE:
+      break;
     }
   }
 
-  switch (state) {
-  case State::IDLE: {
-    /// Reset everything to base state
-    // Radio
-    if (manager.available()) {
-      ESP_LOGI(TAG, "Radio message received.");
-      uint8_t len = sizeof(msgBuf);
-      uint8_t from;
-
-      if (manager.recvfromAck(msgBuf, &len, &from)) {
-        Serial.print("got request from : 0x");
-        Serial.print(from, HEX);
-        Serial.print(": ");
-        for (int i = 0; i < len; i++) {
-          Serial.print(msgBuf[i], HEX);
-        }
-        Serial.println();
-
-        auto data = std::span<uint8_t>{msgBuf, len};
-        if (data[0] == (char)OutputEvent::CREDIT_CARD) {
-          sendData(data);
-        } else if (data[0] == (char)OutputEvent::DIGITAL_ID) {
-          sendData(data);
-        } else {
-          ESP_LOGE(TAG, "Received invalid data type: %c", data[0]);
-        }
-      }
+  if (doorOpen && millis() - doorOpenedAt >= OPEN_DOOR_TIME) {
+    digitalWrite(DOOR_RELAY_PIN, LOW);
+    doorOpen = false;
+    ESP_LOGI(TAG, "Door opened");
+  }
+
+  // Radio messages were already acknowledged by the radio task, in whatever
+  // state the intercom was in
+  while (receiveRadioMessage(radioMessage)) {
+    ESP_LOGI(TAG, "Radio message from 0x%02x, %d bytes (%" PRIu32
+             " dropped so far)", radioMessage.from, radioMessage.len,
+             radioDroppedMessages());
+    auto data = std::span<uint8_t>{radioMessage.data, radioMessage.len};
+    if (openDoorLocally(data)) {
+      continue;
+    }
+    if (data[0] == (char)OutputEvent::CREDIT_CARD) {
+      sendData(data);
+    } else if (data[0] == (char)OutputEvent::DIGITAL_ID) {
+      sendData(data);
+    } else {
+      ESP_LOGE(TAG, "Received invalid data type: %c", data[0]);
     }
+  }
 
+  switch (intercomState.state()) {
+  case State::IDLE: {
     // Doorbell
-    audioMonitorCopier.copy();
-    if (volumeMeter.volume() > DOORBELL_TRIGGER_VOLUME &&
-        millis() - last_trigger_time > DOORBELL_REPEAT_TIME) {
+    size_t bytesRead =
+        audioInAnalog.readBytes(reinterpret_cast<uint8_t *>(captureBuffer),
+                                IDLE_CAPTURE_SAMPLES * sizeof(int16_t));
+    std::span<int16_t> samples{captureBuffer, bytesRead / sizeof(int16_t)};
+    if (monitorIdle(samples, IDLE_DECIMATION, doorbell, uplinkDsp, preRoll,
+                    PREROLL_DOORBELL_LEAD_MS * IDLE_MONITOR_RATE / 1000)) {
       last_trigger_time = millis();
       ESP_LOGI(TAG, "Doorbell triggered!");
       sendBuzzerEvent();
     }
 
-    // Open door
-    digitalWrite(DOOR_RELAY_PIN, LOW);
+    // Pre-roll
+    if (preRoll.held() && millis() - last_trigger_time > PREROLL_HOLD_TIME) {
+      preRoll.release();
+    }
+    break;
+  }
+  case State::LISTEN: {
+    if (preRoll.available() > 0) {
+      // Send the pre-roll faster than real time, with live audio queued
+      // behind it until it has caught up
+      for (int i = 0; i < PREROLL_FLUSH_PACKETS && preRoll.available() > 0;
+           ++i) {
+        uint8_t *packet;
+        int16_t *frame = acquireFrameBuffer(packet);
+        if (frame == nullptr) {
+          break;
+        }
+        // Same duration as a live frame, at the rate it was recorded at
+        size_t samples = preRoll.read(
+            {frame, uplinkFrameSamples() * IDLE_MONITOR_RATE /
+                        listenFormat.sampleRate});
+        sendUplinkFrame({frame, samples}, IDLE_MONITOR_RATE, packet);
+      }
 
-    // Listen
-    digitalWrite(LISTEN_RELAY_PIN, LOW);
+      size_t bytesRead = audioInAnalog.readBytes(
+          reinterpret_cast<uint8_t *>(captureBuffer),
+          uplinkFrameSamples() * sizeof(int16_t));
+      std::span<int16_t> samples{captureBuffer, bytesRead / sizeof(int16_t)};
+      uplinkDsp.process(samples);
+      preRoll.write(samples.first(preRollDownsampler.process(samples)));
+      preRollSentTime = millis();
+      break;
+    }
 
-    // Talk
-    digitalWrite(TALK_RELAY_PIN, LOW);
+    // Capture and process once, for every subscriber
+    uint8_t *packet;
+    int16_t *frame = acquireFrameBuffer(packet);
+    if (frame == nullptr) {
+      audioInAnalog.readBytes(reinterpret_cast<uint8_t *>(captureBuffer),
+                              uplinkFrameSamples() * sizeof(int16_t));
+      break;
+    }
+    size_t bytesRead =
+        audioInAnalog.readBytes(reinterpret_cast<uint8_t *>(frame),
+                                uplinkFrameSamples() * sizeof(int16_t));
+    std::span<int16_t> samples{frame, bytesRead / sizeof(int16_t)};
+    uplinkDsp.process(samples);
+    sendUplinkFrame(samples, listenFormat.sampleRate, packet);
     break;
   }
-  case State::LISTEN: {
-    digitalWrite(TALK_RELAY_PIN, LOW);
-    digitalWrite(LISTEN_RELAY_PIN, HIGH);
-    audioOutCopier.copy();
+  case State::PROBE: {
+    // Playback is written first so it always leads the capture
+    std::span<int16_t> playback{probePlayback,
+                                static_cast<size_t>(talkSampleRate() / 50)};
+    latencyProbe.play(playback);
+    writePcmSamples(playback);
+
+    size_t bytesRead =
+        audioInAnalog.readBytes(reinterpret_cast<uint8_t *>(captureBuffer),
+                                IDLE_CAPTURE_SAMPLES * sizeof(int16_t));
+    size_t samples = decimate({captureBuffer, bytesRead / sizeof(int16_t)},
+                              IDLE_DECIMATION);
+    if (!latencyProbe.capture({captureBuffer, samples})) {
+      break;
+    }
+
+    LatencyReport report = latencyProbe.measure();
+    report.elapsedUs =
+        static_cast<uint32_t>(esp_timer_get_time() - probeStartTime);
+    sendLatencyReport(report);
+    if (report.delayUs < 0) {
+      ESP_LOGW(TAG, "Latency probe: chirp not found (correlation %d/32767)",
+               report.correlation);
+    } else {
+      ESP_LOGI(TAG,
+               "Latency probe: %" PRId32 " us (mean %" PRIu32 " us, std dev "
+               "%" PRIu32 " us over %d runs)",
+               report.delayUs, report.meanUs, report.stdDevUs, report.runs);
+    }
+    changeState(Command::PROBE_DONE);
     break;
   }
   case State::TALK: {
-    digitalWrite(LISTEN_RELAY_PIN, LOW);
-    digitalWrite(TALK_RELAY_PIN, HIGH);
-
-    int packetSize = talkUdp.parsePacket();
-    if (packetSize > 0) {
-      numPackets += packetSize;
-      talkUdp.read(rawAudioBuffer, packetSize);
-      writeAudioSamples(rawAudioBuffer, packetSize);
-    } else {
-      Serial.println("No packet to process!");
+    numPackets += receiveTalkAudio(talkUdp);
+    talkPlaying = playTalkAudio();
+    if (!talkPlaying) {
+      Serial.printf("Num bytes received: %llu\n", numPackets);
     }
-
-    Serial.printf("Num bytes received: %llu\n", numPackets);
     break;
   }
   }
 
-  if (state != State::LISTEN) {
+  // Idle and listen block on the ADC, which has to be read continuously, and
+  // talk on the DAC while anyone is talking
+  if (intercomState.state() == State::TALK && !talkPlaying) {
     delay(10);
   }
 }
\ No newline at end of file
@@ -0,0 +1,72 @@
+#include "preRoll.h"
+#include "g711.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <span>
+
+PreRollBuffer::PreRollBuffer(std::span<uint8_t> storage) : storage_(storage) {}
+
+void PreRollBuffer::write(std::span<const int16_t> samples) {
+  if (held_) {
+    return;
+  }
+  if (holding_) {
+    if (samples.size() >= holdCountdown_) {
+      samples = samples.first(holdCountdown_);
+      held_ = true;
+      holding_ = false;
+    }
+    holdCountdown_ -= samples.size();
+  }
+
+  size_t capacity = storage_.size();
+  size_t writePos = (readPos_ + count_) % capacity;
+  for (int16_t sample : samples) {
+    storage_[writePos] = muLawEncode(sample);
+    writePos = writePos + 1 == capacity ? 0 : writePos + 1;
+  }
+
+  count_ += samples.size();
+  if (count_ > capacity) {
+    // Oldest samples were overwritten
+    readPos_ = (readPos_ + count_ - capacity) % capacity;
+    count_ = capacity;
+  }
+}
+
+size_t PreRollBuffer::read(std::span<int16_t> out) {
+  size_t toRead = std::min(out.size(), count_);
+  size_t capacity = storage_.size();
+  for (size_t i = 0; i < toRead; ++i) {
+    out[i] = muLawDecode(storage_[readPos_]);
+    readPos_ = readPos_ + 1 == capacity ? 0 : readPos_ + 1;
+  }
+  count_ -= toRead;
+  return toRead;
+}
+
+size_t PreRollBuffer::available() const { return count_; }
+size_t PreRollBuffer::capacity() const { return storage_.size(); }
+
+void PreRollBuffer::clear() {
+  readPos_ = 0;
+  count_ = 0;
+  release();
+}
+
+void PreRollBuffer::holdAfter(size_t samples) {
+  if (held_) {
+    return;
+  }
+  holding_ = true;
+  holdCountdown_ = samples;
+}
+
+void PreRollBuffer::release() {
+  holding_ = false;
+  held_ = false;
+  holdCountdown_ = 0;
+}
+
+bool PreRollBuffer::held() const { return held_ || holding_; }
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+
+// Ring buffer of the most recent uplink audio, stored mu-law compressed. It
+// records continuously while the intercom is idle so a listen session can
+// start with the audio from just before it was requested.
+class PreRollBuffer {
+public:
+  explicit PreRollBuffer(std::span<uint8_t> storage);
+
+  // Appends samples, overwriting the oldest ones once full. Ignored while
+  // held.
+  void write(std::span<const int16_t> samples);
+  // Removes up to out.size() of the oldest samples, returning how many
+  size_t read(std::span<int16_t> out);
+  size_t available() const;
+  size_t capacity() const;
+  void clear();
+
+  // Keep recording for `samples` more samples, then stop overwriting so the
+  // audio around an event (e.g. the doorbell) is kept until release()
+  void holdAfter(size_t samples);
+  void release();
+  bool held() const;
+
+private:
+  std::span<uint8_t> storage_;
+  size_t readPos_ = 0;
+  size_t count_ = 0;
+  size_t holdCountdown_ = 0;
+  bool holding_ = false;
+  bool held_ = false;
+};
@@ -0,0 +1,115 @@
+#include "radio.h"
+#include "../../../constants.h"
+#include "util.h"
+
+#include <Arduino.h>
+#include <RHReliableDatagram.h>
+#include <RH_RF69.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+#include <freertos/task.h>
+
+// Off the audio loop's core, and above the loop's priority so ACKs go out
+// promptly
+constexpr BaseType_t RADIO_TASK_CORE = 0;
+constexpr UBaseType_t RADIO_TASK_PRIORITY = 5;
+constexpr uint32_t RADIO_TASK_STACK = 4096;
+// The task also wakes this often without an interrupt, in case an edge was
+// missed
+constexpr TickType_t RADIO_IDLE_WAKE = pdMS_TO_TICKS(100);
+
+// RadioHead normally services the radio from its own ISR, doing SPI
+// transfers in interrupt context. Here the ISR only wakes radioTask, which
+// does the servicing. Sending an ACK waits for the radio's "packet sent"
+// interrupt, and since the task doing the waiting is the one that services
+// interrupts, it has to service them while it waits.
+class TaskServicedRF69 : public RH_RF69 {
+public:
+  using RH_RF69::RH_RF69;
+  using RH_RF69::handleInterrupt;
+
+  bool waitPacketSent() override {
+    while (mode() == RHModeTx) {
+      ulTaskNotifyTake(pdTRUE, RADIO_IDLE_WAKE);
+      handleInterrupt();
+    }
+    return true;
+  }
+};
+
+TaskServicedRF69 driver(SS, RADIO_IRQ_PIN);
+RHReliableDatagram manager(driver, RADIO_INTERCOM_ADDRESS);
+TaskHandle_t radioTaskHandle = nullptr;
+QueueHandle_t radioQueue = nullptr;
+uint32_t droppedMessages = 0;
+
+void IRAM_ATTR radioIsr() {
+  BaseType_t woken = pdFALSE;
+  vTaskNotifyGiveFromISR(radioTaskHandle, &woken);
+  portYIELD_FROM_ISR(woken);
+}
+
+void radioTask(void *) {
+  RadioMessage message;
+  while (true) {
+    ulTaskNotifyTake(pdTRUE, RADIO_IDLE_WAKE);
+    driver.handleInterrupt();
+    while (manager.available()) {
+      message.len = sizeof(message.data);
+      // Sends the ACK
+      if (!manager.recvfromAck(message.data, &message.len, &message.from) ||
+          message.len == 0) {
+        continue;
+      }
+      if (xQueueSend(radioQueue, &message, 0) != pdTRUE) {
+        ++droppedMessages;
+      }
+    }
+  }
+}
+
+void setupRadio() {
+  pinMode(RADIO_RESET_PIN, OUTPUT);
+  digitalWrite(RADIO_RESET_PIN, LOW);
+  delay(100);
+  digitalWrite(RADIO_RESET_PIN, HIGH);
+  delay(100);
+  digitalWrite(RADIO_RESET_PIN, LOW);
+  delay(100);
+  bool radioInitialized = manager.init();
+  if (!radioInitialized) {
+    ESP_LOGI(TAG, "Waiting for radio to initialize...");
+    delay(1000);
+  }
+
+  driver.setTxPower(RADIO_POWER, true);
+  bool radioFrequencySet = driver.setFrequency(RADIO_FREQUENCY);
+  if (!radioFrequencySet) {
+    ESP_LOGE(TAG, "Failed to set radio frequency");
+    errorHang();
+  }
+
+  bool radioModemConfigSet = driver.setModemConfig(RH_RF69::FSK_Rb2Fd5);
+  if (!radioModemConfigSet) {
+    ESP_LOGE(TAG, "Failed to set radio modem config");
+    errorHang();
+  }
+
+  radioQueue = xQueueCreate(RADIO_RX_QUEUE_LENGTH, sizeof(RadioMessage));
+  if (radioQueue == nullptr ||
+      xTaskCreatePinnedToCore(radioTask, "Radio RX", RADIO_TASK_STACK,
+                              nullptr, RADIO_TASK_PRIORITY, &radioTaskHandle,
+                              RADIO_TASK_CORE) != pdPASS) {
+    ESP_LOGE(TAG, "Failed to start radio task");
+    errorHang();
+  }
+  // Replaces the handler RadioHead attached in init()
+  detachInterrupt(digitalPinToInterrupt(RADIO_IRQ_PIN));
+  attachInterrupt(digitalPinToInterrupt(RADIO_IRQ_PIN), radioIsr, RISING);
+}
+
+bool receiveRadioMessage(RadioMessage &message) {
+  return xQueueReceive(radioQueue, &message, 0) == pdTRUE;
+}
+
+uint32_t radioDroppedMessages() { return droppedMessages; }
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <RH_RF69.h>
+#include <cstddef>
+#include <cstdint>
+
+constexpr int RADIO_IRQ_PIN = 26;
+constexpr int RADIO_RESET_PIN = 16;
+// Messages received but not yet forwarded to the bridge. Further messages are
+// still acknowledged, then dropped.
+constexpr size_t RADIO_RX_QUEUE_LENGTH = 8;
+
+// A message from the scanner. data starts with its OutputEvent type.
+struct RadioMessage {
+  uint8_t from;
+  uint8_t len;
+  uint8_t data[RH_RF69_MAX_MESSAGE_LEN];
+};
+
+// Sets the radio up and starts the task that services it. The task wakes on
+// the radio's interrupt, acknowledges each message and queues it, so the
+// scanner gets its ACK whatever the intercom is doing.
+void setupRadio();
+// Takes the oldest queued message without blocking. Returns false if there
+// isn't one.
+bool receiveRadioMessage(RadioMessage &message);
+// Messages dropped because the queue was full
+uint32_t radioDroppedMessages();
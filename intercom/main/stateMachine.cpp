@@ -0,0 +1,73 @@
+#include "stateMachine.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <span>
+
+const char *stateName(State state) {
+  switch (state) {
+  case State::IDLE:
+    return "IDLE";
+  case State::LISTEN:
+    return "LISTEN";
+  case State::TALK:
+    return "TALK";
+  case State::PROBE:
+    return "PROBE";
+  }
+  return "?";
+}
+
+void StateMachine::begin(const StateMachineConfig &config, State initial) {
+  config_ = config;
+  state_ = initial;
+  transitions_ = 0;
+  rejected_ = 0;
+}
+
+State StateMachine::state() const { return state_; }
+
+bool StateMachine::allows(Command command) const {
+  State to;
+  return findTransition(state_, command, to);
+}
+
+bool StateMachine::handle(Command command) {
+  State from = state_;
+  State to;
+  if (!findTransition(from, command, to)) {
+    ++rejected_;
+    return false;
+  }
+
+  int64_t start = config_.clock != nullptr ? config_.clock() : 0;
+  if (to != from) {
+    const StateHooks &leaving = config_.hooks[static_cast<size_t>(from)];
+    const StateHooks &entering = config_.hooks[static_cast<size_t>(to)];
+    if (leaving.exit != nullptr) {
+      leaving.exit(to);
+    }
+    state_ = to;
+    if (entering.enter != nullptr) {
+      entering.enter(from);
+    }
+  }
+  int64_t end = config_.clock != nullptr ? config_.clock() : 0;
+
+  history_[transitions_ % STATE_HISTORY_SIZE] = {
+      start, static_cast<uint32_t>(end - start), from, to, command};
+  ++transitions_;
+  return true;
+}
+
+size_t StateMachine::history(std::span<TransitionRecord> out) const {
+  size_t count = std::min<size_t>({transitions_, STATE_HISTORY_SIZE,
+                                   out.size()});
+  for (size_t i = 0; i < count; ++i) {
+    out[i] = history_[(transitions_ - count + i) % STATE_HISTORY_SIZE];
+  }
+  return count;
+}
+
+uint32_t StateMachine::transitions() const { return transitions_; }
+uint32_t StateMachine::rejected() const { return rejected_; }
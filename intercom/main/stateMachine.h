@@ -0,0 +1,128 @@
+#pragma once
+
+#include "tcpClient.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+
+// The intercom's top level states and the commands that move between them.
+// Hardware is only touched by each state's enter and exit hooks, which run
+// when the state actually changes, so nothing is rewritten every loop.
+// This file has no Arduino dependencies so it can be exercised on the host.
+
+// PROBE is entered from IDLE and goes back to it once the probe is done
+enum class State : uint8_t { IDLE, LISTEN, TALK, PROBE };
+constexpr size_t STATE_COUNT = 4;
+
+const char *stateName(State state);
+
+struct Transition {
+  State from;
+  Command command;
+  State to;
+};
+
+// Every legal state change. A command that doesn't appear here for the
+// current state is rejected. Transitions back to the same state don't run
+// any hooks; the command's own handling (e.g. a new format) still applies.
+constexpr Transition TRANSITIONS[] = {
+    {State::IDLE, Command::LISTEN_ON, State::LISTEN},
+    {State::IDLE, Command::TALK_ON, State::TALK},
+    {State::IDLE, Command::LATENCY_PROBE, State::PROBE},
+    {State::IDLE, Command::LISTEN_STOP, State::IDLE},
+    {State::IDLE, Command::RESET, State::IDLE},
+
+    {State::LISTEN, Command::LISTEN_ON, State::LISTEN},
+    {State::LISTEN, Command::TALK_ON, State::TALK},
+    {State::LISTEN, Command::LISTEN_STOP, State::IDLE},
+    {State::LISTEN, Command::RESET, State::IDLE},
+
+    {State::TALK, Command::LISTEN_ON, State::LISTEN},
+    {State::TALK, Command::TALK_ON, State::TALK},
+    {State::TALK, Command::LISTEN_STOP, State::IDLE},
+    {State::TALK, Command::RESET, State::IDLE},
+
+    // Someone answering cuts a probe short
+    {State::PROBE, Command::LISTEN_ON, State::LISTEN},
+    {State::PROBE, Command::TALK_ON, State::TALK},
+    {State::PROBE, Command::LISTEN_STOP, State::IDLE},
+    {State::PROBE, Command::PROBE_DONE, State::IDLE},
+    {State::PROBE, Command::RESET, State::IDLE},
+};
+
+// Looks command up for state in TRANSITIONS. Returns false if it's illegal.
+constexpr bool findTransition(State from, Command command, State &to) {
+  for (const Transition &transition : TRANSITIONS) {
+    if (transition.from == from && transition.command == command) {
+      to = transition.to;
+      return true;
+    }
+  }
+  return false;
+}
+
+// A dropped connection has to get back to IDLE from anywhere
+static_assert([] {
+  for (size_t i = 0; i < STATE_COUNT; ++i) {
+    State to = State::PROBE;
+    if (!findTransition(static_cast<State>(i), Command::RESET, to) ||
+        to != State::IDLE) {
+      return false;
+    }
+  }
+  return true;
+}());
+
+struct StateHooks {
+  // Called with the state being left, after its exit hook
+  void (*enter)(State from) = nullptr;
+  // Called with the state being entered
+  void (*exit)(State to) = nullptr;
+};
+
+struct TransitionRecord {
+  // From the config's clock, when the command was handled
+  int64_t timeUs;
+  // Time spent in the exit and enter hooks
+  uint32_t hookUs;
+  State from;
+  State to;
+  Command command;
+};
+
+constexpr size_t STATE_HISTORY_SIZE = 16;
+
+struct StateMachineConfig {
+  // Indexed by State
+  StateHooks hooks[STATE_COUNT] = {};
+  // Microseconds, e.g. esp_timer_get_time
+  int64_t (*clock)() = nullptr;
+};
+
+class StateMachine {
+public:
+  // Starts in initial without running its enter hook
+  void begin(const StateMachineConfig &config, State initial);
+
+  State state() const;
+  // Whether command is legal in the current state
+  bool allows(Command command) const;
+  // Moves to the state TRANSITIONS gives for command, running the current
+  // state's exit hook and the new state's enter hook if they differ.
+  // Returns false, changing nothing, if command isn't legal in this state.
+  bool handle(Command command);
+
+  // The most recent transitions, oldest first
+  size_t history(std::span<TransitionRecord> out) const;
+  uint32_t transitions() const;
+  uint32_t rejected() const;
+
+private:
+  StateMachineConfig config_;
+  State state_ = State::IDLE;
+
+  TransitionRecord history_[STATE_HISTORY_SIZE] = {};
+  uint32_t transitions_ = 0;
+  uint32_t rejected_ = 0;
+};
@@ -1,4 +1,5 @@
 #include "talk.h"
+#include "g711.h"
 #include "util.h"
 
 #include <Adafruit_TLV320DAC3100.h>
@@ -9,6 +10,12 @@
 
 Adafruit_TLV320DAC3100 dac;
 I2SClass dac_i2s;
+AudioDescriptor talkFormat = {DAC_SAMPLE_RATE, SampleFormat::S16LE,
+                              UplinkCodec::PCM_S16, 32, AUDIO_IN_PORT};
+alignas(int16_t) uint8_t talkPacket[AUDIO_MAX_DATAGRAM];
+int16_t decodeBuffer[AUDIO_MAX_DATAGRAM];
+TalkMixer mixer;
+int16_t mixBuffer[TALK_BLOCK_MS * AUDIO_MAX_SAMPLE_RATE / 1000];
 
 void setupTalk(WiFiUDP& talkUdp) {
   // Relay
@@ -105,6 +112,8 @@ void setupTalk(WiFiUDP& talkUdp) {
     ESP_LOGE(TAG, "Failed to initialize I2S!");
   }
 
+  mixer.begin(TalkMixerConfig{}, DAC_SAMPLE_RATE);
+
   // UDP
   int udpResult = talkUdp.begin(AUDIO_IN_PORT);
   if (udpResult != 1) {
@@ -113,6 +122,89 @@ void setupTalk(WiFiUDP& talkUdp) {
   }
 }
 
-void writeAudioSamples(uint8_t* audioBuffer, size_t packetSize) {
-  dac_i2s.write(audioBuffer, packetSize);
-}
\ No newline at end of file
+bool configureTalk(WiFiUDP& talkUdp, const AudioDescriptor& format) {
+  if (!isSupported(format)) {
+    ESP_LOGE(TAG, "Unsupported talk format: %d Hz, codec %d, %d ms",
+             format.sampleRate, static_cast<int>(format.codec),
+             format.frameMs);
+    return false;
+  }
+
+  // The DAC's clocks are all derived from BCLK, so only I2S needs to change
+  if (format.sampleRate != talkFormat.sampleRate) {
+    dac_i2s.end();
+    if (!dac_i2s.begin(I2S_MODE_STD, format.sampleRate,
+                       I2S_DATA_BIT_WIDTH_16BIT, I2S_SLOT_MODE_MONO)) {
+      ESP_LOGE(TAG, "Failed to restart I2S at %d Hz", format.sampleRate);
+      dac_i2s.begin(I2S_MODE_STD, talkFormat.sampleRate,
+                    I2S_DATA_BIT_WIDTH_16BIT, I2S_SLOT_MODE_MONO);
+      return false;
+    }
+    talkFormat.sampleRate = format.sampleRate;
+    mixer.begin(TalkMixerConfig{}, format.sampleRate);
+  }
+  if (format.port != talkFormat.port) {
+    talkUdp.stop();
+    if (talkUdp.begin(format.port) != 1) {
+      ESP_LOGE(TAG, "Failed to start UDP server on port %d", format.port);
+      talkUdp.begin(talkFormat.port);
+      return false;
+    }
+  }
+
+  talkFormat = format;
+  ESP_LOGI(TAG, "Talk format: %d Hz, codec %d, %d ms frames, port %d",
+           format.sampleRate, static_cast<int>(format.codec), format.frameMs,
+           format.port);
+  return true;
+}
+
+int talkSampleRate() { return talkFormat.sampleRate; }
+
+void writePcmSamples(std::span<const int16_t> samples) {
+  dac_i2s.write(reinterpret_cast<const uint8_t*>(samples.data()),
+                samples.size_bytes());
+}
+
+void resetTalk() { mixer.reset(); }
+
+bool setTalkGain(const TalkGain& gain) { return mixer.setGain(gain); }
+
+void clearTalkGains() { mixer.clearGains(); }
+
+size_t receiveTalkAudio(WiFiUDP& talkUdp) {
+  size_t received = 0;
+  while (talkUdp.parsePacket() > 0) {
+    TalkSourceId source = talkSourceId(
+        static_cast<uint32_t>(talkUdp.remoteIP()), talkUdp.remotePort());
+    size_t bytesRead = talkUdp.read(talkPacket, sizeof(talkPacket));
+    received += bytesRead;
+
+    std::span<const int16_t> samples;
+    if (talkFormat.codec == UplinkCodec::MULAW) {
+      samples = {decodeBuffer,
+                 muLawDecode({talkPacket, bytesRead}, decodeBuffer)};
+    } else {
+      samples = {reinterpret_cast<const int16_t*>(talkPacket),
+                 bytesRead / sizeof(int16_t)};
+    }
+    if (!mixer.push(source, samples, millis())) {
+      ESP_LOGD(TAG, "Ignoring talk audio from %s:%d, already mixing %zu "
+               "sources", talkUdp.remoteIP().toString().c_str(),
+               talkUdp.remotePort(), TALK_MAX_SOURCES);
+    }
+  }
+  return received;
+}
+
+bool playTalkAudio() {
+  size_t samples = TALK_BLOCK_MS * talkFormat.sampleRate / 1000;
+  std::span<int16_t> block{mixBuffer, samples};
+  if (mixer.mix(block, millis()) == 0) {
+    return false;
+  }
+  writePcmSamples(block);
+  return true;
+}
+
+const TalkMixer& talkMixer() { return mixer; }
\ No newline at end of file
@@ -1,5 +1,9 @@
 #pragma once
 #include "WiFiUdp.h"
+#include "audioFormat.h"
+#include "talkMixer.h"
+
+#include <span>
 
 constexpr int DAC_BCLK_PIN = 14;
 constexpr int DAC_WS_PIN = 15;
@@ -8,6 +12,28 @@ constexpr int DAC_RESET_PIN = 17;
 constexpr int DAC_SAMPLE_RATE = 16000;
 constexpr int TALK_RELAY_PIN = 32;
 constexpr int AUDIO_IN_PORT = 9997;
+// Audio mixed and written to the DAC at a time
+constexpr int TALK_BLOCK_MS = 10;
 
 void setupTalk(WiFiUDP& talkUdp);
-void writeAudioSamples(uint8_t* audioBuffer, size_t packetSize);
\ No newline at end of file
+// Switches the DAC and the talk socket to a negotiated format. Returns false
+// if the format isn't supported, leaving the current one in place.
+bool configureTalk(WiFiUDP& talkUdp, const AudioDescriptor& format);
+// Forgets every talk source, for the start of a talk session
+void resetTalk();
+// Sets a talk sender's gain, from Command::TALK_GAIN. Returns false if there
+// are already TALK_MAX_GAINS for other senders.
+bool setTalkGain(const TalkGain& gain);
+// For when the bridge reconnects, and sends its gains again
+void clearTalkGains();
+// Queues every talk packet that has arrived with the mixer, by sender.
+// Returns the number of bytes received.
+size_t receiveTalkAudio(WiFiUDP& talkUdp);
+// Writes the next TALK_BLOCK_MS of the talk sources' mix to the DAC, which
+// blocks while the DAC's buffers are full. Returns false, writing nothing,
+// if no source is playing.
+bool playTalkAudio();
+const TalkMixer& talkMixer();
+// Plays PCM generated on the intercom itself, at talkSampleRate()
+void writePcmSamples(std::span<const int16_t> samples);
+int talkSampleRate();
\ No newline at end of file
@@ -0,0 +1,204 @@
+#include "talkMixer.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <span>
+
+// Samples mixed per pass, which bounds the accumulator on the stack
+constexpr size_t MIX_CHUNK_SAMPLES = 256;
+
+void TalkMixer::begin(const TalkMixerConfig &config, int sampleRate) {
+  config_ = config;
+  maxDelaySamples_ = std::min<size_t>(
+      static_cast<size_t>(config.maxDelayMs) * sampleRate / 1000,
+      TALK_JITTER_CAPACITY);
+  jitterSamples_ = std::min<size_t>(
+      static_cast<size_t>(config.jitterMs) * sampleRate / 1000,
+      maxDelaySamples_);
+  reset();
+}
+
+void TalkMixer::reset() {
+  for (Source &source : sources_) {
+    source.active = false;
+  }
+}
+
+TalkMixer::Source *TalkMixer::find(TalkSourceId source) {
+  for (Source &candidate : sources_) {
+    if (candidate.active && candidate.id == source) {
+      return &candidate;
+    }
+  }
+  return nullptr;
+}
+
+void TalkMixer::drop(Source &source, size_t samples) {
+  source.readPos = (source.readPos + samples) % TALK_JITTER_CAPACITY;
+  source.count -= samples;
+}
+
+bool TalkMixer::push(TalkSourceId id, std::span<const int16_t> samples,
+                     uint32_t nowMs) {
+  Source *source = find(id);
+  if (source == nullptr) {
+    for (Source &candidate : sources_) {
+      if (!candidate.active) {
+        source = &candidate;
+        break;
+      }
+    }
+    if (source == nullptr) {
+      ++rejectedPackets_;
+      return false;
+    }
+    source->active = true;
+    source->playing = false;
+    source->id = id;
+    source->readPos = 0;
+    source->count = 0;
+    source->gain = gain(id);
+  }
+  source->lastHeardMs = nowMs;
+
+  // Only the newest audio matters if a single packet is longer than the
+  // allowed delay
+  if (samples.size() > maxDelaySamples_) {
+    droppedSamples_ += samples.size() - maxDelaySamples_;
+    samples = samples.last(maxDelaySamples_);
+  }
+  if (source->count + samples.size() > maxDelaySamples_) {
+    size_t excess = source->count + samples.size() - maxDelaySamples_;
+    drop(*source, excess);
+    droppedSamples_ += excess;
+  }
+
+  size_t writePos = (source->readPos + source->count) % TALK_JITTER_CAPACITY;
+  for (int16_t sample : samples) {
+    source->buffer[writePos] = sample;
+    writePos = writePos + 1 == TALK_JITTER_CAPACITY ? 0 : writePos + 1;
+  }
+  source->count += samples.size();
+  return true;
+}
+
+size_t TalkMixer::mix(std::span<int16_t> out, uint32_t nowMs) {
+  size_t mixed = 0;
+  for (Source &source : sources_) {
+    if (!source.active) {
+      continue;
+    }
+    if (nowMs - source.lastHeardMs > config_.sourceTimeoutMs) {
+      source.active = false;
+      continue;
+    }
+    if (!source.playing && source.count > 0 &&
+        source.count >= jitterSamples_) {
+      source.playing = true;
+    }
+    mixed += source.playing;
+  }
+  if (mixed == 0) {
+    std::fill(out.begin(), out.end(), 0);
+    return 0;
+  }
+
+  int32_t accumulator[MIX_CHUNK_SAMPLES];
+  for (size_t offset = 0; offset < out.size(); offset += MIX_CHUNK_SAMPLES) {
+    size_t len = std::min(MIX_CHUNK_SAMPLES, out.size() - offset);
+    std::fill_n(accumulator, len, 0);
+
+    for (Source &source : sources_) {
+      if (!source.active || !source.playing) {
+        continue;
+      }
+      size_t available = std::min(len, source.count);
+      size_t readPos = source.readPos;
+      for (size_t i = 0; i < available; ++i) {
+        accumulator[i] += source.buffer[readPos] * source.gain;
+        readPos = readPos + 1 == TALK_JITTER_CAPACITY ? 0 : readPos + 1;
+      }
+      drop(source, available);
+      // Buffer up again rather than play out every packet as it arrives
+      if (available < len) {
+        source.playing = false;
+        ++underruns_;
+      }
+    }
+
+    for (size_t i = 0; i < len; ++i) {
+      int32_t sample = (accumulator[i] + TALK_UNITY_GAIN / 2) >> 12;
+      out[offset + i] = static_cast<int16_t>(
+          std::clamp<int32_t>(sample, INT16_MIN, INT16_MAX));
+    }
+  }
+  return mixed;
+}
+
+bool TalkMixer::setGain(const TalkGain &preset) {
+  GainEntry *entry = nullptr;
+  for (GainEntry &candidate : gains_) {
+    if (candidate.set && candidate.address == preset.address &&
+        candidate.port == preset.port) {
+      entry = &candidate;
+      break;
+    }
+    if (!candidate.set && entry == nullptr) {
+      entry = &candidate;
+    }
+  }
+  if (entry == nullptr) {
+    return false;
+  }
+  *entry = {true, preset.address, preset.port,
+            std::min<int32_t>(preset.gain, TALK_MAX_GAIN)};
+
+  for (Source &source : sources_) {
+    if (source.active) {
+      source.gain = gain(source.id);
+    }
+  }
+  return true;
+}
+
+void TalkMixer::clearGains() {
+  for (GainEntry &entry : gains_) {
+    entry.set = false;
+  }
+  for (Source &source : sources_) {
+    source.gain = gain(source.id);
+  }
+}
+
+int32_t TalkMixer::gain(TalkSourceId id) const {
+  uint32_t address = static_cast<uint32_t>(id >> 16);
+  uint16_t port = static_cast<uint16_t>(id);
+  const GainEntry *forAddress = nullptr;
+  for (const GainEntry &entry : gains_) {
+    if (!entry.set || entry.address != address) {
+      continue;
+    }
+    if (entry.port == port) {
+      return entry.gain;
+    }
+    if (entry.port == 0) {
+      forAddress = &entry;
+    }
+  }
+  if (forAddress != nullptr) {
+    return forAddress->gain;
+  }
+  return std::clamp(config_.defaultGain, 0, TALK_MAX_GAIN);
+}
+
+size_t TalkMixer::sourceCount() const {
+  size_t active = 0;
+  for (const Source &source : sources_) {
+    active += source.active;
+  }
+  return active;
+}
+
+uint32_t TalkMixer::underruns() const { return underruns_; }
+uint32_t TalkMixer::droppedSamples() const { return droppedSamples_; }
+uint32_t TalkMixer::rejectedPackets() const { return rejectedPackets_; }
@@ -0,0 +1,121 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+
+// Mixes talk audio from several senders (e.g. two people answering from
+// different phones) into the one DAC feed. Every source has its own jitter
+// buffer and gain, and the mix saturates instead of wrapping.
+// This file has no Arduino dependencies so it can be tested on the host.
+
+// Further senders are ignored until one of these goes quiet
+constexpr size_t TALK_MAX_SOURCES = 3;
+constexpr int32_t TALK_UNITY_GAIN = 1 << 12; // Source gains are Q12
+constexpr int32_t TALK_MAX_GAIN = 4 * TALK_UNITY_GAIN;
+// Gains set with TalkMixer::setGain() for senders, sending or not
+constexpr size_t TALK_MAX_GAINS = 8;
+// Per source. 256 ms at 16 kHz.
+constexpr size_t TALK_JITTER_CAPACITY = 4096;
+// Every source at full scale and full gain still fits the accumulator
+static_assert(TALK_MAX_SOURCES * 32768 * TALK_MAX_GAIN <= INT32_MAX);
+
+// Identifies a sender by its IPv4 address (in network byte order, like
+// TalkGain's) and UDP port, since talk datagrams are bare audio
+using TalkSourceId = uint64_t;
+constexpr TalkSourceId talkSourceId(uint32_t address, uint16_t port) {
+  return static_cast<TalkSourceId>(address) << 16 | port;
+}
+
+// A talk sender's gain, sent by the bridge after Command::TALK_GAIN (little
+// endian). Must be kept in sync with the bridge's audioFormat.ts.
+struct __attribute__((packed)) TalkGain {
+  // IPv4, in network byte order
+  uint32_t address;
+  // 0 for every port on address, since senders like ffmpeg pick their own
+  uint16_t port;
+  // Q12
+  uint16_t gain;
+};
+static_assert(sizeof(TalkGain) == 8);
+
+struct TalkMixerConfig {
+  // Audio buffered per source before it starts playing, and again whenever
+  // it runs dry
+  int jitterMs = 40;
+  // Buffered audio past which the oldest is dropped, so a source whose
+  // clock runs fast or that arrives in bursts doesn't build up delay
+  int maxDelayMs = 120;
+  // A source that sends nothing for this long frees its slot
+  uint32_t sourceTimeoutMs = 1000;
+  // Gain new sources start with if none was set for them, Q12
+  int32_t defaultGain = TALK_UNITY_GAIN;
+};
+
+class TalkMixer {
+public:
+  void begin(const TalkMixerConfig &config, int sampleRate);
+  // Forgets every source, but not the gains set for them
+  void reset();
+
+  // Queues decoded samples from source, received at nowMs. Returns false if
+  // it's a new source and there's no room for it.
+  bool push(TalkSourceId source, std::span<const int16_t> samples,
+            uint32_t nowMs);
+  // Fills out with the mix of every source that's playing, and drops the
+  // ones that have timed out by nowMs. Returns how many were mixed in; out
+  // is silence if none were.
+  size_t mix(std::span<int16_t> out, uint32_t nowMs);
+
+  // Sets the gain of the senders preset is for. It applies right away to
+  // those already sending and to the rest once they start. A gain for a
+  // single port wins over one for the whole address. Clamped to
+  // TALK_MAX_GAIN. Returns false if TALK_MAX_GAINS are already set for other
+  // senders.
+  bool setGain(const TalkGain &preset);
+  // Back to defaultGain for every sender
+  void clearGains();
+  // Q12
+  int32_t gain(TalkSourceId source) const;
+  size_t sourceCount() const;
+
+  // Times a playing source ran dry
+  uint32_t underruns() const;
+  // Samples dropped to keep a source's delay down
+  uint32_t droppedSamples() const;
+  // Pushes from sources that didn't fit
+  uint32_t rejectedPackets() const;
+
+private:
+  struct Source {
+    bool active = false;
+    // Whether it's being mixed in, as opposed to filling up to jitterMs
+    bool playing = false;
+    TalkSourceId id = 0;
+    int32_t gain = TALK_UNITY_GAIN;
+    uint32_t lastHeardMs = 0;
+    int16_t buffer[TALK_JITTER_CAPACITY] = {};
+    size_t readPos = 0;
+    size_t count = 0;
+  };
+
+  struct GainEntry {
+    bool set = false;
+    uint32_t address = 0;
+    uint16_t port = 0;
+    int32_t gain = TALK_UNITY_GAIN;
+  };
+
+  Source *find(TalkSourceId source);
+  void drop(Source &source, size_t samples);
+
+  TalkMixerConfig config_;
+  size_t jitterSamples_ = 0;
+  size_t maxDelaySamples_ = 0;
+  Source sources_[TALK_MAX_SOURCES];
+  GainEntry gains_[TALK_MAX_GAINS];
+
+  uint32_t underruns_ = 0;
+  uint32_t droppedSamples_ = 0;
+  uint32_t rejectedPackets_ = 0;
+};
@@ -1,4 +1,6 @@
 #include "tcpClient.h"
+#include "allowlist.h"
+#include "talkMixer.h"
 #include "util.h"
 
 #include <cerrno>
@@ -9,6 +11,23 @@
 #include <unistd.h>
 
 int tcpSocket = -1;
+ReceiverReport receiverReport = {};
+AudioDescriptor audioDescriptor = {};
+UplinkSubscription subscription = {};
+AllowlistHeader allowlistHeader = {};
+TalkGain talkGain = {};
+
+// The bridge writes payloads in one go with the command, so this won't block
+// for long
+bool recvPayload(void *payload, size_t len) {
+  if (recv(tcpSocket, payload, len, MSG_WAITALL) == static_cast<ssize_t>(len)) {
+    return true;
+  }
+  ESP_LOGE(TAG, "Failed to recv command payload %s. Attempting to reconnect",
+           strerror(errno));
+  connectToTCPServer();
+  return false;
+}
 
 void connectToTCPServer() {
   if (tcpSocket > 0) {
@@ -68,13 +87,46 @@ std::optional<Command> getCommand() {
   case (char)Command::OPEN_DOOR:
     return Command::OPEN_DOOR;
   case (char)Command::LISTEN_ON:
+    if (!recvPayload(&audioDescriptor, sizeof(audioDescriptor))) {
+      return Command::RESET;
+    }
     return Command::LISTEN_ON;
   case (char)Command::LISTEN_STOP:
     return Command::LISTEN_STOP;
   case (char)Command::TALK_ON:
+    if (!recvPayload(&audioDescriptor, sizeof(audioDescriptor))) {
+      return Command::RESET;
+    }
     return Command::TALK_ON;
   case (char)Command::HEARTBEAT:
     return Command::HEARTBEAT;
+  case (char)Command::RECEIVER_REPORT:
+    if (!recvPayload(&receiverReport, sizeof(receiverReport))) {
+      return Command::RESET;
+    }
+    return Command::RECEIVER_REPORT;
+  case (char)Command::LATENCY_PROBE:
+    return Command::LATENCY_PROBE;
+  case (char)Command::SUBSCRIBE:
+    if (!recvPayload(&subscription, sizeof(subscription))) {
+      return Command::RESET;
+    }
+    return Command::SUBSCRIBE;
+  case (char)Command::UNSUBSCRIBE:
+    if (!recvPayload(&subscription, sizeof(subscription))) {
+      return Command::RESET;
+    }
+    return Command::UNSUBSCRIBE;
+  case (char)Command::ALLOWLIST:
+    if (!recvPayload(&allowlistHeader, sizeof(allowlistHeader))) {
+      return Command::RESET;
+    }
+    return Command::ALLOWLIST;
+  case (char)Command::TALK_GAIN:
+    if (!recvPayload(&talkGain, sizeof(talkGain))) {
+      return Command::RESET;
+    }
+    return Command::TALK_GAIN;
   default:
     ESP_LOGE(TAG,
              "Got unexpected command. Going to disconnect and reconnect: %c",
@@ -84,6 +136,12 @@ std::optional<Command> getCommand() {
   }
 }
 
+const ReceiverReport &getReceiverReport() { return receiverReport; }
+const AudioDescriptor &getAudioDescriptor() { return audioDescriptor; }
+const UplinkSubscription &getSubscription() { return subscription; }
+const AllowlistHeader &getAllowlistHeader() { return allowlistHeader; }
+const TalkGain &getTalkGain() { return talkGain; }
+
 void sendBuzzerEvent() {
   char value = (char)OutputEvent::BUZZER;
   write(tcpSocket, &value, 1);
@@ -92,3 +150,10 @@ void sendBuzzerEvent() {
 void sendData(std::span<uint8_t> buffer) {
   write(tcpSocket, buffer.data(), buffer.size());
 }
+
+void sendLatencyReport(const LatencyReport &report) {
+  uint8_t message[1 + sizeof(report)];
+  message[0] = (uint8_t)OutputEvent::LATENCY_REPORT;
+  memcpy(message + 1, &report, sizeof(report));
+  write(tcpSocket, message, sizeof(message));
+}
@@ -1,25 +1,68 @@
 #pragma once
 
+#include "audioFormat.h"
+#include "latencyProbe.h"
+#include "uplinkPacket.h"
+
 #include <cstdint>
 #include <optional>
 #include <span>
 
+// See allowlist.h
+struct AllowlistHeader;
+// See talkMixer.h
+struct TalkGain;
+
 enum class Command {
   OPEN_DOOR = 'D',
+  // Both followed by an AudioDescriptor, see getAudioDescriptor()
   LISTEN_ON = 'L',
   TALK_ON = 'T',
   LISTEN_STOP = 'S',
   HEARTBEAT = 'H',
+  // Followed by a ReceiverReport, see getReceiverReport()
+  RECEIVER_REPORT = 'Q',
+  // Answered with OutputEvent::LATENCY_REPORT, see latencyProbe.h
+  LATENCY_PROBE = 'P',
+  // Both followed by an UplinkSubscription, see getSubscription()
+  SUBSCRIBE = 'U',
+  UNSUBSCRIBE = 'X',
+  // Followed by an AllowlistHeader and the digests, see allowlist.h
+  ALLOWLIST = 'A',
+  // Followed by a TalkGain, see getTalkGain()
+  TALK_GAIN = 'G',
   RESET = 'R', // Internal only command. Not sent by the TCP server
+  PROBE_DONE = 'p', // Internal only, raised when a latency probe finishes
 };
 
 enum class OutputEvent {
   BUZZER = 'B',
   CREDIT_CARD = 'C',
   DIGITAL_ID = 'D',
+  // Followed by the CREDIT_CARD or DIGITAL_ID message the intercom opened
+  // the door for from its allowlist
+  DOOR_OPENED = 'O',
+  // Followed by a LatencyReport
+  LATENCY_REPORT = 'P',
 };
 
 void connectToTCPServer();
 std::optional<Command> getCommand();
+// The report that came with the last Command::RECEIVER_REPORT
+const ReceiverReport &getReceiverReport();
+// The format that came with the last Command::LISTEN_ON or Command::TALK_ON
+const AudioDescriptor &getAudioDescriptor();
+// The subscription that came with the last Command::SUBSCRIBE or
+// Command::UNSUBSCRIBE
+const UplinkSubscription &getSubscription();
+// The header that came with the last Command::ALLOWLIST
+const AllowlistHeader &getAllowlistHeader();
+// The gain that came with the last Command::TALK_GAIN
+const TalkGain &getTalkGain();
+// Reads the rest of a command's payload, for those that don't have a fixed
+// size (e.g. the digests after an AllowlistHeader). Reconnects and returns
+// false if the connection fails.
+bool recvPayload(void *payload, size_t len);
 void sendBuzzerEvent();
 void sendData(std::span<uint8_t> buffer);
+void sendLatencyReport(const LatencyReport &report);
@@ -0,0 +1,90 @@
+#include "uplinkAdaptation.h"
+
+#include <algorithm>
+#include <cstdint>
+
+UplinkFormat resolveProfile(const UplinkProfile &profile,
+                            const AudioDescriptor &base,
+                            size_t payloadCapacity) {
+  int decimation = profile.decimation;
+  while (decimation > 1 &&
+         base.sampleRate / decimation < AUDIO_MIN_SAMPLE_RATE) {
+    decimation /= 2;
+  }
+  UplinkCodec codec = profile.compress ? UplinkCodec::MULAW : base.codec;
+
+  size_t bytesPerSample = codec == UplinkCodec::PCM_S16 ? 2 : 1;
+  size_t fits = payloadCapacity / bytesPerSample * decimation;
+  size_t frameSamples = static_cast<size_t>(base.sampleRate) * base.frameMs *
+                        profile.frameScale / 1000;
+  frameSamples = std::min({frameSamples, fits, UPLINK_MAX_FRAME_SAMPLES});
+  // Whole output samples only, for any subscriber
+  frameSamples -= frameSamples % UPLINK_MAX_DECIMATION;
+  return {decimation, codec, frameSamples};
+}
+
+bool resolveSubscription(const AudioDescriptor &requested, int captureRate,
+                         size_t payloadCapacity, UplinkFormat &format) {
+  if (requested.sampleRate == 0 || captureRate % requested.sampleRate != 0) {
+    return false;
+  }
+  int decimation = captureRate / requested.sampleRate;
+  if (decimation > UPLINK_MAX_DECIMATION ||
+      UPLINK_MAX_DECIMATION % decimation != 0) {
+    return false;
+  }
+
+  size_t bytesPerSample = requested.codec == UplinkCodec::PCM_S16 ? 2 : 1;
+  size_t fits = payloadCapacity / bytesPerSample * decimation;
+  fits = std::min(fits, UPLINK_MAX_FRAME_SAMPLES);
+  fits -= fits % UPLINK_MAX_DECIMATION;
+  format = {decimation, requested.codec, fits};
+  return true;
+}
+
+void UplinkAdaptation::begin(const AdaptationConfig &config) {
+  config_ = config;
+  config_.worstProfile =
+      std::min(config_.worstProfile, UPLINK_PROFILE_COUNT - 1);
+  config_.bestProfile = std::min(config_.bestProfile, config_.worstProfile);
+  reset();
+}
+
+void UplinkAdaptation::reset() {
+  profile_ = config_.bestProfile;
+  goodReports_ = 0;
+}
+
+size_t UplinkAdaptation::profileIndex() const { return profile_; }
+const UplinkProfile &UplinkAdaptation::profile() const {
+  return UPLINK_PROFILES[profile_];
+}
+
+bool UplinkAdaptation::onReport(const ReceiverReport &report) {
+  bool bad = report.fractionLost > config_.degradeFractionLost ||
+             report.jitterMs > config_.degradeJitterMs ||
+             report.delayMs > config_.degradeDelayMs;
+  if (bad) {
+    goodReports_ = 0;
+    if (profile_ < config_.worstProfile) {
+      ++profile_;
+      return true;
+    }
+    return false;
+  }
+
+  bool good = report.fractionLost <= config_.upgradeFractionLost &&
+              report.jitterMs <= config_.degradeJitterMs / 2 &&
+              report.delayMs <= config_.degradeDelayMs / 2;
+  if (!good) {
+    goodReports_ = 0;
+    return false;
+  }
+  if (++goodReports_ >= config_.upgradeReports &&
+      profile_ > config_.bestProfile) {
+    --profile_;
+    goodReports_ = 0;
+    return true;
+  }
+  return false;
+}
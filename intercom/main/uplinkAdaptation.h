@@ -0,0 +1,88 @@
+#pragma once
+
+#include "audioFormat.h"
+#include "uplinkPacket.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+
+// A step down from the negotiated listen format
+struct UplinkProfile {
+  // The capture rate is divided by this, down to AUDIO_MIN_SAMPLE_RATE
+  int decimation;
+  // Send mu-law whatever codec was negotiated
+  bool compress;
+  // Multiple of the negotiated frame duration
+  int frameScale;
+};
+
+// Best quality first. Each step roughly halves the bitrate. Lower quality
+// profiles also send fewer, larger packets, which holds up better when the
+// air is busy. Rates are for the default 32 kHz PCM with 16 ms frames.
+constexpr UplinkProfile UPLINK_PROFILES[] = {
+    {1, false, 1}, // ~520 kbit/s
+    {1, true, 2},  // 32 kHz mu-law, 32 ms, ~260 kbit/s
+    {2, true, 3},  // 16 kHz mu-law, 48 ms, ~130 kbit/s
+    {4, true, 3},  // 8 kHz mu-law, 48 ms, ~66 kbit/s
+};
+constexpr size_t UPLINK_PROFILE_COUNT = std::size(UPLINK_PROFILES);
+constexpr size_t UPLINK_MAX_FRAME_SAMPLES = 1536;
+// Frames are a multiple of this many samples, so that every subscriber's
+// decimation divides them
+constexpr int UPLINK_MAX_DECIMATION = 4;
+
+// What a profile works out to for a negotiated format
+struct UplinkFormat {
+  int decimation;
+  UplinkCodec codec;
+  // Capture-rate samples per packet
+  size_t frameSamples;
+};
+
+// Frames are shortened if they wouldn't fit in payloadCapacity bytes once
+// encoded
+UplinkFormat resolveProfile(const UplinkProfile &profile,
+                            const AudioDescriptor &base,
+                            size_t payloadCapacity);
+
+// The format for an extra subscriber that asked for `requested`. Its packets
+// carry the bridge's frames, so only the rate and codec are its own, and
+// frameSamples is the most that fits in one packet. Returns false if the
+// rate isn't the capture rate divided by 1, 2 or 4.
+bool resolveSubscription(const AudioDescriptor &requested, int captureRate,
+                         size_t payloadCapacity, UplinkFormat &format);
+
+struct AdaptationConfig {
+  // Range of UPLINK_PROFILES that may be used
+  size_t bestProfile = 0;
+  size_t worstProfile = UPLINK_PROFILE_COUNT - 1;
+  // Any of these in a report steps down a profile straight away
+  uint8_t degradeFractionLost = 13; // 5%
+  uint16_t degradeJitterMs = 30;
+  uint16_t degradeDelayMs = 150;
+  // Reports in a row under half of the limits above (and this much loss)
+  // before stepping back up
+  uint8_t upgradeFractionLost = 3; // 1%
+  int upgradeReports = 5;
+};
+
+// Picks the uplink profile from the bridge's receiver reports: drop down
+// quickly when the network is struggling, and creep back up once it has
+// been fine for a while.
+class UplinkAdaptation {
+public:
+  void begin(const AdaptationConfig &config);
+  // Back to the best allowed profile
+  void reset();
+
+  // Returns true if the profile changed
+  bool onReport(const ReceiverReport &report);
+  size_t profileIndex() const;
+  const UplinkProfile &profile() const;
+
+private:
+  AdaptationConfig config_;
+  size_t profile_ = 0;
+  int goodReports_ = 0;
+};
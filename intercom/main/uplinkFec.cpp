@@ -0,0 +1,70 @@
+#include "uplinkFec.h"
+#include "uplinkPacket.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <span>
+
+UplinkFec::UplinkFec(std::span<uint8_t> storage) : parity_(storage) {}
+
+void UplinkFec::begin(size_t groupSize) {
+  groupSize_ = groupSize;
+  std::fill(parity_.begin(), parity_.end(), 0);
+  maxLen_ = 0;
+  reset();
+}
+
+void UplinkFec::reset() {
+  std::fill(parity_.begin(), parity_.begin() + maxLen_, 0);
+  count_ = 0;
+  maxLen_ = 0;
+  lengths_ = 0;
+}
+
+bool UplinkFec::enabled() const { return groupSize_ > 0; }
+
+bool UplinkFec::add(const uint8_t *packet, size_t len) {
+  if (groupSize_ == 0 || len < UPLINK_HEADER_SIZE) {
+    return false;
+  }
+  if (len > parity_.size()) {
+    // Can't be protected, so don't let it be counted as protected either
+    reset();
+    return false;
+  }
+
+  if (count_ == 0) {
+    UplinkHeader header;
+    memcpy(&header, packet, sizeof(header));
+    firstSeq_ = header.seq;
+    sampleRate_ = header.sampleRate;
+  }
+  for (size_t i = 0; i < len; ++i) {
+    parity_[i] ^= packet[i];
+  }
+  maxLen_ = std::max(maxLen_, len);
+  lengths_ ^= static_cast<uint16_t>(len);
+  return ++count_ == groupSize_;
+}
+
+size_t UplinkFec::writeParity(uint8_t *out) {
+  if (count_ == 0) {
+    return 0;
+  }
+
+  UplinkHeader header = {
+      .type = static_cast<uint8_t>(UplinkPacketType::PARITY),
+      .codec = static_cast<uint8_t>(UplinkCodec::PCM_S16),
+      .seq = firstSeq_,
+      .timestamp = 0,
+      .sampleRate = sampleRate_,
+      .sampleCount = static_cast<uint16_t>(count_),
+  };
+  memcpy(out, &header, sizeof(header));
+  memcpy(out + UPLINK_HEADER_SIZE, &lengths_, sizeof(lengths_));
+  memcpy(out + UPLINK_PARITY_OVERHEAD, parity_.data(), maxLen_);
+  size_t len = UPLINK_PARITY_OVERHEAD + maxLen_;
+  reset();
+  return len;
+}
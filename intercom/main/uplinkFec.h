@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+
+// Forward error correction for the listen uplink: after every groupSize
+// packets, a parity packet lets the receiver rebuild any single one of them.
+// Costs 1/groupSize extra bandwidth.
+class UplinkFec {
+public:
+  // storage must hold the largest packet that will be protected
+  explicit UplinkFec(std::span<uint8_t> storage);
+
+  // A group size of 0 turns FEC off
+  void begin(size_t groupSize);
+  // Starts a new group, dropping whatever was accumulated
+  void reset();
+  bool enabled() const;
+
+  // Adds a packet that is about to be sent. Returns true when it completes
+  // a group and writeParity() should be called.
+  bool add(const uint8_t *packet, size_t len);
+  // Writes the parity packet for the completed group and returns its length.
+  // out must have room for the longest packet in the group plus
+  // UPLINK_PARITY_OVERHEAD.
+  size_t writeParity(uint8_t *out);
+
+private:
+  std::span<uint8_t> parity_;
+  size_t groupSize_ = 0;
+  size_t count_ = 0;
+  size_t maxLen_ = 0;
+  uint16_t lengths_ = 0;
+  uint16_t firstSeq_ = 0;
+  uint16_t sampleRate_ = 0;
+};
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Wire format of the listen uplink. Every datagram starts with an
+// UplinkHeader (little endian). These must be kept in sync with the bridge's
+// uplinkReceiver.ts and tools/uplink.py.
+
+enum class UplinkPacketType : uint8_t {
+  // Payload is sampleCount samples at sampleRate in the given codec
+  AUDIO = 'A',
+  // Sent periodically instead of audio while nobody is talking. Covers
+  // sampleCount samples at sampleRate; the payload is the background noise
+  // level as a uint16_t mean absolute sample value.
+  COMFORT_NOISE = 'N',
+  // XOR parity over the sampleCount packets starting at seq, so the
+  // receiver can rebuild any one of them that was lost. The payload is the
+  // XOR of the packets' lengths as a uint16_t, followed by the XOR of the
+  // whole packets (headers included), each zero padded to the longest.
+  PARITY = 'P',
+};
+
+enum class UplinkCodec : uint8_t {
+  PCM_S16 = 0,
+  // G.711, see g711.h
+  MULAW = 1,
+};
+
+struct __attribute__((packed)) UplinkHeader {
+  uint8_t type;
+  uint8_t codec;
+  uint16_t seq;
+  // Stream position of the first sample, in ticks of the capture clock
+  // (the session's negotiated sample rate), whatever rate the audio is sent
+  // at
+  uint32_t timestamp;
+  uint16_t sampleRate;
+  uint16_t sampleCount;
+};
+
+constexpr size_t UPLINK_HEADER_SIZE = sizeof(UplinkHeader);
+static_assert(UPLINK_HEADER_SIZE == 12);
+
+// Extra bytes a parity packet needs on top of the packets it protects
+constexpr size_t UPLINK_PARITY_OVERHEAD = UPLINK_HEADER_SIZE + sizeof(uint16_t);
+
+// Sent by the bridge over the control channel, following
+// Command::RECEIVER_REPORT, about once a second during a listen session
+struct __attribute__((packed)) ReceiverReport {
+  // Highest uplink sequence number received
+  uint16_t highestSeq;
+  // Share of the packets expected since the last report that were lost
+  // (before FEC recovery), out of 256
+  uint8_t fractionLost;
+  uint8_t reserved;
+  // Interarrival jitter, in milliseconds
+  uint16_t jitterMs;
+  // How far packets are arriving behind the quickest recent one, in
+  // milliseconds. Grows when something along the way is queueing.
+  uint16_t delayMs;
+};
+static_assert(sizeof(ReceiverReport) == 8);
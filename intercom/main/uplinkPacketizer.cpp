@@ -0,0 +1,101 @@
+#include "uplinkPacketizer.h"
+#include "g711.h"
+
+#include <cstdint>
+#include <cstring>
+#include <span>
+
+void UplinkPacketizer::begin(const PacketizerConfig &config,
+                             int captureRate) {
+  captureRate_ = captureRate;
+  keepaliveTicks_ = config.keepaliveMs * captureRate / 1000;
+  decimation_ = 1;
+  codec_ = UplinkCodec::PCM_S16;
+  tickRemainder_ = 0;
+}
+
+void UplinkPacketizer::setFormat(const UplinkFormat &format) {
+  decimation_ = format.decimation;
+  codec_ = format.codec;
+}
+
+uint32_t UplinkPacketizer::audioPackets() const { return audioPackets_; }
+uint32_t UplinkPacketizer::silentPackets() const { return silentPackets_; }
+
+size_t UplinkPacketizer::finish(uint8_t *packet, const UplinkFrame &frame) {
+  std::span<const int16_t> samples = frame.samples;
+  if (samples.empty()) {
+    return 0;
+  }
+
+  uint32_t timestamp = timestamp_;
+  int decimation = 1;
+  if (frame.sampleRate == captureRate_) {
+    timestamp_ += samples.size();
+    decimation = decimation_;
+  } else {
+    // The remainder is carried so the stream position doesn't drift when
+    // the rates don't divide evenly
+    uint64_t ticks =
+        static_cast<uint64_t>(samples.size()) * captureRate_ + tickRemainder_;
+    timestamp_ += ticks / frame.sampleRate;
+    tickRemainder_ = ticks % frame.sampleRate;
+  }
+
+  if (frame.speech) {
+    // Anything skipped since the last packet shows up as a timestamp gap,
+    // which the receiver fills with comfort noise.
+    // Box filter and decimate while encoding. Crude as anti-aliasing goes,
+    // but speech has little energy up where it leaks through. Each sample
+    // written only overlaps samples that have been read, so the frame can
+    // be the payload.
+    uint8_t *payload = packet + UPLINK_HEADER_SIZE;
+    size_t count = samples.size() / decimation;
+    for (size_t i = 0; i < count; ++i) {
+      int32_t sum = 0;
+      for (int j = 0; j < decimation; ++j) {
+        sum += samples[i * decimation + j];
+      }
+      int16_t sample = static_cast<int16_t>(sum / decimation);
+      if (codec_ == UplinkCodec::MULAW) {
+        payload[i] = muLawEncode(sample);
+      } else {
+        memcpy(payload + i * sizeof(int16_t), &sample, sizeof(sample));
+      }
+    }
+    size_t payloadLen =
+        codec_ == UplinkCodec::MULAW ? count : count * sizeof(int16_t);
+    writeHeader(packet, UplinkPacketType::AUDIO, codec_, timestamp,
+                frame.sampleRate / decimation, count);
+    sentUntil_ = timestamp_;
+    ++audioPackets_;
+    return UPLINK_HEADER_SIZE + payloadLen;
+  }
+
+  if (timestamp_ - sentUntil_ < keepaliveTicks_) {
+    return 0;
+  }
+
+  // One comfort noise packet covers everything since the last packet
+  writeHeader(packet, UplinkPacketType::COMFORT_NOISE, UplinkCodec::PCM_S16,
+              sentUntil_, captureRate_, timestamp_ - sentUntil_);
+  uint16_t level = static_cast<uint16_t>(frame.noiseLevel);
+  memcpy(packet + UPLINK_HEADER_SIZE, &level, sizeof(level));
+  sentUntil_ = timestamp_;
+  ++silentPackets_;
+  return UPLINK_HEADER_SIZE + sizeof(level);
+}
+
+void UplinkPacketizer::writeHeader(uint8_t *packet, UplinkPacketType type,
+                                   UplinkCodec codec, uint32_t timestamp,
+                                   int sampleRate, size_t sampleCount) {
+  UplinkHeader header = {
+      .type = static_cast<uint8_t>(type),
+      .codec = static_cast<uint8_t>(codec),
+      .seq = seq_++,
+      .timestamp = timestamp,
+      .sampleRate = static_cast<uint16_t>(sampleRate),
+      .sampleCount = static_cast<uint16_t>(sampleCount),
+  };
+  memcpy(packet, &header, sizeof(header));
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include "uplinkAdaptation.h"
+#include "uplinkPacket.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+
+struct PacketizerConfig {
+  // How often a comfort noise packet is sent while nobody is talking
+  int keepaliveMs = 100;
+};
+
+// A frame of processed uplink audio. Capture, the DSP and voice detection
+// run once per frame, however many subscribers it's packetized for.
+struct UplinkFrame {
+  std::span<const int16_t> samples;
+  // The capture rate, or another rate for audio recorded at one (e.g.
+  // pre-roll recorded while idle), which is sent as is without decimation
+  int sampleRate;
+  // Whether the VAD heard speech, and the background level if not
+  bool speech;
+  int32_t noiseLevel;
+};
+
+// Turns processed uplink audio into packets in one subscriber's format, with
+// discontinuous transmission: while the VAD hears nothing only a small
+// comfort noise packet is sent every keepaliveMs. The receiver fills the
+// gaps from the timestamps.
+class UplinkPacketizer {
+public:
+  // Timestamps are in captureRate ticks
+  void begin(const PacketizerConfig &config, int captureRate);
+  // Takes effect from the next packet
+  void setFormat(const UplinkFormat &format);
+
+  // Encodes frame into packet's payload, which starts UPLINK_HEADER_SIZE
+  // bytes in. The frame's samples may be the payload itself. Writes the
+  // header and returns the number of bytes to send, or 0 if the packet
+  // should be dropped.
+  size_t finish(uint8_t *packet, const UplinkFrame &frame);
+
+  uint32_t audioPackets() const;
+  uint32_t silentPackets() const;
+
+private:
+  void writeHeader(uint8_t *packet, UplinkPacketType type, UplinkCodec codec,
+                   uint32_t timestamp, int sampleRate, size_t sampleCount);
+
+  int captureRate_ = 0;
+  uint32_t keepaliveTicks_ = 0;
+  int decimation_ = 1;
+  UplinkCodec codec_ = UplinkCodec::PCM_S16;
+
+  uint16_t seq_ = 0;
+  // Stream position, in capture-rate samples
+  uint32_t timestamp_ = 0;
+  // Fraction of a tick left over from audio at a different rate, over its
+  // sample rate
+  uint32_t tickRemainder_ = 0;
+  // Stream position up to which the receiver has been told what to play
+  uint32_t sentUntil_ = 0;
+
+  uint32_t audioPackets_ = 0;
+  uint32_t silentPackets_ = 0;
+};
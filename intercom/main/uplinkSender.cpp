@@ -0,0 +1,132 @@
+#include "uplinkSender.h"
+#include "util.h"
+
+#include <cstdint>
+#include <lwip/tcpip.h>
+
+bool UplinkSender::begin(const UplinkSenderConfig &config) {
+  if (config.poolSize > UPLINK_MAX_POOL_SIZE ||
+      config.packetsPerFlush == 0 ||
+      config.packetsPerFlush >= config.poolSize) {
+    ESP_LOGE(TAG, "Invalid uplink sender config: pool %zu, per flush %zu",
+             config.poolSize, config.packetsPerFlush);
+    return false;
+  }
+  config_ = config;
+
+  LOCK_TCPIP_CORE();
+  pcb_ = udp_new();
+  UNLOCK_TCPIP_CORE();
+  if (pcb_ == nullptr) {
+    ESP_LOGE(TAG, "Failed to create uplink UDP pcb");
+    return false;
+  }
+
+  // PBUF_TRANSPORT reserves headroom for the UDP/IP/link headers, so lwIP
+  // prepends them in place instead of chaining a separate header pbuf
+  for (size_t i = 0; i < config_.poolSize; ++i) {
+    pbuf *buffer = pbuf_alloc(PBUF_TRANSPORT, config_.packetSize, PBUF_RAM);
+    if (buffer == nullptr) {
+      ESP_LOGE(TAG, "Failed to allocate uplink pbuf %zu", i);
+      end();
+      return false;
+    }
+    pool_[i] = {buffer, buffer->payload, false};
+  }
+
+  ESP_LOGI(TAG, "Uplink sender: %zu byte packets, %zu per flush, pool of %zu",
+           config_.packetSize, config_.packetsPerFlush, config_.poolSize);
+  return true;
+}
+
+void UplinkSender::end() {
+  LOCK_TCPIP_CORE();
+  if (pcb_ != nullptr) {
+    udp_remove(pcb_);
+    pcb_ = nullptr;
+  }
+  for (Slot &slot : pool_) {
+    if (slot.buffer != nullptr) {
+      pbuf_free(slot.buffer);
+    }
+    slot = {};
+  }
+  UNLOCK_TCPIP_CORE();
+  acquired_ = nullptr;
+  queueLen_ = 0;
+}
+
+uint8_t *UplinkSender::acquire() {
+  for (size_t tried = 0; tried < config_.poolSize; ++tried) {
+    Slot &slot = pool_[nextSlot_];
+    nextSlot_ = (nextSlot_ + 1) % config_.poolSize;
+
+    // A reference count above 1 means the stack still has the pbuf queued
+    // (e.g. waiting on ARP), so it can't be written to yet
+    if (slot.buffer == nullptr || slot.queued || slot.buffer->ref != 1) {
+      continue;
+    }
+
+    // Sending leaves the protocol headers prepended, so move the payload
+    // pointer back to where the capture stage expects it
+    int16_t headerLen = static_cast<uint8_t *>(slot.payload) -
+                        static_cast<uint8_t *>(slot.buffer->payload);
+    if (headerLen > 0) {
+      pbuf_remove_header(slot.buffer, headerLen);
+    }
+    slot.buffer->len = slot.buffer->tot_len = config_.packetSize;
+
+    acquired_ = &slot;
+    return static_cast<uint8_t *>(slot.payload);
+  }
+
+  ++droppedPackets_;
+  return nullptr;
+}
+
+void UplinkSender::commit(size_t len, const UplinkDestination &to) {
+  if (acquired_ == nullptr) {
+    ESP_LOGE(TAG, "Committed uplink packet without acquiring one");
+    return;
+  }
+  if (len == 0 || len > config_.packetSize) {
+    acquired_ = nullptr;
+    return;
+  }
+
+  // The pbuf is a single PBUF_RAM segment, so shrinking it is just a matter
+  // of adjusting the lengths. pbuf_realloc would trim the allocation.
+  acquired_->buffer->len = acquired_->buffer->tot_len = len;
+  acquired_->queued = true;
+  acquired_->destination = to;
+  queue_[queueLen_++] = acquired_;
+  acquired_ = nullptr;
+
+  if (queueLen_ >= config_.packetsPerFlush) {
+    flush();
+  }
+}
+
+void UplinkSender::flush() {
+  if (queueLen_ == 0) {
+    return;
+  }
+
+  LOCK_TCPIP_CORE();
+  for (size_t i = 0; i < queueLen_; ++i) {
+    const UplinkDestination &to = queue_[i]->destination;
+    err_t err = udp_sendto(pcb_, queue_[i]->buffer, &to.address, to.port);
+    if (err == ERR_OK) {
+      ++sentPackets_;
+    } else {
+      ++droppedPackets_;
+    }
+    queue_[i]->queued = false;
+  }
+  UNLOCK_TCPIP_CORE();
+  queueLen_ = 0;
+}
+
+const UplinkSenderConfig &UplinkSender::config() const { return config_; }
+uint32_t UplinkSender::sentPackets() const { return sentPackets_; }
+uint32_t UplinkSender::droppedPackets() const { return droppedPackets_; }
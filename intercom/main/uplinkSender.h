@@ -0,0 +1,68 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <lwip/ip_addr.h>
+#include <lwip/pbuf.h>
+#include <lwip/udp.h>
+
+constexpr size_t UPLINK_MAX_POOL_SIZE = 16;
+
+struct UplinkDestination {
+  ip_addr_t address;
+  uint16_t port;
+};
+
+struct UplinkSenderConfig {
+  // Payload bytes per datagram
+  size_t packetSize = 1024;
+  // Datagrams handed to lwIP per core lock. Higher values cost less CPU per
+  // packet but send in bursts.
+  size_t packetsPerFlush = 1;
+  // Preallocated pbufs. Must be larger than packetsPerFlush so the capture
+  // stage has somewhere to write while a flush is in flight.
+  size_t poolSize = 6;
+};
+
+// Sends the listen uplink through lwIP's raw UDP API out of a fixed pool of
+// pbufs. The capture stage writes straight into a pbuf's payload, so there is
+// no per-packet allocation and no copy between capture and the network stack.
+// Each packet has its own destination, so one pool serves every subscriber.
+class UplinkSender {
+public:
+  bool begin(const UplinkSenderConfig &config);
+  void end();
+
+  // Returns a buffer of config.packetSize bytes to fill, or nullptr if every
+  // pbuf is still held by the network stack.
+  uint8_t *acquire();
+  // Queues the buffer from the last acquire() with len bytes of payload, to
+  // be sent to `to`. A len of 0 hands the buffer back without sending it.
+  void commit(size_t len, const UplinkDestination &to);
+  // Sends everything queued so far
+  void flush();
+
+  const UplinkSenderConfig &config() const;
+  uint32_t sentPackets() const;
+  uint32_t droppedPackets() const;
+
+private:
+  struct Slot {
+    pbuf *buffer = nullptr;
+    void *payload = nullptr;
+    bool queued = false;
+    UplinkDestination destination = {};
+  };
+
+  UplinkSenderConfig config_;
+  udp_pcb *pcb_ = nullptr;
+
+  Slot pool_[UPLINK_MAX_POOL_SIZE];
+  size_t nextSlot_ = 0;
+  Slot *acquired_ = nullptr;
+  Slot *queue_[UPLINK_MAX_POOL_SIZE] = {};
+  size_t queueLen_ = 0;
+
+  uint32_t sentPackets_ = 0;
+  uint32_t droppedPackets_ = 0;
+};
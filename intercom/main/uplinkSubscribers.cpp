@@ -0,0 +1,56 @@
+#include "uplinkSubscribers.h"
+
+#include <cstddef>
+#include <lwip/ip_addr.h>
+#include <span>
+
+UplinkSubscriber &UplinkSubscribers::bridge() { return slots_[0]; }
+
+UplinkSubscriber *UplinkSubscribers::find(const UplinkDestination &destination) {
+  for (size_t i = 1; i < UPLINK_MAX_SUBSCRIBERS; ++i) {
+    UplinkSubscriber &subscriber = slots_[i];
+    if (subscriber.active && subscriber.destination.port == destination.port &&
+        ip_addr_cmp(&subscriber.destination.address, &destination.address)) {
+      return &subscriber;
+    }
+  }
+  return nullptr;
+}
+
+UplinkSubscriber *UplinkSubscribers::add(const UplinkDestination &destination) {
+  if (UplinkSubscriber *existing = find(destination)) {
+    return existing;
+  }
+  for (size_t i = 1; i < UPLINK_MAX_SUBSCRIBERS; ++i) {
+    if (!slots_[i].active) {
+      slots_[i].destination = destination;
+      return &slots_[i];
+    }
+  }
+  return nullptr;
+}
+
+bool UplinkSubscribers::remove(const UplinkDestination &destination) {
+  UplinkSubscriber *subscriber = find(destination);
+  if (subscriber == nullptr) {
+    return false;
+  }
+  subscriber->active = false;
+  return true;
+}
+
+void UplinkSubscribers::clear() {
+  for (size_t i = 1; i < UPLINK_MAX_SUBSCRIBERS; ++i) {
+    slots_[i].active = false;
+  }
+}
+
+size_t UplinkSubscribers::count() const {
+  size_t active = 0;
+  for (const UplinkSubscriber &subscriber : slots_) {
+    active += subscriber.active;
+  }
+  return active;
+}
+
+std::span<UplinkSubscriber> UplinkSubscribers::slots() { return slots_; }
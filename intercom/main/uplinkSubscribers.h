@@ -0,0 +1,57 @@
+#pragma once
+
+#include "audioFormat.h"
+#include "uplinkAdaptation.h"
+#include "uplinkFec.h"
+#include "uplinkPacketizer.h"
+#include "uplinkSender.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+
+constexpr size_t UPLINK_MAX_SUBSCRIBERS = 4;
+
+// Per-subscriber packetization state. Everything before packetization is
+// shared.
+struct UplinkSubscriber {
+  UplinkSubscriber() = default;
+  // fec points into fecStorage
+  UplinkSubscriber(const UplinkSubscriber &) = delete;
+  UplinkSubscriber &operator=(const UplinkSubscriber &) = delete;
+
+  bool active = false;
+  UplinkDestination destination = {};
+  // What was asked for, kept so the format can be worked out again when the
+  // capture rate changes
+  AudioDescriptor requested = {};
+  UplinkFormat format = {};
+  UplinkPacketizer packetizer;
+  uint8_t fecStorage[AUDIO_MAX_DATAGRAM];
+  UplinkFec fec{fecStorage};
+};
+
+// Everyone the listen uplink is sent to. The first slot is the bridge, which
+// is always subscribed, and whose format follows the listen session and
+// uplink adaptation.
+class UplinkSubscribers {
+public:
+  UplinkSubscriber &bridge();
+  // Returns the slot for destination, which is a free one unless it's
+  // already subscribed, or nullptr if the table is full. A free slot isn't
+  // active until the caller has set it up and marks it so.
+  UplinkSubscriber *add(const UplinkDestination &destination);
+  // Returns false if destination isn't an extra subscriber
+  bool remove(const UplinkDestination &destination);
+  // Removes everyone but the bridge
+  void clear();
+  // Active subscribers, including the bridge
+  size_t count() const;
+  // Every slot, active or not
+  std::span<UplinkSubscriber> slots();
+
+private:
+  UplinkSubscriber *find(const UplinkDestination &destination);
+
+  UplinkSubscriber slots_[UPLINK_MAX_SUBSCRIBERS];
+};
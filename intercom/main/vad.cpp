@@ -0,0 +1,49 @@
+#include "vad.h"
+
+#include <cstdint>
+#include <span>
+
+void VoiceActivityDetector::begin(const VadConfig &config) {
+  config_ = config;
+  reset();
+}
+
+void VoiceActivityDetector::reset() {
+  noiseFloor_ = config_.minSpeechLevel / config_.speechToNoiseRatio;
+  hangoverRemaining_ = 0;
+}
+
+int32_t VoiceActivityDetector::noiseLevel() const { return noiseFloor_; }
+
+bool VoiceActivityDetector::process(std::span<const int16_t> frame) {
+  if (frame.empty()) {
+    return hangoverRemaining_ > 0;
+  }
+
+  int32_t sum = 0;
+  for (int16_t sample : frame) {
+    sum += sample < 0 ? -sample : sample;
+  }
+  int32_t level = sum / static_cast<int32_t>(frame.size());
+
+  bool speech = level >= config_.minSpeechLevel &&
+                level > noiseFloor_ * config_.speechToNoiseRatio;
+
+  // The floor follows quiet frames down quickly and creeps up slowly, so
+  // it settles on the background level without being dragged up by speech
+  if (level < noiseFloor_) {
+    noiseFloor_ -= (noiseFloor_ - level + 3) >> 2;
+  } else if (!speech) {
+    noiseFloor_ += ((level - noiseFloor_) >> 6) + 1;
+  }
+
+  if (speech) {
+    hangoverRemaining_ = config_.hangoverFrames;
+    return true;
+  }
+  if (hangoverRemaining_ > 0) {
+    --hangoverRemaining_;
+    return true;
+  }
+  return false;
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstdint>
+#include <span>
+
+struct VadConfig {
+  // A frame is speech when its level is this many times the noise floor...
+  int32_t speechToNoiseRatio = 3;
+  // ...and at least this loud (mean absolute sample value)
+  int32_t minSpeechLevel = 150;
+  // Frames still treated as speech after the level drops, so word endings
+  // and short pauses aren't cut
+  int hangoverFrames = 20;
+};
+
+// Cheap energy-based voice activity detector with an adaptive noise floor.
+// Works on frames of already processed uplink audio.
+class VoiceActivityDetector {
+public:
+  void begin(const VadConfig &config);
+  void reset();
+
+  // Returns whether the frame should be sent as audio
+  bool process(std::span<const int16_t> frame);
+  // Background noise as a mean absolute sample value
+  int32_t noiseLevel() const;
+
+private:
+  VadConfig config_;
+  int32_t noiseFloor_ = 0;
+  int hangoverRemaining_ = 0;
+};
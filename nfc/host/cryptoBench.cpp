@@ -0,0 +1,188 @@
+// Times each crypto operation of an mdoc handoff with one of the backends in
+// CryptoBackend.h, at the sizes a tap actually uses: the reader keypair (done
+// ahead of taps), ECDH and the session key derivation, the request, and a
+// response decrypted in one go and in BLE sized chunks as it arrives. Also
+// checks that what's encrypted decrypts, and that a bad tag is caught.
+#include "CryptoBackend.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <mbedtls/build_info.h>
+#include <mbedtls/ecp.h>
+#include <span>
+#include <vector>
+
+using namespace CryptoBackend;
+
+// MdocRequest::IDENTITY, encoded
+constexpr size_t REQUEST_SIZE = 276;
+// A response with the three items requested from each document
+constexpr size_t RESPONSE_SIZE = 3000;
+// SessionTranscript, with both keys and the handover
+constexpr size_t TRANSCRIPT_SIZE = 400;
+// The most the device writes to the characteristic at once
+constexpr size_t CHUNK_SIZE = 512;
+constexpr int KEY_ITERATIONS = 50;
+constexpr int ITERATIONS = 1000;
+
+void check(const char *name, int error) {
+  if (error != 0) {
+    fprintf(stderr, "%s failed: %d\n", name, error);
+    exit(1);
+  }
+}
+
+// Runs op, which returns 0 or an error, and prints how long it took on
+// average
+template <typename Op> void bench(const char *name, int iterations, Op op) {
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < iterations; ++i) {
+    check(name, op());
+  }
+  auto end = std::chrono::steady_clock::now();
+  double us = std::chrono::duration<double, std::micro>(end - start).count();
+  printf("%-24s %10.1f us\n", name, us / iterations);
+}
+
+std::vector<uint8_t> pattern(size_t size, uint8_t seed) {
+  std::vector<uint8_t> bytes(size);
+  for (size_t i = 0; i < size; ++i) {
+    bytes[i] = static_cast<uint8_t>(seed + i * 31);
+  }
+  return bytes;
+}
+
+int main() {
+  check("setup", setup());
+  printf("Backend: %s\n", name());
+#ifdef MBEDTLS_ECP_FIXED_POINT_OPTIM
+  bool fixedPoint = MBEDTLS_ECP_FIXED_POINT_OPTIM;
+#else
+  bool fixedPoint = false;
+#endif
+#ifdef MBEDTLS_ECP_NIST_OPTIM
+  bool nistOptim = true;
+#else
+  bool nistOptim = false;
+#endif
+  printf("ECP: fixed point %s, NIST optimisation %s, window size %d\n",
+         fixedPoint ? "on" : "off", nistOptim ? "on" : "off",
+         MBEDTLS_ECP_WINDOW_SIZE);
+
+  // Reader key
+  bench("Generate key", KEY_ITERATIONS, [] {
+    EcKey key;
+    initKey(key);
+    int error = generateKey(key);
+    freeKey(key);
+    return error;
+  });
+  EcKey readerKey;
+  EcKey deviceKey;
+  initKey(readerKey);
+  initKey(deviceKey);
+  check("generateKey", generateKey(readerKey));
+  check("generateKey", generateKey(deviceKey));
+  uint8_t readerPublicKey[PUBLIC_KEY_SIZE];
+  uint8_t devicePublicKey[PUBLIC_KEY_SIZE];
+  bench("Export public key", ITERATIONS, [&] {
+    return exportPublicKey(readerKey, std::span{readerPublicKey});
+  });
+  check("exportPublicKey",
+        exportPublicKey(deviceKey, std::span{devicePublicKey}));
+
+  // Session keys
+  uint8_t sharedSecret[SHARED_SECRET_SIZE];
+  bench("ECDH", KEY_ITERATIONS, [&] {
+    return ecdh(readerKey, devicePublicKey, std::span{sharedSecret});
+  });
+  uint8_t deviceSecret[SHARED_SECRET_SIZE];
+  check("ecdh", ecdh(deviceKey, readerPublicKey, std::span{deviceSecret}));
+  if (!std::equal(sharedSecret, sharedSecret + SHARED_SECRET_SIZE,
+                  deviceSecret)) {
+    fprintf(stderr, "Shared secrets don't match\n");
+    return 1;
+  }
+
+  std::vector<uint8_t> transcript = pattern(TRANSCRIPT_SIZE, 1);
+  static const uint8_t readerInfo[] = "SKReader";
+  static const uint8_t deviceInfo[] = "SKDevice";
+  uint8_t prk[PRK_SIZE];
+  uint8_t skReader[AEAD_KEY_SIZE];
+  uint8_t skDevice[AEAD_KEY_SIZE];
+  bench("Session HKDF", ITERATIONS, [&] {
+    int error = hkdfExtract(transcript, sharedSecret, std::span{prk});
+    if (error == 0) {
+      error = hkdfExpand(prk, {readerInfo, 8}, skReader);
+    }
+    if (error == 0) {
+      error = hkdfExpand(prk, {deviceInfo, 8}, skDevice);
+    }
+    return error;
+  });
+
+  AeadKey aead;
+  initAead(aead);
+  bench("AEAD key setup", ITERATIONS,
+        [&] { return setAeadKey(aead, skReader); });
+
+  // Messages
+  uint8_t iv[AEAD_IV_SIZE] = {0, 0, 0, 0, 0, 0, 0, 1, 0, 0, 0, 1};
+  std::vector<uint8_t> request = pattern(REQUEST_SIZE, 2);
+  std::vector<uint8_t> encryptedRequest(REQUEST_SIZE + AEAD_TAG_SIZE);
+  bench("Encrypt request", ITERATIONS, [&] {
+    return aeadEncrypt(aead, iv, request, encryptedRequest.data());
+  });
+
+  std::vector<uint8_t> response = pattern(RESPONSE_SIZE, 3);
+  std::vector<uint8_t> encrypted(RESPONSE_SIZE + AEAD_TAG_SIZE);
+  std::vector<uint8_t> decrypted(RESPONSE_SIZE);
+  check("aeadEncrypt", aeadEncrypt(aead, iv, response, encrypted.data()));
+  bench("Decrypt response", ITERATIONS,
+        [&] { return aeadDecrypt(aead, iv, encrypted, decrypted.data()); });
+  if (decrypted != response) {
+    fprintf(stderr, "Decrypted response doesn't match\n");
+    return 1;
+  }
+
+  std::span<const uint8_t> ciphertext{encrypted.data(), RESPONSE_SIZE};
+  std::span<const uint8_t, AEAD_TAG_SIZE> responseTag{
+      encrypted.data() + RESPONSE_SIZE, AEAD_TAG_SIZE};
+  auto decryptChunks = [&](std::span<const uint8_t, AEAD_TAG_SIZE> tag) {
+    int error = aeadDecryptStart(aead, iv);
+    for (size_t i = 0; error == 0 && i < ciphertext.size(); i += CHUNK_SIZE) {
+      size_t len = std::min(CHUNK_SIZE, ciphertext.size() - i);
+      error = aeadDecryptUpdate(aead, ciphertext.subspan(i, len),
+                                decrypted.data() + i);
+    }
+    if (error == 0) {
+      error = aeadDecryptFinish(aead, tag);
+    }
+    return error;
+  };
+  std::fill(decrypted.begin(), decrypted.end(), 0);
+  bench("Decrypt response chunks", ITERATIONS,
+        [&] { return decryptChunks(responseTag); });
+  if (decrypted != response) {
+    fprintf(stderr, "Decrypted response chunks don't match\n");
+    return 1;
+  }
+
+  uint8_t badTag[AEAD_TAG_SIZE];
+  std::copy(responseTag.begin(), responseTag.end(), badTag);
+  badTag[0] ^= 1;
+  if (decryptChunks(badTag) == 0 ||
+      aeadDecrypt(aead, iv, {encryptedRequest.data(), 8}, decrypted.data()) ==
+          0) {
+    fprintf(stderr, "Bad response wasn't caught\n");
+    return 1;
+  }
+
+  freeAead(aead);
+  freeKey(readerKey);
+  freeKey(deviceKey);
+  return 0;
+}
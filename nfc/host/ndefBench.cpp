@@ -0,0 +1,211 @@
+// Times NdefReader walking the NDEF messages of a tap and prints their
+// records. Each argument is a file with a raw NDEF message. With no
+// arguments, the messages a tap sends and ones shaped like what a wallet
+// sends back are used. With --write-corpus <dir>, those are written to dir
+// instead, which is how corpus/ndef was seeded for ndefFuzz.
+#include "Encode.h"
+#include "Handover.h"
+#include "NdefReader.h"
+#include "Tnep.h"
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+constexpr int ITERATIONS = 100000;
+
+using namespace Encode;
+
+// TNEP Service Parameter, offering negotiated handover
+constexpr void encodeServiceParameter(Writer &writer) {
+  Ndef::record(writer, {Ndef::WELL_KNOWN, "Tp"}, true, true,
+               [](Writer &payload) {
+                 // TNEP version, then the service name
+                 payload.append(0x10);
+                 payload.append(
+                     static_cast<uint8_t>(Handover::SERVICE_NAME.size()));
+                 payload.append(Handover::SERVICE_NAME);
+                 // Communication mode, minimum waiting time, maximum
+                 // waiting time extensions and maximum message size
+                 payload.append({0x00, 0x01, 0x0F, 0xFF, 0xFF});
+               });
+}
+
+// TNEP Status, success
+constexpr void encodeStatus(Writer &writer) {
+  Ndef::record(writer, {Ndef::WELL_KNOWN, "Te"}, true, true,
+               [](Writer &payload) { payload.append(0x00); });
+}
+
+// Handover Select, with the DeviceEngagement a wallet puts in it
+constexpr void encodeHandoverSelect(Writer &writer) {
+  Ndef::record(writer, {Ndef::WELL_KNOWN, "Hs"}, true, false,
+               [](Writer &payload) {
+                 payload.append(0x15);
+                 Ndef::record(payload, {Ndef::WELL_KNOWN, "ac"}, true, true,
+                              [](Writer &carrier) {
+                                carrier.append({0x01, 0x01, '0', 0x00});
+                              });
+               });
+  Ndef::record(
+      writer, {Ndef::EXTERNAL, "iso.org:18013:deviceengagement", "mdoc"},
+      false, false, [](Writer &payload) {
+        Cbor::map(payload, 3);
+        Cbor::integer(payload, 0);
+        Cbor::text(payload, "1.0");
+        // Security, with the device key as a COSE_Key
+        Cbor::integer(payload, 1);
+        Cbor::array(payload, 2);
+        Cbor::integer(payload, 1);
+        Cbor::embedded(payload, [](Writer &key) {
+          constexpr uint8_t COORDINATE[32] = {};
+          Cbor::map(key, 4);
+          Cbor::integer(key, 1);
+          Cbor::integer(key, 2);
+          Cbor::integer(key, -1);
+          Cbor::integer(key, 1);
+          Cbor::integer(key, -2);
+          Cbor::bytes(key, COORDINATE);
+          Cbor::integer(key, -3);
+          Cbor::bytes(key, COORDINATE);
+        });
+        // Device retrieval methods, BLE
+        Cbor::integer(payload, 2);
+        Cbor::array(payload, 1);
+        Cbor::array(payload, 3);
+        Cbor::integer(payload, 2);
+        Cbor::integer(payload, 1);
+        Cbor::map(payload, 2);
+        Cbor::integer(payload, 0);
+        Cbor::boolean(payload, false);
+        Cbor::integer(payload, 1);
+        Cbor::boolean(payload, true);
+      });
+  Ndef::record(writer, {Ndef::MEDIA, "application/vnd.bluetooth.le.oob", "0"},
+               false, true, [](Writer &payload) {
+                 // LE Role: only central
+                 payload.append({0x02, 0x1C, 0x01});
+                 payload.append({0x11, 0x07});
+                 Handover::encodeUuid(payload, Handover::SERVICE_UUID);
+               });
+}
+
+// One record that's too big for a short record
+constexpr void encodeLongRecord(Writer &writer) {
+  Ndef::record(writer, {Ndef::MEDIA, "application/octet-stream"}, true, true,
+               [](Writer &payload) {
+                 for (int i = 0; i < 300; ++i) {
+                   payload.append(static_cast<uint8_t>(i));
+                 }
+               });
+}
+
+struct Message {
+  const char *name;
+  std::vector<uint8_t> bytes;
+};
+
+template <size_t N>
+Message message(const char *name, const std::array<uint8_t, N> &bytes) {
+  return {name, {bytes.begin(), bytes.end()}};
+}
+
+std::vector<Message> builtInMessages() {
+  return {
+      message("service-parameter", build<encodeServiceParameter>()),
+      message("service-select", Handover::SERVICE_SELECT),
+      message("status", build<encodeStatus>()),
+      message("handover-request", Handover::HANDOVER_REQUEST),
+      message("handover-select", build<encodeHandoverSelect>()),
+      message("long-record", build<encodeLongRecord>()),
+  };
+}
+
+bool readMessage(const char *path, std::vector<uint8_t> &bytes) {
+  std::ifstream file(path, std::ios::binary);
+  if (!file) {
+    fprintf(stderr, "Failed to open %s\n", path);
+    return false;
+  }
+  bytes.assign(std::istreambuf_iterator<char>(file), {});
+  return true;
+}
+
+bool writeCorpus(const std::string &dir) {
+  for (const Message &message : builtInMessages()) {
+    std::string path = dir + "/" + message.name;
+    std::ofstream file(path, std::ios::binary);
+    file.write(reinterpret_cast<const char *>(message.bytes.data()),
+               message.bytes.size());
+    if (!file) {
+      fprintf(stderr, "Failed to write %s\n", path.c_str());
+      return false;
+    }
+  }
+  return true;
+}
+
+// Walks message, printing its records and how long walking it took
+bool bench(const char *name, std::span<const uint8_t> message) {
+  size_t records = 0;
+  NdefReader::Error error = NdefReader::Error::NONE;
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < ITERATIONS; ++i) {
+    records = 0;
+    error = NdefReader::forEachRecord(message, [&](const NdefReader::Record &) {
+      ++records;
+      return NdefReader::Error::NONE;
+    });
+  }
+  auto end = std::chrono::steady_clock::now();
+  double ns = std::chrono::duration<double, std::nano>(end - start).count();
+
+  printf("%s (%zu B, %zu records): %.1f ns\n", name, message.size(), records,
+         ns / ITERATIONS);
+  error = NdefReader::forEachRecord(message, [](const NdefReader::Record &r) {
+    printf("  TNF %u %.*s", r.tnf, static_cast<int>(r.type.size()),
+           r.type.data());
+    if (!r.id.empty()) {
+      printf(" #%.*s", static_cast<int>(r.id.size()), r.id.data());
+    }
+    printf(", %zu B payload\n", r.payload.size());
+    Tnep::ServiceParameter parameter;
+    if (r.type == "Tp" &&
+        Tnep::parse(r.payload, parameter) == Tnep::Error::NONE) {
+      Tnep::Timing timing = parameter.timing();
+      printf("  Polled every %u ms, %u more times\n", timing.waitMs,
+             timing.extensions);
+    }
+    return NdefReader::Error::NONE;
+  });
+  if (error != NdefReader::Error::NONE) {
+    printf("  Failed: %s\n", NdefReader::errorString(error));
+    return false;
+  }
+  return true;
+}
+
+int main(int argc, char **argv) {
+  if (argc == 3 && std::string_view(argv[1]) == "--write-corpus") {
+    return writeCorpus(argv[2]) ? 0 : 1;
+  }
+
+  bool ok = true;
+  if (argc == 1) {
+    for (const Message &message : builtInMessages()) {
+      ok = bench(message.name, message.bytes) && ok;
+    }
+    return ok ? 0 : 1;
+  }
+  for (int i = 1; i < argc; ++i) {
+    std::vector<uint8_t> bytes;
+    ok = readMessage(argv[i], bytes) && bench(argv[i], bytes) && ok;
+  }
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,94 @@
+// Fuzzes NdefReader, which parses whatever a phone writes to the NDEF file,
+// and Tnep on the Tp records in it, by checking every view they yield lies
+// within the input, in order. With clang this is a libFuzzer target:
+//   ./build/ndefFuzz corpus/ndef
+// Otherwise it's built with NDEF_FUZZ_REPLAY and just runs each file it's
+// given through the same checks, under the sanitizers:
+//   ./build/ndefFuzz corpus/ndef/*
+// corpus/ndef was seeded with ndefBench --write-corpus, plus broken messages:
+// cut short, chunked, and with lengths that run past the end.
+#include "NdefReader.h"
+#include "Tnep.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <span>
+
+namespace {
+
+const uint8_t *inputEnd;
+const uint8_t *lastEnd;
+
+void checkWithin(const void *data, size_t size) {
+  auto start = static_cast<const uint8_t *>(data);
+  if (size == 0) {
+    return;
+  }
+  if (start < lastEnd || size > static_cast<size_t>(inputEnd - start)) {
+    fprintf(stderr, "Record view outside the input\n");
+    abort();
+  }
+  lastEnd = start + size;
+}
+
+} // namespace
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+  std::span<const uint8_t> message{data, size};
+  inputEnd = data + size;
+  lastEnd = data;
+  size_t records = 0;
+  NdefReader::Error error = NdefReader::forEachRecord(
+      message, [&](const NdefReader::Record &record) {
+        if (record.messageBegin != (records == 0)) {
+          fprintf(stderr, "Message begin on record %zu\n", records);
+          abort();
+        }
+        ++records;
+        checkWithin(record.type.data(), record.type.size());
+        checkWithin(record.id.data(), record.id.size());
+        checkWithin(record.payload.data(), record.payload.size());
+        Tnep::ServiceParameter parameter;
+        if (record.type == "Tp" &&
+            Tnep::parse(record.payload, parameter) == Tnep::Error::NONE) {
+          lastEnd = record.payload.data();
+          checkWithin(parameter.serviceName.data(),
+                      parameter.serviceName.size());
+          parameter.timing();
+        }
+        return NdefReader::Error::NONE;
+      });
+  if (error == NdefReader::Error::NONE && records == 0) {
+    fprintf(stderr, "Message without records\n");
+    abort();
+  }
+
+  NdefReader::Record record;
+  lastEnd = data;
+  if (NdefReader::only(message, record) == NdefReader::Error::NONE) {
+    checkWithin(record.payload.data(), record.payload.size());
+  }
+  return 0;
+}
+
+#ifdef NDEF_FUZZ_REPLAY
+#include <fstream>
+#include <iterator>
+#include <vector>
+
+int main(int argc, char **argv) {
+  for (int i = 1; i < argc; ++i) {
+    std::ifstream file(argv[i], std::ios::binary);
+    if (!file) {
+      fprintf(stderr, "Failed to open %s\n", argv[i]);
+      return 1;
+    }
+    std::vector<uint8_t> bytes{std::istreambuf_iterator<char>(file), {}};
+    LLVMFuzzerTestOneInput(bytes.data(), bytes.size());
+  }
+  printf("Replayed %d inputs\n", argc - 1);
+  return 0;
+}
+#endif
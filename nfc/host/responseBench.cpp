@@ -0,0 +1,249 @@
+// Times DeviceResponse::decode over decrypted DeviceResponses and prints what
+// it picked out of them. Each argument is a recorded response: either the raw
+// CBOR, or the hex the firmware logs after "Unencrypted client to server
+// characteristic: " (the whole log line is fine). With no arguments, a
+// synthetic response shaped like a wallet's is used: an mDL and a photo ID,
+// each with the identity elements and age_over_21, and the usual issuerAuth
+// and deviceSigned around them.
+#include "DeviceResponse.h"
+#include "MdocRequest.h"
+
+#include <cctype>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+constexpr int ITERATIONS = 10000;
+// What issuerAuth's certificate and MSO are roughly, for two documents with
+// four elements each
+constexpr size_t CERTIFICATE_SIZE = 700;
+constexpr size_t MSO_SIZE = 1200;
+
+constexpr DeviceResponse::ElementIndex IDENTITY_INDEX{MdocRequest::IDENTITY};
+static_assert(IDENTITY_INDEX.valid());
+using AgeOver21 = MdocRequest::AgeOver<21>;
+constexpr DeviceResponse::ElementIndex AGE_OVER_INDEX{AgeOver21::ELEMENTS};
+static_assert(AGE_OVER_INDEX.valid());
+
+// Just enough of a CBOR encoder for the synthetic response
+class Writer {
+public:
+  Writer &head(uint8_t major, uint64_t argument) {
+    uint8_t initial = major << 5;
+    if (argument < 24) {
+      bytes_.push_back(initial | argument);
+      return *this;
+    }
+    int size = argument <= 0xFF ? 1 : argument <= 0xFFFF ? 2 : 4;
+    bytes_.push_back(initial | (size == 1 ? 24 : size == 2 ? 25 : 26));
+    for (int i = size - 1; i >= 0; --i) {
+      bytes_.push_back(argument >> (i * 8));
+    }
+    return *this;
+  }
+  Writer &uint(uint64_t value) { return head(0, value); }
+  Writer &bytes(std::span<const uint8_t> bytes) {
+    head(2, bytes.size());
+    bytes_.insert(bytes_.end(), bytes.begin(), bytes.end());
+    return *this;
+  }
+  Writer &filler(size_t size) {
+    return bytes(std::vector<uint8_t>(size, 0xA5));
+  }
+  Writer &text(std::string_view text) {
+    head(3, text.size());
+    bytes_.insert(bytes_.end(), text.begin(), text.end());
+    return *this;
+  }
+  Writer &array(uint64_t size) { return head(4, size); }
+  Writer &map(uint64_t size) { return head(5, size); }
+  Writer &tag(uint64_t tag) { return head(6, tag); }
+  Writer &boolean(bool value) { return head(7, value ? 21 : 20); }
+  Writer &null() { return head(7, 22); }
+
+  const std::vector<uint8_t> &encoded() const { return bytes_; }
+
+private:
+  std::vector<uint8_t> bytes_;
+};
+
+// An element's value, written by whoever builds the item
+using ValueWriter = void (*)(Writer &);
+
+struct Item {
+  std::string_view identifier;
+  ValueWriter value;
+};
+
+// IssuerSignedItemBytes, with the keys in deterministic order like wallets
+// send them, so elementValue comes before elementIdentifier
+void writeItem(Writer &writer, uint64_t digestId, const Item &item) {
+  Writer itemWriter;
+  itemWriter.map(4).text("random").filler(16).text("digestID").uint(digestId);
+  itemWriter.text("elementValue");
+  item.value(itemWriter);
+  itemWriter.text("elementIdentifier").text(item.identifier);
+  writer.tag(24).bytes(itemWriter.encoded());
+}
+
+void writeDocument(Writer &writer, std::string_view docType,
+                   std::string_view nameSpace, std::span<const Item> items) {
+  writer.map(3).text("docType").text(docType);
+
+  writer.text("issuerSigned").map(2).text("nameSpaces").map(1);
+  writer.text(nameSpace).array(items.size());
+  for (size_t i = 0; i < items.size(); ++i) {
+    writeItem(writer, i, items[i]);
+  }
+  // COSE_Sign1 with the document signer certificate and the MSO
+  writer.text("issuerAuth").array(4).filler(4);
+  writer.map(1).uint(33).filler(CERTIFICATE_SIZE);
+  writer.tag(24).filler(MSO_SIZE).filler(64);
+
+  writer.text("deviceSigned").map(2).text("nameSpaces").tag(24).filler(1);
+  writer.text("deviceAuth").map(1).text("deviceMac");
+  writer.array(4).filler(3).map(0).null().filler(32);
+}
+
+void writeFullDate(Writer &writer) { writer.tag(1004).text("1971-09-01"); }
+
+std::vector<uint8_t> syntheticResponse() {
+  static constexpr Item MDL_ITEMS[] = {
+      {"family_name", [](Writer &w) { w.text("Mustermann"); }},
+      {"given_name", [](Writer &w) { w.text("Erika"); }},
+      {"birth_date", writeFullDate},
+      {"age_over_21", [](Writer &w) { w.boolean(true); }},
+  };
+  static constexpr Item PHOTO_ID_ITEMS[] = {
+      {"family_name_unicode", [](Writer &w) { w.text("Mustermann"); }},
+      {"given_name_unicode", [](Writer &w) { w.text("Erika"); }},
+      // Wrapped in a map under the same name
+      {"birth_date",
+       [](Writer &w) {
+         writeFullDate(w.map(1).text("birth_date"));
+       }},
+      {"age_over_21", [](Writer &w) { w.boolean(true); }},
+  };
+  Writer writer;
+  writer.map(3).text("version").text("1.0").text("documents").array(2);
+  writeDocument(writer, "org.iso.18013.5.1.mDL", "org.iso.18013.5.1",
+                MDL_ITEMS);
+  writeDocument(writer, "org.iso.23220.photoid.1", "org.iso.23220.1",
+                PHOTO_ID_ITEMS);
+  writer.text("status").uint(0);
+  return writer.encoded();
+}
+
+int hexDigit(char c) {
+  if (c >= '0' && c <= '9') {
+    return c - '0';
+  }
+  if (c >= 'A' && c <= 'F') {
+    return c - 'A' + 10;
+  }
+  if (c >= 'a' && c <= 'f') {
+    return c - 'a' + 10;
+  }
+  return -1;
+}
+
+// The response in a file, either raw or as logged by the firmware
+bool readResponse(const char *path, std::vector<uint8_t> &response) {
+  std::ifstream file(path, std::ios::binary);
+  if (!file) {
+    fprintf(stderr, "Failed to open %s\n", path);
+    return false;
+  }
+  std::string contents{std::istreambuf_iterator<char>(file), {}};
+  std::string_view hex = contents;
+  if (size_t colon = hex.rfind(": "); colon != std::string_view::npos) {
+    hex.remove_prefix(colon + 2);
+  }
+  while (!hex.empty() && isspace(static_cast<unsigned char>(hex.back()))) {
+    hex.remove_suffix(1);
+  }
+
+  response.clear();
+  bool isHex = !hex.empty() && hex.size() % 2 == 0;
+  for (size_t i = 0; isHex && i < hex.size(); i += 2) {
+    int high = hexDigit(hex[i]);
+    int low = hexDigit(hex[i + 1]);
+    isHex = high >= 0 && low >= 0;
+    response.push_back(high << 4 | low);
+  }
+  if (!isHex) {
+    response.assign(contents.begin(), contents.end());
+  }
+  return true;
+}
+
+void printValues(std::span<const MdocRequest::Element> elements,
+                 std::span<const DeviceResponse::Value> values) {
+  for (size_t i = 0; i < elements.size(); ++i) {
+    std::string_view name = elements[i].mdl;
+    const DeviceResponse::Value &value = values[i];
+    std::string_view text = value.textView();
+    switch (value.type) {
+    case DeviceResponse::Value::Type::MISSING:
+      text = "(missing)";
+      break;
+    case DeviceResponse::Value::Type::BOOL:
+      text = value.boolean ? "true" : "false";
+      break;
+    case DeviceResponse::Value::Type::TEXT:
+      break;
+    }
+    printf("  %.*s: %.*s\n", static_cast<int>(name.size()), name.data(),
+           static_cast<int>(text.size()), text.data());
+  }
+}
+
+// Decodes response for elements, printing the values and how long it took
+bool bench(const char *name, std::span<const uint8_t> response,
+           std::span<const MdocRequest::Element> elements,
+           const DeviceResponse::ElementIndex &index) {
+  DeviceResponse::Value values[MdocRequest::MAX_ELEMENTS];
+  std::span<DeviceResponse::Value> slots{values, elements.size()};
+  DeviceResponse::Result result;
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < ITERATIONS; ++i) {
+    result = DeviceResponse::decode(response, index, slots);
+  }
+  auto end = std::chrono::steady_clock::now();
+  double us = std::chrono::duration<double, std::micro>(end - start).count();
+
+  printf("%s (%zu B): %.2f us\n", name, response.size(), us / ITERATIONS);
+  if (result.error != DeviceResponse::Error::NONE) {
+    printf("  Failed: %s\n", DeviceResponse::errorString(result.error));
+    return false;
+  }
+  printf("  status %llu, %zu documents\n",
+         static_cast<unsigned long long>(result.status), result.documents);
+  printValues(elements, slots);
+  return true;
+}
+
+bool benchAll(const char *name, std::span<const uint8_t> response) {
+  bool ok = bench(name, response, MdocRequest::IDENTITY, IDENTITY_INDEX);
+  return bench(name, response, AgeOver21::ELEMENTS, AGE_OVER_INDEX) && ok;
+}
+
+int main(int argc, char **argv) {
+  if (argc == 1) {
+    std::vector<uint8_t> response = syntheticResponse();
+    return benchAll("Synthetic response", response) ? 0 : 1;
+  }
+
+  bool ok = true;
+  for (int i = 1; i < argc; ++i) {
+    std::vector<uint8_t> response;
+    ok = readResponse(argv[i], response) && benchAll(argv[i], response) && ok;
+  }
+  return ok ? 0 : 1;
+}
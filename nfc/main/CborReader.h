@@ -0,0 +1,190 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <string_view>
+
+#define CHECK_DECODE(code)                                                     \
+  do {                                                                         \
+    CborReader::Error error = code;                                            \
+    if (error != CborReader::Error::NONE) {                                    \
+      return error;                                                            \
+    }                                                                          \
+  } while (0)
+
+// Reads CBOR in place, a head (major type and argument) at a time, for the
+// messages the firmware picks apart in one pass. Strings come back as spans
+// into the buffer, so nothing is copied. Doesn't depend on Arduino or
+// ESP-IDF, so it also builds on the host.
+namespace CborReader {
+
+enum class Error : uint8_t {
+  NONE,
+  // Not CBOR, or cut short
+  MALFORMED,
+  // Indefinite lengths, or nested too deeply
+  UNSUPPORTED,
+  // Valid CBOR, but not shaped like the message
+  UNEXPECTED,
+  // A value bigger than where it goes
+  TOO_LONG,
+};
+
+inline const char *errorString(Error error) {
+  switch (error) {
+  case Error::NONE:
+    return "none";
+  case Error::MALFORMED:
+    return "malformed CBOR";
+  case Error::UNSUPPORTED:
+    return "unsupported CBOR";
+  case Error::UNEXPECTED:
+    return "unexpected CBOR";
+  case Error::TOO_LONG:
+    return "value too long";
+  }
+  return "unknown";
+}
+
+enum Major : uint8_t {
+  UNSIGNED = 0,
+  NEGATIVE = 1,
+  BYTES = 2,
+  TEXT = 3,
+  ARRAY = 4,
+  MAP = 5,
+  TAG = 6,
+  SIMPLE = 7,
+};
+constexpr uint64_t SIMPLE_FALSE = 20;
+constexpr uint64_t SIMPLE_TRUE = 21;
+// CBOR encoded in a byte string, e.g. an IssuerSignedItem or a COSE_Key
+constexpr uint64_t ENCODED_CBOR_TAG = 24;
+// Of the parts that are skipped, e.g. issuerAuth's certificates
+constexpr int MAX_DEPTH = 16;
+
+class Reader {
+public:
+  explicit Reader(std::span<const uint8_t> bytes)
+      : pos_(bytes.data()), end_(bytes.data() + bytes.size()) {}
+
+  const uint8_t *position() const { return pos_; }
+  const uint8_t *end() const { return end_; }
+
+  // The argument is the value, length, count or tag number, depending on the
+  // major type. A string's bytes are left for take().
+  Error head(uint8_t &major, uint64_t &argument) {
+    if (pos_ == end_) {
+      return Error::MALFORMED;
+    }
+    uint8_t initial = *pos_++;
+    major = initial >> 5;
+    uint8_t info = initial & 0x1F;
+    if (info < 24) {
+      argument = info;
+      return Error::NONE;
+    }
+    if (info > 27) {
+      // 31 is an indefinite length, which wallets don't use
+      return info == 31 ? Error::UNSUPPORTED : Error::MALFORMED;
+    }
+    size_t size = size_t{1} << (info - 24);
+    if (static_cast<size_t>(end_ - pos_) < size) {
+      return Error::MALFORMED;
+    }
+    argument = 0;
+    for (size_t i = 0; i < size; ++i) {
+      argument = (argument << 8) | *pos_++;
+    }
+    return Error::NONE;
+  }
+
+  // Reads a head, which has to be of the given major type
+  Error expect(uint8_t major, uint64_t &argument) {
+    uint8_t actual;
+    CHECK_DECODE(head(actual, argument));
+    return actual == major ? Error::NONE : Error::UNEXPECTED;
+  }
+
+  Error take(uint64_t length, std::span<const uint8_t> &bytes) {
+    if (length > static_cast<uint64_t>(end_ - pos_)) {
+      return Error::MALFORMED;
+    }
+    bytes = {pos_, static_cast<size_t>(length)};
+    pos_ += length;
+    return Error::NONE;
+  }
+
+  Error bytes(std::span<const uint8_t> &bytes) {
+    uint64_t length;
+    CHECK_DECODE(expect(BYTES, length));
+    return take(length, bytes);
+  }
+
+  Error text(std::string_view &text) {
+    uint64_t length;
+    CHECK_DECODE(expect(TEXT, length));
+    std::span<const uint8_t> bytes;
+    CHECK_DECODE(take(length, bytes));
+    text = {reinterpret_cast<const char *>(bytes.data()), bytes.size()};
+    return Error::NONE;
+  }
+
+  // Skips the rest of an item whose head has been read
+  Error skipRest(uint8_t major, uint64_t argument, int depth) {
+    switch (major) {
+    case BYTES:
+    case TEXT: {
+      std::span<const uint8_t> bytes;
+      return take(argument, bytes);
+    }
+    case ARRAY:
+    case MAP: {
+      if (depth >= MAX_DEPTH) {
+        return Error::UNSUPPORTED;
+      }
+      // Every item is at least a byte
+      if (argument > static_cast<uint64_t>(end_ - pos_)) {
+        return Error::MALFORMED;
+      }
+      uint64_t items = major == MAP ? argument * 2 : argument;
+      for (uint64_t i = 0; i < items; ++i) {
+        CHECK_DECODE(skip(depth + 1));
+      }
+      return Error::NONE;
+    }
+    case TAG:
+      if (depth >= MAX_DEPTH) {
+        return Error::UNSUPPORTED;
+      }
+      return skip(depth + 1);
+    default:
+      // Integers, simple values and floats are all head
+      return Error::NONE;
+    }
+  }
+
+  Error skip(int depth = 0) {
+    uint8_t major;
+    uint64_t argument;
+    CHECK_DECODE(head(major, argument));
+    return skipRest(major, argument, depth);
+  }
+
+private:
+  const uint8_t *pos_;
+  const uint8_t *end_;
+};
+
+// Calls onItem() for each item of an array, which has to read or skip it
+template <typename F> Error forEachItem(Reader &reader, F &&onItem) {
+  uint64_t count;
+  CHECK_DECODE(reader.expect(ARRAY, count));
+  for (uint64_t i = 0; i < count; ++i) {
+    CHECK_DECODE(onItem());
+  }
+  return Error::NONE;
+}
+
+} // namespace CborReader
@@ -1,174 +1,428 @@
 #include "Crypto.h"
+#include "CryptoBackend.h"
 #include "Slice.h"
 #include "errors.h"
 #include "utils.h"
 #include <NimBLECharacteristic.h>
+#include <algorithm>
 #include <cstdint>
-#include <mbedtls/bignum.h>
-#include <mbedtls/ecdh.h>
-#include <mbedtls/ecp.h>
-#include <mbedtls/entropy.h>
-#include <mbedtls/gcm.h>
-#include <mbedtls/hkdf.h>
+#include <cstring>
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+#include <freertos/task.h>
+#include <mbedtls/platform_util.h>
 #include <optional>
-#include <psa/crypto.h>
 
 namespace Crypto {
-uint8_t encryptedRequestBuf[REQUEST_SIZE];
-mbedtls_entropy_context entropyCtx;
-mbedtls_ecp_keypair readerKeypair;
-mbedtls_ecp_point devicePublicKey;
-mbedtls_mpi sharedSecret;
-esp_gcm_context gcmCtx;
+// Generating a key takes a while, so it's done when nothing else is running
+constexpr UBaseType_t READER_KEY_TASK_PRIORITY = tskIDLE_PRIORITY;
+// Off loop()'s core
+constexpr BaseType_t READER_KEY_TASK_CORE = 0;
+constexpr uint32_t READER_KEY_TASK_STACK = 4096;
+// How long a tap waits for a key if none are ready
+constexpr TickType_t READER_KEY_WAIT = pdMS_TO_TICKS(2000);
+// Before retrying a key that failed to generate
+constexpr TickType_t READER_KEY_RETRY_DELAY = pdMS_TO_TICKS(1000);
 
-mbedtls_ecp_group *group = &readerKeypair.MBEDTLS_PRIVATE(grp);
+struct ReaderKey {
+  CryptoBackend::EcKey keypair;
+  uint8_t encodedPublicKey[ENCODED_READER_PUBLIC_KEY_LENGTH];
+};
 
-uint8_t deviceKey[32];
+ReaderKey readerKeys[READER_KEY_POOL_SIZE];
+// Used for the current session, and not in either queue
+ReaderKey *currentReaderKey = nullptr;
+// Keys ready for a session, and keys waiting to be (re)generated
+QueueHandle_t readyReaderKeys = nullptr;
+QueueHandle_t staleReaderKeys = nullptr;
+
+bool encodeReaderPublicKey(ReaderKey &key) {
+  // The first byte is 0x04 to indicate uncompressed and each each point is 32
+  // bytes
+  uint8_t points[CryptoBackend::PUBLIC_KEY_SIZE];
+  CHECK_CRYPTO_RETURN_BOOL(
+      "Failed to copy readerPublicKeyPoints into buf",
+      CryptoBackend::exportPublicKey(key.keypair, std::span{points}));
+  std::span<const uint8_t, 32> xSpan{points + 1, 32};
+  std::span<const uint8_t, 32> ySpan{points + 1 + 32, 32};
+
+  CborEncoder encoder;
+  cbor_encoder_init(&encoder, key.encodedPublicKey,
+                    sizeof(key.encodedPublicKey), 0);
+
+  CborEncoder mapEncoder;
+  CHECK_CBOR_RETURN_BOOL("Failed to create map",
+                         cbor_encoder_create_map(&encoder, &mapEncoder, 4));
+
+  CHECK_CBOR_RETURN_BOOL("Failed to add key 1",
+                         cbor_encode_int(&mapEncoder, 1));
+  CHECK_CBOR_RETURN_BOOL("Failed to add value 2 for key 1",
+                         cbor_encode_int(&mapEncoder, 2));
+
+  CHECK_CBOR_RETURN_BOOL("Failed to add key -1",
+                         cbor_encode_negative_int(&mapEncoder, 1));
+  CHECK_CBOR_RETURN_BOOL("Failed to add value 1 for key -1",
+                         cbor_encode_int(&mapEncoder, 1));
+
+  CHECK_CBOR_RETURN_BOOL("Failed to add key -2",
+                         cbor_encode_negative_int(&mapEncoder, 2));
+  CHECK_CBOR_RETURN_BOOL(
+      "Failed to add value for key -2",
+      cbor_encode_byte_string(&mapEncoder, xSpan.data(), xSpan.size()));
+
+  CHECK_CBOR_RETURN_BOOL("Failed to add key -3",
+                         cbor_encode_negative_int(&mapEncoder, 3));
+  CHECK_CBOR_RETURN_BOOL(
+      "Failed to add value for key -3",
+      cbor_encode_byte_string(&mapEncoder, ySpan.data(), ySpan.size()));
+
+  CHECK_CBOR_RETURN_BOOL("Failed to close map", cbor_encoder_close_container(
+                                                    &encoder, &mapEncoder));
+
+  size_t numWritten =
+      cbor_encoder_get_buffer_size(&encoder, key.encodedPublicKey);
+  if (numWritten != ENCODED_READER_PUBLIC_KEY_LENGTH) {
+    ESP_LOGE(TAG, "Unexpected encoded reader public key length: %d",
+             numWritten);
+    return false;
+  }
+  return true;
+}
+
+bool generateReaderKey(ReaderKey &key) {
+  // Wipes the last session's private key
+  CryptoBackend::freeKey(key.keypair);
+  CryptoBackend::initKey(key.keypair);
+  CHECK_CRYPTO_RETURN_BOOL("Failed to generate readerKeypair",
+                           CryptoBackend::generateKey(key.keypair));
+  return encodeReaderPublicKey(key);
+}
+
+void readerKeyTask(void *) {
+  ReaderKey *key;
+  while (true) {
+    xQueueReceive(staleReaderKeys, &key, portMAX_DELAY);
+    while (!generateReaderKey(*key)) {
+      vTaskDelay(READER_KEY_RETRY_DELAY);
+    }
+    xQueueSend(readyReaderKeys, &key, 0);
+  }
+}
 
 void setup() {
-  // TODO: Check if we need this
-  if (psa_crypto_init() != PSA_SUCCESS) {
-    ESP_LOGE(TAG, "Unable to init crypto");
+  if (CryptoBackend::setup() != 0) {
+    ESP_LOGE(TAG, "Unable to init crypto (%s)", CryptoBackend::name());
+    errorHang();
+  }
+
+  readyReaderKeys = xQueueCreate(READER_KEY_POOL_SIZE, sizeof(ReaderKey *));
+  staleReaderKeys = xQueueCreate(READER_KEY_POOL_SIZE, sizeof(ReaderKey *));
+  if (readyReaderKeys == nullptr || staleReaderKeys == nullptr) {
+    ESP_LOGE(TAG, "Unable to create reader key queues");
+    errorHang();
+  }
+  for (ReaderKey &key : readerKeys) {
+    CryptoBackend::initKey(key.keypair);
+    ReaderKey *keyPtr = &key;
+    xQueueSend(staleReaderKeys, &keyPtr, 0);
+  }
+  if (xTaskCreatePinnedToCore(readerKeyTask, "Reader Keys",
+                              READER_KEY_TASK_STACK, nullptr,
+                              READER_KEY_TASK_PRIORITY, nullptr,
+                              READER_KEY_TASK_CORE) != pdPASS) {
+    ESP_LOGE(TAG, "Unable to start reader key task");
     errorHang();
   }
-  mbedtls_entropy_init(&entropyCtx);
-  mbedtls_ecp_keypair_init(&readerKeypair);
-  mbedtls_ecp_point_init(&devicePublicKey);
-  mbedtls_mpi_init(&sharedSecret);
-  mbedtls_gcm_init(&gcmCtx);
 }
 
-bool generateNewReaderKeypair() {
-  CHECK_CRYPTO_RETURN_BOOL(
-      "Failed to generate readerKeypair",
-      mbedtls_ecp_gen_key(MBEDTLS_ECP_DP_SECP256R1, &readerKeypair,
-                          &mbedtls_entropy_func, &entropyCtx));
+bool takeReaderKeypair() {
+  // In case the last tap didn't
+  retireReaderKeypair();
 
+  ReaderKey *key;
+  if (xQueueReceive(readyReaderKeys, &key, 0) != pdTRUE) {
+    ESP_LOGW(TAG, "No reader keys ready, waiting for one");
+    CHECK_PRINT_RETURN_BOOL(
+        "Timed out waiting for a reader key",
+        xQueueReceive(readyReaderKeys, &key, READER_KEY_WAIT) == pdTRUE);
+  }
+  currentReaderKey = key;
   return true;
 }
 
-std::optional<
-    std::pair<std::span<const uint8_t, 32>, std::span<const uint8_t, 32>>>
-copyReaderPublicKeyPoints() {
-  // The first byte is 0x04 to indicate uncompressed and each each point is 32
-  // bytes
-  static uint8_t buf[65];
-  size_t outputLen;
-  CHECK_CRYPTO_RETURN_OPT(
-      "Failed to copy readerPublicKeyPoints into buf",
-      mbedtls_ecp_point_write_binary(group, &readerKeypair.MBEDTLS_PRIVATE(Q),
-                                     MBEDTLS_ECP_PF_UNCOMPRESSED, &outputLen,
-                                     buf, sizeof(buf)));
-  if (outputLen != sizeof(buf)) {
-    ESP_LOGE(TAG, "Unexpected readerPublicKeyPoints len: %d", outputLen);
-    return std::nullopt;
+void retireReaderKeypair() {
+  // Never used again
+  if (currentReaderKey != nullptr) {
+    xQueueSend(staleReaderKeys, &currentReaderKey, 0);
+    currentReaderKey = nullptr;
   }
+}
 
-  std::span<const uint8_t, 32> xSpan{buf + 1, 32};
-  std::span<const uint8_t, 32> ySpan{buf + 1 + 32, 32};
-  return std::pair{xSpan, ySpan};
-
-  return std::nullopt;
+std::span<const uint8_t, ENCODED_READER_PUBLIC_KEY_LENGTH>
+encodedReaderPublicKey() {
+  return std::span{currentReaderKey->encodedPublicKey};
 }
 
 std::optional<std::span<const uint8_t, 16>>
 getIdent(std::span<const uint8_t> encodedDevicePublicKey) {
   static uint8_t hkdfOutput[16];
   static const uint8_t info[] = "BLEIdent";
-  const mbedtls_md_info_t *md = mbedtls_md_info_from_type(MBEDTLS_MD_SHA256);
   CHECK_CRYPTO_RETURN_OPT("Failed to HKDF",
-                          mbedtls_hkdf(md, nullptr, 0,
-                                       encodedDevicePublicKey.data(),
-                                       encodedDevicePublicKey.size(), info, 8,
-                                       hkdfOutput, sizeof(hkdfOutput)));
+                          CryptoBackend::hkdf({}, encodedDevicePublicKey,
+                                              {info, 8}, hkdfOutput));
   std::span<uint8_t, sizeof(hkdfOutput)> ident{hkdfOutput};
   printHex("Ident: ", ident);
   return ident;
 }
 
-std::optional<std::span<const uint8_t>>
-encryptRequest(std::span<const uint8_t> deviceXY,
-               std::span<const uint8_t> transcript) {
-  CHECK_CRYPTO_RETURN_OPT("Failed to read devicePublicKey",
-                          mbedtls_ecp_point_read_binary(group, &devicePublicKey,
-                                                        deviceXY.data(),
-                                                        deviceXY.size()));
-  CHECK_CRYPTO_RETURN_OPT("Invalid devicePublicKey",
-                          mbedtls_ecp_check_pubkey(group, &devicePublicKey));
-  CHECK_CRYPTO_RETURN_OPT(
+Session::Session() {
+  CryptoBackend::initAead(readerAead_);
+  CryptoBackend::initAead(deviceAead_);
+}
+
+Session::~Session() { end(); }
+
+bool Session::begin(std::span<const uint8_t> deviceXY,
+                    std::span<const uint8_t> transcript) {
+  end();
+  CHECK_PRINT_RETURN_BOOL("No reader key taken", currentReaderKey != nullptr);
+  uint8_t sharedSecret[CryptoBackend::SHARED_SECRET_SIZE];
+  CHECK_CRYPTO_RETURN_BOOL(
       "Failed to computed shared secret",
-      mbedtls_ecdh_compute_shared(group, &sharedSecret, &devicePublicKey,
-                                  &readerKeypair.MBEDTLS_PRIVATE(d),
-                                  &mbedtls_entropy_func, &entropyCtx));
-
-  static uint8_t sharedSecretBuf[32];
-  CHECK_CRYPTO_RETURN_OPT("Failed to write shared secret to buffer",
-                          mbedtls_mpi_write_binary(&sharedSecret,
-                                                   sharedSecretBuf,
-                                                   sizeof(sharedSecretBuf)));
-  static uint8_t readerKey[32];
+      CryptoBackend::ecdh(currentReaderKey->keypair, deviceXY,
+                          std::span{sharedSecret}));
+
+  // One extract for both keys
+  uint8_t prk[CryptoBackend::PRK_SIZE];
+  int error = CryptoBackend::hkdfExtract(transcript, sharedSecret,
+                                         std::span{prk});
+  mbedtls_platform_zeroize(sharedSecret, sizeof(sharedSecret));
+  CHECK_CRYPTO_RETURN_BOOL("Failed to HKDF extract", error);
+
   static const uint8_t readerInfo[] = "SKReader";
-  const mbedtls_md_info_t *md = mbedtls_md_info_from_type(MBEDTLS_MD_SHA256);
-  CHECK_CRYPTO_RETURN_OPT("Failed to HKDF reader key",
-                          mbedtls_hkdf(md, transcript.data(), transcript.size(),
-                                       sharedSecretBuf, sizeof(sharedSecretBuf),
-                                       readerInfo, 8, readerKey,
-                                       sizeof(readerKey)));
-  printHex("Reader Key: ", {readerKey, sizeof(readerKey)});
   static const uint8_t deviceInfo[] = "SKDevice";
-  CHECK_CRYPTO_RETURN_OPT("Failed to HKDF device key",
-                          mbedtls_hkdf(md, transcript.data(), transcript.size(),
-                                       sharedSecretBuf, sizeof(sharedSecretBuf),
-                                       deviceInfo, 8, deviceKey,
-                                       sizeof(deviceKey)));
-  printHex("Device Key: ", {deviceKey, sizeof(deviceKey)});
-
-  static uint8_t iv[] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1};
-  mbedtls_gcm_init(&gcmCtx);
-  CHECK_CRYPTO_RETURN_OPT(
-      "Failed to set key",
-      mbedtls_gcm_setkey(&gcmCtx, MBEDTLS_CIPHER_ID_AES, readerKey, 256));
-  uint8_t *tag = encryptedRequestBuf + sizeof(unencryptedRequest);
-  CHECK_CRYPTO_RETURN_OPT(
-      "Failed to encrypt",
-      mbedtls_gcm_crypt_and_tag(&gcmCtx, MBEDTLS_GCM_ENCRYPT,
-                                sizeof(unencryptedRequest), iv, sizeof(iv),
-                                nullptr, 0, unencryptedRequest,
-                                encryptedRequestBuf, TAG_SIZE, tag));
-
-  std::span<const uint8_t> encryptedRequest(encryptedRequestBuf,
-                                            sizeof(encryptedRequestBuf));
-  printHex("Encrypted Request: ", encryptedRequest);
-
-  return encryptedRequest;
+  uint8_t readerKey[CryptoBackend::AEAD_KEY_SIZE];
+  uint8_t deviceKey[CryptoBackend::AEAD_KEY_SIZE];
+  error = CryptoBackend::hkdfExpand(prk, {readerInfo, 8}, readerKey);
+  if (error == 0) {
+    error = CryptoBackend::hkdfExpand(prk, {deviceInfo, 8}, deviceKey);
+  }
+  if (error == 0) {
+    error = CryptoBackend::setAeadKey(readerAead_, readerKey);
+  }
+  if (error == 0) {
+    error = CryptoBackend::setAeadKey(deviceAead_, deviceKey);
+  }
+  // The contexts have what they need
+  mbedtls_platform_zeroize(prk, sizeof(prk));
+  mbedtls_platform_zeroize(readerKey, sizeof(readerKey));
+  mbedtls_platform_zeroize(deviceKey, sizeof(deviceKey));
+  CHECK_CRYPTO_RETURN_BOOL("Failed to set up session keys", error);
+
+  readerCounter_ = 1;
+  deviceCounter_ = 1;
+  active_ = true;
+  return true;
+}
+
+void Session::end() {
+  // Also wipes the keys
+  CryptoBackend::freeAead(readerAead_);
+  CryptoBackend::freeAead(deviceAead_);
+  CryptoBackend::initAead(readerAead_);
+  CryptoBackend::initAead(deviceAead_);
+  active_ = false;
+}
+
+bool Session::active() const { return active_; }
+
+// 8 byte identifier, then the message counter (big endian)
+void Session::iv(bool fromDevice, uint32_t counter,
+                 uint8_t (&out)[IV_SIZE]) const {
+  memset(out, 0, 8);
+  out[7] = fromDevice ? 1 : 0;
+  out[8] = counter >> 24;
+  out[9] = counter >> 16;
+  out[10] = counter >> 8;
+  out[11] = counter;
+}
+
+std::optional<std::span<const uint8_t>>
+Session::encrypt(std::span<const uint8_t> plaintext, WriteSlice &output) {
+  CHECK_PRINT_RETURN_OPT("No session", active_);
+  uint8_t *outputPtr = output.deferAppend(plaintext.size() + TAG_SIZE);
+  CHECK_RETURN_OPT(outputPtr);
+
+  uint8_t messageIv[IV_SIZE];
+  iv(false, readerCounter_++, messageIv);
+  CHECK_CRYPTO_RETURN_OPT("Failed to encrypt",
+                          CryptoBackend::aeadEncrypt(readerAead_, messageIv,
+                                                     plaintext, outputPtr));
+
+  auto encrypted = output.spanAndReset();
+  printHex("Encrypted Request: ", encrypted);
+  return encrypted;
 }
 
 std::optional<std::span<const uint8_t>>
-decryptResponse(std::span<const uint8_t> encrypted, WriteSlice &outputSlice) {
+Session::decrypt(std::span<const uint8_t> encrypted, WriteSlice &output) {
+  CHECK_PRINT_RETURN_OPT("No session", active_);
   size_t dataLen = encrypted.size();
-  if (dataLen == 0) {
+  if (dataLen < TAG_SIZE) {
     ESP_LOGE(TAG, "Invalid encrypted response size: %d", dataLen);
     return std::nullopt;
   }
 
-  // First 8 bytes is identifier and last 4 bytes is the sequence number
-  static uint8_t iv[] = {0, 0, 0, 0, 0, 0, 0, 1, 0, 0, 0, 1};
-
-  std::span<const uint8_t, TAG_SIZE> tag = encrypted.last<TAG_SIZE>();
   size_t encryptedLen = dataLen - TAG_SIZE;
-  uint8_t *outputPtr = outputSlice.deferAppend(encryptedLen);
-
-  mbedtls_gcm_init(&gcmCtx);
-  CHECK_CRYPTO_RETURN_OPT(
-      "Failed to set key",
-      mbedtls_gcm_setkey(&gcmCtx, MBEDTLS_CIPHER_ID_AES, deviceKey, 256));
-  CHECK_CRYPTO_RETURN_OPT(
-      "Failed to decrypt",
-      mbedtls_gcm_auth_decrypt(&gcmCtx, encryptedLen, iv, sizeof(iv), nullptr,
-                               0, tag.data(), tag.size(), encrypted.data(),
-                               outputPtr));
-
-  return outputSlice.spanAndReset();
+  uint8_t *outputPtr = output.deferAppend(encryptedLen);
+  CHECK_RETURN_OPT(outputPtr);
+
+  uint8_t messageIv[IV_SIZE];
+  iv(true, deviceCounter_++, messageIv);
+  CHECK_CRYPTO_RETURN_OPT("Failed to decrypt",
+                          CryptoBackend::aeadDecrypt(deviceAead_, messageIv,
+                                                     encrypted, outputPtr));
+
+  return output.spanAndReset();
+}
+
+CryptoBackend::AeadKey *Session::beginDecrypt() {
+  CHECK_PRINT_RETURN_VAL("No session", active_, nullptr);
+  uint8_t messageIv[IV_SIZE];
+  iv(true, deviceCounter_++, messageIv);
+  CHECK_CRYPTO_RETURN_VAL(
+      "Failed to start decryption",
+      CryptoBackend::aeadDecryptStart(deviceAead_, messageIv), nullptr);
+  return &deviceAead_;
+}
+
+ResponseDecryptor::ResponseDecryptor(Session &session, WriteSlice &output)
+    : session_(session), output_(output) {}
+
+void ResponseDecryptor::reset() {
+  output_.reset();
+  mode_ = Mode::HEADER;
+  headerLen_ = 0;
+  ciphertextLeft_ = 0;
+  tagLen_ = 0;
+}
+
+bool ResponseDecryptor::feed(std::span<const uint8_t> bytes) {
+  // A byte at a time, so the header ends exactly where the ciphertext starts
+  while (mode_ == Mode::HEADER && !bytes.empty()) {
+    header_[headerLen_++] = bytes[0];
+    bytes = bytes.subspan(1);
+    CHECK_RETURN_BOOL(parseHeader());
+  }
+
+  switch (mode_) {
+  case Mode::HEADER:
+    return true;
+  case Mode::STREAMING:
+    return decrypt(bytes);
+  case Mode::BUFFERED:
+    return output_.append(bytes);
+  }
+  return false;
+}
+
+// Leaves mode_ at HEADER if more of the header is needed
+bool ResponseDecryptor::parseHeader() {
+  static constexpr uint8_t dataKey[] = {0x64, 'd', 'a', 't', 'a'};
+  auto buffer = [&] {
+    mode_ = Mode::BUFFERED;
+    return output_.append({header_, headerLen_});
+  };
+
+  // A map with at least one entry
+  if (header_[0] < 0xA1 || header_[0] > 0xB7) {
+    return buffer();
+  }
+  // "data" as its first key
+  size_t keyLen = std::min(headerLen_ - 1, sizeof(dataKey));
+  if (memcmp(header_ + 1, dataKey, keyLen) != 0) {
+    return buffer();
+  }
+  if (headerLen_ < 1 + sizeof(dataKey) + 1) {
+    return true;
+  }
+
+  // A definite length byte string, with its length in up to 4 bytes
+  uint8_t initial = header_[1 + sizeof(dataKey)];
+  if ((initial & 0xE0) != 0x40) {
+    return buffer();
+  }
+  uint8_t info = initial & 0x1F;
+  size_t lengthSize;
+  if (info < 24) {
+    lengthSize = 0;
+  } else if (info <= 26) {
+    lengthSize = 1 << (info - 24);
+  } else {
+    return buffer();
+  }
+  size_t headerSize = 1 + sizeof(dataKey) + 1 + lengthSize;
+  if (headerLen_ < headerSize) {
+    return true;
+  }
+  size_t dataLen = lengthSize == 0 ? info : 0;
+  for (size_t i = headerSize - lengthSize; i < headerSize; ++i) {
+    dataLen = (dataLen << 8) | header_[i];
+  }
+  if (dataLen < TAG_SIZE) {
+    return buffer();
+  }
+
+  mode_ = Mode::STREAMING;
+  ciphertextLeft_ = dataLen - TAG_SIZE;
+  aead_ = session_.beginDecrypt();
+  return aead_ != nullptr;
+}
+
+bool ResponseDecryptor::decrypt(std::span<const uint8_t> bytes) {
+  size_t len = std::min(bytes.size(), ciphertextLeft_);
+  if (len > 0) {
+    uint8_t *outputPtr = output_.deferAppend(len);
+    CHECK_RETURN_BOOL(outputPtr);
+    CHECK_CRYPTO_RETURN_BOOL(
+        "Failed to decrypt",
+        CryptoBackend::aeadDecryptUpdate(*aead_, bytes.first(len), outputPtr));
+    ciphertextLeft_ -= len;
+    bytes = bytes.subspan(len);
+  }
+
+  // Anything after the tag (e.g. a status) isn't needed
+  size_t tagBytes = std::min(bytes.size(), TAG_SIZE - tagLen_);
+  memcpy(tag_ + tagLen_, bytes.data(), tagBytes);
+  tagLen_ += tagBytes;
+  return true;
+}
+
+bool ResponseDecryptor::streaming() const { return mode_ == Mode::STREAMING; }
+
+std::optional<std::span<const uint8_t>> ResponseDecryptor::finish() {
+  CHECK_PRINT_RETURN_OPT("Response ended before its tag",
+                         mode_ == Mode::STREAMING && ciphertextLeft_ == 0 &&
+                             tagLen_ == TAG_SIZE);
+  // Also fails if the tag doesn't match, which is checked in constant time
+  if (CryptoBackend::aeadDecryptFinish(*aead_, std::span{tag_}) != 0) {
+    ESP_LOGE(TAG, "Response failed authentication");
+    // Like Session::decrypt(), don't leave unauthenticated plaintext
+    // around
+    memset(output_.data(), 0, output_.len());
+    output_.reset();
+    return std::nullopt;
+  }
+  return output_.spanAndReset();
+}
+
+std::span<const uint8_t> ResponseDecryptor::takeBuffered() {
+  // Too short to tell what it was
+  if (mode_ == Mode::HEADER) {
+    mode_ = Mode::BUFFERED;
+    output_.append({header_, headerLen_});
+  }
+  return output_.spanAndReset();
 }
 
 } // namespace Crypto
\ No newline at end of file
@@ -1,5 +1,6 @@
 #pragma once
 
+#include "CryptoBackend.h"
 #include "Slice.h"
 #include <cstdint>
 #include <optional>
@@ -7,53 +8,120 @@
 
 namespace Crypto {
 
-// Generated via tools/ble-server/item-request.js
-constexpr uint8_t unencryptedRequest[] = {
-    0xa2, 0x67, 0x76, 0x65, 0x72, 0x73, 0x69, 0x6f, 0x6e, 0x63, 0x31, 0x2e,
-    0x30, 0x6b, 0x64, 0x6f, 0x63, 0x52, 0x65, 0x71, 0x75, 0x65, 0x73, 0x74,
-    0x73, 0x82, 0xa1, 0x6c, 0x69, 0x74, 0x65, 0x6d, 0x73, 0x52, 0x65, 0x71,
-    0x75, 0x65, 0x73, 0x74, 0xd8, 0x18, 0x58, 0x63, 0xa2, 0x67, 0x64, 0x6f,
-    0x63, 0x54, 0x79, 0x70, 0x65, 0x75, 0x6f, 0x72, 0x67, 0x2e, 0x69, 0x73,
-    0x6f, 0x2e, 0x31, 0x38, 0x30, 0x31, 0x33, 0x2e, 0x35, 0x2e, 0x31, 0x2e,
-    0x6d, 0x44, 0x4c, 0x6a, 0x6e, 0x61, 0x6d, 0x65, 0x53, 0x70, 0x61, 0x63,
-    0x65, 0x73, 0xa1, 0x71, 0x6f, 0x72, 0x67, 0x2e, 0x69, 0x73, 0x6f, 0x2e,
-    0x31, 0x38, 0x30, 0x31, 0x33, 0x2e, 0x35, 0x2e, 0x31, 0xa3, 0x6a, 0x67,
-    0x69, 0x76, 0x65, 0x6e, 0x5f, 0x6e, 0x61, 0x6d, 0x65, 0xf5, 0x6b, 0x66,
-    0x61, 0x6d, 0x69, 0x6c, 0x79, 0x5f, 0x6e, 0x61, 0x6d, 0x65, 0xf5, 0x6a,
-    0x62, 0x69, 0x72, 0x74, 0x68, 0x5f, 0x64, 0x61, 0x74, 0x65, 0xf5, 0xa1,
-    0x6c, 0x69, 0x74, 0x65, 0x6d, 0x73, 0x52, 0x65, 0x71, 0x75, 0x65, 0x73,
-    0x74, 0xd8, 0x18, 0x58, 0x73, 0xa2, 0x67, 0x64, 0x6f, 0x63, 0x54, 0x79,
-    0x70, 0x65, 0x77, 0x6f, 0x72, 0x67, 0x2e, 0x69, 0x73, 0x6f, 0x2e, 0x32,
-    0x33, 0x32, 0x32, 0x30, 0x2e, 0x70, 0x68, 0x6f, 0x74, 0x6f, 0x69, 0x64,
-    0x2e, 0x31, 0x6a, 0x6e, 0x61, 0x6d, 0x65, 0x53, 0x70, 0x61, 0x63, 0x65,
-    0x73, 0xa1, 0x6f, 0x6f, 0x72, 0x67, 0x2e, 0x69, 0x73, 0x6f, 0x2e, 0x32,
-    0x33, 0x32, 0x32, 0x30, 0x2e, 0x31, 0xa3, 0x72, 0x67, 0x69, 0x76, 0x65,
-    0x6e, 0x5f, 0x6e, 0x61, 0x6d, 0x65, 0x5f, 0x75, 0x6e, 0x69, 0x63, 0x6f,
-    0x64, 0x65, 0xf5, 0x73, 0x66, 0x61, 0x6d, 0x69, 0x6c, 0x79, 0x5f, 0x6e,
-    0x61, 0x6d, 0x65, 0x5f, 0x75, 0x6e, 0x69, 0x63, 0x6f, 0x64, 0x65, 0xf5,
-    0x6a, 0x62, 0x69, 0x72, 0x74, 0x68, 0x5f, 0x64, 0x61, 0x74, 0x65, 0xf5};
-constexpr size_t TAG_SIZE = 16;
-constexpr size_t REQUEST_SIZE = sizeof(unencryptedRequest) + TAG_SIZE;
+constexpr size_t TAG_SIZE = CryptoBackend::AEAD_TAG_SIZE;
+// A P-256 reader public key encoded as a COSE_Key
+constexpr size_t ENCODED_READER_PUBLIC_KEY_LENGTH = 75;
+// Ephemeral reader keys generated in the background ahead of taps, including
+// the one in use
+constexpr size_t READER_KEY_POOL_SIZE = 3;
 
+// Also starts generating reader keys
 void setup();
 
-bool generateNewReaderKeypair();
-std::optional<
-    std::pair<std::span<const uint8_t, 32>, std::span<const uint8_t, 32>>>
-copyReaderPublicKeyPoints();
+// Moves on to a new reader keypair for a session. Each key is only used for
+// one session, after which it's replaced in the background. If none are
+// ready, waits for the next one.
+bool takeReaderKeypair();
+// Hands the current keypair back once the session's keys are derived from it
+// and its public key is sent, so its private key is wiped and the pool
+// refilled without waiting for the next tap
+void retireReaderKeypair();
+// The current reader public key, encoded ahead of time. Only valid between
+// takeReaderKeypair() and retireReaderKeypair().
+std::span<const uint8_t, ENCODED_READER_PUBLIC_KEY_LENGTH>
+encodedReaderPublicKey();
 
 std::optional<std::span<const uint8_t, 16>>
 getIdent(std::span<const uint8_t> encodedDevicePublicKey);
 
-std::optional<std::span<const uint8_t>>
-encryptRequest(std::span<const uint8_t> deviceXY,
-               std::span<const uint8_t> transcript);
+// Session encryption with a device (ISO 18013-5 9.1.1.5). SKReader and
+// SKDevice are derived once per session, each into an AES-GCM context that's
+// kept for the whole session, so each message only costs the AEAD itself.
+// Messages in each direction are numbered from 1, which goes in their IV.
+class Session {
+public:
+  Session();
+  ~Session();
+  Session(const Session &) = delete;
+  Session &operator=(const Session &) = delete;
 
-std::optional<std::span<const uint8_t>>
-encryptRequest(std::span<const uint8_t> deviceXY,
-               std::span<const uint8_t> transcript);
+  // Starts a session with the device's public key (uncompressed, 0x04 X Y)
+  // and the session transcript, using the current reader key. Ends any
+  // session already going.
+  bool begin(std::span<const uint8_t> deviceXY,
+             std::span<const uint8_t> transcript);
+  // Forgets the session keys
+  void end();
+  bool active() const;
 
-std::optional<std::span<const uint8_t>>
-decryptResponse(std::span<const uint8_t> encrypted, WriteSlice &outputSlice);
+  // Encrypts the next message to the device, with its tag after it
+  std::optional<std::span<const uint8_t>>
+  encrypt(std::span<const uint8_t> plaintext, WriteSlice &output);
+  // Decrypts the next message from the device, which ends with its tag. The
+  // output can overlap the message if it trails it by at least 8 bytes.
+  std::optional<std::span<const uint8_t>>
+  decrypt(std::span<const uint8_t> encrypted, WriteSlice &output);
+  // Starts decrypting the next message from the device piece by piece, with
+  // CryptoBackend::aeadDecryptUpdate() and aeadDecryptFinish() on the
+  // returned key
+  CryptoBackend::AeadKey *beginDecrypt();
+
+private:
+  static constexpr size_t IV_SIZE = CryptoBackend::AEAD_IV_SIZE;
+
+  void iv(bool fromDevice, uint32_t counter, uint8_t (&out)[IV_SIZE]) const;
+
+  CryptoBackend::AeadKey readerAead_;
+  CryptoBackend::AeadKey deviceAead_;
+  // Of the next message in each direction
+  uint32_t readerCounter_ = 1;
+  uint32_t deviceCounter_ = 1;
+  bool active_ = false;
+};
+
+// Decrypts a response while its BLE chunks are still arriving, so only the tag
+// is left to check once the last one lands. The response is SessionData,
+// which is expected to start with its "data" byte string. Anything else (e.g.
+// a status, or data that isn't first) is buffered whole instead, for
+// Session::decrypt().
+class ResponseDecryptor {
+public:
+  // Plaintext, or the whole response if it's buffered, goes to output
+  ResponseDecryptor(Session &session, WriteSlice &output);
+
+  // Starts on a new response
+  void reset();
+  // Takes the next part of the response. Returns false if it can't be used,
+  // after which the decryptor has to be reset.
+  bool feed(std::span<const uint8_t> bytes);
+  // Whether the response is being decrypted as it arrives. Only known once
+  // the start of it has arrived.
+  bool streaming() const;
+  // After the last part of a streamed response. Checks the tag and returns
+  // the plaintext.
+  std::optional<std::span<const uint8_t>> finish();
+  // After the last part of a buffered response. Returns the response as it
+  // arrived.
+  std::span<const uint8_t> takeBuffered();
+
+private:
+  enum class Mode { HEADER, STREAMING, BUFFERED };
+  // map, "data", byte string length
+  static constexpr size_t MAX_HEADER_SIZE = 1 + 5 + 5;
+
+  bool parseHeader();
+  bool decrypt(std::span<const uint8_t> bytes);
+
+  Session &session_;
+  WriteSlice &output_;
+  CryptoBackend::AeadKey *aead_ = nullptr;
+  Mode mode_ = Mode::HEADER;
+  uint8_t header_[MAX_HEADER_SIZE];
+  size_t headerLen_ = 0;
+  // Still to come in the data byte string
+  size_t ciphertextLeft_ = 0;
+  uint8_t tag_[TAG_SIZE];
+  size_t tagLen_ = 0;
+};
 
 } // namespace Crypto
\ No newline at end of file
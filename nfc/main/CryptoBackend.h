@@ -0,0 +1,100 @@
+#pragma once
+
+// The cryptographic primitives the mdoc handoff is built on, with two
+// implementations: the legacy mbedtls APIs (CryptoLegacy.cpp, the default)
+// and PSA Crypto (CryptoPsa.cpp, with CRYPTO_BACKEND_PSA defined). Neither
+// depends on Arduino or ESP-IDF, so both also build on the host for
+// benchmarking (see nfc/host). Functions that can fail return 0 or an
+// mbedtls / PSA error code.
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+
+#ifdef CRYPTO_BACKEND_PSA
+#include <psa/crypto.h>
+#else
+#include <mbedtls/ecp.h>
+#include <mbedtls/gcm.h>
+#endif
+
+namespace CryptoBackend {
+
+// Uncompressed: 0x04, X, Y
+constexpr size_t PUBLIC_KEY_SIZE = 65;
+constexpr size_t SHARED_SECRET_SIZE = 32;
+// SHA-256, which HKDF is done with
+constexpr size_t PRK_SIZE = 32;
+// AES-256-GCM
+constexpr size_t AEAD_KEY_SIZE = 32;
+constexpr size_t AEAD_IV_SIZE = 12;
+constexpr size_t AEAD_TAG_SIZE = 16;
+
+#ifdef CRYPTO_BACKEND_PSA
+// mbedtls_svc_key_id_t is psa_key_id_t unless mbedtls is built with
+// MBEDTLS_PSA_CRYPTO_KEY_ID_ENCODES_OWNER
+struct EcKey {
+  mbedtls_svc_key_id_t id;
+};
+struct AeadKey {
+  mbedtls_svc_key_id_t id;
+  // For piece by piece decryption
+  psa_aead_operation_t operation;
+};
+#else
+struct EcKey {
+  mbedtls_ecp_keypair keypair;
+};
+struct AeadKey {
+  mbedtls_gcm_context gcm;
+};
+#endif
+
+const char *name();
+// Before anything else
+int setup();
+
+// P-256 keys for ECDH
+void initKey(EcKey &key);
+// Also wipes it
+void freeKey(EcKey &key);
+// Only ever called from one task at a time, though not necessarily the one
+// the rest is called from
+int generateKey(EcKey &key);
+int exportPublicKey(const EcKey &key,
+                    std::span<uint8_t, PUBLIC_KEY_SIZE> publicKey);
+// The shared secret (x coordinate) with an uncompressed peer public key
+int ecdh(EcKey &key, std::span<const uint8_t> peerPublicKey,
+         std::span<uint8_t, SHARED_SECRET_SIZE> secret);
+
+// HKDF-SHA-256
+int hkdfExtract(std::span<const uint8_t> salt, std::span<const uint8_t> ikm,
+                std::span<uint8_t, PRK_SIZE> prk);
+int hkdfExpand(std::span<const uint8_t, PRK_SIZE> prk,
+               std::span<const uint8_t> info, std::span<uint8_t> okm);
+// Extract and expand. salt can be empty.
+int hkdf(std::span<const uint8_t> salt, std::span<const uint8_t> ikm,
+         std::span<const uint8_t> info, std::span<uint8_t> okm);
+
+// AES-256-GCM keys, which keep their key schedule between messages
+void initAead(AeadKey &key);
+// Also wipes it
+void freeAead(AeadKey &key);
+int setAeadKey(AeadKey &key, std::span<const uint8_t, AEAD_KEY_SIZE> keyBytes);
+// Writes the ciphertext and then the tag to output, which must have room for
+// both
+int aeadEncrypt(AeadKey &key, std::span<const uint8_t, AEAD_IV_SIZE> iv,
+                std::span<const uint8_t> plaintext, uint8_t *output);
+// Decrypts ciphertext followed by its tag. output can overlap encrypted if it
+// trails it by at least 8 bytes.
+int aeadDecrypt(AeadKey &key, std::span<const uint8_t, AEAD_IV_SIZE> iv,
+                std::span<const uint8_t> encrypted, uint8_t *output);
+// The same, piece by piece. Each update writes as much plaintext as it's
+// given ciphertext, and finishing checks the tag.
+int aeadDecryptStart(AeadKey &key, std::span<const uint8_t, AEAD_IV_SIZE> iv);
+int aeadDecryptUpdate(AeadKey &key, std::span<const uint8_t> ciphertext,
+                      uint8_t *output);
+int aeadDecryptFinish(AeadKey &key,
+                      std::span<const uint8_t, AEAD_TAG_SIZE> tag);
+
+} // namespace CryptoBackend
@@ -0,0 +1,169 @@
+#ifndef CRYPTO_BACKEND_PSA
+
+#include "CryptoBackend.h"
+#include <cstdint>
+#include <mbedtls/bignum.h>
+#include <mbedtls/constant_time.h>
+#include <mbedtls/ecdh.h>
+#include <mbedtls/ecp.h>
+#include <mbedtls/entropy.h>
+#include <mbedtls/error.h>
+#include <mbedtls/gcm.h>
+#include <mbedtls/hkdf.h>
+#include <mbedtls/md.h>
+#include <mbedtls/platform_util.h>
+#include <psa/crypto.h>
+#include <span>
+
+namespace CryptoBackend {
+
+// An entropy context isn't thread safe, and keys are generated on a
+// different task from ECDH, which uses it for blinding
+mbedtls_entropy_context keyEntropyCtx;
+mbedtls_entropy_context ecdhEntropyCtx;
+
+const char *name() { return "legacy mbedtls"; }
+
+int setup() {
+  mbedtls_entropy_init(&keyEntropyCtx);
+  mbedtls_entropy_init(&ecdhEntropyCtx);
+#ifdef MBEDTLS_PSA_CRYPTO_C
+  // Since mbedtls 3, legacy hashing (and so HKDF) can be done through PSA
+  // drivers, which need this
+  if (psa_crypto_init() != PSA_SUCCESS) {
+    return MBEDTLS_ERR_ERROR_GENERIC_ERROR;
+  }
+#endif
+  return 0;
+}
+
+void initKey(EcKey &key) { mbedtls_ecp_keypair_init(&key.keypair); }
+void freeKey(EcKey &key) { mbedtls_ecp_keypair_free(&key.keypair); }
+
+int generateKey(EcKey &key) {
+  return mbedtls_ecp_gen_key(MBEDTLS_ECP_DP_SECP256R1, &key.keypair,
+                             &mbedtls_entropy_func, &keyEntropyCtx);
+}
+
+int exportPublicKey(const EcKey &key,
+                    std::span<uint8_t, PUBLIC_KEY_SIZE> publicKey) {
+  size_t outputLen;
+  int error = mbedtls_ecp_point_write_binary(
+      &key.keypair.MBEDTLS_PRIVATE(grp), &key.keypair.MBEDTLS_PRIVATE(Q),
+      MBEDTLS_ECP_PF_UNCOMPRESSED, &outputLen, publicKey.data(),
+      publicKey.size());
+  if (error == 0 && outputLen != publicKey.size()) {
+    return MBEDTLS_ERR_ECP_BAD_INPUT_DATA;
+  }
+  return error;
+}
+
+int ecdh(EcKey &key, std::span<const uint8_t> peerPublicKey,
+         std::span<uint8_t, SHARED_SECRET_SIZE> secret) {
+  mbedtls_ecp_group *group = &key.keypair.MBEDTLS_PRIVATE(grp);
+  mbedtls_ecp_point peer;
+  mbedtls_mpi sharedSecret;
+  mbedtls_ecp_point_init(&peer);
+  mbedtls_mpi_init(&sharedSecret);
+  int error = mbedtls_ecp_point_read_binary(group, &peer, peerPublicKey.data(),
+                                            peerPublicKey.size());
+  if (error == 0) {
+    error = mbedtls_ecp_check_pubkey(group, &peer);
+  }
+  if (error == 0) {
+    error = mbedtls_ecdh_compute_shared(group, &sharedSecret, &peer,
+                                        &key.keypair.MBEDTLS_PRIVATE(d),
+                                        &mbedtls_entropy_func, &ecdhEntropyCtx);
+  }
+  if (error == 0) {
+    error =
+        mbedtls_mpi_write_binary(&sharedSecret, secret.data(), secret.size());
+  }
+  mbedtls_ecp_point_free(&peer);
+  mbedtls_mpi_free(&sharedSecret);
+  return error;
+}
+
+const mbedtls_md_info_t *sha256() {
+  return mbedtls_md_info_from_type(MBEDTLS_MD_SHA256);
+}
+
+int hkdfExtract(std::span<const uint8_t> salt, std::span<const uint8_t> ikm,
+                std::span<uint8_t, PRK_SIZE> prk) {
+  return mbedtls_hkdf_extract(sha256(), salt.data(), salt.size(), ikm.data(),
+                              ikm.size(), prk.data());
+}
+
+int hkdfExpand(std::span<const uint8_t, PRK_SIZE> prk,
+               std::span<const uint8_t> info, std::span<uint8_t> okm) {
+  return mbedtls_hkdf_expand(sha256(), prk.data(), prk.size(), info.data(),
+                             info.size(), okm.data(), okm.size());
+}
+
+int hkdf(std::span<const uint8_t> salt, std::span<const uint8_t> ikm,
+         std::span<const uint8_t> info, std::span<uint8_t> okm) {
+  return mbedtls_hkdf(sha256(), salt.data(), salt.size(), ikm.data(),
+                      ikm.size(), info.data(), info.size(), okm.data(),
+                      okm.size());
+}
+
+void initAead(AeadKey &key) { mbedtls_gcm_init(&key.gcm); }
+void freeAead(AeadKey &key) { mbedtls_gcm_free(&key.gcm); }
+
+int setAeadKey(AeadKey &key, std::span<const uint8_t, AEAD_KEY_SIZE> keyBytes) {
+  return mbedtls_gcm_setkey(&key.gcm, MBEDTLS_CIPHER_ID_AES, keyBytes.data(),
+                            keyBytes.size() * 8);
+}
+
+int aeadEncrypt(AeadKey &key, std::span<const uint8_t, AEAD_IV_SIZE> iv,
+                std::span<const uint8_t> plaintext, uint8_t *output) {
+  return mbedtls_gcm_crypt_and_tag(&key.gcm, MBEDTLS_GCM_ENCRYPT,
+                                   plaintext.size(), iv.data(), iv.size(),
+                                   nullptr, 0, plaintext.data(), output,
+                                   AEAD_TAG_SIZE, output + plaintext.size());
+}
+
+int aeadDecrypt(AeadKey &key, std::span<const uint8_t, AEAD_IV_SIZE> iv,
+                std::span<const uint8_t> encrypted, uint8_t *output) {
+  if (encrypted.size() < AEAD_TAG_SIZE) {
+    return MBEDTLS_ERR_GCM_BAD_INPUT;
+  }
+  size_t ciphertextLen = encrypted.size() - AEAD_TAG_SIZE;
+  return mbedtls_gcm_auth_decrypt(&key.gcm, ciphertextLen, iv.data(),
+                                  iv.size(), nullptr, 0,
+                                  encrypted.data() + ciphertextLen,
+                                  AEAD_TAG_SIZE, encrypted.data(), output);
+}
+
+int aeadDecryptStart(AeadKey &key, std::span<const uint8_t, AEAD_IV_SIZE> iv) {
+  return mbedtls_gcm_starts(&key.gcm, MBEDTLS_GCM_DECRYPT, iv.data(),
+                            iv.size());
+}
+
+int aeadDecryptUpdate(AeadKey &key, std::span<const uint8_t> ciphertext,
+                      uint8_t *output) {
+  size_t outputLen;
+  int error = mbedtls_gcm_update(&key.gcm, ciphertext.data(), ciphertext.size(),
+                                 output, ciphertext.size(), &outputLen);
+  if (error == 0 && outputLen != ciphertext.size()) {
+    return MBEDTLS_ERR_GCM_BAD_INPUT;
+  }
+  return error;
+}
+
+int aeadDecryptFinish(AeadKey &key,
+                      std::span<const uint8_t, AEAD_TAG_SIZE> tag) {
+  uint8_t expected[AEAD_TAG_SIZE];
+  size_t outputLen;
+  int error = mbedtls_gcm_finish(&key.gcm, nullptr, 0, &outputLen, expected,
+                                 sizeof(expected));
+  if (error == 0 && mbedtls_ct_memcmp(expected, tag.data(), tag.size()) != 0) {
+    error = MBEDTLS_ERR_GCM_AUTH_FAILED;
+  }
+  mbedtls_platform_zeroize(expected, sizeof(expected));
+  return error;
+}
+
+} // namespace CryptoBackend
+
+#endif
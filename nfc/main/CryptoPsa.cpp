@@ -0,0 +1,183 @@
+#ifdef CRYPTO_BACKEND_PSA
+
+#include "CryptoBackend.h"
+#include <cstdint>
+#include <psa/crypto.h>
+#include <span>
+
+// PSA keeps its keys in its own key store, and does its own random number
+// generation. On the ESP32 that needs mbedtls built with MBEDTLS_PSA_CRYPTO_C
+// and MBEDTLS_THREADING_C, since keys are generated on a background task.
+
+namespace CryptoBackend {
+
+const char *name() { return "PSA Crypto"; }
+
+int setup() { return psa_crypto_init(); }
+
+void initKey(EcKey &key) { key.id = MBEDTLS_SVC_KEY_ID_INIT; }
+
+void freeKey(EcKey &key) {
+  psa_destroy_key(key.id);
+  key.id = MBEDTLS_SVC_KEY_ID_INIT;
+}
+
+int generateKey(EcKey &key) {
+  psa_key_attributes_t attributes = psa_key_attributes_init();
+  psa_set_key_type(&attributes,
+                   PSA_KEY_TYPE_ECC_KEY_PAIR(PSA_ECC_FAMILY_SECP_R1));
+  psa_set_key_bits(&attributes, 256);
+  psa_set_key_usage_flags(&attributes, PSA_KEY_USAGE_DERIVE);
+  psa_set_key_algorithm(&attributes, PSA_ALG_ECDH);
+  return psa_generate_key(&attributes, &key.id);
+}
+
+int exportPublicKey(const EcKey &key,
+                    std::span<uint8_t, PUBLIC_KEY_SIZE> publicKey) {
+  size_t outputLen;
+  psa_status_t status = psa_export_public_key(key.id, publicKey.data(),
+                                              publicKey.size(), &outputLen);
+  if (status == PSA_SUCCESS && outputLen != publicKey.size()) {
+    return PSA_ERROR_CORRUPTION_DETECTED;
+  }
+  return status;
+}
+
+int ecdh(EcKey &key, std::span<const uint8_t> peerPublicKey,
+         std::span<uint8_t, SHARED_SECRET_SIZE> secret) {
+  size_t outputLen;
+  // Also checks the peer's key is on the curve
+  psa_status_t status = psa_raw_key_agreement(
+      PSA_ALG_ECDH, key.id, peerPublicKey.data(), peerPublicKey.size(),
+      secret.data(), secret.size(), &outputLen);
+  if (status == PSA_SUCCESS && outputLen != secret.size()) {
+    return PSA_ERROR_CORRUPTION_DETECTED;
+  }
+  return status;
+}
+
+// Runs one of the HKDF algorithms with the inputs it takes, in the order it
+// takes them. An empty salt is left out, which HKDF takes as all zeroes. Info
+// has to be given to HKDF and HKDF-Expand even if empty, or mbedtls won't
+// output anything, and can't be given to HKDF-Extract.
+psa_status_t derive(psa_algorithm_t alg, std::span<const uint8_t> salt,
+                    std::span<const uint8_t> secret,
+                    std::span<const uint8_t> info, std::span<uint8_t> output) {
+  psa_key_derivation_operation_t operation =
+      psa_key_derivation_operation_init();
+  psa_status_t status = psa_key_derivation_setup(&operation, alg);
+  if (status == PSA_SUCCESS && !salt.empty()) {
+    status = psa_key_derivation_input_bytes(
+        &operation, PSA_KEY_DERIVATION_INPUT_SALT, salt.data(), salt.size());
+  }
+  if (status == PSA_SUCCESS) {
+    status = psa_key_derivation_input_bytes(&operation,
+                                            PSA_KEY_DERIVATION_INPUT_SECRET,
+                                            secret.data(), secret.size());
+  }
+  if (status == PSA_SUCCESS && !PSA_ALG_IS_HKDF_EXTRACT(alg)) {
+    status = psa_key_derivation_input_bytes(
+        &operation, PSA_KEY_DERIVATION_INPUT_INFO, info.data(), info.size());
+  }
+  if (status == PSA_SUCCESS) {
+    status = psa_key_derivation_output_bytes(&operation, output.data(),
+                                             output.size());
+  }
+  psa_key_derivation_abort(&operation);
+  return status;
+}
+
+int hkdfExtract(std::span<const uint8_t> salt, std::span<const uint8_t> ikm,
+                std::span<uint8_t, PRK_SIZE> prk) {
+  return derive(PSA_ALG_HKDF_EXTRACT(PSA_ALG_SHA_256), salt, ikm, {}, prk);
+}
+
+int hkdfExpand(std::span<const uint8_t, PRK_SIZE> prk,
+               std::span<const uint8_t> info, std::span<uint8_t> okm) {
+  return derive(PSA_ALG_HKDF_EXPAND(PSA_ALG_SHA_256), {}, prk, info, okm);
+}
+
+int hkdf(std::span<const uint8_t> salt, std::span<const uint8_t> ikm,
+         std::span<const uint8_t> info, std::span<uint8_t> okm) {
+  return derive(PSA_ALG_HKDF(PSA_ALG_SHA_256), salt, ikm, info, okm);
+}
+
+void initAead(AeadKey &key) {
+  key.id = MBEDTLS_SVC_KEY_ID_INIT;
+  key.operation = psa_aead_operation_init();
+}
+
+void freeAead(AeadKey &key) {
+  psa_aead_abort(&key.operation);
+  psa_destroy_key(key.id);
+  key.id = MBEDTLS_SVC_KEY_ID_INIT;
+}
+
+int setAeadKey(AeadKey &key, std::span<const uint8_t, AEAD_KEY_SIZE> keyBytes) {
+  freeAead(key);
+  psa_key_attributes_t attributes = psa_key_attributes_init();
+  psa_set_key_type(&attributes, PSA_KEY_TYPE_AES);
+  psa_set_key_bits(&attributes, keyBytes.size() * 8);
+  psa_set_key_usage_flags(&attributes,
+                          PSA_KEY_USAGE_ENCRYPT | PSA_KEY_USAGE_DECRYPT);
+  psa_set_key_algorithm(&attributes, PSA_ALG_GCM);
+  return psa_import_key(&attributes, keyBytes.data(), keyBytes.size(),
+                        &key.id);
+}
+
+int aeadEncrypt(AeadKey &key, std::span<const uint8_t, AEAD_IV_SIZE> iv,
+                std::span<const uint8_t> plaintext, uint8_t *output) {
+  size_t outputLen;
+  return psa_aead_encrypt(key.id, PSA_ALG_GCM, iv.data(), iv.size(), nullptr,
+                          0, plaintext.data(), plaintext.size(), output,
+                          plaintext.size() + AEAD_TAG_SIZE, &outputLen);
+}
+
+// mbedtls copies the caller's buffers (MBEDTLS_PSA_COPY_CALLER_BUFFERS), so
+// the output can overlap the input
+int aeadDecrypt(AeadKey &key, std::span<const uint8_t, AEAD_IV_SIZE> iv,
+                std::span<const uint8_t> encrypted, uint8_t *output) {
+  if (encrypted.size() < AEAD_TAG_SIZE) {
+    return PSA_ERROR_INVALID_ARGUMENT;
+  }
+  size_t outputLen;
+  return psa_aead_decrypt(key.id, PSA_ALG_GCM, iv.data(), iv.size(), nullptr,
+                          0, encrypted.data(), encrypted.size(), output,
+                          encrypted.size() - AEAD_TAG_SIZE, &outputLen);
+}
+
+int aeadDecryptStart(AeadKey &key, std::span<const uint8_t, AEAD_IV_SIZE> iv) {
+  psa_aead_abort(&key.operation);
+  psa_status_t status =
+      psa_aead_decrypt_setup(&key.operation, key.id, PSA_ALG_GCM);
+  if (status == PSA_SUCCESS) {
+    status = psa_aead_set_nonce(&key.operation, iv.data(), iv.size());
+  }
+  return status;
+}
+
+int aeadDecryptUpdate(AeadKey &key, std::span<const uint8_t> ciphertext,
+                      uint8_t *output) {
+  size_t outputLen;
+  psa_status_t status =
+      psa_aead_update(&key.operation, ciphertext.data(), ciphertext.size(),
+                      output, ciphertext.size(), &outputLen);
+  // mbedtls's GCM never holds any back
+  if (status == PSA_SUCCESS && outputLen != ciphertext.size()) {
+    return PSA_ERROR_CORRUPTION_DETECTED;
+  }
+  return status;
+}
+
+int aeadDecryptFinish(AeadKey &key,
+                      std::span<const uint8_t, AEAD_TAG_SIZE> tag) {
+  size_t outputLen;
+  psa_status_t status = psa_aead_verify(&key.operation, nullptr, 0, &outputLen,
+                                        tag.data(), tag.size());
+  psa_aead_abort(&key.operation);
+  return status;
+}
+
+} // namespace CryptoBackend
+
+#endif
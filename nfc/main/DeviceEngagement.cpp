@@ -0,0 +1,95 @@
+#include "DeviceEngagement.h"
+#include "CborReader.h"
+#include <cstdint>
+#include <span>
+
+namespace DeviceEngagement {
+
+namespace {
+
+using namespace CborReader;
+
+constexpr int64_t SECURITY_KEY = 1;
+constexpr uint64_t CIPHER_SUITE = 1;
+constexpr int64_t COSE_X_KEY = -2;
+constexpr int64_t COSE_Y_KEY = -3;
+
+// Calls onEntry(key) for each entry of a map with an integer key, which has
+// to read or skip the entry's value. Entries with other keys are skipped.
+template <typename F> Error forEachEntry(Reader &reader, F &&onEntry) {
+  uint64_t count;
+  CHECK_DECODE(reader.expect(MAP, count));
+  for (uint64_t i = 0; i < count; ++i) {
+    uint8_t major;
+    uint64_t argument;
+    CHECK_DECODE(reader.head(major, argument));
+    if ((major != UNSIGNED && major != NEGATIVE) || argument > INT64_MAX) {
+      CHECK_DECODE(reader.skipRest(major, argument, 0));
+      CHECK_DECODE(reader.skip());
+      continue;
+    }
+    CHECK_DECODE(onEntry(major == UNSIGNED
+                             ? static_cast<int64_t>(argument)
+                             : -1 - static_cast<int64_t>(argument)));
+  }
+  return Error::NONE;
+}
+
+Error coordinate(Reader &reader, std::span<const uint8_t> &out) {
+  CHECK_DECODE(reader.bytes(out));
+  return out.size() == COORD_LENGTH ? Error::NONE : Error::UNEXPECTED;
+}
+
+Error coseKey(std::span<const uint8_t> bytes, DeviceKey &key) {
+  Reader reader(bytes);
+  CHECK_DECODE(forEachEntry(reader, [&](int64_t label) {
+    if (label == COSE_X_KEY) {
+      return coordinate(reader, key.x);
+    }
+    if (label == COSE_Y_KEY) {
+      return coordinate(reader, key.y);
+    }
+    return reader.skip();
+  }));
+  return key.x.empty() || key.y.empty() ? Error::UNEXPECTED : Error::NONE;
+}
+
+// Security = [cipherSuiteIdentifier, EDeviceKeyBytes]
+Error security(Reader &reader, DeviceKey &key) {
+  uint64_t count;
+  CHECK_DECODE(reader.expect(ARRAY, count));
+  if (count != 2) {
+    return Error::UNEXPECTED;
+  }
+  uint64_t cipherSuite;
+  CHECK_DECODE(reader.expect(UNSIGNED, cipherSuite));
+  if (cipherSuite != CIPHER_SUITE) {
+    return Error::UNSUPPORTED;
+  }
+
+  const uint8_t *taggedStart = reader.position();
+  uint64_t tag;
+  CHECK_DECODE(reader.expect(TAG, tag));
+  if (tag != ENCODED_CBOR_TAG) {
+    return Error::UNEXPECTED;
+  }
+  CHECK_DECODE(reader.bytes(key.coseKey));
+  key.tagged = {taggedStart, reader.position()};
+  return coseKey(key.coseKey, key);
+}
+
+} // namespace
+
+Error parse(std::span<const uint8_t> engagement, DeviceKey &key) {
+  key = {};
+  Reader reader(engagement);
+  CHECK_DECODE(forEachEntry(reader, [&](int64_t field) {
+    if (field == SECURITY_KEY) {
+      return security(reader, key);
+    }
+    return reader.skip();
+  }));
+  return key.tagged.empty() ? Error::UNEXPECTED : Error::NONE;
+}
+
+} // namespace DeviceEngagement
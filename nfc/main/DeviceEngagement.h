@@ -0,0 +1,33 @@
+#pragma once
+
+#include "CborReader.h"
+#include <cstddef>
+#include <cstdint>
+#include <span>
+
+// Picks the device's ephemeral key out of a DeviceEngagement (ISO 18013-5
+// 8.2.1.1) without copying anything: every part of the key is a span into the
+// engagement, so the ident, the session key and the transcript can all use
+// the bytes the wallet sent. Doesn't depend on Arduino or ESP-IDF.
+namespace DeviceEngagement {
+
+constexpr size_t COORD_LENGTH = 32;
+
+struct DeviceKey {
+  // EDeviceKeyBytes, i.e. tag 24 and the byte string, which the BLE ident is
+  // derived from
+  std::span<const uint8_t> tagged;
+  // The COSE_Key inside it
+  std::span<const uint8_t> coseKey;
+  // P-256 coordinates, COORD_LENGTH each
+  std::span<const uint8_t> x;
+  std::span<const uint8_t> y;
+};
+
+using Error = CborReader::Error;
+using CborReader::errorString;
+
+// Only cipher suite 1 is supported, otherwise it's UNSUPPORTED
+Error parse(std::span<const uint8_t> engagement, DeviceKey &key);
+
+} // namespace DeviceEngagement
@@ -0,0 +1,183 @@
+#include "DeviceResponse.h"
+#include "CborReader.h"
+#include <cstdint>
+#include <cstring>
+#include <span>
+#include <string_view>
+
+namespace DeviceResponse {
+
+namespace {
+
+using namespace CborReader;
+
+// Calls onEntry(key) for each entry of a map with text keys, which has to
+// read or skip the entry's value
+template <typename F> Error forEachEntry(Reader &reader, F &&onEntry) {
+  uint64_t count;
+  CHECK_DECODE(reader.expect(MAP, count));
+  for (uint64_t i = 0; i < count; ++i) {
+    std::string_view key;
+    CHECK_DECODE(reader.text(key));
+    CHECK_DECODE(onEntry(key));
+  }
+  return Error::NONE;
+}
+
+class Decoder {
+public:
+  Decoder(const ElementIndex &index, std::span<Value> values)
+      : index_(index), values_(values) {}
+
+  Error response(Reader &reader, Result &result) {
+    return forEachEntry(reader, [&](std::string_view key) {
+      if (key == "documents") {
+        return forEachItem(reader, [&] {
+          ++result.documents;
+          return document(reader);
+        });
+      }
+      if (key == "status") {
+        return reader.expect(UNSIGNED, result.status);
+      }
+      return reader.skip();
+    });
+  }
+
+private:
+  Error document(Reader &reader) {
+    return forEachEntry(reader, [&](std::string_view key) {
+      if (key != "issuerSigned") {
+        return reader.skip();
+      }
+      return forEachEntry(reader, [&](std::string_view field) {
+        if (field != "nameSpaces") {
+          return reader.skip();
+        }
+        // Each namespace's IssuerSignedItemBytes
+        return forEachEntry(reader, [&](std::string_view) {
+          return forEachItem(reader, [&] { return itemBytes(reader); });
+        });
+      });
+    });
+  }
+
+  Error itemBytes(Reader &reader) {
+    uint64_t tag;
+    CHECK_DECODE(reader.expect(TAG, tag));
+    if (tag != ENCODED_CBOR_TAG) {
+      return Error::UNEXPECTED;
+    }
+    std::span<const uint8_t> bytes;
+    CHECK_DECODE(reader.bytes(bytes));
+    Reader itemReader(bytes);
+    return item(itemReader);
+  }
+
+  // elementValue can come before elementIdentifier (it does with
+  // deterministic encoding), so where it is is kept until it's known whether
+  // it's wanted
+  Error item(Reader &reader) {
+    std::string_view identifier;
+    bool hasIdentifier = false;
+    const uint8_t *valueAt = nullptr;
+    CHECK_DECODE(forEachEntry(reader, [&](std::string_view key) {
+      if (key == "elementIdentifier") {
+        hasIdentifier = true;
+        return reader.text(identifier);
+      }
+      if (key == "elementValue") {
+        valueAt = reader.position();
+      }
+      return reader.skip();
+    }));
+    if (!hasIdentifier || valueAt == nullptr) {
+      return Error::UNEXPECTED;
+    }
+
+    int slot = index_.find(identifier);
+    if (slot < 0 || static_cast<size_t>(slot) >= values_.size() ||
+        values_[slot].type != Value::Type::MISSING) {
+      return Error::NONE;
+    }
+    Reader valueReader({valueAt, reader.end()});
+    return value(valueReader, identifier, values_[slot], 0);
+  }
+
+  // Values of other types are left MISSING
+  Error value(Reader &reader, std::string_view identifier, Value &out,
+              int depth) {
+    uint8_t major;
+    uint64_t argument;
+    CHECK_DECODE(reader.head(major, argument));
+    // Dates are tagged
+    while (major == TAG) {
+      CHECK_DECODE(reader.head(major, argument));
+    }
+
+    switch (major) {
+    case TEXT: {
+      std::span<const uint8_t> bytes;
+      CHECK_DECODE(reader.take(argument, bytes));
+      if (bytes.size() >= MAX_TEXT_SIZE) {
+        return Error::TOO_LONG;
+      }
+      memcpy(out.text, bytes.data(), bytes.size());
+      out.text[bytes.size()] = '\0';
+      out.textLen = bytes.size();
+      out.type = Value::Type::TEXT;
+      return Error::NONE;
+    }
+    case SIMPLE:
+      if (argument == SIMPLE_FALSE || argument == SIMPLE_TRUE) {
+        out.boolean = argument == SIMPLE_TRUE;
+        out.type = Value::Type::BOOL;
+      }
+      return Error::NONE;
+    case MAP:
+      // A photo ID's birth_date is wrapped in a map, under the same name
+      if (depth >= MAX_DEPTH) {
+        return Error::UNSUPPORTED;
+      }
+      for (uint64_t i = 0; i < argument; ++i) {
+        uint8_t keyMajor;
+        uint64_t keyArgument;
+        CHECK_DECODE(reader.head(keyMajor, keyArgument));
+        if (keyMajor != TEXT) {
+          CHECK_DECODE(reader.skipRest(keyMajor, keyArgument, depth + 1));
+          CHECK_DECODE(reader.skip(depth + 1));
+          continue;
+        }
+        std::span<const uint8_t> key;
+        CHECK_DECODE(reader.take(keyArgument, key));
+        if (std::string_view{reinterpret_cast<const char *>(key.data()),
+                             key.size()} == identifier) {
+          return value(reader, identifier, out, depth + 1);
+        }
+        CHECK_DECODE(reader.skip(depth + 1));
+      }
+      return Error::NONE;
+    default:
+      return reader.skipRest(major, argument, depth);
+    }
+  }
+
+  const ElementIndex &index_;
+  std::span<Value> values_;
+};
+
+} // namespace
+
+Result decode(std::span<const uint8_t> response, const ElementIndex &index,
+              std::span<Value> values) {
+  for (Value &value : values) {
+    value.type = Value::Type::MISSING;
+  }
+  Result result;
+  Reader reader(response);
+  Decoder decoder(index, values);
+  result.error = decoder.response(reader, result);
+  return result;
+}
+
+} // namespace DeviceResponse
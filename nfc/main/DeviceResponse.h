@@ -0,0 +1,118 @@
+#pragma once
+
+#include "CborReader.h"
+#include "MdocRequest.h"
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <string_view>
+
+// Decodes a wallet's DeviceResponse (ISO 18013-5 8.3.2.1.2.2) in one pass,
+// picking out the requested data elements from every document and namespace
+// as it goes and skipping everything else (issuerAuth, deviceSigned, ...)
+// without looking inside. Doesn't depend on Arduino or ESP-IDF, so it also
+// builds on the host for benchmarking (see nfc/host).
+namespace DeviceResponse {
+
+// Including the NUL
+constexpr size_t MAX_TEXT_SIZE = 64;
+
+// Where a requested element's value is written
+struct Value {
+  enum class Type : uint8_t { MISSING, TEXT, BOOL };
+  Type type = Type::MISSING;
+  bool boolean = false;
+  uint8_t textLen = 0;
+  // NUL terminated
+  char text[MAX_TEXT_SIZE];
+
+  std::string_view textView() const { return {text, textLen}; }
+};
+
+// Finds which requested element an identifier is, with a perfect hash built
+// at compile time over both documents' identifiers for the elements
+class ElementIndex {
+public:
+  constexpr explicit ElementIndex(
+      std::span<const MdocRequest::Element> elements) {
+    for (uint32_t seed = 0; seed < MAX_SEED; ++seed) {
+      if (build(elements, seed)) {
+        valid_ = true;
+        return;
+      }
+    }
+  }
+
+  // Whether a perfect hash was found, which should be static_asserted
+  constexpr bool valid() const { return valid_; }
+
+  // The element's position in the request, or -1 if it wasn't requested
+  constexpr int find(std::string_view identifier) const {
+    size_t bucket = hash(identifier, seed_) % BUCKETS;
+    return names_[bucket] == identifier ? slots_[bucket] : -1;
+  }
+
+private:
+  static constexpr size_t BUCKETS = 4 * MdocRequest::MAX_ELEMENTS;
+  static constexpr uint32_t MAX_SEED = 1000;
+
+  // FNV-1a
+  static constexpr uint32_t hash(std::string_view text, uint32_t seed) {
+    uint32_t hash = 2166136261u ^ seed;
+    for (char c : text) {
+      hash = (hash ^ static_cast<uint8_t>(c)) * 16777619u;
+    }
+    return hash;
+  }
+
+  constexpr bool add(std::string_view name, int slot) {
+    size_t bucket = hash(name, seed_) % BUCKETS;
+    if (slots_[bucket] != -1) {
+      return names_[bucket] == name;
+    }
+    names_[bucket] = name;
+    slots_[bucket] = slot;
+    return true;
+  }
+
+  constexpr bool build(std::span<const MdocRequest::Element> elements,
+                       uint32_t seed) {
+    seed_ = seed;
+    for (size_t i = 0; i < BUCKETS; ++i) {
+      names_[i] = {};
+      slots_[i] = -1;
+    }
+    if (elements.size() > MdocRequest::MAX_ELEMENTS) {
+      return false;
+    }
+    for (size_t i = 0; i < elements.size(); ++i) {
+      if (!add(elements[i].mdl, i) || !add(elements[i].photoId, i)) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  uint32_t seed_ = 0;
+  bool valid_ = false;
+  std::string_view names_[BUCKETS] = {};
+  int8_t slots_[BUCKETS] = {};
+};
+
+using Error = CborReader::Error;
+using CborReader::errorString;
+
+struct Result {
+  Error error = Error::NONE;
+  // DeviceResponse status, 0 for OK
+  uint64_t status = 0;
+  size_t documents = 0;
+};
+
+// Writes each requested element's value into values, in request order. The
+// first document to have an element wins. Elements that aren't in the
+// response are left MISSING.
+Result decode(std::span<const uint8_t> response, const ElementIndex &index,
+              std::span<Value> values);
+
+} // namespace DeviceResponse
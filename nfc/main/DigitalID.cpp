@@ -1,20 +1,28 @@
 #include "Arduino.h"
 #include "Crypto.h"
+#include "DeviceEngagement.h"
+#include "DeviceResponse.h"
+#include "Encode.h"
+#include "Handover.h"
+#include "MdocRequest.h"
 #include "NFC.h"
+#include "NdefReader.h"
 #include "Radio.h"
 #include "Slice.h"
+#include "Tnep.h"
 #include "errors.h"
 #include "freertos/idf_additions.h"
 #include "utils.h"
-#include <NdefMessage.h>
-#include <NdefRecord.h>
 #include <NimBLEAttValue.h>
 #include <NimBLECharacteristic.h>
 #include <NimBLEDevice.h>
 #include <NimBLELocalValueAttribute.h>
 #include <NimBLEServer.h>
+#include <algorithm>
 #include <cbor.h>
+#include <cinttypes>
 #include <cstdint>
+#include <esp_timer.h>
 #include <initializer_list>
 #include <optional>
 #include <ranges>
@@ -26,6 +34,30 @@ namespace DigitalID {
 
 constexpr size_t RESPONSE_BUFFER_SIZE = 5000;
 
+// What a tap asks the wallet for, which is what's sent on to the intercom, so
+// the bridge has to expect the same. MdocRequest::AgeOver<21>::ELEMENTS only
+// asks whether the holder is over 21, for a much smaller response.
+constexpr std::span<const MdocRequest::Element> REQUESTED_ELEMENTS =
+    MdocRequest::IDENTITY;
+static_assert(REQUESTED_ELEMENTS.size() <= MdocRequest::MAX_ELEMENTS);
+constexpr DeviceResponse::ElementIndex ELEMENT_INDEX{REQUESTED_ELEMENTS};
+static_assert(ELEMENT_INDEX.valid(), "No perfect hash for the elements");
+
+// With the device currently handed off to over BLE
+Crypto::Session session;
+constexpr auto UNENCRYPTED_REQUEST = Encode::build<[](Encode::Writer &writer) {
+  MdocRequest::encode(writer, REQUESTED_ELEMENTS);
+}>();
+uint8_t encryptedRequestBuf[sizeof(UNENCRYPTED_REQUEST) + Crypto::TAG_SIZE];
+// SessionEstablishment (ISO 18013-5 9.1.1.4) up to the reader key, after a
+// byte that says it's the last (and only) part of the message
+constexpr auto ESTABLISHMENT_START = Encode::build<[](Encode::Writer &writer) {
+  writer.append(0x00);
+  Encode::Cbor::map(writer, 2);
+  Encode::Cbor::text(writer, "eReaderKey");
+  Encode::Cbor::embeddedHead(writer, Crypto::ENCODED_READER_PUBLIC_KEY_LENGTH);
+}>();
+
 class ServerCallbacks : public NimBLEServerCallbacks {
   void onConnect(NimBLEServer *pServer, NimBLEConnInfo &connInfo) override {
     ESP_LOGI(TAG, "Connected!");
@@ -95,6 +127,76 @@ class ServerToClientCharacteristicCallbacks
   };
 } serverToClientCharacteristicCallbacks;
 
+// Finds the encrypted data in a whole SessionData message and decrypts it
+// into writeSlice, which the message must be at the start of
+std::optional<std::span<const uint8_t>>
+decryptSessionData(std::span<const uint8_t> message, WriteSlice &writeSlice) {
+  const uint8_t *encrypted = nullptr;
+  size_t encryptedLen;
+  CborParser parser;
+  CborValue value;
+  CHECK_CBOR_RETURN_OPT(
+      "CBOR parser fialed to initialize",
+      cbor_parser_init(message.data(), message.size(), 0, &parser, &value));
+  CHECK_PRINT_RETURN_OPT("CBOR value is not map", cbor_value_is_map(&value));
+  CHECK_CBOR_RETURN_OPT("Failed to enter map",
+                        cbor_value_enter_container(&value, &value));
+  bool found = false;
+  while (!cbor_value_at_end(&value)) {
+    CHECK_CBOR_RETURN_OPT(
+        "Failed to check if key is data",
+        cbor_value_text_string_equals(&value, "data", &found));
+    if (found) {
+      CHECK_CBOR_RETURN_OPT("Failed to advance past data key",
+                            cbor_value_advance(&value));
+      CHECK_PRINT_RETURN_OPT("data is not byte string",
+                             cbor_value_is_byte_string(&value));
+
+      // Hopefully all of data is one chunk. If not, fail
+      cbor_value_begin_string_iteration(&value);
+      CHECK_CBOR_RETURN_OPT("Failed to get data string chunk",
+                            cbor_value_get_byte_string_chunk(
+                                &value, &encrypted, &encryptedLen, &value));
+      CHECK_PRINT_RETURN_OPT("Not at end of string iteration",
+                             cbor_value_string_iteration_at_end(&value));
+      CHECK_CBOR_RETURN_OPT("Failed to finish string iteration",
+                            cbor_value_finish_string_iteration(&value));
+      break;
+    }
+
+    CHECK_CBOR_RETURN_OPT(
+        "Failed to check if key is status",
+        cbor_value_text_string_equals(&value, "status", &found));
+    if (found) {
+      CHECK_CBOR_RETURN_OPT("Failed to advance past status key",
+                            cbor_value_advance(&value));
+      CHECK_PRINT_RETURN_OPT("status is not integer",
+                             cbor_value_is_integer(&value));
+      int status;
+      cbor_value_get_int(&value, &status);
+      ESP_LOGI(TAG, "Got message with status: %d", status);
+      CHECK_CBOR_RETURN_OPT("Failed to advance past status value",
+                            cbor_value_advance(&value));
+      break;
+    }
+
+    CHECK_CBOR_RETURN_OPT("Failed to advance past key",
+                          cbor_value_advance(&value));
+    CHECK_CBOR_RETURN_OPT("Failed to advance past value",
+                          cbor_value_advance(&value));
+  }
+  CHECK_PRINT_RETURN_OPT("Failed to find data or status in message", found);
+
+  std::span<const uint8_t> encryptedSpan{encrypted, encryptedLen};
+
+  writeSlice.reset();
+  // mbedtls allows the input and output buffers to overlap, but the output
+  // buffer must trail at least 8 bytes behind the input buffer
+  CHECK_PRINT_RETURN_OPT("Unable to share buffer for decryption",
+                         writeSlice.data() + 8 <= encrypted);
+  return session.decrypt(encryptedSpan, writeSlice);
+}
+
 class ClientToServerCharacteristicCallbacks
     : public NimBLECharacteristicCallbacks {
   void onWrite(NimBLECharacteristic *pCharacteristic,
@@ -107,30 +209,35 @@ class ClientToServerCharacteristicCallbacks
     printHex("Received encrypted client to server characteristic: ", chunk);
     if (chunk.size() == 0) {
       ESP_LOGE(TAG, "Received empty chunk");
+      return;
     }
 
     static uint8_t *messageBuffer = new uint8_t[RESPONSE_BUFFER_SIZE];
     static WriteSlice writeSlice(messageBuffer, RESPONSE_BUFFER_SIZE);
-    std::span<const uint8_t> message;
+    static Crypto::ResponseDecryptor decryptor(session, writeSlice);
+    bool complete;
     switch (chunk[0]) {
     case 0:
       ESP_LOGI(TAG, "Received complete message");
-      if (writeSlice.len() == 0) {
-        message = chunk.subspan(1);
-      } else {
-        writeSlice.append(chunk.subspan(1));
-        message = writeSlice.spanAndReset();
-      }
+      complete = true;
       break;
     case 1:
       ESP_LOGI(TAG, "Received partial message");
-      writeSlice.append(chunk.subspan(1));
-      return;
+      complete = false;
+      break;
     default:
       ESP_LOGE(TAG, "Unknown message type: %d", chunk[0]);
       return;
     };
-    printHex("Got complete message ", message);
+    // Decrypted as it arrives where possible
+    if (!decryptor.feed(chunk.subspan(1))) {
+      ESP_LOGE(TAG, "Failed to take message chunk");
+      decryptor.reset();
+      return;
+    }
+    if (!complete) {
+      return;
+    }
 
     bool success = pCharacteristic->getService()->getServer()->disconnect(
         connInfo.getConnHandle());
@@ -138,212 +245,33 @@ class ClientToServerCharacteristicCallbacks
       ESP_LOGE(TAG, "Failed to disconnect");
     }
 
-    const uint8_t *encrypted = nullptr;
-    size_t encryptedLen;
-    CborParser parser;
-    CborValue value;
-    CHECK_CBOR_RETURN(
-        "CBOR parser fialed to initialize",
-        cbor_parser_init(message.data(), message.size(), 0, &parser, &value));
-    CHECK_PRINT_RETURN("CBOR value is not map", cbor_value_is_map(&value));
-    CHECK_CBOR_RETURN("Failed to enter map",
-                      cbor_value_enter_container(&value, &value));
-    bool found = false;
-    while (!cbor_value_at_end(&value)) {
-      CHECK_CBOR_RETURN("Failed to check if key is data",
-                        cbor_value_text_string_equals(&value, "data", &found));
-      if (found) {
-        CHECK_CBOR_RETURN("Failed to advance past data key",
-                          cbor_value_advance(&value));
-        CHECK_PRINT_RETURN("data is not byte string",
-                           cbor_value_is_byte_string(&value));
-
-        // Hopefully all of data is one chunk. If not, fail
-        cbor_value_begin_string_iteration(&value);
-        CHECK_CBOR_RETURN("Failed to get data string chunk",
-                          cbor_value_get_byte_string_chunk(
-                              &value, &encrypted, &encryptedLen, &value));
-        CHECK_PRINT_RETURN("Not at end of string iteration",
-                           cbor_value_string_iteration_at_end(&value));
-        CHECK_CBOR_RETURN("Failed to finish string iteration",
-                          cbor_value_finish_string_iteration(&value));
-        break;
-      }
-
-      CHECK_CBOR_RETURN(
-          "Failed to check if key is status",
-          cbor_value_text_string_equals(&value, "status", &found));
-      if (found) {
-        CHECK_CBOR_RETURN("Failed to advance past status key",
-                          cbor_value_advance(&value));
-        CHECK_PRINT_RETURN("status is not integer",
-                           cbor_value_is_integer(&value));
-        int status;
-        cbor_value_get_int(&value, &status);
-        ESP_LOGI(TAG, "Got message with status: %d", status);
-        CHECK_CBOR_RETURN("Failed to advance past status value",
-                          cbor_value_advance(&value));
-        break;
-      }
-
-      CHECK_CBOR_RETURN("Failed to advance past key",
-                        cbor_value_advance(&value));
-      CHECK_CBOR_RETURN("Failed to advance past value",
-                        cbor_value_advance(&value));
+    std::optional<std::span<const uint8_t>> unencryptedSpanOpt;
+    if (decryptor.streaming()) {
+      int64_t start = esp_timer_get_time();
+      unencryptedSpanOpt = decryptor.finish();
+      ESP_LOGI(TAG, "Checked response tag in %" PRId64 " us",
+               esp_timer_get_time() - start);
+    } else {
+      std::span<const uint8_t> message = decryptor.takeBuffered();
+      printHex("Got complete message ", message);
+      unencryptedSpanOpt = decryptSessionData(message, writeSlice);
     }
-    CHECK_PRINT_RETURN("Failed to find data or status in message", found);
-
-    std::span<const uint8_t> encryptedSpan{encrypted, encryptedLen};
-
-    writeSlice.reset();
-    // mbedtls allows the input and output buffers to overlap, but the output
-    // buffer must trail at least 8 bytes behind the input buffer
-    CHECK_PRINT_RETURN("Unable to share buffer for decryption",
-                       writeSlice.data() + 8 <= encrypted);
-    std::optional<std::span<const uint8_t>> unencryptedSpanOpt =
-        Crypto::decryptResponse(encryptedSpan, writeSlice);
+    decryptor.reset();
+    // Only one response is asked for
+    session.end();
     CHECK_PRINT_RETURN("Failed to decrypt response",
                        unencryptedSpanOpt.has_value());
     printHex("Unencrypted client to server characteristic: ",
              *unencryptedSpanOpt);
 
-    CborParser decryptParser;
-    CborValue decryptValue;
-    CHECK_CBOR_RETURN("CBOR parser fialed to initialize",
-                      cbor_parser_init(unencryptedSpanOpt->data(),
-                                       unencryptedSpanOpt->size(), 0,
-                                       &decryptParser, &decryptValue));
-    CHECK_PRINT_RETURN("CBOR value is not map",
-                       cbor_value_is_map(&decryptValue));
-    CHECK_CBOR_RETURN(
-        "Failed to find documents key",
-        cbor_value_map_find_value(&decryptValue, "documents", &decryptValue));
-    CHECK_PRINT_RETURN("documents is not an array",
-                       cbor_value_is_array(&decryptValue));
-    CHECK_CBOR_RETURN("Failed to enter array",
-                      cbor_value_enter_container(&decryptValue, &decryptValue));
-    CHECK_PRINT_RETURN("first document is not a map",
-                       cbor_value_is_map(&decryptValue));
-    CHECK_CBOR_RETURN("Failed to find issuerSigned key",
-                      cbor_value_map_find_value(&decryptValue, "issuerSigned",
-                                                &decryptValue));
-    CHECK_PRINT_RETURN("issuerSigned is not a map",
-                       cbor_value_is_map(&decryptValue));
-    CHECK_CBOR_RETURN(
-        "Failed to find nameSpaces key",
-        cbor_value_map_find_value(&decryptValue, "nameSpaces", &decryptValue));
-    CHECK_PRINT_RETURN("nameSpaces is not a map",
-                       cbor_value_is_map(&decryptValue));
-    CHECK_CBOR_RETURN("Failed to enter nameSpaces",
-                      cbor_value_enter_container(&decryptValue, &decryptValue));
-    // check if key exists and is string
-    CHECK_PRINT_RETURN("map key is not a string",
-                       cbor_value_is_text_string(&decryptValue));
-    // advance
-    CHECK_CBOR_RETURN("Failed to advance to value",
-                      cbor_value_advance(&decryptValue));
-    // check if value is array
-    CHECK_PRINT_RETURN("value is not an array",
-                       cbor_value_is_array(&decryptValue));
-    // get array size
-    size_t arraySize;
-    CHECK_CBOR_RETURN("Failed to get array size",
-                      cbor_value_get_array_length(&decryptValue, &arraySize));
-    Serial.printf("Array size: %d\n", arraySize);
-    CHECK_CBOR_RETURN("Failed to enter array",
-                      cbor_value_enter_container(&decryptValue, &decryptValue));
-
-    size_t givenNameLen = 50, familyNameLen = 50, birthDateLen = 50;
-    char givenName[givenNameLen], familyName[familyNameLen],
-        birthDate[birthDateLen];
-    for (size_t i = 0; i < arraySize; ++i) {
-      CHECK_PRINT_RETURN("value is not tagged",
-                         cbor_value_is_tag(&decryptValue));
-      CHECK_CBOR_RETURN("Failed to skip tag",
-                        cbor_value_skip_tag(&decryptValue));
-      // check if value is byte string
-      CHECK_PRINT_RETURN("value is not a byte string",
-                         cbor_value_is_byte_string(&decryptValue));
-      CHECK_CBOR_RETURN("Failed to begin string iteration",
-                        cbor_value_begin_string_iteration(&decryptValue));
-      const uint8_t *chunk;
-      size_t chunkLen;
-      CHECK_CBOR_RETURN("Failed to get data string chunk",
-                        cbor_value_get_byte_string_chunk(
-                            &decryptValue, &chunk, &chunkLen, &decryptValue));
-      printHex("Chunk: ", {chunk, chunkLen});
-      // Assuming only one chunk, so should be at end
-      CHECK_PRINT_RETURN("Not at end of string iteration",
-                         cbor_value_string_iteration_at_end(&decryptValue));
-      CHECK_CBOR_RETURN("Failed to finish string iteration",
-                        cbor_value_finish_string_iteration(&decryptValue));
-
-      CborParser chunkParser;
-      CborValue chunkValue, itemValue;
-      CHECK_CBOR_RETURN(
-          "CBOR parser failed to initialize",
-          cbor_parser_init(chunk, chunkLen, 0, &chunkParser, &chunkValue));
-      CHECK_PRINT_RETURN("CBOR value is not map",
-                         cbor_value_is_map(&chunkValue));
-      // get key elementIdentifier
-      CHECK_CBOR_RETURN("Failed to get key elementIdentifier",
-                        cbor_value_map_find_value(
-                            &chunkValue, "elementIdentifier", &itemValue));
-      CHECK_PRINT_RETURN("elementIdentifier is not a string",
-                         cbor_value_is_text_string(&itemValue));
-      size_t elementIdentifierLen = 50;
-      char elementIdentifier[elementIdentifierLen];
-      CHECK_CBOR_RETURN(
-          "Failed to get elementIdentifier",
-          cbor_value_copy_text_string(&itemValue, elementIdentifier,
-                                      &elementIdentifierLen, &itemValue));
-      std::string_view elementIdentifierView(elementIdentifier,
-                                             elementIdentifierLen);
-
-      // get key elementValue
-      CHECK_CBOR_RETURN(
-          "Failed to get key elementValue",
-          cbor_value_map_find_value(&chunkValue, "elementValue", &itemValue));
-
-      char *buffer = nullptr;
-      size_t *bufferLen = 0;
-      Serial.printf("Element identifier: %s\n", elementIdentifierView.data());
-      if (elementIdentifierView.contains("given_name")) {
-        buffer = givenName;
-        bufferLen = &givenNameLen;
-      } else if (elementIdentifierView.contains("family_name")) {
-        buffer = familyName;
-        bufferLen = &familyNameLen;
-      } else if (elementIdentifierView.contains("birth_date")) {
-        buffer = birthDate;
-        bufferLen = &birthDateLen;
-        // For digital ID, birth date the value is wrapped in another map, so we
-        // need to advance itemValue to that location
-        if (!cbor_value_is_tag(&itemValue)) {
-          CHECK_PRINT_RETURN("birth_date is not tag+string nor map",
-                             cbor_value_is_map(&itemValue));
-          CHECK_CBOR_RETURN(
-              "Failed to get key birth_date",
-              cbor_value_map_find_value(&itemValue, "birth_date", &itemValue));
-        }
-        // Birth date has a random tag before the data
-        CHECK_CBOR_RETURN("Failed to skip tag",
-                          cbor_value_skip_tag(&itemValue));
-      } else {
-        ESP_LOGE(TAG, "Unknown element identifier: %s",
-                 elementIdentifierView.data());
-        continue;
-      }
-      // Sometimes there's a random tag before the data
-      CHECK_PRINT_RETURN("elementValue is not a string",
-                         cbor_value_is_text_string(&itemValue));
-      CHECK_CBOR_RETURN("Failed to copy elementValue",
-                        cbor_value_copy_text_string(&itemValue, buffer,
-                                                    bufferLen, &itemValue));
-    }
-    ESP_LOGI(TAG, "Given name: %s", givenName);
-    ESP_LOGI(TAG, "Family name: %s", familyName);
-    ESP_LOGI(TAG, "Birth date: %s", birthDate);
+    DeviceResponse::Value values[REQUESTED_ELEMENTS.size()];
+    DeviceResponse::Result result =
+        DeviceResponse::decode(*unencryptedSpanOpt, ELEMENT_INDEX, values);
+    CHECK_PRINT_RETURN("Failed to decode response: %s",
+                       result.error == DeviceResponse::Error::NONE,
+                       DeviceResponse::errorString(result.error));
+    ESP_LOGI(TAG, "Response status %" PRIu64 " with %zu documents",
+             result.status, result.documents);
 
     uint8_t radioMessage[150];
     WriteSlice radioMessageSlice(radioMessage, sizeof(radioMessage));
@@ -351,17 +279,33 @@ class ClientToServerCharacteristicCallbacks
         "Failed to append digital id message type",
         radioMessageSlice.append(std::initializer_list{
             static_cast<uint8_t>(Radio::MessageType::DIGITAL_ID)}));
-    const std::initializer_list<const char *> messageData = {
-        givenName, familyName, birthDate};
-    for (const auto &[i, str] : std::views::enumerate(messageData)) {
+    for (size_t i = 0; i < REQUESTED_ELEMENTS.size(); ++i) {
+      std::string_view name = REQUESTED_ELEMENTS[i].mdl;
+      const DeviceResponse::Value &value = values[i];
+      CHECK_PRINT_RETURN("Response is missing %.*s",
+                         value.type != DeviceResponse::Value::Type::MISSING,
+                         static_cast<int>(name.size()), name.data());
       if (i != 0) {
         CHECK_PRINT_RETURN("Failed to append delimeter",
                            radioMessageSlice.append({{';'}}));
       }
+      std::string_view text = value.textView();
+      if (value.type == DeviceResponse::Value::Type::BOOL) {
+        // On its own it wouldn't say what it's the answer to
+        CHECK_PRINT_RETURN(
+            "Failed to append element name",
+            radioMessageSlice.append(
+                {reinterpret_cast<const uint8_t *>(name.data()), name.size()}));
+        CHECK_PRINT_RETURN("Failed to append delimeter",
+                           radioMessageSlice.append({{'='}}));
+        text = value.boolean ? "true" : "false";
+      }
+      ESP_LOGI(TAG, "%.*s: %.*s", static_cast<int>(name.size()), name.data(),
+               static_cast<int>(text.size()), text.data());
       CHECK_PRINT_RETURN(
           "Failed to append data",
           radioMessageSlice.append(
-              {reinterpret_cast<const uint8_t *>(str), strlen(str)}));
+              {reinterpret_cast<const uint8_t *>(text.data()), text.size()}));
     }
 
     auto radioMessageSpan = radioMessageSlice.span();
@@ -384,30 +328,10 @@ class ClientToServerCharacteristicCallbacks
 } clientToServerCharacteristicCallbacks;
 
 uint8_t rbuf[PN532_PACKBUFFSIZ];
-// TODO: really, only one buffer is needed, with two spans.
-uint8_t encodedDevicePublicKeyBuf[PN532_PACKBUFFSIZ];
-uint8_t devicePublicKeyBuf[PN532_PACKBUFFSIZ];
-// Generated via tools/ble-server, originally from spec example
-// Generated via tools/multipaz-sandbox
-uint8_t handoverRequestBuf[] = {
-    0x91, 0x02, 0x0A, 0x48, 0x72, 0x15, 0xD1, 0x02, 0x04, 0x61, 0x63, 0x01,
-    0x01, 0x30, 0x00, 0x1C, 0x1E, 0x06, 0x0A, 0x69, 0x73, 0x6F, 0x2E, 0x6F,
-    0x72, 0x67, 0x3A, 0x31, 0x38, 0x30, 0x31, 0x33, 0x3A, 0x72, 0x65, 0x61,
-    0x64, 0x65, 0x72, 0x65, 0x6E, 0x67, 0x61, 0x67, 0x65, 0x6D, 0x65, 0x6E,
-    0x74, 0x6D, 0x64, 0x6F, 0x63, 0x72, 0x65, 0x61, 0x64, 0x65, 0x72, 0xA1,
-    0x00, 0x63, 0x31, 0x2E, 0x30, 0x5A, 0x20, 0x15, 0x01, 0x61, 0x70, 0x70,
-    0x6C, 0x69, 0x63, 0x61, 0x74, 0x69, 0x6F, 0x6E, 0x2F, 0x76, 0x6E, 0x64,
-    0x2E, 0x62, 0x6C, 0x75, 0x65, 0x74, 0x6F, 0x6F, 0x74, 0x68, 0x2E, 0x6C,
-    0x65, 0x2E, 0x6F, 0x6F, 0x62, 0x30, 0x02, 0x1C, 0x00, 0x11, 0x07, 0xA4,
-    0xB2, 0x31, 0xD2, 0x94, 0x69, 0x0B, 0xA9, 0xF9, 0x4F, 0x3C, 0x09, 0x40,
-    0x60, 0x18, 0x82};
-constexpr size_t ENCODED_READER_PUBLIC_KEY_LENGTH = 75;
-uint8_t fullRequestBuf[Crypto::REQUEST_SIZE + ENCODED_READER_PUBLIC_KEY_LENGTH +
-                       32];
-auto handoverRequestSpan =
-    std::span<const uint8_t>(handoverRequestBuf, sizeof(handoverRequestBuf));
+uint8_t fullRequestBuf[sizeof(encryptedRequestBuf) +
+                       Crypto::ENCODED_READER_PUBLIC_KEY_LENGTH + 32];
 uint8_t sessionTranscriptBuf[PN532_PACKBUFFSIZ * 3];
-constexpr size_t COORD_LENGTH = 32;
+constexpr size_t COORD_LENGTH = DeviceEngagement::COORD_LENGTH;
 uint8_t deviceXYPubKeyEncodedBuf[COORD_LENGTH * 2 + 1];
 std::span<uint8_t> devicePubKeyX{deviceXYPubKeyEncodedBuf + 1, COORD_LENGTH};
 std::span<uint8_t> devicePubKeyY{deviceXYPubKeyEncodedBuf + 1 + COORD_LENGTH,
@@ -422,14 +346,28 @@ NimBLECharacteristic *serverToClientCharacteristic = nullptr;
 NimBLECharacteristic *identCharacteristic = nullptr;
 NimBLEAdvertising *pAdvertising = nullptr;
 
-std::optional<std::span<const uint8_t>> readNdefFile(bool isCC) {
+// However long the wallet says, a tap shouldn't hang on it
+constexpr uint32_t MAX_NDEF_WAIT_MS = 1000;
+
+// Polls for the file, first right away and then on the tag device's TNEP
+// schedule, so it's read as soon as the wallet has written it
+std::optional<std::span<const uint8_t>>
+readNdefFile(bool isCC, const Tnep::Timing &timing = Tnep::DEFAULT_TIMING) {
   deviceXYPubKeyEncodedBuf[0] = 0x04; // Uncompressed public key
   std::optional<ReadSlice> readSliceOpt;
   ReadSlice readSlice{nullptr, 0};
   uint8_t binaryLength = 0;
-  uint8_t retries = 0;
+  int polls = 0;
+  const int maxPolls = 2 + timing.extensions;
+  const uint32_t waitMs = std::min(timing.waitMs, MAX_NDEF_WAIT_MS);
+  int64_t start = esp_timer_get_time();
+
+  while (binaryLength == 0 && polls < maxPolls) {
+    if (polls > 0) {
+      delay(waitMs);
+    }
+    ++polls;
 
-  while (binaryLength == 0 && retries < 5) {
     // Read return data length
     writeSlice.reset();
     CHECK_RETURN_OPT(writeSlice.append({{0x00, 0xB0, 0x00, 0x00, 0x02}}));
@@ -447,18 +385,16 @@ std::optional<std::span<const uint8_t>> readNdefFile(bool isCC) {
     CHECK_PRINT_RETURN_OPT("Binary length byte 0 is not 0x00",
                            readSlice.span()[0] == 0x00);
     binaryLength = readSlice.span()[1];
-
-    if (binaryLength == 0) {
-      ESP_LOGI(TAG, "No data from NDEF file, retrying...");
-      ++retries;
-      delay(100);
-    }
   }
 
-  if (retries == 5) {
-    ESP_LOGE(TAG, "Did not get any data from NDEF file");
+  int64_t elapsed = esp_timer_get_time() - start;
+  if (binaryLength == 0) {
+    ESP_LOGE(TAG, "Did not get any data from NDEF file in %" PRId64 " us",
+             elapsed);
     return std::nullopt;
   }
+  ESP_LOGI(TAG, "NDEF file ready after %" PRId64 " us, %d polls", elapsed,
+           polls);
 
   if (!isCC)
     binaryLength += 2;
@@ -484,169 +420,129 @@ bool checkIfValid() {
   return data.has_value();
 }
 
-bool encodeReaderPublicKey(CborEncoder *encoder) {
-  // First encode to buf and then encode buf to encoder as a byte string
-  // TODO: Try to do something smarter
-  static uint8_t buf[ENCODED_READER_PUBLIC_KEY_LENGTH];
-  CborEncoder tmpEncoder;
-  cbor_encoder_init(&tmpEncoder, buf, sizeof(buf), 0);
-
-  CborEncoder mapEncoder;
-  CHECK_CBOR_RETURN_BOOL("Failed to create map",
-                         cbor_encoder_create_map(&tmpEncoder, &mapEncoder, 4));
-
-  CHECK_CBOR_RETURN_BOOL("Failed to add key 1",
-                         cbor_encode_int(&mapEncoder, 1));
-  CHECK_CBOR_RETURN_BOOL("Failed to add value 2 for key 1",
-                         cbor_encode_int(&mapEncoder, 2));
-
-  CHECK_CBOR_RETURN_BOOL("Failed to add key -1",
-                         cbor_encode_negative_int(&mapEncoder, 1));
-  CHECK_CBOR_RETURN_BOOL("Failed to add value 1 for key -1",
-                         cbor_encode_int(&mapEncoder, 1));
-
-  auto readerPublicKeyPointsOpt = Crypto::copyReaderPublicKeyPoints();
-  CHECK_RETURN_BOOL(readerPublicKeyPointsOpt);
-  const auto &[xSpan, ySpan] = *readerPublicKeyPointsOpt;
-
-  CHECK_CBOR_RETURN_BOOL("Failed to add key -2",
-                         cbor_encode_negative_int(&mapEncoder, 2));
-  CHECK_CBOR_RETURN_BOOL(
-      "Failed to add value for key -2",
-      cbor_encode_byte_string(&mapEncoder, xSpan.data(), xSpan.size()));
-
-  CHECK_CBOR_RETURN_BOOL("Failed to add key -3",
-                         cbor_encode_negative_int(&mapEncoder, 3));
-  CHECK_CBOR_RETURN_BOOL(
-      "Failed to add value for key -3",
-      cbor_encode_byte_string(&mapEncoder, ySpan.data(), ySpan.size()));
-
-  CHECK_CBOR_RETURN_BOOL("Failed to close map", cbor_encoder_close_container(
-                                                    &tmpEncoder, &mapEncoder));
-
-  size_t numWritten = cbor_encoder_get_buffer_size(&tmpEncoder, buf);
-  if (numWritten != ENCODED_READER_PUBLIC_KEY_LENGTH) {
-    ESP_LOGE(TAG, "Unexpected encoded reader public key length: %d",
-             numWritten);
-    return false;
-  }
-
-  CHECK_CBOR_RETURN_BOOL(
-      "Failed to write encoded reader public key",
-      cbor_encode_byte_string(encoder, buf, ENCODED_READER_PUBLIC_KEY_LENGTH));
-
-  return true;
+// The static parts come from Handover, so only the parts from this tap are
+// copied in
+std::optional<std::span<const uint8_t>>
+encodeTranscript(std::span<const uint8_t> deviceEngagement,
+                 std::span<const uint8_t> handoverSelect) {
+  Encode::Writer writer(sessionTranscriptBuf);
+  writer.append(Handover::TRANSCRIPT_START);
+  Encode::Cbor::bytes(writer, deviceEngagement);
+  auto readerKey = Crypto::encodedReaderPublicKey();
+  Encode::Cbor::embeddedHead(writer, readerKey.size());
+  writer.append(readerKey);
+  Encode::Cbor::array(writer, 2);
+  Encode::Cbor::bytes(writer, handoverSelect);
+  writer.append(Handover::TRANSCRIPT_END);
+
+  size_t length = writer.size() - Handover::TRANSCRIPT_HEAD_SIZE;
+  CHECK_PRINT_RETURN_OPT("Transcript doesn't fit",
+                         writer.fits() && length <= 0xFFFF);
+  sessionTranscriptBuf[Handover::TRANSCRIPT_LENGTH_AT] = length >> 8;
+  sessionTranscriptBuf[Handover::TRANSCRIPT_LENGTH_AT + 1] = length & 0xFF;
+  return writer.written();
 }
 
-void performHandoff() {
+// Everything in a handoff that uses the reader key taken for it: the
+// exchange with the device up to the encrypted request for the BLE session
+std::optional<std::span<const uint8_t>> exchangeHandover() {
   std::optional<ReadSlice> readSliceOpt;
   ReadSlice readSlice{nullptr, 0};
-  uint8_t ndefPayloadBuf[PN532_PACKBUFFSIZ];
-  Crypto::generateNewReaderKeypair();
 
   // All CC/NDEF ADPU commands are from the Type 4 Tag Operation Specification
 
   // SELECT CC
   writeSlice.reset();
-  CHECK_RETURN(
+  CHECK_RETURN_OPT(
       writeSlice.appendApduCommand(0x00, 0xA4, 0x00, 0x0C, {{0xE1, 0x03}}));
   readSliceOpt =
       NFC::exchangeData("Sending SELECT CC File: ", writeSlice.span(), rbuf);
-  CHECK_RETURN(readSliceOpt);
+  CHECK_RETURN_OPT(readSliceOpt);
   readSlice = *readSliceOpt;
 
   printHex("Select CC file: ", readSlice.span());
 
   // Read CC
   auto ccData = readNdefFile(true);
-  CHECK_RETURN(ccData);
+  CHECK_RETURN_OPT(ccData);
   auto ccDataSpan = std::span<const uint8_t>(*ccData);
   // Based on spec, CC data should be at least 13 bytes
   // (15 bytes - 2 bytes for length at beginning)
-  CHECK_PRINT_RETURN("CC data is not at least 13 bytes",
-                     ccDataSpan.size() >= 13);
+  CHECK_PRINT_RETURN_OPT("CC data is not at least 13 bytes",
+                         ccDataSpan.size() >= 13);
   auto ccTlvSpan = ccDataSpan.subspan(5, ccDataSpan.size() - 5);
   printHex("CC TLV: ", ccTlvSpan);
   TLVS tlvs;
   tlvs.decodeTLVs(ccTlvSpan.data(), ccTlvSpan.size());
   TLVNode *fileControlTag = tlvs.findTLV(0x04);
-  CHECK_PRINT_RETURN("Failed to get file control tag from CC data",
-                     fileControlTag != nullptr);
+  CHECK_PRINT_RETURN_OPT("Failed to get file control tag from CC data",
+                         fileControlTag != nullptr);
   std::span<const uint8_t> fileControlValue{fileControlTag->getValue(),
                                             fileControlTag->getValueLength()};
-  CHECK_PRINT_RETURN("File control tag value is not at least length 2",
-                     fileControlValue.size() >= 2);
+  CHECK_PRINT_RETURN_OPT("File control tag value is not at least length 2",
+                         fileControlValue.size() >= 2);
 
   // SELECT NDEF File
   writeSlice.reset();
-  CHECK_RETURN(writeSlice.appendApduCommand(
+  CHECK_RETURN_OPT(writeSlice.appendApduCommand(
       0x00, 0xA4, 0x00, 0x0C, {{fileControlValue[0], fileControlValue[1]}}));
   readSliceOpt =
       NFC::exchangeData("Sending NDEF Select File: ", writeSlice.span(), rbuf);
-  CHECK_RETURN(readSliceOpt);
+  CHECK_RETURN_OPT(readSliceOpt);
   readSlice = *readSliceOpt;
 
   // Read NDEF record. Should contain an NDEF record of type Tp (service
-  // parameter) with data including "urn:nfc:sn:handover". We may want to
-  // parse and verify this more robustly.
+  // parameter) for "urn:nfc:sn:handover".
   auto initialNdefData = readNdefFile(false);
-  CHECK_RETURN(initialNdefData);
+  CHECK_RETURN_OPT(initialNdefData);
 
   auto initialNdefDataSpan = std::span<const uint8_t>(*initialNdefData);
-  auto initialNdefMessage =
-      NdefMessage(initialNdefDataSpan.data(), initialNdefDataSpan.size());
-  CHECK_PRINT_RETURN("Initial NDEF message does not contain one NDEF record",
-                     initialNdefMessage.getRecordCount() == 1);
-  auto serviceParameterRecord = initialNdefMessage.getRecord(0);
-  CHECK_PRINT_RETURN("Record is not a service parameter",
-                     serviceParameterRecord.getType() == "Tp");
-  CHECK_PRINT_RETURN("Service parameter payload length is 0",
-                     serviceParameterRecord.getPayloadLength() > 0);
-  serviceParameterRecord.getPayload(ndefPayloadBuf);
-  auto payloadSpan = std::span<const uint8_t>(
-      ndefPayloadBuf, serviceParameterRecord.getPayloadLength());
-  auto payloadHandoverSearch =
-      std::ranges::search(payloadSpan, std::string_view("urn:nfc:sn:handover"));
-  CHECK_PRINT_RETURN(
-      "Handover service not in the service parameter record payload",
-      payloadHandoverSearch.size() > 0);
+  NdefReader::Record serviceParameterRecord;
+  NdefReader::Error ndefError =
+      NdefReader::only(initialNdefDataSpan, serviceParameterRecord);
+  CHECK_PRINT_RETURN_OPT("Initial NDEF message is not one NDEF record: %s",
+                         ndefError == NdefReader::Error::NONE,
+                         NdefReader::errorString(ndefError));
+  CHECK_PRINT_RETURN_OPT("Record is not a service parameter",
+                         serviceParameterRecord.type == "Tp");
+  Tnep::ServiceParameter serviceParameter;
+  Tnep::Error tnepError =
+      Tnep::parse(serviceParameterRecord.payload, serviceParameter);
+  CHECK_PRINT_RETURN_OPT("Failed to parse service parameter: %s",
+                         tnepError == Tnep::Error::NONE,
+                         Tnep::errorString(tnepError));
+  CHECK_PRINT_RETURN_OPT(
+      "Service parameter is not for the handover service",
+      serviceParameter.serviceName == Handover::SERVICE_NAME);
+  // The wallet's answers to the service select and handover request are
+  // polled for on its schedule
+  Tnep::Timing timing = serviceParameter.timing();
+  ESP_LOGI(TAG, "Wallet waiting time %" PRIu32 " ms, %u extensions",
+           timing.waitMs, timing.extensions);
 
   // Technically, we could have static handover here.
   // However, both iOS and Android do negotiated handover
   // for digital IDs, so we have no need to support static handover.
 
   // Select the handover service (Ts)
-  NdefRecord serviceSelect = NdefRecord();
-  serviceSelect.setTnf(TNF_WELL_KNOWN);
-  serviceSelect.setId(0, 0);
-  serviceSelect.setType((const byte *)"Ts", 2);
-  // I think \x13 is the length of the payload
-  // (TNEP stuff we don't have the spec for)
-  serviceSelect.setPayload((const byte *)"\x13urn:nfc:sn:handover", 20);
-
-  // TODO: we probably want writeSlice to be able to take in an NDEFRecord
-  // instead of doing all this garbage
   // Write to file: length + message
-  byte messageBuf[300];
-  serviceSelect.encode(messageBuf, true, true);
-  auto messageSpan =
-      std::span<const uint8_t>(messageBuf, serviceSelect.getEncodedSize());
+  std::span<const uint8_t> messageSpan = Handover::SERVICE_SELECT;
   printHex("Service Select: ", messageSpan);
 
   writeSlice.reset();
-  CHECK_RETURN(writeSlice.append(
+  CHECK_RETURN_OPT(writeSlice.append(
       {{0x00, 0xD6, 0x00, 0x00, static_cast<uint8_t>(messageSpan.size() + 2), 0,
         static_cast<uint8_t>(messageSpan.size())}}));
   writeSlice.append(messageSpan);
   readSliceOpt = NFC::exchangeData(
       "Writing Service Select message: ", writeSlice.span(), rbuf);
-  CHECK_RETURN(readSliceOpt);
+  CHECK_RETURN_OPT(readSliceOpt);
   readSlice = *readSliceOpt;
   printHex("Service Select response: ", readSlice.span());
 
   // Read response
-  auto serviceSelectedResponse = readNdefFile(false);
-  CHECK_RETURN(serviceSelectedResponse);
+  auto serviceSelectedResponse = readNdefFile(false, timing);
+  CHECK_RETURN_OPT(serviceSelectedResponse);
 
   // From NDEF Exchange Protocol 1.0: 4.3 TNEP Status Message
   // If the NFC Tag Device has received a Service Select Message with a known
@@ -656,284 +552,111 @@ void performHandoff() {
   auto serviceSelectedResponseSpan =
       std::span<const uint8_t>(*serviceSelectedResponse);
 
-  auto statusMessage = NdefMessage(serviceSelectedResponseSpan.data(),
-                                   serviceSelectedResponseSpan.size());
-
-  CHECK_PRINT_RETURN(
-      "Service selected response does not contain one NDEF record",
-      statusMessage.getRecordCount() == 1);
-  auto statusRecord = statusMessage.getRecord(0);
-  CHECK_PRINT_RETURN("Record is not a TNEP Status Message",
-                     statusRecord.getType() == "Te");
-  CHECK_PRINT_RETURN("Status record payload length is not 1",
-                     statusRecord.getPayloadLength() == 1);
-  byte statusCode = 0xFF;
-  statusRecord.getPayload(&statusCode);
-  CHECK_PRINT_RETURN("Status code is not 0x00", statusCode == 0x00);
+  NdefReader::Record statusRecord;
+  ndefError = NdefReader::only(serviceSelectedResponseSpan, statusRecord);
+  CHECK_PRINT_RETURN_OPT("Service selected response is not one NDEF record: %s",
+                         ndefError == NdefReader::Error::NONE,
+                         NdefReader::errorString(ndefError));
+  CHECK_PRINT_RETURN_OPT("Record is not a TNEP Status Message",
+                         statusRecord.type == "Te");
+  CHECK_PRINT_RETURN_OPT("Status record payload length is not 1",
+                         statusRecord.payload.size() == 1);
+  CHECK_PRINT_RETURN_OPT("Status code is not 0x00",
+                         statusRecord.payload[0] == 0);
 
   // Send handover request
   // Write to file: length + message
   writeSlice.reset();
-  CHECK_RETURN(writeSlice.append(
+  CHECK_RETURN_OPT(writeSlice.append(
       {{0x00, 0xD6, 0x00, 0x00,
-        static_cast<uint8_t>(handoverRequestSpan.size() + 2), 0,
-        static_cast<uint8_t>(handoverRequestSpan.size())}}));
-  writeSlice.append(handoverRequestSpan);
+        static_cast<uint8_t>(Handover::HANDOVER_REQUEST.size() + 2), 0,
+        static_cast<uint8_t>(Handover::HANDOVER_REQUEST.size())}}));
+  writeSlice.append(Handover::HANDOVER_REQUEST);
   readSliceOpt =
       NFC::exchangeData("Writing Handover Request: ", writeSlice.span(), rbuf);
-  CHECK_RETURN(readSliceOpt);
+  CHECK_RETURN_OPT(readSliceOpt);
   readSlice = *readSliceOpt;
 
-  auto handoverResponse = readNdefFile(false);
-  CHECK_RETURN(handoverResponse);
+  auto handoverResponse = readNdefFile(false, timing);
+  CHECK_RETURN_OPT(handoverResponse);
   printHex("Handover Response: ", *handoverResponse);
 
   auto handoverResponseSpan = std::span<const uint8_t>(*handoverResponse);
-  auto handoverResponseMessage =
-      NdefMessage(handoverResponseSpan.data(), handoverResponseSpan.size());
+  // Used in place, so rbuf can't be reused until the session has begun
   std::optional<std::span<const uint8_t>> encodedDeviceEngagementOpt =
       std::nullopt;
-  for (int i = 0; i < handoverResponseMessage.getRecordCount(); i++) {
-    auto record = handoverResponseMessage.getRecord(i);
-    if (record.getType() == "iso.org:18013:deviceengagement" &&
-        record.getId() == "mdoc") {
-      record.getPayload(ndefPayloadBuf);
-      encodedDeviceEngagementOpt =
-          std::span<const uint8_t>(ndefPayloadBuf, record.getPayloadLength());
-    }
-  }
-  CHECK_RETURN(encodedDeviceEngagementOpt);
+  ndefError = NdefReader::forEachRecord(
+      handoverResponseSpan, [&](const NdefReader::Record &record) {
+        if (record.type == "iso.org:18013:deviceengagement" &&
+            record.id == "mdoc") {
+          encodedDeviceEngagementOpt = record.payload;
+        }
+        return NdefReader::Error::NONE;
+      });
+  CHECK_PRINT_RETURN_OPT("Failed to read handover select: %s",
+                         ndefError == NdefReader::Error::NONE,
+                         NdefReader::errorString(ndefError));
+  CHECK_PRINT_RETURN_OPT("Handover select has no device engagement",
+                         encodedDeviceEngagementOpt.has_value());
   auto encodedDeviceEngagementSpan = *encodedDeviceEngagementOpt;
   printHex("Encoded device engagement: ", encodedDeviceEngagementSpan);
 
-  // Get public key out of device engagement
-  CborParser parser;
-  CborValue value;
-  CHECK_CBOR_RETURN("CBOR parser fialed to initialize",
-                    cbor_parser_init(encodedDeviceEngagementSpan.data(),
-                                     encodedDeviceEngagementSpan.size(), 0,
-                                     &parser, &value));
-  CHECK_PRINT_RETURN("CBOR value is not map", cbor_value_is_map(&value));
-  CHECK_CBOR_RETURN("Failed to enter map",
-                    cbor_value_enter_container(&value, &value));
-  bool keyFound = false;
-  while (!cbor_value_at_end(&value)) {
-    if (cbor_value_is_unsigned_integer(&value)) {
-      uint64_t key;
-      CHECK_CBOR_RETURN("Failed to get key",
-                        cbor_value_get_uint64(&value, &key));
-      if (key == 1) {
-        keyFound = true;
-        break;
-      }
-    }
-    CHECK_CBOR_RETURN("Failed to advance", cbor_value_advance(&value));
-  }
-  CHECK_PRINT_RETURN("Key 1 not found", keyFound);
-  CHECK_CBOR_RETURN("Failed to advance to data", cbor_value_advance(&value));
-  CHECK_PRINT_RETURN("Data is not array", cbor_value_is_array(&value));
-  CHECK_CBOR_RETURN("Failed to enter array",
-                    cbor_value_enter_container(&value, &value));
-  CHECK_PRINT_RETURN("First value is not uint",
-                     cbor_value_is_unsigned_integer(&value));
-  uint64_t cipherSuiteIdentifier;
-  CHECK_CBOR_RETURN("Failed to get cipher suite identifier",
-                    cbor_value_get_uint64(&value, &cipherSuiteIdentifier));
-  CHECK_PRINT_RETURN("Cipher suite identifier is not 1, which is the only "
-                     "identifier we know about",
-                     cipherSuiteIdentifier == 1);
-  CHECK_CBOR_RETURN("Failed to advance to tagged device public key",
-                    cbor_value_advance(&value));
-  CHECK_PRINT_RETURN("Tagged device public key is not tagged",
-                     cbor_value_is_tag(&value));
-  CborTag devicePublicKeyTag;
-  CHECK_CBOR_RETURN("Failed to get device public key tag",
-                    cbor_value_get_tag(&value, &devicePublicKeyTag));
-  CHECK_PRINT_RETURN("device public key tag is not 24",
-                     devicePublicKeyTag == 24);
-  CHECK_CBOR_RETURN("Failed to advance to device public key",
-                    cbor_value_advance(&value));
-  CHECK_PRINT_RETURN("device public key is not byte string",
-                     cbor_value_is_byte_string(&value));
-  size_t devicePublicKeyLength = PN532_PACKBUFFSIZ;
-  CHECK_CBOR_RETURN("Failed to get device public key",
-                    cbor_value_copy_byte_string(&value, devicePublicKeyBuf,
-                                                &devicePublicKeyLength,
-                                                &value));
-  std::span<const uint8_t> devicePublicKeySpan(devicePublicKeyBuf,
-                                               devicePublicKeyLength);
-  printHex("device public key: ", devicePublicKeySpan);
-
-  // Write extracted public key back to CBOR, with tag
-  // This could definintely be improved.
-  CborEncoder encoder;
-  cbor_encoder_init(&encoder, encodedDevicePublicKeyBuf, PN532_PACKBUFFSIZ, 0);
-  CHECK_CBOR_RETURN("Failed to encode device public key",
-                    cbor_encode_tag(&encoder, devicePublicKeyTag));
-  CHECK_CBOR_RETURN("Failed to encode device public key",
-                    cbor_encode_byte_string(&encoder,
-                                            devicePublicKeySpan.data(),
-                                            devicePublicKeySpan.size()));
-  std::span<const uint8_t> encodedDevicePublicKeySpan(
-      encodedDevicePublicKeyBuf,
-      cbor_encoder_get_buffer_size(&encoder, encodedDevicePublicKeyBuf));
-  printHex("Encoded device public key: ", encodedDevicePublicKeySpan);
-
-  auto identOpt = Crypto::getIdent(encodedDevicePublicKeySpan);
-  CHECK_PRINT_RETURN("Failed to construct ident", identOpt);
+  // Everything about the device key is used straight out of the payload
+  DeviceEngagement::DeviceKey deviceKey;
+  DeviceEngagement::Error engagementError =
+      DeviceEngagement::parse(encodedDeviceEngagementSpan, deviceKey);
+  CHECK_PRINT_RETURN_OPT("Failed to parse device engagement: %s",
+                         engagementError == DeviceEngagement::Error::NONE,
+                         DeviceEngagement::errorString(engagementError));
+  printHex("Encoded device public key: ", deviceKey.tagged);
+
+  auto identOpt = Crypto::getIdent(deviceKey.tagged);
+  CHECK_PRINT_RETURN_OPT("Failed to construct ident", identOpt);
   const auto &ident = *identOpt;
   identCharacteristic->setValue(ident.data(), ident.size());
 
-  // Extract x and y from the device public key
-  CborParser keyParser;
-  CborValue keyValue;
-  std::optional<std::span<const uint8_t>> xSpanOpt = std::nullopt;
-  std::optional<std::span<const uint8_t>> ySpanOpt = std::nullopt;
-  CHECK_CBOR_RETURN("CBOR parser failed to initialize",
-                    cbor_parser_init(devicePublicKeySpan.data(),
-                                     devicePublicKeySpan.size(), 0, &keyParser,
-                                     &keyValue));
-  CHECK_PRINT_RETURN("CBOR value is not map", cbor_value_is_map(&keyValue));
-  CHECK_CBOR_RETURN("Failed to enter map",
-                    cbor_value_enter_container(&keyValue, &keyValue));
-  // Find -2 (x) and -3 (y)
-  while (!cbor_value_at_end(&keyValue) &&
-         (!xSpanOpt.has_value() || !ySpanOpt.has_value())) {
-    if (cbor_value_is_negative_integer(&keyValue)) {
-      int key;
-      CHECK_CBOR_RETURN("Failed to get key",
-                        cbor_value_get_int(&keyValue, &key));
-      if (key == -2) {
-        CHECK_CBOR_RETURN("Failed to advance to x",
-                          cbor_value_advance(&keyValue));
-        CHECK_PRINT_RETURN("x is not byte string",
-                           cbor_value_is_byte_string(&keyValue));
-        size_t xLength = devicePubKeyX.size();
-        CHECK_CBOR_RETURN("Failed to get x",
-                          cbor_value_copy_byte_string(
-                              &keyValue, devicePubKeyX.data(), &xLength, NULL));
-        CHECK_PRINT_RETURN("x length is not 32", xLength == COORD_LENGTH);
-        xSpanOpt = devicePubKeyX;
-      }
-
-      if (key == -3) {
-        CHECK_CBOR_RETURN("Failed to advance to y",
-                          cbor_value_advance(&keyValue));
-        CHECK_PRINT_RETURN("y is not byte string",
-                           cbor_value_is_byte_string(&keyValue));
-        size_t yLength = devicePubKeyY.size();
-
-        CHECK_CBOR_RETURN("Failed to get y",
-                          cbor_value_copy_byte_string(
-                              &keyValue, devicePubKeyY.data(), &yLength, NULL));
-        CHECK_PRINT_RETURN("y length is not 32", yLength == COORD_LENGTH);
-        ySpanOpt = devicePubKeyY;
-      }
-    }
-
-    CHECK_CBOR_RETURN("Failed to advance", cbor_value_advance(&keyValue));
-  }
-  CHECK_PRINT_RETURN("Failed to get x or y",
-                     xSpanOpt.has_value() && ySpanOpt.has_value());
-  /// Transcript
-  CborEncoder transcriptEncoder;
-  cbor_encoder_init(&transcriptEncoder, sessionTranscriptBuf + 5,
-                    sizeof(sessionTranscriptBuf) - 5,
-                    0); // TODO: clean up offsets
-  CborEncoder arrayEncoder;
-  CHECK_CBOR_RETURN(
-      "Failed to create array",
-      cbor_encoder_create_array(&transcriptEncoder, &arrayEncoder, 3));
-
-  // 1: Device engagement
-  CHECK_CBOR_RETURN("Failed to add tag", cbor_encode_tag(&arrayEncoder, 24));
-  CHECK_CBOR_RETURN(
-      "Failed to add device engagement",
-      cbor_encode_byte_string(&arrayEncoder, encodedDeviceEngagementSpan.data(),
-                              encodedDeviceEngagementSpan.size()));
-  // 2: Reader public key
-  CHECK_CBOR_RETURN("Failed to add tag", cbor_encode_tag(&arrayEncoder, 24));
-  CHECK_PRINT_RETURN("Failed to add reader public key",
-                     encodeReaderPublicKey(&arrayEncoder));
-  // 3: Handover array
-  CborEncoder handoverArrayEncoder;
-  CHECK_CBOR_RETURN(
-      "Failed to add handover array",
-      cbor_encoder_create_array(&arrayEncoder, &handoverArrayEncoder, 2));
-  // 3a: Handover select (incorrectly named handover response, TODO fix)
-  CHECK_CBOR_RETURN("Failed to add handover select",
-                    cbor_encode_byte_string(&handoverArrayEncoder,
-                                            handoverResponseSpan.data(),
-                                            handoverResponseSpan.size()));
-  // 3b: Handover request
-  // CHECK_CBOR_RETURN("Failed to add handover select",
-  //                        cbor_encode_byte_string(
-  //                            &handoverArrayEncoder,
-  //                            handoverResponseSpan.data(),
-  //                            handoverResponseSpan.size()) );
-  CHECK_CBOR_RETURN("Failed to add handover request",
-                    cbor_encode_byte_string(&handoverArrayEncoder,
-                                            handoverRequestSpan.data(),
-                                            handoverRequestSpan.size()));
-  // Close containers
-  CHECK_CBOR_RETURN(
-      "Failed to close handover array",
-      cbor_encoder_close_container(&arrayEncoder, &handoverArrayEncoder));
-  CHECK_CBOR_RETURN(
-      "Failed to close array",
-      cbor_encoder_close_container(&transcriptEncoder, &arrayEncoder));
-  // Add tag
-  sessionTranscriptBuf[0] = 0xD8;
-  sessionTranscriptBuf[1] = 0x18;
-  // Interpret as bytes of 0xXXXX length
-  sessionTranscriptBuf[2] = 0x59;
-  size_t binaryLength = cbor_encoder_get_buffer_size(&transcriptEncoder,
-                                                     sessionTranscriptBuf + 5);
-  sessionTranscriptBuf[3] = binaryLength >> 8;
-  sessionTranscriptBuf[4] = binaryLength & 0xFF;
-
-  std::span<const uint8_t> transcriptSpan(sessionTranscriptBuf,
-                                          binaryLength + 5);
+  // The key is imported uncompressed, which has X and Y next to each other
+  std::ranges::copy(deviceKey.x, devicePubKeyX.begin());
+  std::ranges::copy(deviceKey.y, devicePubKeyY.begin());
+  auto transcriptOpt =
+      encodeTranscript(encodedDeviceEngagementSpan, handoverResponseSpan);
+  CHECK_RETURN_OPT(transcriptOpt);
+  std::span<const uint8_t> transcriptSpan = *transcriptOpt;
   printHex("Transcript: ", transcriptSpan);
 
   printHex("Device XY: ", {deviceXYPubKeyEncodedBuf});
+  CHECK_PRINT_RETURN_OPT(
+      "Failed to start session",
+      session.begin({deviceXYPubKeyEncodedBuf}, transcriptSpan));
+  WriteSlice encryptedRequestSlice(encryptedRequestBuf,
+                                   sizeof(encryptedRequestBuf));
   auto encryptedRequestOpt =
-      Crypto::encryptRequest({deviceXYPubKeyEncodedBuf}, transcriptSpan);
-  CHECK_RETURN(encryptedRequestOpt);
+      session.encrypt(UNENCRYPTED_REQUEST, encryptedRequestSlice);
+  CHECK_RETURN_OPT(encryptedRequestOpt);
   auto encryptedRequestSpan = *encryptedRequestOpt;
 
   // Build full request
-  CborEncoder requestEncoder;
-  cbor_encoder_init(&requestEncoder, fullRequestBuf + 1,
-                    sizeof(fullRequestBuf) - 1, 0);
-  CborEncoder mapEncoder;
-  CHECK_CBOR_RETURN("Failed to create map",
-                    cbor_encoder_create_map(&requestEncoder, &mapEncoder, 2));
-  auto readerKey = "eReaderKey";
-  CHECK_CBOR_RETURN(
-      "Failed to reader key",
-      cbor_encode_text_string(&mapEncoder, readerKey, strlen(readerKey)));
-  CHECK_CBOR_RETURN("Failed to add tag for reader public key",
-                    cbor_encode_tag(&mapEncoder, 24));
-  CHECK_PRINT_RETURN("Failed to add reader public key",
-                     encodeReaderPublicKey(&mapEncoder));
-  auto dataKey = "data";
-  CHECK_CBOR_RETURN(
-      "Failed to add data key",
-      cbor_encode_text_string(&mapEncoder, dataKey, strlen(dataKey)));
-  CHECK_CBOR_RETURN("Failed to add data",
-                    cbor_encode_byte_string(&mapEncoder,
-                                            encryptedRequestSpan.data(),
-                                            encryptedRequestSpan.size()));
-  CHECK_CBOR_RETURN("Failed to close map",
-                    cbor_encoder_close_container(&requestEncoder, &mapEncoder));
-  std::span<const uint8_t> requestSpan(
-      fullRequestBuf,
-      cbor_encoder_get_buffer_size(&requestEncoder, fullRequestBuf + 1) + 1);
-  fullRequestBuf[0] = 0x00;
+  Encode::Writer requestWriter(fullRequestBuf);
+  requestWriter.append(ESTABLISHMENT_START);
+  requestWriter.append(Crypto::encodedReaderPublicKey());
+  Encode::Cbor::text(requestWriter, "data");
+  Encode::Cbor::bytes(requestWriter, encryptedRequestSpan);
+  CHECK_PRINT_RETURN_OPT("Request doesn't fit", requestWriter.fits());
+  std::span<const uint8_t> requestSpan = requestWriter.written();
   printHex("Full Request: ", requestSpan);
+  return requestSpan;
+}
+
+void performHandoff() {
+  CHECK_PRINT_RETURN("Failed to get a reader key",
+                     Crypto::takeReaderKeypair());
+  auto requestOpt = exchangeHandover();
+  // The key's done with either way, so it's wiped and replaced now rather
+  // than at the next tap
+  Crypto::retireReaderKeypair();
+  CHECK_RETURN(requestOpt);
 
-  stateCharacteristicCallbacks.setRequest(requestSpan);
+  stateCharacteristicCallbacks.setRequest(*requestOpt);
 
   // TODO: also need to return full handover response to be used by the
   // caller for encryption stuff
@@ -946,10 +669,12 @@ void performHandoff() {
 }
 
 void setupBLEServer() {
+  printHex("Mdoc request: ", UNENCRYPTED_REQUEST);
+
   NimBLEDevice::init("Digital Intercom");
   pServer = NimBLEDevice::createServer();
   pServer->setCallbacks(&serverCallbacks);
-  pService = pServer->createService("82186040-093c-4ff9-a90b-6994d231b2a4");
+  pService = pServer->createService(Handover::SERVICE_UUID);
 
   stateCharacteristic = pService->createCharacteristic(
       "00000005-A123-48CE-896B-4C76973373E6",
@@ -0,0 +1,200 @@
+#pragma once
+
+#include "CborReader.h"
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
+#include <span>
+#include <string_view>
+
+// Writes CBOR and NDEF with constexpr functions, so the firmware's fixed
+// messages are built at compile time from descriptions of what's in them
+// (see build()), and messages with parts only known during a tap are built
+// from pieces worked out ahead of time. Doesn't depend on Arduino or ESP-IDF.
+namespace Encode {
+
+// Writes into a buffer, or just counts what would be written. Once something
+// doesn't fit, nothing more is written, but it's still counted.
+class Writer {
+public:
+  // Only counts
+  constexpr Writer() = default;
+  constexpr explicit Writer(std::span<uint8_t> out) : out_(out) {}
+
+  constexpr void append(uint8_t byte) {
+    if (size_ < out_.size()) {
+      out_[size_] = byte;
+    }
+    ++size_;
+  }
+  constexpr void append(std::span<const uint8_t> bytes) {
+    if (size_ <= out_.size() && bytes.size() <= out_.size() - size_) {
+      std::copy(bytes.begin(), bytes.end(), out_.begin() + size_);
+    }
+    size_ += bytes.size();
+  }
+  constexpr void append(std::initializer_list<uint8_t> bytes) {
+    append(std::span{bytes.begin(), bytes.size()});
+  }
+  constexpr void append(std::string_view text) {
+    if (size_ <= out_.size() && text.size() <= out_.size() - size_) {
+      std::copy(text.begin(), text.end(), out_.begin() + size_);
+    }
+    size_ += text.size();
+  }
+
+  constexpr size_t size() const { return size_; }
+  constexpr bool fits() const { return size_ <= out_.size(); }
+  // Only whole if it fits
+  constexpr std::span<const uint8_t> written() const {
+    return out_.first(std::min(size_, out_.size()));
+  }
+
+private:
+  std::span<uint8_t> out_;
+  size_t size_ = 0;
+};
+
+// How many bytes encode(writer) writes
+template <typename F> constexpr size_t measure(F &&encode) {
+  Writer counter;
+  encode(counter);
+  return counter.size();
+}
+
+// What ENCODE(writer) writes, as an array built at compile time. ENCODE is a
+// function, or a lambda without captures.
+template <auto ENCODE> constexpr auto build() {
+  constexpr size_t SIZE = measure(ENCODE);
+  std::array<uint8_t, SIZE> bytes{};
+  Writer writer(bytes);
+  ENCODE(writer);
+  return bytes;
+}
+
+namespace Cbor {
+
+// With the argument in as few bytes as it fits in, as deterministic encoding
+// has it
+constexpr void head(Writer &writer, uint8_t major, uint64_t argument) {
+  uint8_t initial = major << 5;
+  if (argument < 24) {
+    writer.append(static_cast<uint8_t>(initial | argument));
+    return;
+  }
+  uint8_t info = 27;
+  if (argument <= 0xFF) {
+    info = 24;
+  } else if (argument <= 0xFFFF) {
+    info = 25;
+  } else if (argument <= 0xFFFFFFFF) {
+    info = 26;
+  }
+  int size = 1 << (info - 24);
+  writer.append(static_cast<uint8_t>(initial | info));
+  for (int i = size - 1; i >= 0; --i) {
+    writer.append(static_cast<uint8_t>(argument >> (i * 8)));
+  }
+}
+
+constexpr void integer(Writer &writer, int64_t value) {
+  if (value < 0) {
+    head(writer, CborReader::NEGATIVE, -1 - value);
+  } else {
+    head(writer, CborReader::UNSIGNED, value);
+  }
+}
+
+constexpr void bytes(Writer &writer, std::span<const uint8_t> bytes) {
+  head(writer, CborReader::BYTES, bytes.size());
+  writer.append(bytes);
+}
+
+constexpr void text(Writer &writer, std::string_view text) {
+  head(writer, CborReader::TEXT, text.size());
+  writer.append(text);
+}
+
+constexpr void array(Writer &writer, uint64_t size) {
+  head(writer, CborReader::ARRAY, size);
+}
+
+constexpr void map(Writer &writer, uint64_t size) {
+  head(writer, CborReader::MAP, size);
+}
+
+constexpr void tag(Writer &writer, uint64_t tag) {
+  head(writer, CborReader::TAG, tag);
+}
+
+constexpr void boolean(Writer &writer, bool value) {
+  head(writer, CborReader::SIMPLE,
+       value ? CborReader::SIMPLE_TRUE : CborReader::SIMPLE_FALSE);
+}
+
+// Tag 24 and the head of a byte string of size bytes of CBOR, for when the
+// CBOR itself is written separately
+constexpr void embeddedHead(Writer &writer, uint64_t size) {
+  tag(writer, CborReader::ENCODED_CBOR_TAG);
+  head(writer, CborReader::BYTES, size);
+}
+
+// #6.24(bstr .cbor X), where encode(writer) writes X
+template <typename F> constexpr void embedded(Writer &writer, F &&encode) {
+  embeddedHead(writer, measure(encode));
+  encode(writer);
+}
+
+} // namespace Cbor
+
+namespace Ndef {
+
+enum Tnf : uint8_t {
+  WELL_KNOWN = 0x01,
+  MEDIA = 0x02,
+  EXTERNAL = 0x04,
+};
+
+struct Type {
+  Tnf tnf;
+  std::string_view type;
+  std::string_view id = {};
+};
+
+// A record of a message, whose payload encodePayload(writer) writes. first
+// and last mark where it is in the message, like NdefRecord::encode().
+template <typename F>
+constexpr void record(Writer &writer, const Type &type, bool first, bool last,
+                      F &&encodePayload) {
+  constexpr uint8_t MESSAGE_BEGIN = 0x80;
+  constexpr uint8_t MESSAGE_END = 0x40;
+  constexpr uint8_t SHORT_RECORD = 0x10;
+  constexpr uint8_t ID_LENGTH = 0x08;
+
+  size_t payloadSize = measure(encodePayload);
+  bool shortRecord = payloadSize <= 0xFF;
+  writer.append(static_cast<uint8_t>(
+      (first ? MESSAGE_BEGIN : 0) | (last ? MESSAGE_END : 0) |
+      (shortRecord ? SHORT_RECORD : 0) | (type.id.empty() ? 0 : ID_LENGTH) |
+      type.tnf));
+  writer.append(static_cast<uint8_t>(type.type.size()));
+  if (shortRecord) {
+    writer.append(static_cast<uint8_t>(payloadSize));
+  } else {
+    for (int i = 3; i >= 0; --i) {
+      writer.append(static_cast<uint8_t>(payloadSize >> (i * 8)));
+    }
+  }
+  if (!type.id.empty()) {
+    writer.append(static_cast<uint8_t>(type.id.size()));
+  }
+  writer.append(type.type);
+  writer.append(type.id);
+  encodePayload(writer);
+}
+
+} // namespace Ndef
+
+} // namespace Encode
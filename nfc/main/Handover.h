@@ -0,0 +1,112 @@
+#pragma once
+
+#include "Encode.h"
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+// The fixed NFC messages of a negotiated handover to BLE (NFC Forum TNEP and
+// Connection Handover 1.5, with ISO 18013-5 8.2.2.1), and the parts of the
+// SessionTranscript that don't change from tap to tap, all built at compile
+// time.
+namespace Handover {
+
+// The reader's GATT service, which the handover request points the wallet at
+constexpr char SERVICE_UUID[] = "82186040-093c-4ff9-a90b-6994d231b2a4";
+// The TNEP service a wallet offers for negotiated handover
+constexpr std::string_view SERVICE_NAME = "urn:nfc:sn:handover";
+
+constexpr uint8_t hexDigit(char c) {
+  if (c >= 'a') {
+    return c - 'a' + 10;
+  }
+  if (c >= 'A') {
+    return c - 'A' + 10;
+  }
+  return c - '0';
+}
+
+// Bluetooth sends 128-bit UUIDs least significant byte first
+constexpr void encodeUuid(Encode::Writer &writer, std::string_view uuid) {
+  uint8_t low = 0;
+  bool haveLow = false;
+  for (auto c = uuid.rbegin(); c != uuid.rend(); ++c) {
+    if (*c == '-') {
+      continue;
+    }
+    if (haveLow) {
+      writer.append(static_cast<uint8_t>(hexDigit(*c) << 4 | low));
+    } else {
+      low = hexDigit(*c);
+    }
+    haveLow = !haveLow;
+  }
+}
+
+// TNEP Service Select for the handover service
+constexpr void encodeServiceSelect(Encode::Writer &writer) {
+  using namespace Encode;
+  Ndef::record(writer, {Ndef::WELL_KNOWN, "Ts"}, true, true,
+               [](Writer &payload) {
+                 payload.append(static_cast<uint8_t>(SERVICE_NAME.size()));
+                 payload.append(SERVICE_NAME);
+               });
+}
+
+// Asks for BLE, with the wallet as the central and the reader's service as
+// the peripheral, plus the mdoc ReaderEngagement
+constexpr void encodeHandoverRequest(Encode::Writer &writer) {
+  using namespace Encode;
+  Ndef::record(writer, {Ndef::WELL_KNOWN, "Hr"}, true, false,
+               [](Writer &payload) {
+                 // Version 1.5
+                 payload.append(0x15);
+                 // Carrier power state active, carrier data reference "0",
+                 // no auxiliary data
+                 Ndef::record(payload, {Ndef::WELL_KNOWN, "ac"}, true, true,
+                              [](Writer &carrier) {
+                                carrier.append({0x01, 0x01, '0', 0x00});
+                              });
+               });
+  Ndef::record(writer,
+               {Ndef::EXTERNAL, "iso.org:18013:readerengagement", "mdocreader"},
+               false, false, [](Writer &payload) {
+                 Cbor::map(payload, 1);
+                 Cbor::integer(payload, 0);
+                 Cbor::text(payload, "1.0");
+               });
+  Ndef::record(writer, {Ndef::MEDIA, "application/vnd.bluetooth.le.oob", "0"},
+               false, true, [](Writer &payload) {
+                 // LE Role: only peripheral
+                 payload.append({0x02, 0x1C, 0x00});
+                 // Complete list of 128-bit service UUIDs
+                 payload.append({0x11, 0x07});
+                 encodeUuid(payload, SERVICE_UUID);
+               });
+}
+
+constexpr auto SERVICE_SELECT = Encode::build<encodeServiceSelect>();
+constexpr auto HANDOVER_REQUEST = Encode::build<encodeHandoverRequest>();
+
+// SessionTranscript (ISO 18013-5 9.1.5.1) is
+//   #6.24(bstr .cbor [DeviceEngagementBytes, EReaderKeyBytes, Handover])
+// where Handover is [handover select, handover request]. Only the device
+// engagement, the reader key and the handover select change from tap to tap,
+// so the transcript is built around them from these.
+
+// Up to the device engagement's byte string. The transcript's length always
+// takes two bytes, which are filled in at TRANSCRIPT_LENGTH_AT once the rest
+// has been written.
+constexpr auto TRANSCRIPT_START = Encode::build<[](Encode::Writer &writer) {
+  Encode::Cbor::embeddedHead(writer, 0xFFFF);
+  Encode::Cbor::array(writer, 3);
+  Encode::Cbor::tag(writer, CborReader::ENCODED_CBOR_TAG);
+}>();
+constexpr size_t TRANSCRIPT_LENGTH_AT = 3;
+constexpr size_t TRANSCRIPT_HEAD_SIZE = TRANSCRIPT_LENGTH_AT + 2;
+// After the handover select
+constexpr auto TRANSCRIPT_END = Encode::build<[](Encode::Writer &writer) {
+  Encode::Cbor::bytes(writer, HANDOVER_REQUEST);
+}>();
+
+} // namespace Handover
@@ -0,0 +1,92 @@
+#pragma once
+
+#include "Encode.h"
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <string_view>
+
+// The DeviceRequest (ISO 18013-5 8.3.2.1.2.1) sent to a wallet, asking an mDL
+// and a photo ID for the same data elements. Each element asked for comes
+// back as its own IssuerSignedItem, so the fewer there are, the fewer BLE
+// packets the response takes and the less there is to decrypt and parse.
+namespace MdocRequest {
+
+// A data element, by its identifier in each document's namespace
+struct Element {
+  std::string_view mdl;
+  std::string_view photoId;
+};
+
+constexpr Element GIVEN_NAME{"given_name", "given_name_unicode"};
+constexpr Element FAMILY_NAME{"family_name", "family_name_unicode"};
+constexpr Element BIRTH_DATE{"birth_date", "birth_date"};
+
+// age_over_NN, a boolean both documents have for the ages their issuer chose
+template <uint8_t AGE> struct AgeOver {
+  static_assert(AGE < 100, "NN is two digits");
+  static constexpr char IDENTIFIER[] = {
+      'a', 'g', 'e', '_', 'o', 'v', 'e', 'r', '_', '0' + AGE / 10,
+      '0' + AGE % 10};
+  static constexpr std::string_view NAME{IDENTIFIER, sizeof(IDENTIFIER)};
+  static constexpr Element ELEMENTS[] = {{NAME, NAME}};
+};
+
+// Who the holder is, which the bridge checks against its allowed IDs
+constexpr Element IDENTITY[] = {GIVEN_NAME, FAMILY_NAME, BIRTH_DATE};
+
+// Most elements the rest of the firmware has room for
+constexpr size_t MAX_ELEMENTS = 4;
+
+// The reader only passes elements on to the intercom, but this is what
+// wallets have always been asked for
+constexpr bool INTENT_TO_RETAIN = true;
+
+struct DocType {
+  std::string_view docType;
+  std::string_view nameSpace;
+  std::string_view Element::*identifier;
+};
+
+constexpr DocType DOC_TYPES[] = {
+    {"org.iso.18013.5.1.mDL", "org.iso.18013.5.1", &Element::mdl},
+    {"org.iso.23220.photoid.1", "org.iso.23220.1", &Element::photoId},
+};
+
+// An ItemsRequest without any requestInfo
+constexpr void encodeItemsRequest(Encode::Writer &writer,
+                                  const DocType &docType,
+                                  std::span<const Element> elements) {
+  using namespace Encode::Cbor;
+  map(writer, 2);
+  text(writer, "docType");
+  text(writer, docType.docType);
+  text(writer, "nameSpaces");
+  map(writer, 1);
+  text(writer, docType.nameSpace);
+  map(writer, elements.size());
+  for (const Element &element : elements) {
+    text(writer, element.*docType.identifier);
+    boolean(writer, INTENT_TO_RETAIN);
+  }
+}
+
+// Meant for Encode::build(), so the request is built at compile time
+constexpr void encode(Encode::Writer &writer,
+                      std::span<const Element> elements) {
+  using namespace Encode::Cbor;
+  map(writer, 2);
+  text(writer, "version");
+  text(writer, "1.0");
+  text(writer, "docRequests");
+  array(writer, std::size(DOC_TYPES));
+  for (const DocType &docType : DOC_TYPES) {
+    map(writer, 1);
+    text(writer, "itemsRequest");
+    embedded(writer, [&](Encode::Writer &itemsWriter) {
+      encodeItemsRequest(itemsWriter, docType, elements);
+    });
+  }
+}
+
+} // namespace MdocRequest
@@ -0,0 +1,160 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <string_view>
+
+// Walks an NDEF message in place, a record at a time. Each record's type, ID
+// and payload are views into the message, so nothing is allocated or copied
+// and the message's buffer has to outlive them. Doesn't depend on Arduino or
+// ESP-IDF, so it also builds on the host (see nfc/host).
+namespace NdefReader {
+
+enum class Error : uint8_t {
+  NONE,
+  // Cut short, or a record that claims to be longer than what's left
+  MALFORMED,
+  // Chunked records, which nothing on the tap path sends
+  UNSUPPORTED,
+  // Valid, but not the records that were expected
+  UNEXPECTED,
+};
+
+inline const char *errorString(Error error) {
+  switch (error) {
+  case Error::NONE:
+    return "none";
+  case Error::MALFORMED:
+    return "malformed NDEF";
+  case Error::UNSUPPORTED:
+    return "unsupported NDEF";
+  case Error::UNEXPECTED:
+    return "unexpected NDEF records";
+  }
+  return "unknown";
+}
+
+struct Record {
+  uint8_t tnf = 0;
+  bool messageBegin = false;
+  bool messageEnd = false;
+  std::string_view type;
+  std::string_view id;
+  std::span<const uint8_t> payload;
+};
+
+class Reader {
+public:
+  explicit Reader(std::span<const uint8_t> message)
+      : pos_(message.data()), end_(message.data() + message.size()) {}
+
+  // After the record that ends the message. Anything after it is ignored.
+  bool atEnd() const { return ended_; }
+
+  Error next(Record &record) {
+    constexpr uint8_t MESSAGE_BEGIN = 0x80;
+    constexpr uint8_t MESSAGE_END = 0x40;
+    constexpr uint8_t CHUNK = 0x20;
+    constexpr uint8_t SHORT_RECORD = 0x10;
+    constexpr uint8_t ID_LENGTH = 0x08;
+    constexpr uint8_t TNF = 0x07;
+
+    if (ended_ || pos_ == end_) {
+      return Error::MALFORMED;
+    }
+    uint8_t header = *pos_++;
+    if (header & CHUNK) {
+      return Error::UNSUPPORTED;
+    }
+    // Only the first record begins the message
+    if (((header & MESSAGE_BEGIN) != 0) != first_) {
+      return Error::MALFORMED;
+    }
+    first_ = false;
+
+    uint8_t typeLength;
+    uint32_t payloadLength = 0;
+    uint8_t idLength = 0;
+    if (!byte(typeLength)) {
+      return Error::MALFORMED;
+    }
+    for (int i = (header & SHORT_RECORD) ? 1 : 4; i > 0; --i) {
+      uint8_t length;
+      if (!byte(length)) {
+        return Error::MALFORMED;
+      }
+      payloadLength = payloadLength << 8 | length;
+    }
+    if ((header & ID_LENGTH) && !byte(idLength)) {
+      return Error::MALFORMED;
+    }
+
+    std::span<const uint8_t> type;
+    std::span<const uint8_t> id;
+    if (!take(typeLength, type) || !take(idLength, id) ||
+        !take(payloadLength, record.payload)) {
+      return Error::MALFORMED;
+    }
+    record.tnf = header & TNF;
+    record.messageBegin = header & MESSAGE_BEGIN;
+    record.messageEnd = header & MESSAGE_END;
+    record.type = {reinterpret_cast<const char *>(type.data()), type.size()};
+    record.id = {reinterpret_cast<const char *>(id.data()), id.size()};
+    ended_ = record.messageEnd;
+    return Error::NONE;
+  }
+
+private:
+  bool byte(uint8_t &value) {
+    if (pos_ == end_) {
+      return false;
+    }
+    value = *pos_++;
+    return true;
+  }
+
+  bool take(size_t length, std::span<const uint8_t> &bytes) {
+    if (length > static_cast<size_t>(end_ - pos_)) {
+      return false;
+    }
+    bytes = {pos_, length};
+    pos_ += length;
+    return true;
+  }
+
+  const uint8_t *pos_;
+  const uint8_t *end_;
+  bool first_ = true;
+  bool ended_ = false;
+};
+
+// Calls onRecord(record) for each record of a message, which returns NONE to
+// keep going
+template <typename F>
+Error forEachRecord(std::span<const uint8_t> message, F &&onRecord) {
+  Reader reader(message);
+  while (!reader.atEnd()) {
+    Record record;
+    Error error = reader.next(record);
+    if (error == Error::NONE) {
+      error = onRecord(record);
+    }
+    if (error != Error::NONE) {
+      return error;
+    }
+  }
+  return Error::NONE;
+}
+
+// For messages that are just one record
+inline Error only(std::span<const uint8_t> message, Record &record) {
+  Reader reader(message);
+  Error error = reader.next(record);
+  if (error != Error::NONE) {
+    return error;
+  }
+  return reader.atEnd() ? Error::NONE : Error::UNEXPECTED;
+}
+
+} // namespace NdefReader
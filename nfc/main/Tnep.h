@@ -0,0 +1,77 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <span>
+#include <string_view>
+
+// The parts of NFC Forum TNEP 1.0 (NDEF Exchange Protocol) the reader needs:
+// the service parameter record a wallet offers its services with, and how
+// long it says to wait for its answers. Doesn't depend on Arduino or ESP-IDF,
+// so it also builds on the host (see nfc/host).
+namespace Tnep {
+
+enum class Error : uint8_t {
+  NONE,
+  // Shorter than its service name says
+  MALFORMED,
+};
+
+inline const char *errorString(Error error) {
+  switch (error) {
+  case Error::NONE:
+    return "none";
+  case Error::MALFORMED:
+    return "malformed service parameter";
+  }
+  return "unknown";
+}
+
+// How long a tag device may take to write its answer to a message: it should
+// be there after waitMs, and the reader can wait that long again up to
+// extensions more times (TNEP 4.1.6)
+struct Timing {
+  uint32_t waitMs;
+  uint8_t extensions;
+};
+
+// For files that aren't part of a TNEP exchange, like the CC file, which
+// should be there right away. Five reads a tenth of a second apart.
+constexpr Timing DEFAULT_TIMING = {100, 3};
+
+// The payload of a Tp record (TNEP 4.1.2)
+struct ServiceParameter {
+  uint8_t version = 0;
+  std::string_view serviceName;
+  uint8_t communicationMode = 0;
+  // WT_INT: the minimum waiting time is 2^(WT_INT / 4 - 1) ms
+  uint8_t minWaitingTime = 0;
+  // N_wait
+  uint8_t maxExtensions = 0;
+  uint16_t maxMessageSize = 0;
+
+  Timing timing() const {
+    return {static_cast<uint32_t>(
+                std::ceil(std::exp2((minWaitingTime - 4) / 4.0))),
+            maxExtensions};
+  }
+};
+
+inline Error parse(std::span<const uint8_t> payload,
+                   ServiceParameter &parameter) {
+  constexpr size_t AFTER_NAME = 5;
+  if (payload.size() < 2 || payload.size() - 2 < payload[1] + AFTER_NAME) {
+    return Error::MALFORMED;
+  }
+  parameter.version = payload[0];
+  parameter.serviceName = {reinterpret_cast<const char *>(&payload[2]),
+                           payload[1]};
+  auto rest = payload.subspan(2 + payload[1]);
+  parameter.communicationMode = rest[0];
+  parameter.minWaitingTime = rest[1] & 0x3F;
+  parameter.maxExtensions = rest[2] & 0x0F;
+  parameter.maxMessageSize = rest[3] << 8 | rest[4];
+  return Error::NONE;
+}
+
+} // namespace Tnep
@@ -0,0 +1,77 @@
+# Sends a synthetic uplink through UplinkDecoder, with talk spurts and the
+# comfort noise packets the intercom sends instead of silence, over a steady
+# network. Checks that the receiver reports it makes wouldn't make the
+# intercom step down a profile, or keep it from stepping back up, while
+# nobody is talking.
+import random
+import sys
+from uplink import AUDIO, COMFORT_NOISE, HEADER, PCM_S16, REPORT, UplinkDecoder
+
+CLOCK_RATE = 32000
+FRAME_SAMPLES = CLOCK_RATE // 50
+# PacketizerConfig::keepaliveMs
+KEEPALIVE_TICKS = CLOCK_RATE // 10
+NETWORK_DELAY = 0.020
+NETWORK_JITTER = 0.001
+# Seconds of talking, then of silence, repeated
+PATTERN = [(3, 5)] * 4
+# AdaptationConfig: reports must stay under half the degrade limits for the
+# profile to step back up
+UPGRADE_JITTER_MS = 30 / 2
+UPGRADE_DELAY_MS = 150 / 2
+
+
+def make_stream():
+    """Returns (send time, packet) in send order, like UplinkPacketizer."""
+    stream = []
+    seq = 0
+    timestamp = 0
+    sent_until = 0
+    for talk, silence in PATTERN:
+        for frame in range((talk + silence) * 50):
+            start = timestamp
+            timestamp += FRAME_SAMPLES
+            if frame < talk * 50:
+                header = HEADER.pack(AUDIO, PCM_S16, seq % 0x10000, start,
+                                     CLOCK_RATE, FRAME_SAMPLES)
+                packet = header + bytes(FRAME_SAMPLES * 2)
+            elif timestamp - sent_until >= KEEPALIVE_TICKS:
+                header = HEADER.pack(COMFORT_NOISE, PCM_S16, seq % 0x10000,
+                                     sent_until, CLOCK_RATE,
+                                     timestamp - sent_until)
+                packet = header + (100).to_bytes(2, "little")
+            else:
+                continue
+            # A frame is sent once it has all been captured
+            stream.append((timestamp / CLOCK_RATE, packet))
+            sent_until = timestamp
+            seq += 1
+    return stream
+
+
+def main():
+    rng = random.Random(1)
+    decoder = UplinkDecoder(lambda _: None, CLOCK_RATE)
+    next_report = 1.0
+    ok = True
+    print(f"{'time':>5} {'lost':>5} {'jitter':>7} {'delay':>6}")
+    for sent, packet in make_stream():
+        arrival = sent + NETWORK_DELAY + abs(rng.gauss(0, NETWORK_JITTER))
+        while arrival >= next_report:
+            report = decoder.make_report()
+            if report is not None:
+                _, lost, _, jitter, delay = REPORT.unpack(report)
+                good = (lost == 0 and jitter < UPGRADE_JITTER_MS
+                        and delay < UPGRADE_DELAY_MS)
+                print(f"{next_report:>5.0f} {lost:>5} {jitter:>5} ms "
+                      f"{delay:>3} ms{'' if good else ' TOO HIGH'}")
+                ok &= good
+            next_report += 1
+        decoder.push(packet, arrival)
+    print("Reports " + ("stayed under the upgrade limits" if ok
+                        else "went over the upgrade limits"))
+    return 0 if ok else 1
+
+
+if __name__ == "__main__":
+    sys.exit(main())
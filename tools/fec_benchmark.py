@@ -0,0 +1,92 @@
+# Sends a synthetic uplink stream through random packet loss and reports how
+# much the intercom's XOR parity FEC recovers, for a few group sizes.
+import random
+from uplink import AUDIO, HEADER, PCM_S16, UplinkDecoder, make_parity
+
+SAMPLE_RATE = 32000
+PACKET_SIZE = 1024
+SAMPLES = (PACKET_SIZE - HEADER.size) // 2
+PACKETS = 20000
+GROUP_SIZES = [0, 2, 4, 8, 16]
+
+
+def make_stream(group_size):
+    """Returns (packet, is_parity) in send order."""
+    rng = random.Random(1)
+    stream = []
+    group = []
+    for seq in range(PACKETS):
+        payload = rng.randbytes(SAMPLES * 2)
+        header = HEADER.pack(AUDIO, PCM_S16, seq % 0x10000, seq * SAMPLES,
+                             SAMPLE_RATE, SAMPLES)
+        packet = header + payload
+        stream.append((packet, False))
+        if group_size:
+            group.append(packet)
+            if len(group) == group_size:
+                stream.append((make_parity(group), True))
+                group = []
+    return stream
+
+
+def uniform_loss(rate):
+    rng = random.Random(2)
+    return lambda: rng.random() < rate
+
+
+def burst_loss(rate, burst):
+    """Gilbert model with the given average loss rate and burst length."""
+    rng = random.Random(3)
+    leave_bad = 1 / burst
+    enter_bad = rate * leave_bad / (1 - rate)
+    bad = False
+
+    def lost():
+        nonlocal bad
+        bad = rng.random() >= leave_bad if bad else rng.random() < enter_bad
+        return bad
+    return lost
+
+
+def run(stream, lost):
+    played = []
+    decoder = UplinkDecoder(lambda _: None)
+    decoder._play = lambda packet: played.append(packet)
+    for packet, _ in stream:
+        if not lost():
+            decoder.push(packet)
+    decoder.flush()
+
+    originals = {p[:HEADER.size]: p for p, parity in stream if not parity}
+    corrupt = sum(originals.get(p[:HEADER.size]) != p for p in played)
+    return 1 - len(played) / PACKETS, corrupt
+
+
+def main():
+    channels = [
+        ("1% random", lambda: uniform_loss(0.01)),
+        ("5% random", lambda: uniform_loss(0.05)),
+        ("10% random", lambda: uniform_loss(0.10)),
+        ("5% bursts of 3", lambda: burst_loss(0.05, 3)),
+    ]
+    print(f"{'group':>6} {'overhead':>9}", end="")
+    for name, _ in channels:
+        print(f" {name:>15}", end="")
+    print()
+
+    for group_size in GROUP_SIZES:
+        stream = make_stream(group_size)
+        data = sum(len(p) for p, parity in stream if not parity)
+        overhead = sum(len(p) for p, parity in stream if parity) / data
+        label = str(group_size) if group_size else "off"
+        print(f"{label:>6} {overhead:>8.1%}", end="")
+        for _, make_channel in channels:
+            residual, corrupt = run(stream, make_channel())
+            assert corrupt == 0, "recovered packet doesn't match the original"
+            print(f" {residual:>15.2%}", end="")
+        print()
+    print("Residual loss after FEC, by group size and channel")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,222 @@
+# Measures the legs of mouth-to-ear latency that the intercom's own probe
+# (intercom/main/latencyProbe.h) can't see:
+#   device: stands in for the bridge's control server, has the intercom probe
+#           its audio paths and reports that along with how long the control
+#           round trip took on top of it, i.e. the network
+#   ffmpeg: pipes a chirp through ffmpeg in real time the way the bridge does
+#           and times how long it takes to come out the other end
+import argparse
+import socket
+import subprocess
+import threading
+import time
+import numpy as np
+from uplink import LATENCY, LATENCY_PROBE, LATENCY_REPORT
+
+HOST = "0.0.0.0"
+CONTROL_PORT = 9998
+# Other events the intercom sends, see OutputEvent in intercom/main/tcpClient.h
+CREDIT_CARD = b"C"
+# Not counting the event byte, see CREDIT_CARD_DATA_LEN in constants.ts
+CREDIT_CARD_SIZE = 34
+DIGITAL_ID = b"D"
+# Followed by a CREDIT_CARD or DIGITAL_ID event
+DOOR_OPENED = b"O"
+# A probe takes about half a second. The intercom ignores it if it's busy.
+REPORT_TIMEOUT = 5
+BLOCK_SECONDS = 0.02
+# Same as the intercom's probe
+CHIRP_SECONDS = 0.064
+CHIRP_START_HZ = 300
+CHIRP_END_HZ = 3400
+AMPLITUDE = 5000
+# Silence between chirps, long enough for any codec delay
+RUN_SECONDS = 1.5
+# The bridge's input flags, see streamingDelegate.ts
+FFMPEG_INPUT = ("-fflags nobuffer -flags low_delay -analyzeduration 0 "
+                "-probesize 32")
+
+
+def make_chirp(rate):
+    t = np.arange(int(CHIRP_SECONDS * rate)) / rate
+    sweep = (CHIRP_END_HZ - CHIRP_START_HZ) / CHIRP_SECONDS
+    phase = 2 * np.pi * (CHIRP_START_HZ * t + sweep * t * t / 2)
+    window = 0.5 - 0.5 * np.cos(2 * np.pi * t / CHIRP_SECONDS)
+    return (AMPLITUDE * window * np.sin(phase)).astype(np.int16)
+
+
+def summarize(name, values_ms):
+    if not values_ms:
+        print(f"{name}: no measurements")
+        return
+    values = np.array(values_ms)
+    print(f"{name}: mean {values.mean():.1f} ms, std dev {values.std():.1f} ms, "
+          f"min {values.min():.1f} ms, max {values.max():.1f} ms "
+          f"over {len(values)} runs")
+
+
+def recv_exactly(conn, n):
+    data = b""
+    while len(data) < n:
+        chunk = conn.recv(n - len(data))
+        if not chunk:
+            raise ConnectionError("intercom disconnected")
+        data += chunk
+    return data
+
+
+def drain(conn):
+    """Throws away everything the intercom has sent that hasn't been read."""
+    conn.setblocking(False)
+    try:
+        while conn.recv(4096):
+            pass
+    except BlockingIOError:
+        pass
+    conn.settimeout(REPORT_TIMEOUT)
+
+
+def read_latency_report(conn):
+    """Skips other events up to the next latency report. Digital IDs have no
+    length, so one is skipped along with everything that came with it."""
+    while (event := recv_exactly(conn, 1)) != LATENCY_REPORT:
+        print("Ignoring event", event)
+        if event == CREDIT_CARD:
+            recv_exactly(conn, CREDIT_CARD_SIZE)
+        elif event == DIGITAL_ID:
+            drain(conn)
+    return LATENCY.unpack(recv_exactly(conn, LATENCY.size))
+
+
+def device_leg(args):
+    server = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+    server.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+    server.bind((HOST, CONTROL_PORT))
+    server.listen()
+    print(f"Waiting for the intercom on {HOST}:{CONTROL_PORT}...")
+    conn, addr = server.accept()
+    print("Connected to", addr)
+
+    device_ms = []
+    network_ms = []
+    for run in range(args.runs):
+        # Anything from before the probe can't be confused with its report
+        drain(conn)
+        sent = time.monotonic()
+        conn.send(LATENCY_PROBE)
+        try:
+            report = read_latency_report(conn)
+        except socket.timeout:
+            print(f"Run {run}: no report, is the intercom idle?")
+            continue
+        round_trip = time.monotonic() - sent
+        delay_us, mean_us, std_dev_us, runs, correlation, elapsed_us = report
+        network = round_trip * 1000 - elapsed_us / 1000
+        network_ms.append(network)
+        if delay_us < 0:
+            print(f"Run {run}: chirp not found (correlation "
+                  f"{correlation / 32767:.2f}), network {network:.1f} ms")
+        else:
+            device_ms.append(delay_us / 1000)
+            print(f"Run {run}: intercom {delay_us / 1000:.1f} ms (its mean "
+                  f"{mean_us / 1000:.1f} ms, std dev {std_dev_us / 1000:.1f} ms "
+                  f"over {runs}), network {network:.1f} ms")
+        time.sleep(args.interval)
+
+    summarize("Intercom audio paths", device_ms)
+    summarize("Control round trip", network_ms)
+
+
+def ffmpeg_leg(args):
+    rate = args.rate
+    chirp = make_chirp(rate)
+    block = int(BLOCK_SECONDS * rate)
+    run_samples = int(RUN_SECONDS * rate)
+    total = run_samples * args.runs
+    audio = np.zeros(total, dtype=np.int16)
+    starts = [run * run_samples + block for run in range(args.runs)]
+    for start in starts:
+        audio[start:start + len(chirp)] = chirp
+
+    # Encoded the way the bridge encodes the listen stream, then decoded again
+    # so the output can be correlated. The decoder's delay counts too, so
+    # this is an upper bound on the bridge's share.
+    command = (
+        f"{args.ffmpeg} -hide_banner -loglevel error {FFMPEG_INPUT} "
+        f"-ac 1 -f s16le -ar {rate} -i pipe:0 {args.encoder} -f nut pipe:1 | "
+        f"{args.ffmpeg} -hide_banner -loglevel error {FFMPEG_INPUT} "
+        f"-f nut -i pipe:0 -ac 1 -ar {rate} -f s16le pipe:1")
+    process = subprocess.Popen(["/bin/bash", "-c", command],
+                               stdin=subprocess.PIPE, stdout=subprocess.PIPE,
+                               bufsize=0)
+
+    chunks = []
+    # (arrival time, output samples received by then)
+    arrivals = []
+
+    def read_output():
+        received = 0
+        while chunk := process.stdout.read(4096):
+            chunks.append(chunk)
+            received += len(chunk)
+            arrivals.append((time.monotonic(), received // 2))
+
+    reader = threading.Thread(target=read_output)
+    reader.start()
+
+    # Written in real time, like audio arriving from the intercom
+    begin = time.monotonic()
+    for offset in range(0, total, block):
+        time.sleep(max(0, begin + offset / rate - time.monotonic()))
+        process.stdin.write(audio[offset:offset + block].tobytes())
+    process.stdin.close()
+    reader.join()
+    process.wait()
+
+    data = b"".join(chunks)
+    output = np.frombuffer(data[:len(data) // 2 * 2],
+                           dtype=np.int16).astype(np.float64)
+    if len(output) == 0:
+        print("ffmpeg produced no output")
+        return
+    arrival_times = np.array([t for t, _ in arrivals])
+    arrival_samples = np.array([n for _, n in arrivals])
+
+    latencies = []
+    reference = chirp.astype(np.float64)
+    for run, start in enumerate(starts):
+        search = output[start:start + run_samples]
+        if len(search) < len(reference):
+            break
+        correlation = np.correlate(search, reference, mode="valid")
+        found = start + int(np.argmax(correlation))
+        # The chirp is out once the chunk holding its first sample arrives
+        index = np.searchsorted(arrival_samples, found + 1)
+        if index >= len(arrival_times):
+            break
+        latency = (arrival_times[index] - (begin + start / rate)) * 1000
+        codec_delay = (found - start) * 1000 / rate
+        latencies.append(latency)
+        print(f"Run {run}: {latency:.1f} ms ({codec_delay:.1f} ms of it codec "
+              "delay)")
+
+    summarize("ffmpeg", latencies)
+
+
+parser = argparse.ArgumentParser(
+    description="Measures the network and ffmpeg legs of audio latency")
+parser.add_argument("leg", choices=["device", "ffmpeg"])
+parser.add_argument("--runs", type=int, default=10)
+parser.add_argument("--interval", type=float, default=1,
+                    help="seconds between device probes")
+parser.add_argument("--rate", type=int, default=32000,
+                    help="listen sample rate fed to ffmpeg")
+parser.add_argument("--ffmpeg", default="ffmpeg")
+parser.add_argument("--encoder", default="-acodec libfdk_aac -profile:a aac_eld",
+                    help="ffmpeg encoder arguments, as in streamingDelegate.ts")
+args = parser.parse_args()
+
+if args.leg == "device":
+    device_leg(args)
+else:
+    ffmpeg_leg(args)
@@ -1,11 +1,31 @@
 import socket
+import struct
+from uplink import (
+    LISTEN_FORMAT,
+    SUBSCRIBE,
+    TALK_FORMAT,
+    TALK_GAIN,
+    UNSUBSCRIBE,
+    make_subscription,
+    make_talk_gain,
+)
 
 HOST = "0.0.0.0"
 PORT = 9998
 
 OPEN_DOOR = b"D"
 LISTEN_ON = b"L"
+TALK_ON = b"T"
 LISTEN_OFF = b"S"
+ALLOWLIST = b"A"
+# Commands that are followed by an audio format
+PAYLOADS = {LISTEN_ON: LISTEN_FORMAT, TALK_ON: TALK_FORMAT}
+# An empty allowlist, so every credential goes to the bridge
+PAYLOADS[ALLOWLIST] = struct.pack("<IHH", 0, 0, 0)
+# SUBSCRIBE and UNSUBSCRIBE add a second listen receiver on this machine
+SUBSCRIBER_PORT = 9996
+# TALK_GAIN doubles the talk audio sent from this machine
+TALK_GAIN_LEVEL = 2.0
 
 
 sock = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
@@ -18,10 +38,18 @@ while True:
     print("Waiting for connection")
     c, addr = sock.accept()
     print("Connected to", addr)
+    # The address the intercom reached us on
+    subscription = make_subscription(c.getsockname()[0], SUBSCRIBER_PORT)
+    payloads = {
+        **PAYLOADS,
+        SUBSCRIBE: subscription,
+        UNSUBSCRIBE: subscription,
+        TALK_GAIN: make_talk_gain(c.getsockname()[0], 0, TALK_GAIN_LEVEL),
+    }
     while True:
         cmd = input().strip().encode("utf-8")
         if len(cmd) != 1:
             print("Invalid len", len(cmd))
             continue
         print("Sending", cmd)
-        c.send(cmd)
+        c.send(cmd + payloads.get(cmd, b""))
@@ -1,39 +1,73 @@
+import argparse
+import random
+import select
 import socket
+import time
 import numpy as np
 from scipy.io.wavfile import write
+from uplink import LISTEN_FORMAT, RECEIVER_REPORT, REPORT, UplinkDecoder
 
 HOST = "0.0.0.0"
 PORT = 9999
-BUFFER_SIZE = 1024
-SAMPLE_RATE = 22050
+CONTROL_PORT = 9998
+BUFFER_SIZE = 1500
+REPORT_INTERVAL = 1
+LISTEN_ON = b"L"
+
+parser = argparse.ArgumentParser(
+    description="Records the intercom's listen uplink to test.wav")
+parser.add_argument("--control", action="store_true",
+                    help="stand in for the bridge's control server: start a "
+                    "listen session and send receiver reports")
+parser.add_argument("--drop", type=float, default=0,
+                    help="share of packets to drop, to exercise FEC and "
+                    "uplink adaptation")
+args = parser.parse_args()
 
 sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
 sock.bind((HOST, PORT))
-samples = []
+chunks = []
+decoder = UplinkDecoder(chunks.append)
 
-print(f"Listening for UDP packets on {HOST}:{PORT}...")
+control = None
+if args.control:
+    server = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+    server.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+    server.bind((HOST, CONTROL_PORT))
+    server.listen()
+    print(f"Waiting for the intercom on {HOST}:{CONTROL_PORT}...")
+    control, addr = server.accept()
+    print("Connected to", addr)
+    control.send(LISTEN_ON + LISTEN_FORMAT)
 
-# 0 to 2^16
-# -2^15-1 to 2^15
+print(f"Listening for UDP packets on {HOST}:{PORT}...")
 
+next_report = time.monotonic() + REPORT_INTERVAL
 try:
     while True:
-        data = sock.recv(BUFFER_SIZE)
-        for i in range(0, len(data), 2):
-            sample = int.from_bytes(data[i:i+2], byteorder="little")
-            samples.append(sample)
+        ready, _, _ = select.select([sock], [], [], REPORT_INTERVAL)
+        if ready:
+            data = sock.recv(BUFFER_SIZE)
+            if random.random() >= args.drop:
+                decoder.push(data)
+        if control is not None and time.monotonic() >= next_report:
+            next_report += REPORT_INTERVAL
+            report = decoder.make_report()
+            if report is not None:
+                seq, lost, _, jitter, delay = REPORT.unpack(report)
+                print(f"Report: seq {seq}, loss {lost}/256, jitter {jitter} ms, "
+                      f"delay {delay} ms")
+                control.send(RECEIVER_REPORT + report)
 except KeyboardInterrupt:
-    pass
+    decoder.flush()
 
 
 print()
-assert len(samples) > 0
-samples = np.array(samples, dtype=np.int32)
-print(np.min(samples), np.max(samples))
-samples -= np.min(samples)
-samples = samples * (2**16 // np.max(samples)) - 2**15
+assert len(chunks) > 0
+samples = np.concatenate(chunks)
+print(f"Packets received: {decoder.received}, recovered: {decoder.recovered}, "
+      f"lost: {decoder.lost}")
 print(np.min(samples), np.max(samples))
-samples = samples.astype(np.int16)
 
-print("Writing", len(samples), len(samples) / SAMPLE_RATE, "seconds")
-write("test.wav", SAMPLE_RATE, samples)
+print("Writing", len(samples), len(samples) / decoder.clock_rate, "seconds")
+write("test.wav", decoder.clock_rate, samples)
@@ -0,0 +1,279 @@
+import socket
+import struct
+import time
+import numpy as np
+
+# Uplink wire format, see intercom/main/uplinkPacket.h
+HEADER = struct.Struct("<BBHIHH")
+AUDIO = ord("A")
+COMFORT_NOISE = ord("N")
+PARITY = ord("P")
+PCM_S16 = 0
+MULAW = 1
+PARITY_OVERHEAD = HEADER.size + 2
+# Audio formats sent after LISTEN_ON and TALK_ON, see intercom/main/audioFormat.h
+AUDIO_DESCRIPTOR = struct.Struct("<HBBHH")
+S16LE = 0
+LISTEN_FORMAT = AUDIO_DESCRIPTOR.pack(32000, S16LE, PCM_S16, 16, 9999)
+TALK_FORMAT = AUDIO_DESCRIPTOR.pack(16000, S16LE, PCM_S16, 32, 9997)
+# Sent after SUBSCRIBE and UNSUBSCRIBE: an IPv4 address then a descriptor
+SUBSCRIBE = b"U"
+UNSUBSCRIBE = b"X"
+
+
+def make_subscription(host, port, sample_rate=8000, codec=MULAW):
+    return socket.inet_aton(host) + AUDIO_DESCRIPTOR.pack(
+        sample_rate, S16LE, codec, 0, port
+    )
+
+
+# Sent after TALK_GAIN: an IPv4 address, a port (0 for any) and a Q12 gain,
+# see intercom/main/talkMixer.h
+TALK_GAIN = b"G"
+
+
+def make_talk_gain(host, port, gain):
+    return socket.inet_aton(host) + struct.pack("<HH", port, round(gain * 4096))
+
+
+# Sent to the intercom on the control channel, followed by REPORT
+RECEIVER_REPORT = b"Q"
+REPORT = struct.Struct("<HBBHH")
+# Answered with LATENCY_REPORT followed by LATENCY, see
+# intercom/main/latencyProbe.h
+LATENCY_PROBE = b"P"
+LATENCY_REPORT = b"P"
+LATENCY = struct.Struct("<iIIHHI")
+
+# Longer gaps are the uplink pausing, not silence
+MAX_GAP_SECONDS = 0.5
+# Packets kept around for FEC recovery
+HISTORY = 256
+# Arrival delay is measured against the quickest packet in this many reports
+DELAY_WINDOW_REPORTS = 10
+
+
+def seq_diff(a, b):
+    return (a - b + 0x8000) % 0x10000 - 0x8000
+
+
+def mulaw_decode(encoded):
+    encoded = ~encoded & 0xFF
+    exponent = (encoded >> 4) & 0x07
+    mantissa = encoded & 0x0F
+    value = (((mantissa << 3) + 0x84) << exponent) - 0x84
+    return -value if encoded & 0x80 else value
+
+
+MULAW_DECODE_TABLE = np.array([mulaw_decode(i) for i in range(256)], dtype=np.int16)
+
+
+def xor_into(target, packet):
+    """XORs packet into the start of target, which must be at least as long."""
+    n = len(packet)
+    value = int.from_bytes(target[:n], "little") ^ int.from_bytes(packet, "little")
+    target[:n] = value.to_bytes(n, "little")
+
+
+def make_parity(packets):
+    """Parity packet for a group, as built by the intercom's UplinkFec."""
+    longest = max(len(p) for p in packets)
+    parity = bytearray(longest)
+    lengths = 0
+    for packet in packets:
+        lengths ^= len(packet)
+        xor_into(parity, packet)
+    _, codec, seq, _, rate, _ = HEADER.unpack_from(packets[0])
+    header = HEADER.pack(PARITY, codec, seq, 0, rate, len(packets))
+    return header + struct.pack("<H", lengths) + bytes(parity)
+
+
+class UplinkDecoder:
+    """Turns uplink packets back into continuous PCM at the negotiated rate.
+
+    Packets are released in sequence order. When FEC is on, a missing packet
+    is waited for until its group's parity could have arrived, and rebuilt
+    from it if it was the only one lost.
+
+    make_report() returns a receiver report for the intercom, covering the
+    packets received since the last one.
+    """
+
+    def __init__(self, on_audio, clock_rate=32000):
+        self.on_audio = on_audio
+        self.clock_rate = clock_rate
+        self.rng = np.random.default_rng()
+        self.packets = {}
+        self.next_seq = None
+        self.newest_seq = None
+        self.group_size = 0
+        self.expected = None
+        self.noise_level = 0
+        self.last_sample = 0
+        self.received = 0
+        self.recovered = 0
+        self.lost = 0
+
+        self.report_base_seq = None
+        self.received_since_report = 0
+        self.last_transit = None
+        self.jitter = 0
+        self.transit_sum = 0
+        self.min_transits = []
+
+    def push(self, data, arrival=None):
+        if len(data) < HEADER.size:
+            return
+        kind, _, seq, timestamp, rate, count = HEADER.unpack_from(data)
+
+        if kind == PARITY:
+            self.group_size = count
+            self._recover(data, seq, count)
+        else:
+            self.received += 1
+            self._measure_arrival(seq, timestamp + self._ticks(rate, count),
+                                  time.monotonic() if arrival is None else arrival)
+            if self.next_seq is None or abs(seq_diff(seq, self.next_seq)) > HISTORY:
+                # First packet, or the intercom restarted
+                self.packets.clear()
+                self.next_seq = seq
+                self.newest_seq = seq
+            if seq_diff(seq, self.next_seq) < 0:
+                return
+            self.packets[seq] = data
+            if seq_diff(seq, self.newest_seq) > 0:
+                self.newest_seq = seq
+        self._release()
+
+    def flush(self):
+        """Releases everything still waiting on a lost packet."""
+        self.group_size = 0
+        self._release()
+
+    def _ticks(self, rate, count):
+        """How much of the stream a packet covers, in clock ticks."""
+        return round(count * self.clock_rate / rate) if rate else 0
+
+    def _measure_arrival(self, seq, end, arrival):
+        if self.report_base_seq is None or abs(seq_diff(seq, self.newest_seq)) > HISTORY:
+            self.report_base_seq = seq
+            self.received_since_report = 0
+            self.last_transit = None
+            self.min_transits = []
+        self.received_since_report += 1
+
+        # Relative transit time in ms, up to the end of the packet's span,
+        # which is when the intercom sent it. Comfort noise is stamped at the
+        # start of the silence it covers. The offset between the clocks cancels
+        # out.
+        transit = arrival * 1000 - end * 1000 / self.clock_rate
+        if self.last_transit is not None:
+            # RFC 3550 interarrival jitter
+            self.jitter += (abs(transit - self.last_transit) - self.jitter) / 16
+        self.last_transit = transit
+        self.transit_sum += transit
+        if self.min_transits:
+            self.min_transits[-1] = min(self.min_transits[-1], transit)
+        else:
+            self.min_transits.append(transit)
+
+    def make_report(self):
+        if self.report_base_seq is None or self.received_since_report == 0:
+            return None
+
+        expected = seq_diff(self.newest_seq, self.report_base_seq) + 1
+        lost = max(0, expected - self.received_since_report)
+        fraction_lost = min(255, lost * 256 // expected) if expected > 0 else 0
+        mean_transit = self.transit_sum / self.received_since_report
+        delay = mean_transit - min(self.min_transits)
+        report = REPORT.pack(self.newest_seq, fraction_lost, 0,
+                             min(65535, round(self.jitter)),
+                             min(65535, round(delay)))
+
+        self.report_base_seq = (self.newest_seq + 1) % 0x10000
+        self.received_since_report = 0
+        self.transit_sum = 0
+        self.min_transits.append(float("inf"))
+        del self.min_transits[:-DELAY_WINDOW_REPORTS]
+        return report
+
+    def _recover(self, parity, first, count):
+        group = [(first + i) % 0x10000 for i in range(count)]
+        missing = [seq for seq in group if seq not in self.packets]
+        if len(missing) != 1 or self.next_seq is None:
+            return
+        if seq_diff(missing[0], self.next_seq) < 0:
+            # Already given up on
+            return
+
+        lengths = struct.unpack_from("<H", parity, HEADER.size)[0]
+        rebuilt = bytearray(parity[PARITY_OVERHEAD:])
+        for seq in group:
+            if seq == missing[0]:
+                continue
+            packet = self.packets[seq]
+            lengths ^= len(packet)
+            xor_into(rebuilt, packet)
+        self.packets[missing[0]] = bytes(rebuilt[:lengths])
+        self.recovered += 1
+        if seq_diff(missing[0], self.newest_seq) > 0:
+            self.newest_seq = missing[0]
+
+    def _release(self):
+        # With FEC, a gap can still be filled until the parity after the
+        # next packet has had a chance to arrive
+        hold = self.group_size + 1 if self.group_size else 0
+        while self.next_seq is not None and seq_diff(self.newest_seq, self.next_seq) >= 0:
+            packet = self.packets.get(self.next_seq)
+            if packet is None:
+                if seq_diff(self.newest_seq, self.next_seq) <= hold:
+                    return
+                self.lost += 1
+            else:
+                self._play(packet)
+            self.next_seq = (self.next_seq + 1) % 0x10000
+            self.packets.pop((self.next_seq - HISTORY) % 0x10000, None)
+
+    def _play(self, packet):
+        kind, codec, _, timestamp, rate, count = HEADER.unpack_from(packet)
+        if rate == 0:
+            return
+        ticks = self._ticks(rate, count)
+
+        if self.expected is not None:
+            gap = (timestamp - self.expected + 2**31) % 2**32 - 2**31
+            if gap < 0 and -gap < self.clock_rate * MAX_GAP_SECONDS:
+                return
+            if 0 < gap < self.clock_rate * MAX_GAP_SECONDS:
+                self.on_audio(self._comfort_noise(gap))
+        self.expected = (timestamp + ticks) % 2**32
+
+        if kind == AUDIO:
+            if codec == PCM_S16:
+                samples = np.frombuffer(packet, dtype="<i2", count=count,
+                                        offset=HEADER.size)
+            elif codec == MULAW:
+                samples = MULAW_DECODE_TABLE[np.frombuffer(
+                    packet, dtype=np.uint8, count=count, offset=HEADER.size)]
+            else:
+                return
+            self.on_audio(self._resample(samples, ticks))
+        elif kind == COMFORT_NOISE:
+            self.noise_level = struct.unpack_from("<H", packet, HEADER.size)[0]
+            self.on_audio(self._comfort_noise(ticks))
+
+    def _resample(self, samples, ticks):
+        """Linear interpolation up to clock_rate, continuing from the last packet."""
+        if len(samples) == 0:
+            return samples
+        if len(samples) == ticks:
+            self.last_sample = samples[-1]
+            return samples
+        previous = np.concatenate(([self.last_sample], samples.astype(np.float64)))
+        positions = (np.arange(1, ticks + 1) * len(samples) / ticks)
+        self.last_sample = samples[-1]
+        return np.interp(positions, np.arange(len(previous)), previous).round().astype(np.int16)
+
+    def _comfort_noise(self, count):
+        level = min(2 * self.noise_level, 32767)
+        return self.rng.uniform(-level, level, count).astype(np.int16)